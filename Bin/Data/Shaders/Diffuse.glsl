@@ -12,6 +12,9 @@ out vec4 vWorldPos;
 out vec3 vNormal;
 out vec3 vViewNormal;
 out vec2 vTexCoord;
+#ifdef TEXTUREARRAY
+flat out float vTextureLayer;
+#endif
 noperspective out vec2 vScreenPos;
 
 #else
@@ -22,6 +25,9 @@ in vec4 vWorldPos;
 in vec3 vNormal;
 in vec3 vViewNormal;
 in vec2 vTexCoord;
+#ifdef TEXTUREARRAY
+flat in float vTextureLayer;
+#endif
 noperspective in vec2 vScreenPos;
 out vec4 fragColor[2];
 
@@ -31,7 +37,11 @@ layout(std140) uniform PerMaterialData3
     vec4 matSpecColor;
 };
 
+#ifdef TEXTUREARRAY
+uniform sampler2DArray diffuseTex0;
+#else
 uniform sampler2D diffuseTex0;
+#endif
 
 #endif
 
@@ -43,6 +53,9 @@ void vert()
     vNormal = normalize((vec4(normal, 0.0) * world));
     vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
     vTexCoord = texCoord;
+#ifdef TEXTUREARRAY
+    vTextureLayer = GetTextureLayer();
+#endif
     gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
     vWorldPos.w = CalculateDepth(gl_Position);
     vScreenPos = CalculateScreenPos(gl_Position);
@@ -54,7 +67,11 @@ void frag()
     vec3 specularLight;
     CalculateLighting(vWorldPos, vNormal, vScreenPos, matDiffColor, matSpecColor, diffuseLight, specularLight);
 
+#ifdef TEXTUREARRAY
+    vec3 finalColor = texture(diffuseTex0, vec3(vTexCoord, vTextureLayer)).rgb * diffuseLight + specularLight;
+#else
     vec3 finalColor = texture(diffuseTex0, vTexCoord).rgb * diffuseLight + specularLight;
+#endif
 
     fragColor[0] = vec4(mix(fogColor, finalColor, GetFogFactor(vWorldPos.w)), matDiffColor.a);
     fragColor[1] = vec4(vViewNormal, 1.0);
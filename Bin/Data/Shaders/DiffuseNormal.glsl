@@ -14,6 +14,9 @@ out vec3 vNormal;
 out vec4 vTangent;
 out vec3 vViewNormal;
 out vec2 vTexCoord;
+#ifdef TEXTUREARRAY
+flat out float vTextureLayer;
+#endif
 noperspective out vec2 vScreenPos;
 
 #else
@@ -25,6 +28,9 @@ in vec3 vNormal;
 in vec4 vTangent;
 in vec3 vViewNormal;
 in vec2 vTexCoord;
+#ifdef TEXTUREARRAY
+flat in float vTextureLayer;
+#endif
 noperspective in vec2 vScreenPos;
 out vec4 fragColor[2];
 
@@ -34,8 +40,13 @@ layout(std140) uniform PerMaterialData3
     vec4 matSpecColor;
 };
 
+#ifdef TEXTUREARRAY
+uniform sampler2DArray diffuseTex0;
+uniform sampler2DArray normalTex1;
+#else
 uniform sampler2D diffuseTex0;
 uniform sampler2D normalTex1;
+#endif
 
 vec3 DecodeNormal(vec4 normalInput)
 {
@@ -56,6 +67,9 @@ void vert()
     vTangent = vec4(normalize(vec4(tangent.xyz, 0.0) * world), tangent.w);
     vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
     vTexCoord = texCoord;
+#ifdef TEXTUREARRAY
+    vTextureLayer = GetTextureLayer();
+#endif
     gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
     vWorldPos.w = CalculateDepth(gl_Position);
     vScreenPos = CalculateScreenPos(gl_Position);
@@ -64,13 +78,21 @@ void vert()
 void frag()
 {
     mat3 tbn = mat3(vTangent.xyz, cross(vTangent.xyz, vNormal) * vTangent.w, vNormal);
+#ifdef TEXTUREARRAY
+    vec3 normal = normalize(DecodeNormal(texture(normalTex1, vec3(vTexCoord, vTextureLayer))) * tbn);
+#else
     vec3 normal = normalize(DecodeNormal(texture(normalTex1, vTexCoord)) * tbn);
+#endif
 
     vec3 diffuseLight;
     vec3 specularLight;
     CalculateLighting(vWorldPos, normal, vScreenPos, matDiffColor, matSpecColor, diffuseLight, specularLight);
 
+#ifdef TEXTUREARRAY
+    vec3 finalColor = texture(diffuseTex0, vec3(vTexCoord, vTextureLayer)).rgb * diffuseLight + specularLight;
+#else
     vec3 finalColor = texture(diffuseTex0, vTexCoord).rgb * diffuseLight + specularLight;
+#endif
 
     fragColor[0] = vec4(mix(fogColor, finalColor, GetFogFactor(vWorldPos.w)), matDiffColor.a);
     fragColor[1] = vec4(vViewNormal, 1.0);
@@ -0,0 +1,103 @@
+#include "Uniforms.glsl"
+
+layout(std140) uniform PerMaterialData3
+{
+    vec4 matDiffColor;
+    vec4 matSpecColor;
+    vec4 detailTiling;
+    vec4 lodCameraPosition;
+};
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+in vec3 position;
+
+uniform sampler2DArray heightTex7;
+
+#ifndef SHADOW
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+noperspective out vec2 vScreenPos;
+#endif
+
+#else
+
+#ifdef SHADOW
+out vec4 fragColor;
+#else
+#include "Lighting.glsl"
+
+in vec4 vWorldPos;
+in vec3 vNormal;
+in vec3 vViewNormal;
+noperspective in vec2 vScreenPos;
+out vec4 fragColor[2];
+
+uniform sampler2D diffuseTex0;
+#endif
+
+#endif
+
+#ifdef COMPILEVS
+// User data holds the heightmap coordinate of the patch origin, the coordinate step per grid cell and the morph range
+float SampleHeight(vec2 gridPos, vec4 patchData, float layer)
+{
+    return textureLod(heightTex7, vec3(patchData.xy + gridPos * patchData.z, layer), 0.0).r;
+}
+#endif
+
+void vert()
+{
+    mat3x4 world = GetWorldMatrix();
+    vec4 patchData = GetUserData();
+    float layer = GetTextureLayer();
+
+    // Morph the odd vertices toward the coarser level's grid as the LOD range is approached. Measure distance from the camera used for patch selection, so that shadow passes morph identically
+    vec2 gridPos = position.xz;
+    if (patchData.w > 0.0)
+    {
+        vec3 unmorphedPos = vec4(gridPos.x, SampleHeight(gridPos, patchData, layer), gridPos.y, 1.0) * world;
+        float morph = clamp((distance(unmorphedPos, lodCameraPosition.xyz) - 0.7 * patchData.w) / (0.3 * patchData.w), 0.0, 1.0);
+        gridPos -= fract(gridPos * 0.5) * 2.0 * morph;
+    }
+
+    vec3 worldPos = vec4(gridPos.x, SampleHeight(gridPos, patchData, layer), gridPos.y, 1.0) * world;
+    gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+
+#ifndef SHADOW
+    // Normal from the central differences of the full resolution heightmap
+    float sampleOffset = 1.0 / (patchData.z * float(textureSize(heightTex7, 0).x));
+    vec2 offset = vec2(sampleOffset, 0.0);
+    float left = SampleHeight(gridPos - offset.xy, patchData, layer);
+    float right = SampleHeight(gridPos + offset.xy, patchData, layer);
+    float back = SampleHeight(gridPos - offset.yx, patchData, layer);
+    float front = SampleHeight(gridPos + offset.yx, patchData, layer);
+    float sampleSpacing = world[0].x * sampleOffset;
+    float heightScale = world[1].y;
+
+    vWorldPos.xyz = worldPos;
+    vNormal = normalize(vec3((left - right) * heightScale, 2.0 * sampleSpacing, (back - front) * heightScale));
+    vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#endif
+}
+
+void frag()
+{
+#ifdef SHADOW
+    fragColor = vec4(1.0, 1.0, 1.0, 1.0);
+#else
+    vec3 diffuseLight;
+    vec3 specularLight;
+    CalculateLighting(vWorldPos, vNormal, vScreenPos, matDiffColor, matSpecColor, diffuseLight, specularLight);
+
+    vec3 finalColor = texture(diffuseTex0, vWorldPos.xz * detailTiling.xy).rgb * diffuseLight + specularLight;
+
+    fragColor[0] = vec4(mix(fogColor, finalColor, GetFogFactor(vWorldPos.w)), matDiffColor.a);
+    fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
+}
@@ -26,6 +26,43 @@ mat3x4 GetWorldMatrix()
 }
 #endif
 
+#if defined(INSTANCED)
+in float texCoord6;
+
+float GetTextureLayer()
+{
+    return texCoord6;
+}
+#else
+uniform float textureLayer;
+
+float GetTextureLayer()
+{
+    return textureLayer;
+}
+#endif
+
+#if defined(USERDATA) && defined(INSTANCED)
+in vec4 texCoord7;
+
+vec4 GetUserData()
+{
+    return texCoord7;
+}
+#elif defined(USERDATA)
+uniform vec4 userData;
+
+vec4 GetUserData()
+{
+    return userData;
+}
+#else
+vec4 GetUserData()
+{
+    return vec4(0.0);
+}
+#endif
+
 float CalculateDepth(vec4 outPos)
 {
     return dot(depthParameters.zw, outPos.zw);
@@ -1,11 +1,14 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/File.h"
 #include "../IO/Log.h"
 #include "../Math/Math.h"
+#include "../Resource/JSONFile.h"
 #include "../Resource/ResourceCache.h"
 #include "FrameBuffer.h"
 #include "Graphics.h"
 #include "IndexBuffer.h"
+#include "IndirectBuffer.h"
 #include "Shader.h"
 #include "ShaderProgram.h"
 #include "Texture.h"
@@ -95,7 +98,10 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     lastDepthBias(false),
     vsync(false),
     hasInstancing(false),
+    hasMultiDrawIndirect(false),
+    uniformBufferAlignment(256),
     instancingEnabled(false),
+    instanceUserDataEnabled(false),
     lastFrameTime(0.0f)
 {
     RegisterSubsystem(this);
@@ -177,7 +183,7 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     glGenVertexArrays(1, &defaultVao);
     glBindVertexArray(defaultVao);
 
-    // Use texcoords 3-5 for instancing if supported
+    // Use texcoords 3-7 for instancing if supported
     if (glVertexAttribDivisorARB)
     {
         hasInstancing = true;
@@ -185,8 +191,23 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
         glVertexAttribDivisorARB(ATTR_TEXCOORD3, 1);
         glVertexAttribDivisorARB(ATTR_TEXCOORD4, 1);
         glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
+        glVertexAttribDivisorARB(ATTR_TEXCOORD6, 1);
+        glVertexAttribDivisorARB(ATTR_TEXCOORD7, 1);
     }
 
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0)
+        uniformBufferAlignment = alignment;
+
+    // Allow the driver to use its own threads for compiling shaders, which benefits shader manifest warming
+    if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xffffffff);
+
+    // Indirect multi-draw needs base instance to offset the instance data per command
+    if (hasInstancing && glMultiDrawElementsIndirect && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance))
+        hasMultiDrawIndirect = true;
+
     DefineQuadVertexBuffer();
 
     SetVSync(vsync);
@@ -329,6 +350,101 @@ ShaderProgram* Graphics::CreateProgram(const std::string& shaderName, const std:
         return nullptr;
 }
 
+bool Graphics::SaveShaderManifest(const std::string& fileName)
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    std::vector<Shader*> shaders;
+    cache->ResourcesByType<Shader>(shaders);
+
+    JSONFile json;
+    JSONValue& root = json.Root();
+    root.SetEmptyArray();
+    size_t numVariations = 0;
+
+    for (auto it = shaders.begin(); it != shaders.end(); ++it)
+    {
+        const std::vector<std::pair<std::string, std::string> >& variations = (*it)->Variations();
+        if (variations.empty())
+            continue;
+
+        // Record the shader file time, so that a changed shader is loaded on demand instead of prefetched
+        JSONValue entry;
+        entry["name"] = (*it)->Name();
+        entry["modified"] = cache->LastModifiedTime((*it)->Name());
+        JSONValue& entryVariations = entry["variations"];
+        entryVariations.SetEmptyArray();
+        for (auto vIt = variations.begin(); vIt != variations.end(); ++vIt)
+        {
+            JSONValue defines;
+            defines.Push(vIt->first);
+            defines.Push(vIt->second);
+            entryVariations.Push(defines);
+        }
+
+        root.Push(entry);
+        numVariations += variations.size();
+    }
+
+    File file(fileName, FILE_WRITE);
+    if (!file.IsWritable())
+    {
+        LOGERROR("Could not open shader manifest file " + fileName + " for writing");
+        return false;
+    }
+
+    LOGINFOF("Saving shader manifest %s with %d variations", fileName.c_str(), (int)numVariations);
+    return json.Save(file);
+}
+
+size_t Graphics::WarmShaderManifest(const std::string& fileName)
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    JSONFile json;
+    AutoPtr<Stream> manifestStream = cache->OpenResource(fileName);
+    if (!manifestStream || !json.Load(*manifestStream))
+        return 0;
+
+    const JSONArray& entries = json.Root().GetArray();
+
+    // Load the shaders first. Their include processing and preprocessing runs in worker threads
+    std::vector<ResourceManifestEntry> shaderEntries;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        ResourceManifestEntry shaderEntry;
+        shaderEntry.type = Shader::TypeStatic();
+        shaderEntry.name = (*it)["name"].GetString();
+        shaderEntry.modifiedTime = (unsigned)(*it)["modified"].GetNumber();
+        shaderEntries.push_back(shaderEntry);
+    }
+    cache->PrefetchResources(shaderEntries);
+
+    std::vector<ShaderProgram*> pendingPrograms;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        Shader* shader = cache->LoadResource<Shader>((*it)["name"].GetString());
+        if (!shader)
+            continue;
+
+        const JSONArray& variations = (*it)["variations"].GetArray();
+        for (auto vIt = variations.begin(); vIt != variations.end(); ++vIt)
+        {
+            ShaderProgram* program = shader->CreateProgram((*vIt)[0].GetString(), (*vIt)[1].GetString(), true);
+            if (program && program->IsPending())
+                pendingPrograms.push_back(program);
+        }
+    }
+
+    for (auto it = pendingPrograms.begin(); it != pendingPrograms.end(); ++it)
+        (*it)->FinishCreate();
+
+    LOGINFOF("Warmed %d shader variations from manifest %s", (int)pendingPrograms.size(), fileName.c_str());
+    return pendingPrograms.size();
+}
+
 void Graphics::SetUniform(ShaderProgram* program, PresetUniform uniform, float value)
 {
     if (program)
@@ -601,7 +717,11 @@ void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
         glDisableVertexAttribArray(ATTR_TEXCOORD4);
         glDisableVertexAttribArray(ATTR_TEXCOORD5);
+        glDisableVertexAttribArray(ATTR_TEXCOORD6);
+        if (instanceUserDataEnabled)
+            glDisableVertexAttribArray(ATTR_TEXCOORD7);
         instancingEnabled = false;
+        instanceUserDataEnabled = false;
     }
 
     glDrawArrays(glPrimitiveTypes[type], (GLsizei)drawStart, (GLsizei)drawCount);
@@ -614,7 +734,11 @@ void Graphics::DrawIndexed(PrimitiveType type, size_t drawStart, size_t drawCoun
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
         glDisableVertexAttribArray(ATTR_TEXCOORD4);
         glDisableVertexAttribArray(ATTR_TEXCOORD5);
+        glDisableVertexAttribArray(ATTR_TEXCOORD6);
+        if (instanceUserDataEnabled)
+            glDisableVertexAttribArray(ATTR_TEXCOORD7);
         instancingEnabled = false;
+        instanceUserDataEnabled = false;
     }
 
     unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
@@ -627,20 +751,7 @@ void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCo
     if (!hasInstancing || !instanceVertexBuffer)
         return;
 
-    if (!instancingEnabled)
-    {
-        glEnableVertexAttribArray(ATTR_TEXCOORD3);
-        glEnableVertexAttribArray(ATTR_TEXCOORD4);
-        glEnableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = true;
-    }
-
-    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
-
-    instanceVertexBuffer->Bind(0);
-    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
+    SetInstanceAttributes(instanceVertexBuffer, instanceStart);
     glDrawArraysInstanced(glPrimitiveTypes[type], (GLint)drawStart, (GLsizei)drawCount, (GLsizei)instanceCount);
 }
 
@@ -651,21 +762,20 @@ void Graphics::DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t
     if (!hasInstancing || !instanceVertexBuffer || !indexSize)
         return;
 
-    if (!instancingEnabled)
-    {
-        glEnableVertexAttribArray(ATTR_TEXCOORD3);
-        glEnableVertexAttribArray(ATTR_TEXCOORD4);
-        glEnableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = true;
-    }
+    SetInstanceAttributes(instanceVertexBuffer, instanceStart);
+    glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize), (GLsizei)instanceCount);
+}
 
-    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
+void Graphics::MultiDrawIndexedIndirect(PrimitiveType type, IndirectBuffer* indirectBuffer, size_t commandStart, size_t commandCount, VertexBuffer* instanceVertexBuffer)
+{
+    unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
 
-    instanceVertexBuffer->Bind(0);
-    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
-    glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize), (GLsizei)instanceCount);
+    if (!hasMultiDrawIndirect || !indirectBuffer || !instanceVertexBuffer || !indexSize || !commandCount)
+        return;
+
+    SetInstanceAttributes(instanceVertexBuffer, 0);
+    indirectBuffer->Bind();
+    glMultiDrawElementsIndirect(glPrimitiveTypes[type], indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(commandStart * sizeof(DrawIndirectCommand)), (GLsizei)commandCount, 0);
 }
 
 void Graphics::DrawQuad()
@@ -818,6 +928,39 @@ void Graphics::DefineQuadVertexBuffer()
     quadVertexBuffer->Define(USAGE_DEFAULT, 6, vertexDeclaration, quadVertexData);
 }
 
+void Graphics::SetInstanceAttributes(VertexBuffer* instanceVertexBuffer, size_t instanceStart)
+{
+    if (!instancingEnabled)
+    {
+        glEnableVertexAttribArray(ATTR_TEXCOORD3);
+        glEnableVertexAttribArray(ATTR_TEXCOORD4);
+        glEnableVertexAttribArray(ATTR_TEXCOORD5);
+        glEnableVertexAttribArray(ATTR_TEXCOORD6);
+        instancingEnabled = true;
+    }
+
+    // User data is only present in the instance buffer of passes that read it
+    bool hasUserData = (instanceVertexBuffer->Attributes() & MASK_TEXCOORD7) != 0;
+    if (hasUserData != instanceUserDataEnabled)
+    {
+        if (hasUserData)
+            glEnableVertexAttribArray(ATTR_TEXCOORD7);
+        else
+            glDisableVertexAttribArray(ATTR_TEXCOORD7);
+        instanceUserDataEnabled = hasUserData;
+    }
+
+    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
+
+    instanceVertexBuffer->Bind(0);
+    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
+    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
+    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
+    glVertexAttribPointer(ATTR_TEXCOORD6, 1, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 3 * sizeof(Vector4)));
+    if (hasUserData)
+        glVertexAttribPointer(ATTR_TEXCOORD7, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 3 * sizeof(Vector4) + sizeof(float)));
+}
+
 void RegisterGraphicsLibrary()
 {
     static bool registered = false;
@@ -12,6 +12,7 @@
 
 class FrameBuffer;
 class IndexBuffer;
+class IndirectBuffer;
 class ShaderProgram;
 class Texture;
 class UniformBuffer;
@@ -69,6 +70,10 @@ public:
     ShaderProgram* SetProgram(const std::string& shaderName, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
     /// Create a shader program, but do not bind immediately. Return pointer on success or null otherwise.
     ShaderProgram* CreateProgram(const std::string& shaderName, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Save the shader variations created so far as a manifest, to be warmed at next startup. The shader file times are recorded, so that shaders changed since are not prefetched. Return true on success.
+    bool SaveShaderManifest(const std::string& fileName);
+    /// Create the shader variations listed in a manifest. The shaders are loaded and preprocessed in parallel on the WorkQueue, then compiles are issued for all variations before any results are checked, so that the driver can compile them in parallel. Return number of variations created.
+    size_t WarmShaderManifest(const std::string& fileName);
     /// Set float preset uniform.
     void SetUniform(ShaderProgram* program, PresetUniform uniform, float value);
     /// Set a Vector2 preset uniform.
@@ -117,6 +122,8 @@ public:
     void DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
     /// Draw instanced indexed geometry with the currently bound vertex and index buffer, and the specified instance data vertex buffer.
     void DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
+    /// Draw several instanced indexed geometries from an indirect command buffer with the currently bound vertex and index buffer, and the specified instance data vertex buffer. The commands' base instance specifies the instance data start.
+    void MultiDrawIndexedIndirect(PrimitiveType type, IndirectBuffer* indirectBuffer, size_t commandStart, size_t commandCount, VertexBuffer* instanceVertexBuffer);
     /// Draw a quad with current renderstate. The quad vertex buffer is left bound.
     void DrawQuad();
 
@@ -135,6 +142,10 @@ public:
     bool IsInitialized() const { return context != nullptr; }
     /// Return whether has instancing support.
     bool HasInstancing() const { return hasInstancing; }
+    /// Return required byte alignment for uniform buffer range bindings.
+    size_t UniformBufferAlignment() const { return uniformBufferAlignment; }
+    /// Return whether has indirect multi-draw support with base instance.
+    bool HasMultiDrawIndirect() const { return hasMultiDrawIndirect; }
     /// Return current window size.
     IntVector2 Size() const;
     /// Return current window width.
@@ -159,6 +170,8 @@ public:
 private:
     /// Set up the vertex buffer for quad rendering.
     void DefineQuadVertexBuffer();
+    /// Enable and set the instance data vertex attributes.
+    void SetInstanceAttributes(VertexBuffer* instanceVertexBuffer, size_t instanceStart);
 
     /// OS-level rendering window.
     SDL_Window* window;
@@ -182,8 +195,14 @@ private:
     bool vsync;
     /// Instancing support flag.
     bool hasInstancing;
+    /// Indirect multi-draw support flag.
+    bool hasMultiDrawIndirect;
+    /// Uniform buffer range binding alignment.
+    size_t uniformBufferAlignment;
     /// Whether instance vertex elements are enabled.
     bool instancingEnabled;
+    /// Whether the instance user data vertex element is enabled.
+    bool instanceUserDataEnabled;
     /// Pending occlusion queries.
     std::vector<std::pair<unsigned, void*> > pendingQueries;
     /// Free occlusion queries.
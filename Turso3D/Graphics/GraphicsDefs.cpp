@@ -28,6 +28,8 @@ const char* elementSemanticNames[] =
 const char* presetUniformNames[] = 
 {
     "worldMatrix",
+    "textureLayer",
+    "userData",
     nullptr
 };
 
@@ -62,6 +62,8 @@ enum VertexAttribute
     ATTR_TEXCOORD3,
     ATTR_TEXCOORD4,
     ATTR_TEXCOORD5,
+    ATTR_TEXCOORD6,
+    ATTR_TEXCOORD7,
     ATTR_BLENDWEIGHTS,
     ATTR_BLENDINDICES,
     MAX_VERTEX_ATTRIBUTES
@@ -80,6 +82,8 @@ enum AttributeMask
     MASK_TEXCOORD3 = 1 << ATTR_TEXCOORD3,
     MASK_TEXCOORD4 = 1 << ATTR_TEXCOORD4,
     MASK_TEXCOORD5 = 1 << ATTR_TEXCOORD5,
+    MASK_TEXCOORD6 = 1 << ATTR_TEXCOORD6,
+    MASK_TEXCOORD7 = 1 << ATTR_TEXCOORD7,
     MASK_BLENDWEIGHTS = 1 << ATTR_BLENDWEIGHTS,
     MASK_BLENDINDICES = 1 << ATTR_BLENDINDICES
 };
@@ -128,6 +132,7 @@ enum TextureType
     TEX_2D = 0,
     TEX_3D,
     TEX_CUBE,
+    TEX_2D_ARRAY
 };
 
 /// Resource usage modes for buffers.
@@ -164,6 +169,8 @@ enum TextureAddressMode
 enum PresetUniform
 {
     U_WORLDMATRIX,
+    U_TEXTURELAYER,
+    U_USERDATA,
     MAX_PRESET_UNIFORMS
 };
 
@@ -216,6 +223,21 @@ struct VertexElement
     size_t offset;
 };
 
+/// Indexed indirect draw command, laid out as expected by the GPU.
+struct DrawIndirectCommand
+{
+    /// Number of indices.
+    unsigned count;
+    /// Number of instances.
+    unsigned instanceCount;
+    /// Index start.
+    unsigned firstIndex;
+    /// Constant added to the indices.
+    int baseVertex;
+    /// Instance start in the instance vertex buffer.
+    unsigned baseInstance;
+};
+
 /// Vertex element sizes by element type.
 extern const size_t elementSizes[];
 /// Vertex element semantic names.
@@ -17,7 +17,6 @@ IndexBuffer::IndexBuffer() :
     indexSize(0),
     usage(USAGE_DEFAULT)
 {
-    assert(Object::Subsystem<Graphics>()->IsInitialized());
 }
 
 IndexBuffer::~IndexBuffer()
@@ -100,6 +99,8 @@ size_t IndexBuffer::BoundIndexSize()
 
 bool IndexBuffer::Create(const void* data)
 {
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+
     glGenBuffers(1, &buffer);
     if (!buffer)
     {
@@ -10,7 +10,7 @@
 class IndexBuffer : public RefCounted
 {
 public:
-    /// Construct. Graphics subsystem must have been initialized.
+    /// Construct. Graphics subsystem must have been initialized before defining the buffer.
     IndexBuffer();
     /// Destruct.
     ~IndexBuffer();
@@ -0,0 +1,112 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "Graphics.h"
+#include "IndirectBuffer.h"
+
+#include <glew.h>
+#include <tracy/Tracy.hpp>
+
+static IndirectBuffer* boundIndirectBuffer = nullptr;
+
+IndirectBuffer::IndirectBuffer() :
+    buffer(0),
+    numCommands(0),
+    usage(USAGE_DEFAULT)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+IndirectBuffer::~IndirectBuffer()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (Object::Subsystem<Graphics>())
+        Release();
+}
+
+bool IndirectBuffer::Define(ResourceUsage usage_, size_t numCommands_, const DrawIndirectCommand* data)
+{
+    ZoneScoped;
+
+    Release();
+
+    if (!numCommands_)
+    {
+        LOGERROR("Can not define indirect buffer with no commands");
+        return false;
+    }
+
+    numCommands = numCommands_;
+    usage = usage_;
+
+    return Create(data);
+}
+
+bool IndirectBuffer::SetData(size_t firstCommand, size_t numCommands_, const DrawIndirectCommand* data, bool discard)
+{
+    if (!data)
+    {
+        LOGERROR("Null source data for updating indirect buffer");
+        return false;
+    }
+    if (firstCommand + numCommands_ > numCommands)
+    {
+        LOGERROR("Out of bounds range for updating indirect buffer");
+        return false;
+    }
+
+    if (buffer)
+    {
+        Bind();
+
+        if (numCommands_ == numCommands)
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, numCommands * sizeof(DrawIndirectCommand), data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+        else if (discard)
+        {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, numCommands * sizeof(DrawIndirectCommand), nullptr, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, firstCommand * sizeof(DrawIndirectCommand), numCommands_ * sizeof(DrawIndirectCommand), data);
+        }
+        else
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, firstCommand * sizeof(DrawIndirectCommand), numCommands_ * sizeof(DrawIndirectCommand), data);
+    }
+
+    return true;
+}
+
+void IndirectBuffer::Bind()
+{
+    if (!buffer || boundIndirectBuffer == this)
+        return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    boundIndirectBuffer = this;
+}
+
+bool IndirectBuffer::Create(const void* data)
+{
+    glGenBuffers(1, &buffer);
+    if (!buffer)
+    {
+        LOGERROR("Failed to create indirect buffer");
+        return false;
+    }
+
+    Bind();
+
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, numCommands * sizeof(DrawIndirectCommand), data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    LOGDEBUGF("Created indirect buffer numCommands %u", (unsigned)numCommands);
+
+    return true;
+}
+
+void IndirectBuffer::Release()
+{
+    if (buffer)
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+
+        if (boundIndirectBuffer == this)
+            boundIndirectBuffer = nullptr;
+    }
+}
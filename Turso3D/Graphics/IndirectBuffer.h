@@ -0,0 +1,47 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+/// GPU buffer for indirect draw commands. Used for multi-draw submission of batches that share state and vertex / index buffers.
+class IndirectBuffer : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    IndirectBuffer();
+    /// Destruct.
+    ~IndirectBuffer();
+
+    /// Define buffer with number of commands. Return true on success.
+    bool Define(ResourceUsage usage, size_t numCommands, const DrawIndirectCommand* data = nullptr);
+    /// Redefine buffer data either completely or partially. Return true on success.
+    bool SetData(size_t firstCommand, size_t numCommands, const DrawIndirectCommand* data, bool discard = false);
+    /// Bind to use. No-op if already bound. Used also when defining or setting data.
+    void Bind();
+
+    /// Return number of commands.
+    size_t NumCommands() const { return numCommands; }
+    /// Return resource usage type.
+    ResourceUsage Usage() const { return usage; }
+    /// Return whether is dynamic.
+    bool IsDynamic() const { return usage == USAGE_DYNAMIC; }
+
+    /// Return the OpenGL object identifier.
+    unsigned GLBuffer() const { return buffer; }
+
+private:
+    /// Create the GPU-side buffer. Return true on success.
+    bool Create(const void* data);
+    /// Release the buffer.
+    void Release();
+
+    /// OpenGL object identifier.
+    unsigned buffer;
+    /// Number of commands.
+    size_t numCommands;
+    /// Resource usage type.
+    ResourceUsage usage;
+};
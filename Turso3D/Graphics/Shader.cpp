@@ -8,6 +8,8 @@
 #include "ShaderProgram.h"
 
 #include <algorithm>
+#include <cctype>
+#include <tracy/Tracy.hpp>
 
 Shader::Shader()
 {
@@ -24,24 +26,33 @@ void Shader::RegisterObject()
 
 bool Shader::BeginLoad(Stream& source)
 {
+    ZoneScoped;
+
     sourceCode.clear();
-    return ProcessIncludes(sourceCode, source);
+    if (!ProcessIncludes(sourceCode, source))
+        return false;
+
+    // Preprocess here, so that it runs in a worker thread when prefetched
+    Preprocess();
+    return true;
 }
 
 bool Shader::EndLoad()
 {
     // Release existing variations (if any) to allow them to be recompiled with changed code
     programs.clear();
+    variations.clear();
     return true;
 }
 
 void Shader::Define(const std::string& code)
 {
     sourceCode = code;
+    Preprocess();
     EndLoad();
 }
 
-ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn)
+ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn, bool deferred)
 {
     auto hashPair = std::make_pair(StringHash(vsDefinesIn), StringHash(fsDefinesIn));
 
@@ -57,9 +68,10 @@ ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::
     if (it != programs.end())
         return it->second;
 
-    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), vsDefines, fsDefines);
+    ShaderProgram* newVariation = new ShaderProgram(preprocessedSource, Name(), vsDefines, fsDefines, deferred);
     programs[hashPair] = newVariation;
     programs[normalizedHashPair] = newVariation;
+    variations.push_back(std::make_pair(vsDefines, fsDefines));
     return newVariation;
 }
 
@@ -77,13 +89,12 @@ std::string Shader::NormalizeDefines(const std::string& defines)
         size_t equalsPos = str.find('=');
         if (equalsPos == std::string::npos)
         {
-            if (sourceCode.find(str) != std::string::npos)
+            if (identifiers.find(StringHash(str)) != identifiers.end())
                 used = true;
         }
         else
         {
-            std::string beginPart = str.substr(0, equalsPos);
-            if (sourceCode.find(beginPart) != std::string::npos)
+            if (identifiers.find(StringHash(str.substr(0, equalsPos))) != identifiers.end())
                 used = true;
         }
 
@@ -134,3 +145,29 @@ bool Shader::ProcessIncludes(std::string& code, Stream& source)
 
     return true;
 }
+
+void Shader::Preprocess()
+{
+    preprocessedSource = ShaderSource(sourceCode);
+
+    identifiers.clear();
+    for (size_t i = 0; i < sourceCode.length();)
+    {
+        unsigned char c = (unsigned char)sourceCode[i];
+        if (isalpha(c) || c == '_')
+        {
+            size_t start = i;
+            while (i < sourceCode.length() && (isalnum((unsigned char)sourceCode[i]) || sourceCode[i] == '_'))
+                ++i;
+            identifiers.insert(StringHash(sourceCode.substr(start, i - start)));
+        }
+        else if (isdigit(c))
+        {
+            // Skip number literals including suffixes, so that they are not mistaken for identifiers
+            while (i < sourceCode.length() && (isalnum((unsigned char)sourceCode[i]) || sourceCode[i] == '.'))
+                ++i;
+        }
+        else
+            ++i;
+    }
+}
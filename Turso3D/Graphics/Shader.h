@@ -4,8 +4,9 @@
 
 #include "../Resource/Resource.h"
 #include "GraphicsDefs.h"
+#include "ShaderProgram.h"
 
-class ShaderProgram;
+#include <set>
 
 /// %Shader resource. Defines shader source code, from which shader programs can be compiled & linked by specifying defines.
 class Shader : public Resource
@@ -28,20 +29,30 @@ public:
 
     /// Define shader from source code. All existing variations are destroyed.
     void Define(const std::string& code);
-    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query.
-    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query. If deferred, a new program only issues its compile and link, see ShaderProgram::FinishCreate().
+    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString, bool deferred = false);
     
     /// Return shader source code.
     const std::string& SourceCode() const { return sourceCode; }
+    /// Return normalized vertex and fragment shader defines of the variations created so far, in creation order.
+    const std::vector<std::pair<std::string, std::string> >& Variations() const { return variations; }
 
 private:
     /// Sort the defines and strip extra spaces to prevent creation of unnecessary duplicate shader variations.
     std::string NormalizeDefines(const std::string& defines);
     /// Process include statements in the shader source code recursively. Return true if successful.
     bool ProcessIncludes(std::string& code, Stream& source);
+    /// Build the preprocessed stage code and the identifier set from the flattened source code.
+    void Preprocess();
 
     /// %Shader programs.
     std::map<std::pair<StringHash, StringHash>, SharedPtr<ShaderProgram> > programs;
     /// %Shader source code.
     std::string sourceCode;
+    /// Preprocessed stage code shared by all variations.
+    ShaderSource preprocessedSource;
+    /// Hashes of identifiers in the source code, for dropping defines that have no effect.
+    std::set<StringHash> identifiers;
+    /// Normalized defines of created variations.
+    std::vector<std::pair<std::string, std::string> > variations;
 };
@@ -25,6 +25,8 @@ const char* attribNames[] =
     "texCoord3",
     "texCoord4",
     "texCoord5",
+    "texCoord6",
+    "texCoord7",
     "blendWeights",
     "blendIndices",
     nullptr
@@ -66,14 +68,74 @@ int NumberPostfix(const std::string& string)
     return -1;
 }
 
+static std::string DefinesHeader(const char* stageDefine, const std::vector<std::string>& defines)
+{
+    std::string header;
+    header += "#version 150\n";
+    header += "#define ";
+    header += stageDefine;
+    header += "\n";
+    for (size_t i = 0; i < defines.size(); ++i)
+    {
+        header += "#define ";
+        header += Replace(defines[i], '=', ' ');
+        header += "\n";
+    }
+
+    return header;
+}
+
+static bool CheckCompileStatus(unsigned shader, const char* stageName, const std::string& shaderName)
+{
+    int compiled, length, outLength;
+    std::string errorString;
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    errorString.resize(length);
+    glGetShaderInfoLog(shader, 1024, &outLength, &errorString[0]);
+
+    if (!compiled)
+        LOGERRORF("%s %s compile error: %s", stageName, shaderName.c_str(), errorString.c_str());
+#ifdef _DEBUG
+    else if (length > 1)
+        LOGDEBUGF("%s %s compile output: %s", stageName, shaderName.c_str(), errorString.c_str());
+#endif
+
+    return compiled != 0;
+}
+
+ShaderSource::ShaderSource()
+{
+}
+
+ShaderSource::ShaderSource(const std::string& sourceCode) :
+    vsCode(sourceCode),
+    fsCode(sourceCode)
+{
+    CommentOutFunction(vsCode, "void frag(");
+    ReplaceInPlace(vsCode, "void vert(", "void main(");
+    CommentOutFunction(fsCode, "void vert(");
+    ReplaceInPlace(fsCode, "void frag(", "void main(");
+}
+
 ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines) :
-    program(0)
+    ShaderProgram(ShaderSource(sourceCode), shaderName_, vsDefines, fsDefines)
+{
+}
+
+ShaderProgram::ShaderProgram(const ShaderSource& source, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines, bool deferred) :
+    program(0),
+    vs(0),
+    fs(0)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 
     shaderName = vsDefines.length() ? (shaderName_ + " " + vsDefines + " " + fsDefines) : (shaderName_ + " " + fsDefines);
 
-    Create(sourceCode, Split(vsDefines), Split(fsDefines));
+    Create(source, Split(vsDefines), Split(fsDefines));
+    if (!deferred)
+        FinishCreate();
 }
 
 ShaderProgram::~ShaderProgram()
@@ -101,6 +163,8 @@ int ShaderProgram::Uniform(StringHash name) const
 
 bool ShaderProgram::Bind()
 {
+    if (IsPending())
+        FinishCreate();
     if (!program)
         return false;
 
@@ -112,89 +176,24 @@ bool ShaderProgram::Bind()
     return true;
 }
 
-void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines)
+void ShaderProgram::Create(const ShaderSource& source, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines)
 {
     ZoneScoped;
 
-    std::string vsSourceCode;
-    vsSourceCode += "#version 150\n";
-    vsSourceCode += "#define COMPILEVS\n";
-    for (size_t i = 0; i < vsDefines.size(); ++i)
-    {
-        vsSourceCode += "#define ";
-        vsSourceCode += Replace(vsDefines[i], '=', ' ');
-        vsSourceCode += "\n";
-    }
-    vsSourceCode += sourceCode;
-    CommentOutFunction(vsSourceCode, "void frag(");
-    ReplaceInPlace(vsSourceCode, "void vert(", "void main(");
-    const char* vsShaderStr = vsSourceCode.c_str();
-
-    int vsCompiled;
-    unsigned vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vsShaderStr, nullptr);
+    // Only the defines header is built per variation, the preprocessed code is passed as a separate string
+    std::string vsHeader = DefinesHeader("COMPILEVS", vsDefines);
+    const char* vsStrings[] = { vsHeader.c_str(), source.vsCode.c_str() };
+    vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 2, vsStrings, nullptr);
     glCompileShader(vs);
-    glGetShaderiv(vs, GL_COMPILE_STATUS, &vsCompiled);
-
-    {
-        int length, outLength;
-        std::string errorString;
 
-        glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(vs, 1024, &outLength, &errorString[0]);
-
-        if (!vsCompiled)
-            LOGERRORF("VS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
-
-    std::string fsSourceCode;
-    fsSourceCode += "#version 150\n";
-    fsSourceCode += "#define COMPILEFS\n";
-    for (size_t i = 0; i < fsDefines.size(); ++i)
-    {
-        fsSourceCode += "#define ";
-        fsSourceCode += Replace(fsDefines[i], '=', ' ');
-        fsSourceCode += "\n";
-    }
-    fsSourceCode += sourceCode;
-    CommentOutFunction(fsSourceCode, "void vert(");
-    ReplaceInPlace(fsSourceCode, "void frag(", "void main(");
-    const char* fsShaderStr = fsSourceCode.c_str();
-
-    int fsCompiled;
-    unsigned fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fsShaderStr, nullptr);
+    std::string fsHeader = DefinesHeader("COMPILEFS", fsDefines);
+    const char* fsStrings[] = { fsHeader.c_str(), source.fsCode.c_str() };
+    fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 2, fsStrings, nullptr);
     glCompileShader(fs);
-    glGetShaderiv(fs, GL_COMPILE_STATUS, &fsCompiled);
-
-    {
-        int length, outLength;
-        std::string errorString;
-
-        glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(fs, 1024, &outLength, &errorString[0]);
-
-        if (!fsCompiled)
-            LOGERRORF("FS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
-
-    if (!vsCompiled || !fsCompiled)
-    {
-        glDeleteShader(vs);
-        glDeleteShader(fs);
-        return;
-    }
 
+    // Link without waiting for the compile results. If compile failed, the link fails too and the errors are reported in FinishCreate()
     program = glCreateProgram();
     glAttachShader(program, vs);
     glAttachShader(program, fs);
@@ -202,8 +201,28 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
         glBindAttribLocation(program, i, attribNames[i]);
 
     glLinkProgram(program);
+}
+
+void ShaderProgram::FinishCreate()
+{
+    if (!IsPending())
+        return;
+
+    ZoneScoped;
+
+    bool vsCompiled = CheckCompileStatus(vs, "VS", shaderName);
+    bool fsCompiled = CheckCompileStatus(fs, "FS", shaderName);
     glDeleteShader(vs);
     glDeleteShader(fs);
+    vs = 0;
+    fs = 0;
+
+    if (!vsCompiled || !fsCompiled)
+    {
+        glDeleteProgram(program);
+        program = 0;
+        return;
+    }
 
     int linked;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
@@ -309,6 +328,14 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
 
 void ShaderProgram::Release()
 {
+    if (vs)
+    {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        vs = 0;
+        fs = 0;
+    }
+
     if (program)
     {
         glDeleteProgram(program);
@@ -7,18 +7,39 @@
 #include "../Object/Ptr.h"
 #include "GraphicsDefs.h"
 
+/// %Shader source code preprocessed for compiling variations. The stage entry points are resolved once, so that a variation only needs to inject its defines in front of the code.
+struct ShaderSource
+{
+    /// Construct empty.
+    ShaderSource();
+    /// Construct from combined source code with vert() and frag() entry points.
+    ShaderSource(const std::string& sourceCode);
+
+    /// Vertex shader code, with frag() commented out and vert() renamed to main().
+    std::string vsCode;
+    /// Fragment shader code, with vert() commented out and frag() renamed to main().
+    std::string fsCode;
+};
+
 /// Linked shader program consisting of vertex and fragment shaders.
 class ShaderProgram : public RefCounted
 {
 public:
     /// Construct from shader source code and defines. Graphics subsystem must have been initialized.
     ShaderProgram(const std::string& sourceCode, const std::string& shaderName = JSONValue::emptyString, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Construct from preprocessed shader source and defines. If deferred, compile and link are only issued to the driver and finished on FinishCreate() or first bind. Graphics subsystem must have been initialized.
+    ShaderProgram(const ShaderSource& source, const std::string& shaderName, const std::string& vsDefines, const std::string& fsDefines, bool deferred = false);
     /// Destruct.
     ~ShaderProgram();
 
+    /// Finish a deferred compile and link by checking the results and querying attributes and uniforms. No-op if not pending.
+    void FinishCreate();
     /// Bind for using. No-op if already bound. Return false if program is not successfully linked.
     bool Bind();
 
+    /// Return whether a deferred compile and link is waiting for FinishCreate().
+    bool IsPending() const { return vs != 0; }
+
     /// Return shader name concatenated from parent shader name and defines.
     const std::string& ShaderName() const { return shaderName; }
     /// Return bitmask of used vertex attributes.
@@ -38,13 +59,17 @@ public:
     unsigned GLProgram() const { return program; }
 
 private:
-    /// Compile & link.
-    void Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines);
+    /// Issue compile & link to the driver.
+    void Create(const ShaderSource& source, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines);
     /// Release the program.
     void Release();
 
     /// OpenGL shader program identifier.
     unsigned program;
+    /// OpenGL vertex shader identifier while pending.
+    unsigned vs;
+    /// OpenGL fragment shader identifier while pending.
+    unsigned fs;
     /// Used vertex attribute bitmask.
     unsigned attributes;
     /// All uniform locations.
@@ -15,7 +15,8 @@ static const GLenum glTargets[] =
 {
     GL_TEXTURE_2D,
     GL_TEXTURE_3D,
-    GL_TEXTURE_CUBE_MAP
+    GL_TEXTURE_CUBE_MAP,
+    GL_TEXTURE_2D_ARRAY
 };
 
 const unsigned Texture::glInternalFormats[] =
@@ -241,6 +242,11 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
         LOGERROR("Cube map must have square dimensions and 6 faces");
         return false;
     }
+    if (type_ == TEX_2D_ARRAY && multisample_ > 1)
+    {
+        LOGERROR("Multisampled array textures are unsupported");
+        return false;
+    }
 
     if (numLevels_ < 1)
         numLevels_ = 1;
@@ -275,7 +281,24 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
     // If not compressed and no initial data, create the initial level 0 texture with null data
     // Clear previous error first to be able to check whether the data was successfully set
     glGetError();
-    if (!IsCompressed() && !initialData)
+    if (type == TEX_2D_ARRAY)
+    {
+        // Array textures are always updated one layer at a time, so allocate storage for all levels first
+        for (size_t i = 0; i < numLevels; ++i)
+        {
+            IntVector3 levelSize(Max(size.x >> i, 1), Max(size.y >> i, 1), size.z);
+
+            if (!IsCompressed())
+                glTexImage3D(target, (int)i, glInternalFormats[format], levelSize.x, levelSize.y, levelSize.z, 0, glFormats[format], glDataTypes[format], nullptr);
+            else
+            {
+                ImageLevel levelData;
+                Image::CalculateDataSize(levelSize, format, levelData);
+                glCompressedTexImage3D(target, (int)i, glInternalFormats[format], levelSize.x, levelSize.y, levelSize.z, 0, (GLsizei)levelData.dataSize, nullptr);
+            }
+        }
+    }
+    else if (!IsCompressed() && !initialData)
     {
         if (multisample == 1)
         {
@@ -336,6 +359,75 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
     return true;
 }
 
+bool Texture::DefineArray(const std::vector<Image*>& images)
+{
+    ZoneScoped;
+
+    if (images.empty() || !images[0])
+    {
+        LOGERROR("No images to define array texture from");
+        return false;
+    }
+
+    Image* firstImage = images[0];
+    if (firstImage->Format() > FMT_DXT5)
+    {
+        LOGERROR("ETC1 and PVRTC formats are unsupported");
+        return false;
+    }
+
+    size_t numLayers = images.size();
+    size_t numLevels_ = firstImage->NumLevels();
+
+    for (size_t i = 1; i < numLayers; ++i)
+    {
+        if (!images[i] || images[i]->Size() != firstImage->Size() || images[i]->Format() != firstImage->Format())
+        {
+            LOGERROR("Array texture layers must have the same size and format");
+            return false;
+        }
+        numLevels_ = Min(numLevels_, images[i]->NumLevels());
+    }
+
+    // Generate mips for uncompressed images like when loading a single texture, so that all layers can be filtered
+    std::vector<AutoPtr<Image> > mipImages;
+    std::vector<std::vector<Image*> > layerLevels(numLayers);
+
+    for (size_t i = 0; i < numLayers; ++i)
+    {
+        Image* mipImage = images[i];
+        layerLevels[i].push_back(mipImage);
+
+        if (!firstImage->IsCompressed())
+        {
+            while (mipImage->Width() > 1 || mipImage->Height() > 1)
+            {
+                mipImages.push_back(new Image());
+                mipImage->GenerateMipImage(*mipImages.back());
+                mipImage = mipImages.back();
+                layerLevels[i].push_back(mipImage);
+            }
+        }
+    }
+
+    if (!firstImage->IsCompressed())
+        numLevels_ = layerLevels[0].size();
+
+    // Initial data is ordered by level first, then by layer
+    std::vector<ImageLevel> initialData;
+    initialData.reserve(numLevels_ * numLayers);
+
+    for (size_t i = 0; i < numLevels_; ++i)
+    {
+        for (size_t j = 0; j < numLayers; ++j)
+            initialData.push_back(firstImage->IsCompressed() ? images[j]->Level(i) : layerLevels[j][i]->Level(0));
+    }
+
+    bool success = Define(TEX_2D_ARRAY, IntVector3(firstImage->Width(), firstImage->Height(), (int)numLayers), firstImage->Format(), 1, numLevels_, &initialData[0]);
+    success &= DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
+    return success;
+}
+
 bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, TextureAddressMode v, TextureAddressMode w, unsigned maxAnisotropy_, float minLod_, float maxLod_, const Color& borderColor_)
 {
     ZoneScoped;
@@ -436,7 +528,9 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
     GLenum glTarget = (type == TEX_CUBE) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + box.near : target;
 
     IntBox levelBox(0, 0, 0, Max(size.x >> level, 1), Max(size.y >> level, 1), Max(size.z >> level, 1));
-    if (type == TEX_CUBE)
+    if (type == TEX_2D_ARRAY)
+        levelBox.far = size.z;
+    else if (type == TEX_CUBE)
     {
         if (box.Depth() != 1)
         {
@@ -458,7 +552,15 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
 
     bool wholeLevel = box == levelBox;
 
-    if (type != TEX_3D)
+    if (type == TEX_2D_ARRAY)
+    {
+        // Storage was allocated on definition, so always update as a subregion
+        if (!IsCompressed())
+            glTexSubImage3D(target, (int)level, box.left, box.top, box.near, box.Width(), box.Height(), box.Depth(), glFormats[format], glDataTypes[format], data.data);
+        else
+            glCompressedTexSubImage3D(target, (int)level, box.left, box.top, box.near, box.Width(), box.Height(), box.Depth(), glInternalFormats[format], (GLsizei)data.dataSize, data.data);
+    }
+    else if (type != TEX_3D)
     {
         if (!IsCompressed())
         {
@@ -33,6 +33,8 @@ public:
     bool Define(TextureType type, const IntVector2& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
     /// Define texture type and dimensions and set initial data. Return true on success.
     bool Define(TextureType type, const IntVector3& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
+    /// Define a 2D array texture from images with the same size and format, one layer per image. Mipmaps are generated for uncompressed images. Return true on success.
+    bool DefineArray(const std::vector<Image*>& images);
     /// Define sampling parameters. Return true on success.
     bool DefineSampler(TextureFilterMode filter = FILTER_ANISOTROPIC, TextureAddressMode u = ADDRESS_WRAP, TextureAddressMode v = ADDRESS_WRAP, TextureAddressMode w = ADDRESS_WRAP, unsigned maxAnisotropy = 16, float minLod = -M_MAX_FLOAT, float maxLod = M_MAX_FLOAT, const Color& borderColor = Color::BLACK);
     /// Set data for a mipmap level. Return true on success.
@@ -52,7 +54,7 @@ public:
     int Width() const { return size.x; }
     /// Return height in pixels.
     int Height() const { return size.y; }
-    /// Return depth in pixels. For cube maps, returns the number of faces.
+    /// Return depth in pixels. For cube maps, returns the number of faces and for array textures the number of layers.
     int Depth() const { return size.z; }
     /// Return image format.
     ImageFormat Format() const { return format; }
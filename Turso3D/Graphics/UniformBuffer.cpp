@@ -9,6 +9,8 @@
 #include <tracy/Tracy.hpp>
 
 static UniformBuffer* boundUniformBuffers[MAX_CONSTANT_BUFFER_SLOTS];
+static size_t boundOffsets[MAX_CONSTANT_BUFFER_SLOTS];
+static size_t boundSizes[MAX_CONSTANT_BUFFER_SLOTS];
 
 UniformBuffer::UniformBuffer() :
     buffer(0),
@@ -78,11 +80,18 @@ bool UniformBuffer::SetData(size_t offset, size_t numBytes, const void* data, bo
 
 void UniformBuffer::Bind(size_t index)
 {
-    if (!buffer || boundUniformBuffers[index] == this)
+    Bind(index, 0, size);
+}
+
+void UniformBuffer::Bind(size_t index, size_t offset, size_t numBytes)
+{
+    if (!buffer || (boundUniformBuffers[index] == this && boundOffsets[index] == offset && boundSizes[index] == numBytes))
         return;
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, 0, size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, offset, numBytes);
     boundUniformBuffers[index] = this;
+    boundOffsets[index] = offset;
+    boundSizes[index] = numBytes;
 }
 
 void UniformBuffer::Unbind(size_t index)
@@ -21,6 +21,8 @@ public:
     bool SetData(size_t offset, size_t numBytes, const void* data, bool discard = false);
     /// Bind to use at a specific shader slot. No-op if already bound.
     void Bind(size_t index);
+    /// Bind a byte range to use at a specific shader slot. The offset must be a multiple of the uniform buffer offset alignment. No-op if already bound.
+    void Bind(size_t index, size_t offset, size_t numBytes);
 
     /// Return size of buffer in bytes.
     size_t Size() const { return size; }
@@ -19,8 +19,8 @@ static const unsigned baseAttributeIndex[] =
     2,
     3,
     4,
-    10,
-    11
+    12,
+    13
 };
 
 static const unsigned elementGLSizes[] =
@@ -50,7 +50,6 @@ VertexBuffer::VertexBuffer() :
     attributes(0),
     usage(USAGE_DEFAULT)
 {
-    assert(Object::Subsystem<Graphics>()->IsInitialized());
 }
 
 VertexBuffer::~VertexBuffer()
@@ -207,6 +206,8 @@ size_t VertexBuffer::VertexElementSize(const VertexElement& element)
 
 bool VertexBuffer::Create(const void* data)
 {
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+
     glGenBuffers(1, &buffer);
     if (!buffer)
     {
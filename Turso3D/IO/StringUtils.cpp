@@ -2,9 +2,586 @@
 
 #include "StringUtils.h"
 
+#include <cassert>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
 #include <cstdarg>
+#include <cstdio>
 #include <cstring>
-#include <cctype>
+
+static const double pow10Table[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const unsigned long long pow10IntegerTable[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+    10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const int MAX_FAST_POW10 = 22;
+static const int MAX_FAST_DIGITS = 15;
+static const int MAX_MANTISSA_DIGITS = 19;
+static const int MAX_EXACT_DIGITS = 800;
+
+static double ScaleByPow10(double value, int exponent)
+{
+    while (exponent > MAX_FAST_POW10)
+    {
+        value *= pow10Table[MAX_FAST_POW10];
+        exponent -= MAX_FAST_POW10;
+    }
+    while (exponent < -MAX_FAST_POW10)
+    {
+        value /= pow10Table[MAX_FAST_POW10];
+        exponent += MAX_FAST_POW10;
+    }
+
+    return exponent >= 0 ? value * pow10Table[exponent] : value / pow10Table[-exponent];
+}
+
+static long double ScaleByPow10(long double value, int exponent)
+{
+    while (exponent > MAX_FAST_POW10)
+    {
+        value *= pow10Table[MAX_FAST_POW10];
+        exponent -= MAX_FAST_POW10;
+    }
+    while (exponent < -MAX_FAST_POW10)
+    {
+        value /= pow10Table[MAX_FAST_POW10];
+        exponent += MAX_FAST_POW10;
+    }
+
+    return exponent >= 0 ? value * pow10Table[exponent] : value / pow10Table[-exponent];
+}
+
+/// Arbitrary precision unsigned integer for exact decimal to binary comparisons.
+struct DecimalBigInt
+{
+    /// Construct from a value.
+    DecimalBigInt(unsigned long long value) :
+        size(0)
+    {
+        while (value)
+        {
+            limbs[size++] = (unsigned)value;
+            value >>= 32;
+        }
+    }
+
+    /// Construct from decimal digit characters.
+    DecimalBigInt(const char* digits, int numDigits) :
+        size(0)
+    {
+        while (numDigits > 0)
+        {
+            int count = numDigits < 9 ? numDigits : 9;
+            unsigned value = 0;
+            for (int i = 0; i < count; ++i)
+                value = value * 10 + (*digits++ - '0');
+            Multiply((unsigned)pow10IntegerTable[count], value);
+            numDigits -= count;
+        }
+    }
+
+    /// Multiply by a 32-bit value and add another.
+    void Multiply(unsigned value, unsigned add = 0)
+    {
+        unsigned long long carry = add;
+        for (int i = 0; i < size; ++i)
+        {
+            carry += (unsigned long long)limbs[i] * value;
+            limbs[i] = (unsigned)carry;
+            carry >>= 32;
+        }
+        if (carry)
+        {
+            assert(size < MAX_LIMBS);
+            limbs[size++] = (unsigned)carry;
+        }
+    }
+
+    /// Multiply by a power of ten.
+    void MultiplyPow10(int exponent)
+    {
+        for (; exponent >= 9; exponent -= 9)
+            Multiply(1000000000);
+        if (exponent > 0)
+            Multiply((unsigned)pow10IntegerTable[exponent]);
+    }
+
+    /// Multiply by a power of two.
+    void MultiplyPow2(int exponent)
+    {
+        int limbShift = exponent >> 5;
+        int bitShift = exponent & 31;
+        if (!size || !exponent)
+            return;
+
+        assert(size + limbShift + 1 <= MAX_LIMBS);
+        limbs[size + limbShift] = 0;
+        for (int i = size - 1; i >= 0; --i)
+        {
+            unsigned long long value = (unsigned long long)limbs[i] << bitShift;
+            limbs[i + limbShift + 1] |= (unsigned)(value >> 32);
+            limbs[i + limbShift] = (unsigned)value;
+        }
+        for (int i = 0; i < limbShift; ++i)
+            limbs[i] = 0;
+        size += limbShift + 1;
+        while (size && !limbs[size - 1])
+            --size;
+    }
+
+    /// Compare with another. Return negative, zero or positive.
+    int Compare(const DecimalBigInt& rhs) const
+    {
+        if (size != rhs.size)
+            return size < rhs.size ? -1 : 1;
+        for (int i = size - 1; i >= 0; --i)
+        {
+            if (limbs[i] != rhs.limbs[i])
+                return limbs[i] < rhs.limbs[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    /// Maximum limb count, enough for the largest and smallest doubles scaled to integers with the maximum exact digit count.
+    static const int MAX_LIMBS = 128;
+
+    /// 32-bit limbs, least significant first.
+    unsigned limbs[MAX_LIMBS];
+    /// Number of limbs in use.
+    int size;
+};
+
+static int CompareWithHalfway(const DecimalBigInt& decimal, int exponent, bool truncated, double low, double high)
+{
+    // Express both doubles as integers of a common binary exponent, then the halfway point is their sum times half of that
+    int lowExponent, highExponent;
+    unsigned long long lowMantissa = (unsigned long long)ldexp(frexp(low, &lowExponent), 53);
+    unsigned long long highMantissa = (unsigned long long)ldexp(frexp(high, &highExponent), 53);
+    if (!lowMantissa)
+        lowExponent = highExponent;
+    int binaryExponent = (lowExponent < highExponent ? lowExponent : highExponent) - 53;
+    unsigned long long sum = (lowMantissa << (lowExponent - 53 - binaryExponent)) + (highMantissa << (highExponent - 53 - binaryExponent));
+    --binaryExponent;
+
+    DecimalBigInt lhs(decimal);
+    DecimalBigInt rhs(sum);
+    if (exponent >= 0)
+        lhs.MultiplyPow10(exponent);
+    else
+        rhs.MultiplyPow10(-exponent);
+    if (binaryExponent >= 0)
+        rhs.MultiplyPow2(binaryExponent);
+    else
+        lhs.MultiplyPow2(-binaryExponent);
+
+    // Halfway points have fewer significant digits than are kept, so nonzero digits beyond them can only break an exact tie
+    int result = lhs.Compare(rhs);
+    return (result == 0 && truncated) ? 1 : result;
+}
+
+static bool IsOddMantissa(double value)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof bits);
+    return (bits & 1) != 0;
+}
+
+static double DecimalToDouble(const char* digits, int numDigits, int exponent, bool truncated)
+{
+    if (!numDigits)
+        return 0.0;
+
+    // The leading digits that fit in an integer give the initial approximation
+    int numMantissaDigits = numDigits < MAX_MANTISSA_DIGITS ? numDigits : MAX_MANTISSA_DIGITS;
+    unsigned long long mantissa = 0;
+    for (int i = 0; i < numMantissaDigits; ++i)
+        mantissa = mantissa * 10 + (digits[i] - '0');
+    int mantissaExponent = exponent + numDigits - numMantissaDigits;
+
+    // Exact mantissa and power of ten in a double give a correctly rounded result with a single operation
+    if (numDigits <= MAX_FAST_DIGITS && !truncated && exponent >= -MAX_FAST_POW10 && exponent <= MAX_FAST_POW10)
+        return ScaleByPow10((double)mantissa, exponent);
+
+    // Clamp far out of range exponents to overflow / underflow directly
+    if (numDigits + exponent > 310)
+        return HUGE_VAL;
+    if (numDigits + exponent < -326)
+        return 0.0;
+
+    // Approximate in extended precision, then correct to the nearest double by exact comparison of all kept digits against the halfway points to the neighbours
+    double value = (double)ScaleByPow10((long double)mantissa, mantissaExponent);
+    DecimalBigInt decimal(digits, numDigits);
+    for (int i = 0; i < 4; ++i)
+    {
+        double higher = nextafter(value, HUGE_VAL);
+        if (higher < HUGE_VAL)
+        {
+            int result = CompareWithHalfway(decimal, exponent, truncated, value, higher);
+            if (result > 0 || (result == 0 && IsOddMantissa(value)))
+            {
+                value = higher;
+                continue;
+            }
+        }
+        if (value > 0.0)
+        {
+            double lower = nextafter(value, 0.0);
+            int result = CompareWithHalfway(decimal, exponent, truncated, lower, value);
+            if (result < 0 || (result == 0 && IsOddMantissa(value)))
+            {
+                value = lower;
+                continue;
+            }
+        }
+        break;
+    }
+
+    return value;
+}
+
+static float DecimalToFloat(const char* digits, int numDigits, int exponent, bool truncated)
+{
+    double value = DecimalToDouble(digits, numDigits, exponent, truncated);
+    float result = (float)value;
+    if ((double)result == value)
+        return result;
+
+    // Rounding to double first is only wrong when it lands exactly on the halfway point between two floats, so resolve that case by exact comparison of the digits. Above the largest float, the next value is taken as 2^128
+    float low = (double)result > value ? nextafterf(result, 0.0f) : result;
+    double high = low < FLT_MAX ? (double)nextafterf(low, HUGE_VALF) : ldexp(1.0, 128);
+    if (value != ((double)low + high) * 0.5)
+        return result;
+
+    int compare = CompareWithHalfway(DecimalBigInt(digits, numDigits), exponent, truncated, (double)low, high);
+    unsigned lowBits;
+    memcpy(&lowBits, &low, sizeof lowBits);
+    // An exact tie rounds to the even mantissa
+    return (compare > 0 || (compare == 0 && (lowBits & 1))) ? (float)high : low;
+}
+
+static int CompareDecimalWithDouble(unsigned long long mantissa, int exponent, double value)
+{
+    int binaryExponent;
+    unsigned long long binaryMantissa = (unsigned long long)ldexp(frexp(value, &binaryExponent), 53);
+    binaryExponent -= 53;
+
+    DecimalBigInt lhs(mantissa);
+    DecimalBigInt rhs(binaryMantissa);
+    if (exponent >= 0)
+        lhs.MultiplyPow10(exponent);
+    else
+        rhs.MultiplyPow10(-exponent);
+    if (binaryExponent >= 0)
+        rhs.MultiplyPow2(binaryExponent);
+    else
+        lhs.MultiplyPow2(-binaryExponent);
+
+    return lhs.Compare(rhs);
+}
+
+static int MantissaDigits(char* digits, unsigned long long mantissa)
+{
+    int numDigits = 0;
+    for (; mantissa; mantissa /= 10)
+        digits[numDigits++] = (char)('0' + mantissa % 10);
+    for (int i = 0; i < numDigits / 2; ++i)
+    {
+        char digit = digits[i];
+        digits[i] = digits[numDigits - 1 - i];
+        digits[numDigits - 1 - i] = digit;
+    }
+
+    return numDigits;
+}
+
+static double DecimalToDouble(unsigned long long mantissa, int exponent)
+{
+    char digits[MAX_MANTISSA_DIGITS + 1];
+    int numDigits = MantissaDigits(digits, mantissa);
+    return DecimalToDouble(digits, numDigits, exponent, false);
+}
+
+static float DecimalToFloat(unsigned long long mantissa, int exponent)
+{
+    char digits[MAX_MANTISSA_DIGITS + 1];
+    int numDigits = MantissaDigits(digits, mantissa);
+    return DecimalToFloat(digits, numDigits, exponent, false);
+}
+
+static size_t FormatUnsigned(char* dest, unsigned long long value)
+{
+    char digits[20];
+    size_t numDigits = 0;
+
+    do
+    {
+        digits[numDigits++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (size_t i = 0; i < numDigits; ++i)
+        dest[i] = digits[numDigits - 1 - i];
+    dest[numDigits] = 0;
+    return numDigits;
+}
+
+static size_t FormatSpecial(char* dest, bool nan, bool negative)
+{
+    const char* text = nan ? "nan" : (negative ? "-inf" : "inf");
+    size_t length = strlen(text);
+    memcpy(dest, text, length + 1);
+    return length;
+}
+
+static size_t FormatDecimal(char* dest, bool negative, unsigned long long mantissa, int exponent)
+{
+    while (mantissa && !(mantissa % 10))
+    {
+        mantissa /= 10;
+        ++exponent;
+    }
+
+    char digits[24];
+    int numDigits = (int)FormatUnsigned(digits, mantissa);
+    int pointPos = numDigits + exponent;
+    int sciExponent = pointPos - 1;
+    char* ptr = dest;
+
+    if (negative)
+        *ptr++ = '-';
+
+    // Use fixed notation for moderate magnitudes like JavaScript, else scientific
+    if (sciExponent > -7 && sciExponent < 21)
+    {
+        if (pointPos <= 0)
+        {
+            *ptr++ = '0';
+            *ptr++ = '.';
+            for (int i = pointPos; i < 0; ++i)
+                *ptr++ = '0';
+            memcpy(ptr, digits, numDigits);
+            ptr += numDigits;
+        }
+        else if (pointPos >= numDigits)
+        {
+            memcpy(ptr, digits, numDigits);
+            ptr += numDigits;
+            for (int i = numDigits; i < pointPos; ++i)
+                *ptr++ = '0';
+        }
+        else
+        {
+            memcpy(ptr, digits, pointPos);
+            ptr += pointPos;
+            *ptr++ = '.';
+            memcpy(ptr, digits + pointPos, numDigits - pointPos);
+            ptr += numDigits - pointPos;
+        }
+    }
+    else
+    {
+        *ptr++ = digits[0];
+        if (numDigits > 1)
+        {
+            *ptr++ = '.';
+            memcpy(ptr, digits + 1, numDigits - 1);
+            ptr += numDigits - 1;
+        }
+        *ptr++ = 'e';
+        if (sciExponent < 0)
+        {
+            *ptr++ = '-';
+            sciExponent = -sciExponent;
+        }
+        ptr += FormatUnsigned(ptr, (unsigned long long)sciExponent);
+    }
+
+    *ptr = 0;
+    return ptr - dest;
+}
+
+static int DecimalExponent(double value)
+{
+    int exponent = (int)floor(log10(value));
+    // Correct for inexact logarithm near powers of ten
+    double scaled = ScaleByPow10(value, -exponent);
+    if (scaled >= 10.0)
+        ++exponent;
+    else if (scaled < 1.0)
+        --exponent;
+    return exponent;
+}
+
+static void GenerateDigits(double value, int decimalExponent, int numDigits, unsigned long long& mantissa, int& exponent)
+{
+    exponent = decimalExponent - (numDigits - 1);
+    mantissa = (unsigned long long)(ScaleByPow10((long double)value, -exponent) + 0.5L);
+    // Rounding may carry over to one more digit
+    if (mantissa >= pow10IntegerTable[numDigits])
+    {
+        mantissa /= 10;
+        ++exponent;
+    }
+}
+
+static void GenerateExactDigits(double value, int decimalExponent, int numDigits, unsigned long long& mantissa, int& exponent)
+{
+    GenerateDigits(value, decimalExponent, numDigits, mantissa, exponent);
+
+    // Beyond double precision the approximation can be off by one, so correct it until the value lies between the halfway points to the neighbouring mantissas, rounding exact ties to even
+    for (;;)
+    {
+        int upper = CompareDecimalWithDouble((2 * mantissa + 1) * 5, exponent - 1, value);
+        if (upper < 0 || (upper == 0 && (mantissa & 1)))
+        {
+            ++mantissa;
+            continue;
+        }
+        int lower = CompareDecimalWithDouble((2 * mantissa - 1) * 5, exponent - 1, value);
+        if (lower > 0 || (lower == 0 && (mantissa & 1)))
+        {
+            --mantissa;
+            continue;
+        }
+        break;
+    }
+
+    if (mantissa >= pow10IntegerTable[numDigits])
+    {
+        mantissa /= 10;
+        ++exponent;
+    }
+}
+
+/// Decimal number scanned from a string, before conversion to binary.
+struct ScannedDecimal
+{
+    /// Significant digits without leading or trailing zeros.
+    char digits[MAX_EXACT_DIGITS];
+    /// Number of significant digits.
+    int numDigits;
+    /// Power of ten to scale the digits by.
+    int exponent;
+    /// Whether nonzero digits beyond the kept ones were dropped.
+    bool truncated;
+    /// Negative sign flag.
+    bool negative;
+    /// Infinity flag.
+    bool infinity;
+    /// NaN flag.
+    bool nan;
+};
+
+static const char* ScanDecimal(const char* string, ScannedDecimal& dest)
+{
+    const char* ptr = string;
+    while (isspace((unsigned char)*ptr))
+        ++ptr;
+
+    dest.negative = false;
+    dest.infinity = false;
+    dest.nan = false;
+    dest.numDigits = 0;
+    dest.exponent = 0;
+    dest.truncated = false;
+
+    if (*ptr == '-' || *ptr == '+')
+        dest.negative = *ptr++ == '-';
+
+    // Infinity and NaN as written by FormatNumber()
+    if (tolower(ptr[0]) == 'i' && tolower(ptr[1]) == 'n' && tolower(ptr[2]) == 'f')
+    {
+        dest.infinity = true;
+        return ptr + 3;
+    }
+    if (tolower(ptr[0]) == 'n' && tolower(ptr[1]) == 'a' && tolower(ptr[2]) == 'n')
+    {
+        dest.nan = true;
+        return ptr + 3;
+    }
+
+    bool hasDigits = false;
+
+    // Keep significant digits up to the exact comparison limit, account for the rest in the exponent and remember whether any of them was nonzero
+    while (isdigit((unsigned char)*ptr))
+    {
+        hasDigits = true;
+        if (dest.numDigits < MAX_EXACT_DIGITS)
+        {
+            if (dest.numDigits || *ptr != '0')
+                dest.digits[dest.numDigits++] = *ptr;
+        }
+        else
+        {
+            dest.truncated |= *ptr != '0';
+            ++dest.exponent;
+        }
+        ++ptr;
+    }
+    if (*ptr == '.')
+    {
+        ++ptr;
+        while (isdigit((unsigned char)*ptr))
+        {
+            hasDigits = true;
+            if (dest.numDigits < MAX_EXACT_DIGITS)
+            {
+                if (dest.numDigits || *ptr != '0')
+                    dest.digits[dest.numDigits++] = *ptr;
+                --dest.exponent;
+            }
+            else
+                dest.truncated |= *ptr != '0';
+            ++ptr;
+        }
+    }
+
+    // Trailing zeros do not change the value
+    while (dest.numDigits && dest.digits[dest.numDigits - 1] == '0')
+    {
+        --dest.numDigits;
+        ++dest.exponent;
+    }
+
+    if (!hasDigits)
+    {
+        dest.negative = false;
+        return string;
+    }
+
+    // Exponent is only consumed if it has digits
+    if (*ptr == 'e' || *ptr == 'E')
+    {
+        const char* expPtr = ptr + 1;
+        bool negativeExponent = false;
+        if (*expPtr == '-' || *expPtr == '+')
+            negativeExponent = *expPtr++ == '-';
+
+        if (isdigit((unsigned char)*expPtr))
+        {
+            int explicitExponent = 0;
+            while (isdigit((unsigned char)*expPtr))
+            {
+                if (explicitExponent < 100000)
+                    explicitExponent = explicitExponent * 10 + (*expPtr - '0');
+                ++expPtr;
+            }
+            dest.exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            ptr = expPtr;
+        }
+    }
+
+    return ptr;
+}
 
 size_t CountElements(const std::string& string, char separator)
 {
@@ -278,42 +855,50 @@ std::string ToString(bool value)
 
 std::string ToString(short value)
 {
-    return FormatString("%d", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, (int)value));
 }
 
 std::string ToString(int value)
 {
-    return FormatString("%d", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 std::string ToString(long long value) 
 {
-    return FormatString("%lld", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 std::string ToString(unsigned short value)
 {
-    return FormatString("%u", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, (unsigned)value));
 }
 
 std::string ToString(unsigned value) 
 {
-    return FormatString("%u", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 std::string ToString(unsigned long long value)
 {
-    return FormatString("%llu", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 std::string ToString(float value)
 {
-    return FormatString("%g", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 std::string ToString(double value)
 {
-    return FormatString("%.15g", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatNumber(buffer, value));
 }
 
 int ParseInt(const std::string& string)
@@ -323,8 +908,9 @@ int ParseInt(const std::string& string)
 
 int ParseInt(const char* string)
 {
-    char* ptr = const_cast<char*>(string);
-    return strtol(ptr, &ptr, 10);
+    int ret;
+    ParseNumber(string, ret);
+    return ret;
 }
 
 float ParseFloat(const std::string& string)
@@ -334,6 +920,262 @@ float ParseFloat(const std::string& string)
 
 float ParseFloat(const char* string)
 {
-    char* ptr = const_cast<char*>(string);
-    return (float)strtod(ptr, &ptr);
+    float ret;
+    ParseNumber(string, ret);
+    return ret;
+}
+
+size_t FormatNumber(char* dest, int value)
+{
+    return FormatNumber(dest, (long long)value);
+}
+
+size_t FormatNumber(char* dest, unsigned value)
+{
+    return FormatUnsigned(dest, value);
+}
+
+size_t FormatNumber(char* dest, long long value)
+{
+    if (value < 0)
+    {
+        dest[0] = '-';
+        return 1 + FormatUnsigned(dest + 1, 0ULL - (unsigned long long)value);
+    }
+    else
+        return FormatUnsigned(dest, (unsigned long long)value);
+}
+
+size_t FormatNumber(char* dest, unsigned long long value)
+{
+    return FormatUnsigned(dest, value);
+}
+
+size_t FormatNumber(char* dest, float value)
+{
+    // Inspect the bits, as fast math may optimize away comparisons against NaN
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    if ((bits & 0x7f800000) == 0x7f800000)
+        return FormatSpecial(dest, (bits & 0x7fffff) != 0, (bits & 0x80000000) != 0);
+    if (value == 0.0f)
+        return FormatDecimal(dest, std::signbit(value), 0, 0);
+
+    // Try increasing precision until the digits parse back to the same float. Nine digits always suffice
+    float absValue = fabsf(value);
+    int decimalExponent = DecimalExponent(absValue);
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+
+    for (int numDigits = 1; numDigits <= 9; ++numDigits)
+    {
+        GenerateDigits(absValue, decimalExponent, numDigits, mantissa, exponent);
+        if (DecimalToFloat(mantissa, exponent) == absValue)
+            break;
+    }
+
+    return FormatDecimal(dest, value < 0.0f, mantissa, exponent);
+}
+
+size_t FormatNumber(char* dest, double value)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof bits);
+    if ((bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL)
+        return FormatSpecial(dest, (bits & 0xfffffffffffffULL) != 0, (bits & 0x8000000000000000ULL) != 0);
+    if (value == 0.0)
+        return FormatDecimal(dest, std::signbit(value), 0, 0);
+
+    double absValue = fabs(value);
+    int decimalExponent = DecimalExponent(absValue);
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+
+    // Digits up to the precision of a double can be generated with double arithmetic
+    for (int numDigits = 1; numDigits <= MAX_FAST_DIGITS; ++numDigits)
+    {
+        GenerateDigits(absValue, decimalExponent, numDigits, mantissa, exponent);
+        if (DecimalToDouble(mantissa, exponent) == absValue)
+            return FormatDecimal(dest, value < 0.0, mantissa, exponent);
+    }
+
+    // The last two digits need correct rounding beyond double precision. Seventeen correctly rounded digits always parse back to the same double
+    for (int numDigits = MAX_FAST_DIGITS + 1; numDigits <= 17; ++numDigits)
+    {
+        GenerateExactDigits(absValue, decimalExponent, numDigits, mantissa, exponent);
+        if (DecimalToDouble(mantissa, exponent) == absValue)
+            break;
+    }
+
+    return FormatDecimal(dest, value < 0.0, mantissa, exponent);
+}
+
+const char* ParseNumber(const char* string, int& dest)
+{
+    const char* ptr = string;
+    while (isspace((unsigned char)*ptr))
+        ++ptr;
+
+    bool negative = false;
+    if (*ptr == '-' || *ptr == '+')
+        negative = *ptr++ == '-';
+
+    if (!isdigit((unsigned char)*ptr))
+    {
+        dest = 0;
+        return string;
+    }
+
+    long long value = 0;
+    while (isdigit((unsigned char)*ptr))
+    {
+        // Saturate on overflow, but consume all digits
+        if (value <= 0x80000000LL)
+            value = value * 10 + (*ptr - '0');
+        ++ptr;
+    }
+
+    if (negative)
+        dest = value > 0x80000000LL ? (int)-0x7fffffffLL - 1 : (int)-value;
+    else
+        dest = value > 0x7fffffffLL ? 0x7fffffff : (int)value;
+    return ptr;
+}
+
+const char* ParseNumber(const char* string, float& dest)
+{
+    ScannedDecimal decimal;
+    const char* ret = ScanDecimal(string, decimal);
+
+    if (decimal.nan)
+        dest = NAN;
+    else
+    {
+        // Round directly to float precision, as rounding to double first could round some values the wrong way
+        float value = decimal.infinity ? HUGE_VALF : DecimalToFloat(decimal.digits, decimal.numDigits, decimal.exponent, decimal.truncated);
+        dest = decimal.negative ? -value : value;
+    }
+
+    return ret;
+}
+
+const char* ParseNumber(const char* string, double& dest)
+{
+    ScannedDecimal decimal;
+    const char* ret = ScanDecimal(string, decimal);
+
+    if (decimal.nan)
+        dest = NAN;
+    else
+    {
+        double value = decimal.infinity ? HUGE_VAL : DecimalToDouble(decimal.digits, decimal.numDigits, decimal.exponent, decimal.truncated);
+        dest = decimal.negative ? -value : value;
+    }
+
+    return ret;
+}
+
+StringBuilder::StringBuilder(char* buffer_, size_t capacity_) :
+    buffer(buffer_),
+    capacity(capacity_),
+    length(0),
+    truncated(false)
+{
+    assert(buffer && capacity);
+    buffer[0] = 0;
+}
+
+StringBuilder& StringBuilder::Append(const char* string)
+{
+    return Append(string, strlen(string));
+}
+
+StringBuilder& StringBuilder::Append(const char* string, size_t numChars)
+{
+    size_t available = capacity - 1 - length;
+    if (numChars > available)
+    {
+        numChars = available;
+        truncated = true;
+    }
+
+    memcpy(buffer + length, string, numChars);
+    length += numChars;
+    buffer[length] = 0;
+    return *this;
+}
+
+StringBuilder& StringBuilder::Append(const std::string& string)
+{
+    return Append(string.data(), string.length());
+}
+
+StringBuilder& StringBuilder::Append(char c)
+{
+    return Append(&c, 1);
+}
+
+StringBuilder& StringBuilder::Append(int value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::Append(unsigned value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::Append(long long value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::Append(unsigned long long value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::Append(float value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::Append(double value)
+{
+    char numberBuffer[NUMBER_BUFFER_SIZE];
+    return Append(numberBuffer, FormatNumber(numberBuffer, value));
+}
+
+StringBuilder& StringBuilder::AppendList(const int* values, size_t count, char separator)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i)
+            Append(separator);
+        Append(values[i]);
+    }
+    return *this;
+}
+
+StringBuilder& StringBuilder::AppendList(const float* values, size_t count, char separator)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i)
+            Append(separator);
+        Append(values[i]);
+    }
+    return *this;
+}
+
+void StringBuilder::Clear()
+{
+    length = 0;
+    truncated = false;
+    buffer[0] = 0;
 }
@@ -5,6 +5,9 @@
 #include <string>
 #include <vector>
 
+/// Buffer size sufficient for any number formatted by FormatNumber(), including the terminator.
+static const size_t NUMBER_BUFFER_SIZE = 32;
+
 /// Count number of elements in a string.
 size_t CountElements(const std::string& string, char separator = ' ');
 /// Count number of elements in a string.
@@ -67,4 +70,75 @@ int ParseInt(const char* string);
 float ParseFloat(const std::string& string);
 /// Parse a floating-point value from a string.
 float ParseFloat(const char* string);
+/// Format a number into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, int value);
+/// Format a number into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, unsigned value);
+/// Format a number into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, long long value);
+/// Format a number into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, unsigned long long value);
+/// Format a float into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating, using the fewest digits that parse back to the same value. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, float value);
+/// Format a double into a buffer of at least NUMBER_BUFFER_SIZE chars without allocating, using the fewest digits that parse back to the same value. Output is null-terminated and locale-independent. Return length excluding the terminator.
+size_t FormatNumber(char* dest, double value);
+/// Parse an integer from a C string, skipping leading whitespace. Locale-independent and non-allocating. Return pointer past the number, or the original pointer and zero value if no number.
+const char* ParseNumber(const char* string, int& dest);
+/// Parse a float from a C string, skipping leading whitespace. Locale-independent and non-allocating. Return pointer past the number, or the original pointer and zero value if no number.
+const char* ParseNumber(const char* string, float& dest);
+/// Parse a double from a C string, skipping leading whitespace. Locale-independent and non-allocating. Return pointer past the number, or the original pointer and zero value if no number.
+const char* ParseNumber(const char* string, double& dest);
+
+/// Builds a string into caller-provided storage without allocating. The result is always null-terminated; text that does not fit is truncated.
+class StringBuilder
+{
+public:
+    /// Construct with destination buffer and its size in chars, including space for the terminator.
+    StringBuilder(char* buffer, size_t capacity);
+
+    /// Append a C string.
+    StringBuilder& Append(const char* string);
+    /// Append chars from a string.
+    StringBuilder& Append(const char* string, size_t length);
+    /// Append a string.
+    StringBuilder& Append(const std::string& string);
+    /// Append a char.
+    StringBuilder& Append(char c);
+    /// Append a number.
+    StringBuilder& Append(int value);
+    /// Append a number.
+    StringBuilder& Append(unsigned value);
+    /// Append a number.
+    StringBuilder& Append(long long value);
+    /// Append a number.
+    StringBuilder& Append(unsigned long long value);
+    /// Append a number.
+    StringBuilder& Append(float value);
+    /// Append a number.
+    StringBuilder& Append(double value);
+    /// Append numbers with a separator.
+    StringBuilder& AppendList(const int* values, size_t count, char separator = ' ');
+    /// Append numbers with a separator.
+    StringBuilder& AppendList(const float* values, size_t count, char separator = ' ');
+    /// Reset to empty.
+    void Clear();
+
+    /// Return the null-terminated result.
+    const char* CString() const { return buffer; }
+    /// Return length of the result.
+    size_t Length() const { return length; }
+    /// Return whether appended text had to be truncated.
+    bool IsTruncated() const { return truncated; }
+    /// Return the result as a string.
+    std::string ToString() const { return std::string(buffer, length); }
 
+private:
+    /// Destination buffer.
+    char* buffer;
+    /// Buffer size including the terminator.
+    size_t capacity;
+    /// Current length.
+    size_t length;
+    /// Truncation flag.
+    bool truncated;
+};
@@ -6,7 +6,6 @@
 #include "../IO/StringUtils.h"
 
 #include <utility>
-#include <cstdlib>
 
 void BoundingBox::Define(const Vector3* vertices, size_t count)
 {
@@ -103,13 +102,13 @@ bool BoundingBox::FromString(const char* string)
     if (elements < 6)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    min.x = (float)strtod(ptr, &ptr);
-    min.y = (float)strtod(ptr, &ptr);
-    min.z = (float)strtod(ptr, &ptr);
-    max.x = (float)strtod(ptr, &ptr);
-    max.y = (float)strtod(ptr, &ptr);
-    max.z = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, min.x);
+    ptr = ParseNumber(ptr, min.y);
+    ptr = ParseNumber(ptr, min.z);
+    ptr = ParseNumber(ptr, max.x);
+    ptr = ParseNumber(ptr, max.y);
+    ptr = ParseNumber(ptr, max.z);
     
     return true;
 }
@@ -256,5 +255,8 @@ Intersection BoundingBox::IsInsideFast(const Sphere& sphere) const
 
 std::string BoundingBox::ToString() const
 {
-    return min.ToString() + " " + max.ToString();
+    char buffer[6 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(min.Data(), 3).Append(' ').AppendList(max.Data(), 3);
+    return builder.ToString();
 }
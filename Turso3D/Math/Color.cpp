@@ -3,9 +3,6 @@
 #include "Color.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Color Color::WHITE(1.0f, 1.0f, 1.0f);
 const Color Color::GRAY(0.5f, 0.5f, 0.5f);
 const Color Color::BLACK(0.0f, 0.0f, 0.0f);
@@ -31,12 +28,12 @@ bool Color::FromString(const char* string)
     size_t elements = CountElements(string);
     if (elements < 3)
         return false;
-    char* ptr = const_cast<char*>(string);
-    r = (float)strtod(ptr, &ptr);
-    g = (float)strtod(ptr, &ptr);
-    b = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, r);
+    ptr = ParseNumber(ptr, g);
+    ptr = ParseNumber(ptr, b);
     if (elements > 3)
-        a = (float)strtod(ptr, &ptr);
+        ptr = ParseNumber(ptr, a);
     else
         a = 1.0f;
     
@@ -56,5 +53,8 @@ Color Color::Lerp(const Color &rhs, float t) const
 
 std::string Color::ToString() const
 {
-    return FormatString("%g %g %g %g", r, g, b, a);
+    char buffer[4 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 4);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "IntBox.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const IntBox IntBox::ZERO(0, 0, 0, 0, 0, 0);
 
 bool IntBox::FromString(const char* string)
@@ -14,18 +11,21 @@ bool IntBox::FromString(const char* string)
     if (elements < 6)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    left = strtol(ptr, &ptr, 10);
-    top = strtol(ptr, &ptr, 10);
-    near = strtol(ptr, &ptr, 10);
-    right = strtol(ptr, &ptr, 10);
-    bottom = strtol(ptr, &ptr, 10);
-    far = strtol(ptr, &ptr, 10);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, left);
+    ptr = ParseNumber(ptr, top);
+    ptr = ParseNumber(ptr, near);
+    ptr = ParseNumber(ptr, right);
+    ptr = ParseNumber(ptr, bottom);
+    ptr = ParseNumber(ptr, far);
 
     return true;
 }
 
 std::string IntBox::ToString() const
 {
-    return FormatString("%d %d %d %d %d %d", left, top, near, right, bottom, far);
+    char buffer[6 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 6);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "IntRect.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const IntRect IntRect::ZERO(0, 0, 0, 0);
 
 bool IntRect::FromString(const char* string)
@@ -14,16 +11,19 @@ bool IntRect::FromString(const char* string)
     if (elements < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    left = strtol(ptr, &ptr, 10);
-    top = strtol(ptr, &ptr, 10);
-    right = strtol(ptr, &ptr, 10);
-    bottom = strtol(ptr, &ptr, 10);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, left);
+    ptr = ParseNumber(ptr, top);
+    ptr = ParseNumber(ptr, right);
+    ptr = ParseNumber(ptr, bottom);
     
     return true;
 }
 
 std::string IntRect::ToString() const
 {
-    return FormatString("%d %d %d %d", left, top, right, bottom);
+    char buffer[4 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 4);
+    return builder.ToString();
 }
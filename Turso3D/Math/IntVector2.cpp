@@ -3,9 +3,6 @@
 #include "IntVector2.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const IntVector2 IntVector2::ZERO(0, 0);
 
 bool IntVector2::FromString(const char* string)
@@ -14,15 +11,18 @@ bool IntVector2::FromString(const char* string)
     if (elements < 2)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = strtol(ptr, &ptr, 10);
-    y = strtol(ptr, &ptr, 10);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, x);
+    ptr = ParseNumber(ptr, y);
     
     return true;
 }
 
 std::string IntVector2::ToString() const
 {
-    return FormatString("%d %d", x, y);
+    char buffer[2 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 2);
+    return builder.ToString();
 }
 
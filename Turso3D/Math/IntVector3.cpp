@@ -3,9 +3,6 @@
 #include "IntVector3.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const IntVector3 IntVector3::ZERO(0, 0, 0);
 
 bool IntVector3::FromString(const std::string& str)
@@ -19,15 +16,18 @@ bool IntVector3::FromString(const char* str)
     if (elements < 3)
         return false;
     
-    char* ptr = (char*)str;
-    x = strtol(ptr, &ptr, 10);
-    y = strtol(ptr, &ptr, 10);
-    z = strtol(ptr, &ptr, 10);
+    const char* ptr = str;
+    ptr = ParseNumber(ptr, x);
+    ptr = ParseNumber(ptr, y);
+    ptr = ParseNumber(ptr, z);
 
     return true;
 }
 
 std::string IntVector3::ToString() const
 {
-    return FormatString("%d %d %d", x, y, z);
+    char buffer[3 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 3);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "Matrix3x4.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Matrix3x4 Matrix3x4::ZERO(
     0.0f, 0.0f, 0.0f, 0.0f,
     0.0f, 0.0f, 0.0f, 0.0f,
@@ -22,27 +19,27 @@ bool Matrix3x4::FromString(const char* string)
     if (elements < 12)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    m00 = (float)strtod(ptr, &ptr);
-    m01 = (float)strtod(ptr, &ptr);
-    m02 = (float)strtod(ptr, &ptr);
-    m03 = (float)strtod(ptr, &ptr);
-    m10 = (float)strtod(ptr, &ptr);
-    m11 = (float)strtod(ptr, &ptr);
-    m12 = (float)strtod(ptr, &ptr);
-    m13 = (float)strtod(ptr, &ptr);
-    m20 = (float)strtod(ptr, &ptr);
-    m21 = (float)strtod(ptr, &ptr);
-    m22 = (float)strtod(ptr, &ptr);
-    m23 = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, m00);
+    ptr = ParseNumber(ptr, m01);
+    ptr = ParseNumber(ptr, m02);
+    ptr = ParseNumber(ptr, m03);
+    ptr = ParseNumber(ptr, m10);
+    ptr = ParseNumber(ptr, m11);
+    ptr = ParseNumber(ptr, m12);
+    ptr = ParseNumber(ptr, m13);
+    ptr = ParseNumber(ptr, m20);
+    ptr = ParseNumber(ptr, m21);
+    ptr = ParseNumber(ptr, m22);
+    ptr = ParseNumber(ptr, m23);
     
     return true;
 }
 
 std::string Matrix3x4::ToString() const
 {
-    return FormatString("%g %g %g %g %g %g %g %g %g %g %g %g", 
-        m00, m01, m02, m03, 
-        m10, m11, m12, m13, 
-        m20, m21, m22, m23);
+    char buffer[12 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 12);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "Matrix3x4.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Matrix4 Matrix4::ZERO(
     0.0f, 0.0f, 0.0f, 0.0f,
     0.0f, 0.0f, 0.0f, 0.0f,
@@ -32,32 +29,31 @@ bool Matrix4::FromString(const char* string)
     if (elements < 16)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    m00 = (float)strtod(ptr, &ptr);
-    m01 = (float)strtod(ptr, &ptr);
-    m02 = (float)strtod(ptr, &ptr);
-    m03 = (float)strtod(ptr, &ptr);
-    m10 = (float)strtod(ptr, &ptr);
-    m11 = (float)strtod(ptr, &ptr);
-    m12 = (float)strtod(ptr, &ptr);
-    m13 = (float)strtod(ptr, &ptr);
-    m20 = (float)strtod(ptr, &ptr);
-    m21 = (float)strtod(ptr, &ptr);
-    m22 = (float)strtod(ptr, &ptr);
-    m23 = (float)strtod(ptr, &ptr);
-    m30 = (float)strtod(ptr, &ptr);
-    m31 = (float)strtod(ptr, &ptr);
-    m32 = (float)strtod(ptr, &ptr);
-    m33 = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, m00);
+    ptr = ParseNumber(ptr, m01);
+    ptr = ParseNumber(ptr, m02);
+    ptr = ParseNumber(ptr, m03);
+    ptr = ParseNumber(ptr, m10);
+    ptr = ParseNumber(ptr, m11);
+    ptr = ParseNumber(ptr, m12);
+    ptr = ParseNumber(ptr, m13);
+    ptr = ParseNumber(ptr, m20);
+    ptr = ParseNumber(ptr, m21);
+    ptr = ParseNumber(ptr, m22);
+    ptr = ParseNumber(ptr, m23);
+    ptr = ParseNumber(ptr, m30);
+    ptr = ParseNumber(ptr, m31);
+    ptr = ParseNumber(ptr, m32);
+    ptr = ParseNumber(ptr, m33);
     
     return true;
 }
 
 std::string Matrix4::ToString() const
 {
-    return FormatString("%g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g", 
-        m00, m01, m02, m03,
-        m10, m11, m12, m13,
-        m20, m21, m22, m23,
-        m30, m31, m32, m33);
+    char buffer[16 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 16);
+    return builder.ToString();
 }
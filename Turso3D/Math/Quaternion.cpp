@@ -3,9 +3,6 @@
 #include "Quaternion.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Quaternion Quaternion::IDENTITY(1.0f, 0.0f, 0.0f, 0.0f);
 
 void Quaternion::FromAngleAxis(float angle, const Vector3& axis)
@@ -155,20 +152,20 @@ bool Quaternion::FromString(const char* string)
     if (elements < 3)
         return false;
 
-    char* ptr = const_cast<char*>(string);
+    const char* ptr = string;
     if (elements >= 4)
     {
-        w = (float)strtod(ptr, &ptr);
-        x = (float)strtod(ptr, &ptr);
-        y = (float)strtod(ptr, &ptr);
-        z = (float)strtod(ptr, &ptr);
+        ptr = ParseNumber(ptr, w);
+        ptr = ParseNumber(ptr, x);
+        ptr = ParseNumber(ptr, y);
+        ptr = ParseNumber(ptr, z);
     }
     else
     {
         float x_, y_, z_;
-        x_ = (float)strtod(ptr, &ptr);
-        y_ = (float)strtod(ptr, &ptr);
-        z_ = (float)strtod(ptr, &ptr);
+        ptr = ParseNumber(ptr, x_);
+        ptr = ParseNumber(ptr, y_);
+        ptr = ParseNumber(ptr, z_);
         FromEulerAngles(x_, y_, z_);
     }
 
@@ -265,5 +262,8 @@ Quaternion Quaternion::Nlerp(Quaternion rhs, float t, bool shortestPath) const
 
 std::string Quaternion::ToString() const
 {
-    return FormatString("%g %g %g %g", w, x, y, z);
+    char buffer[4 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 4);
+    return builder.ToString();
 }
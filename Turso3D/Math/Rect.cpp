@@ -4,7 +4,6 @@
 #include "../IO/StringUtils.h"
 
 #include <utility>
-#include <cstdlib>
 
 const Rect Rect::FULL(-1.0f, -1.0f, 1.0f, 1.0f);
 const Rect Rect::POSITIVE(0.0f, 0.0f, 1.0f, 1.0f);
@@ -33,16 +32,19 @@ bool Rect::FromString(const char* string)
     if (elements < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    min.x = (float)strtod(ptr, &ptr);
-    min.y = (float)strtod(ptr, &ptr);
-    max.x = (float)strtod(ptr, &ptr);
-    max.y = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, min.x);
+    ptr = ParseNumber(ptr, min.y);
+    ptr = ParseNumber(ptr, max.x);
+    ptr = ParseNumber(ptr, max.y);
     
     return true;
 }
 
 std::string Rect::ToString() const
 {
-    return min.ToString() + " " + max.ToString();
+    char buffer[4 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(min.Data(), 2).Append(' ').AppendList(max.Data(), 2);
+    return builder.ToString();
 }
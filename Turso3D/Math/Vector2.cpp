@@ -3,9 +3,6 @@
 #include "Vector2.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Vector2 Vector2::ZERO(0.0f, 0.0f);
 const Vector2 Vector2::LEFT(-1.0f, 0.0f);
 const Vector2 Vector2::RIGHT(1.0f, 0.0f);
@@ -19,14 +16,17 @@ bool Vector2::FromString(const char* string)
     if (elements < 2)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, x);
+    ptr = ParseNumber(ptr, y);
 
     return true;
 }
 
 std::string Vector2::ToString() const
 {
-    return FormatString("%g %g", x, y);
+    char buffer[2 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 2);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "Vector3.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Vector3 Vector3::ZERO(0.0f, 0.0f, 0.0f);
 const Vector3 Vector3::LEFT(-1.0f, 0.0f, 0.0f);
 const Vector3 Vector3::RIGHT(1.0f, 0.0f, 0.0f);
@@ -21,15 +18,18 @@ bool Vector3::FromString(const char* string)
     if (elements < 3)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
-    z = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, x);
+    ptr = ParseNumber(ptr, y);
+    ptr = ParseNumber(ptr, z);
     
     return true;
 }
 
 std::string Vector3::ToString() const
 {
-    return FormatString("%g %g %g", x, y, z);
+    char buffer[3 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 3);
+    return builder.ToString();
 }
@@ -3,9 +3,6 @@
 #include "Vector4.h"
 #include "../IO/StringUtils.h"
 
-#include <cstdio>
-#include <cstdlib>
-
 const Vector4 Vector4::ZERO(0.0f, 0.0f, 0.0f, 0.0f);
 const Vector4 Vector4::ONE(1.0f, 1.0f, 1.0f, 1.0f);
 
@@ -15,16 +12,19 @@ bool Vector4::FromString(const char* string)
     if (elements < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
-    z = (float)strtod(ptr, &ptr);
-    w = (float)strtod(ptr, &ptr);
+    const char* ptr = string;
+    ptr = ParseNumber(ptr, x);
+    ptr = ParseNumber(ptr, y);
+    ptr = ParseNumber(ptr, z);
+    ptr = ParseNumber(ptr, w);
     
     return true;
 }
 
 std::string Vector4::ToString() const
 {
-    return FormatString("%g %g %g %g", x, y, z, w);
+    char buffer[4 * NUMBER_BUFFER_SIZE];
+    StringBuilder builder(buffer, sizeof buffer);
+    builder.AppendList(Data(), 4);
+    return builder.ToString();
 }
@@ -2,6 +2,7 @@
 
 #include "../IO/Log.h"
 #include "Allocator.h"
+#include "LargePages.h"
 
 #include <cassert>
 
@@ -10,7 +11,10 @@ static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeS
     if (!capacity)
         capacity = 1;
     
-    unsigned char* blockPtr = new unsigned char[sizeof(AllocatorBlock) + capacity * (sizeof(AllocatorNode) + nodeSize)];
+    unsigned char* blockPtr = static_cast<unsigned char*>(LargePageAllocate(sizeof(AllocatorBlock) + capacity * (sizeof(AllocatorNode) + nodeSize)));
+    if (!blockPtr)
+        throw std::bad_alloc();
+
     AllocatorBlock* newBlock = reinterpret_cast<AllocatorBlock*>(blockPtr);
     newBlock->nodeSize = nodeSize;
     newBlock->capacity = capacity;
@@ -56,7 +60,7 @@ void AllocatorUninitialize(AllocatorBlock* allocator)
     while (allocator)
     {
         AllocatorBlock* next = allocator->next;
-        delete[] reinterpret_cast<unsigned char*>(allocator);
+        LargePageFree(allocator);
         allocator = next;
     }
 }
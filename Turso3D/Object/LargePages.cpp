@@ -0,0 +1,301 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "LargePages.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/// Allocation method stored in the header of mapped memory.
+enum LargePageMethod
+{
+    METHOD_POOLED = 0,
+    METHOD_MAPPED
+};
+
+/// Header preceding each allocation from mapped memory. Heap allocations have no header.
+struct LargePageHeader
+{
+    /// Size class index for pooled allocations, byte size otherwise.
+    size_t size;
+    /// Allocation method.
+    size_t method;
+};
+
+/// Free pooled slot.
+struct LargePageSlot
+{
+    /// Next free slot of the same size class.
+    LargePageSlot* next;
+};
+
+static const size_t HEADER_SIZE = 16;
+static const size_t MIN_SLOT_SHIFT = 6;
+static const size_t MAX_SLOT_SHIFT = 20;
+static const size_t NUM_SLOT_CLASSES = MAX_SLOT_SHIFT - MIN_SLOT_SHIFT + 1;
+
+static std::mutex largePageMutex;
+static std::atomic<int> largePageMode(LARGE_PAGES_OFF);
+static LargePageStats largePageStats = { 0, 0, 0 };
+/// Mapped address ranges by start address, used to tell mapped memory from heap memory on free.
+static std::map<size_t, size_t> mappedRanges;
+/// Lowest and highest mapped address so far. Pointers outside are heap memory and can be freed without taking the lock.
+static std::atomic<size_t> mappedRangeMin((size_t)-1);
+static std::atomic<size_t> mappedRangeMax(0);
+static LargePageSlot* freeSlots[NUM_SLOT_CLASSES] = { nullptr };
+static unsigned char* chunkPtr = nullptr;
+static size_t chunkRemaining = 0;
+
+static void* MapPages(size_t numBytes, LargePageMode mode)
+{
+    #ifdef _WIN32
+    if (mode == LARGE_PAGES_EXPLICIT)
+    {
+        // Requires the lock pages in memory privilege; fall back to regular pages without it
+        size_t pageSize = GetLargePageMinimum();
+        if (pageSize && !(numBytes & (pageSize - 1)))
+        {
+            void* ptr = VirtualAlloc(nullptr, numBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (ptr)
+                return ptr;
+        }
+        ++largePageStats.numFallbacks;
+    }
+
+    return VirtualAlloc(nullptr, numBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    #else
+    if (mode == LARGE_PAGES_EXPLICIT)
+    {
+        // Requires huge pages reserved by the system administrator; fall back to transparent huge pages without them
+        #ifdef MAP_HUGETLB
+        void* ptr = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+            return ptr;
+        #endif
+        ++largePageStats.numFallbacks;
+    }
+
+    // Over-map and trim so that the range is aligned to the chunk size, which allows the kernel to back it fully with huge pages
+    size_t mapBytes = numBytes + LARGE_PAGE_CHUNK_SIZE;
+    void* mapPtr = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapPtr == MAP_FAILED)
+        return nullptr;
+
+    unsigned char* ptr = static_cast<unsigned char*>(mapPtr);
+    size_t head = (LARGE_PAGE_CHUNK_SIZE - ((size_t)ptr & (LARGE_PAGE_CHUNK_SIZE - 1))) & (LARGE_PAGE_CHUNK_SIZE - 1);
+    size_t tail = mapBytes - head - numBytes;
+    if (head)
+        munmap(ptr, head);
+    if (tail)
+        munmap(ptr + head + numBytes, tail);
+    ptr += head;
+
+    #ifdef MADV_HUGEPAGE
+    madvise(ptr, numBytes, MADV_HUGEPAGE);
+    #endif
+    return ptr;
+    #endif
+}
+
+static void UnmapPages(void* ptr, size_t numBytes)
+{
+    #ifdef _WIN32
+    (void)numBytes;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+    #else
+    munmap(ptr, numBytes);
+    #endif
+}
+
+static void AddMappedRange(void* ptr, size_t numBytes)
+{
+    size_t start = (size_t)ptr;
+    mappedRanges[start] = numBytes;
+    if (start < mappedRangeMin.load(std::memory_order_relaxed))
+        mappedRangeMin.store(start, std::memory_order_relaxed);
+    if (start + numBytes > mappedRangeMax.load(std::memory_order_relaxed))
+        mappedRangeMax.store(start + numBytes, std::memory_order_relaxed);
+}
+
+static bool IsMapped(void* ptr)
+{
+    std::map<size_t, size_t>::iterator it = mappedRanges.upper_bound((size_t)ptr);
+    if (it == mappedRanges.begin())
+        return false;
+    --it;
+    return (size_t)ptr < it->first + it->second;
+}
+
+static size_t SlotClassIndex(size_t numBytes)
+{
+    size_t index = 0;
+    while (((size_t)1 << (index + MIN_SLOT_SHIFT)) < numBytes)
+        ++index;
+    return index;
+}
+
+static void RecycleChunkRemainder()
+{
+    // Split the unused tail of the current chunk into the largest fitting slots. Chunk use is always a multiple of the minimum slot size
+    while (chunkRemaining >= ((size_t)1 << MIN_SLOT_SHIFT))
+    {
+        size_t index = NUM_SLOT_CLASSES - 1;
+        while (((size_t)1 << (index + MIN_SLOT_SHIFT)) > chunkRemaining)
+            --index;
+
+        size_t slotSize = (size_t)1 << (index + MIN_SLOT_SHIFT);
+        LargePageSlot* slot = reinterpret_cast<LargePageSlot*>(chunkPtr);
+        slot->next = freeSlots[index];
+        freeSlots[index] = slot;
+        chunkPtr += slotSize;
+        chunkRemaining -= slotSize;
+    }
+
+    chunkPtr = nullptr;
+    chunkRemaining = 0;
+}
+
+static void* AllocateSlot(size_t index)
+{
+    size_t slotSize = (size_t)1 << (index + MIN_SLOT_SHIFT);
+
+    if (freeSlots[index])
+    {
+        LargePageSlot* slot = freeSlots[index];
+        freeSlots[index] = slot->next;
+        largePageStats.usedBytes += slotSize;
+        return slot;
+    }
+
+    if (chunkRemaining < slotSize)
+    {
+        void* chunk = MapPages(LARGE_PAGE_CHUNK_SIZE, (LargePageMode)largePageMode.load());
+        if (!chunk)
+            return nullptr;
+
+        AddMappedRange(chunk, LARGE_PAGE_CHUNK_SIZE);
+
+        RecycleChunkRemainder();
+        chunkPtr = static_cast<unsigned char*>(chunk);
+        chunkRemaining = LARGE_PAGE_CHUNK_SIZE;
+        largePageStats.mappedBytes += LARGE_PAGE_CHUNK_SIZE;
+    }
+
+    void* ptr = chunkPtr;
+    chunkPtr += slotSize;
+    chunkRemaining -= slotSize;
+    largePageStats.usedBytes += slotSize;
+    return ptr;
+}
+
+void SetLargePageMode(LargePageMode mode)
+{
+    largePageMode.store(mode);
+}
+
+LargePageMode GetLargePageMode()
+{
+    return (LargePageMode)largePageMode.load();
+}
+
+LargePageStats GetLargePageStats()
+{
+    std::lock_guard<std::mutex> lock(largePageMutex);
+    return largePageStats;
+}
+
+void* LargePageAllocate(size_t numBytes)
+{
+    static_assert(sizeof(LargePageHeader) <= HEADER_SIZE, "Large page header does not fit");
+
+    LargePageMode mode = (LargePageMode)largePageMode.load();
+    if (mode != LARGE_PAGES_OFF)
+    {
+        size_t totalBytes = numBytes + HEADER_SIZE;
+        LargePageHeader* header = nullptr;
+
+        std::lock_guard<std::mutex> lock(largePageMutex);
+
+        // Small and medium allocations share chunks through power of two size classes. Chunks are retained for reuse, as the pools they serve tend to persist
+        if (totalBytes <= ((size_t)1 << MAX_SLOT_SHIFT))
+        {
+            size_t index = SlotClassIndex(totalBytes);
+            header = static_cast<LargePageHeader*>(AllocateSlot(index));
+            if (header)
+            {
+                header->size = index;
+                header->method = METHOD_POOLED;
+            }
+        }
+        // Larger allocations get their own mapping, which is returned to the system on free
+        else
+        {
+            size_t mapBytes = (totalBytes + LARGE_PAGE_CHUNK_SIZE - 1) & ~(LARGE_PAGE_CHUNK_SIZE - 1);
+            header = static_cast<LargePageHeader*>(MapPages(mapBytes, mode));
+            if (header)
+            {
+                AddMappedRange(header, mapBytes);
+                header->size = mapBytes;
+                header->method = METHOD_MAPPED;
+                largePageStats.mappedBytes += mapBytes;
+                largePageStats.usedBytes += mapBytes;
+            }
+        }
+
+        if (header)
+            return reinterpret_cast<unsigned char*>(header) + HEADER_SIZE;
+    }
+
+    // Large pages off or mapping failed: plain heap memory without a header
+    return malloc(numBytes);
+}
+
+void LargePageFree(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    // Memory outside all mapped ranges is from the heap. When large pages have never been used, this is always the case
+    size_t address = (size_t)ptr;
+    if (address < mappedRangeMin.load(std::memory_order_relaxed) || address >= mappedRangeMax.load(std::memory_order_relaxed))
+    {
+        free(ptr);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(largePageMutex);
+
+    if (!IsMapped(ptr))
+    {
+        lock.unlock();
+        free(ptr);
+        return;
+    }
+
+    LargePageHeader* header = reinterpret_cast<LargePageHeader*>(static_cast<unsigned char*>(ptr) - HEADER_SIZE);
+
+    if (header->method == METHOD_POOLED)
+    {
+        size_t index = header->size;
+        assert(index < NUM_SLOT_CLASSES);
+        LargePageSlot* slot = reinterpret_cast<LargePageSlot*>(header);
+        slot->next = freeSlots[index];
+        freeSlots[index] = slot;
+        largePageStats.usedBytes -= (size_t)1 << (index + MIN_SLOT_SHIFT);
+    }
+    else
+    {
+        largePageStats.mappedBytes -= header->size;
+        largePageStats.usedBytes -= header->size;
+        mappedRanges.erase((size_t)header);
+        UnmapPages(header, header->size);
+    }
+}
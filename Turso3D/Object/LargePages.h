@@ -0,0 +1,91 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+/// Backing memory mode for large engine pools.
+enum LargePageMode
+{
+    LARGE_PAGES_OFF = 0,
+    LARGE_PAGES_TRANSPARENT,
+    LARGE_PAGES_EXPLICIT
+};
+
+/// Size of a large page chunk that pooled allocations are carved from.
+static const size_t LARGE_PAGE_CHUNK_SIZE = 2 * 1024 * 1024;
+
+/// Large page memory statistics.
+struct LargePageStats
+{
+    /// Bytes mapped from the operating system as large page chunks or dedicated mappings.
+    size_t mappedBytes;
+    /// Bytes of the mapped memory that are currently handed out.
+    size_t usedBytes;
+    /// Number of mappings that were requested as explicit large pages but fell back to regular pages.
+    size_t numFallbacks;
+};
+
+/// Set the backing memory mode for subsequent large pool allocations. Should be called at startup before creating subsystems; memory allocated in a previous mode remains valid and is freed correctly.
+void SetLargePageMode(LargePageMode mode);
+/// Return the current backing memory mode.
+LargePageMode GetLargePageMode();
+/// Return large page memory statistics.
+LargePageStats GetLargePageStats();
+/// Allocate memory for a large pool. Memory is 16-byte aligned. When large pages are off, this is a plain malloc() without locking. Return null on failure.
+void* LargePageAllocate(size_t numBytes);
+/// Free memory allocated with LargePageAllocate(). Null is allowed. Heap memory outside the mapped address range is freed without locking.
+void LargePageFree(void* ptr);
+
+/// STL-compatible allocator that allocates from the large page pool, for big and frequently refilled vectors.
+template <class T> class LargePageAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    /// Rebind to another value type.
+    template <class U> struct rebind
+    {
+        typedef LargePageAllocator<U> other;
+    };
+
+    /// Construct.
+    LargePageAllocator()
+    {
+    }
+
+    /// Copy-construct from an allocator of another type.
+    template <class U> LargePageAllocator(const LargePageAllocator<U>&)
+    {
+    }
+
+    /// Allocate space for elements.
+    T* allocate(size_t count)
+    {
+        void* ptr = LargePageAllocate(count * sizeof(T));
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    /// Free space for elements.
+    void deallocate(T* ptr, size_t)
+    {
+        LargePageFree(ptr);
+    }
+
+    /// Return maximum number of elements.
+    size_t max_size() const { return ((size_t)-1) / sizeof(T); }
+};
+
+/// Test for allocator equality. All large page allocators share the same pool.
+template <class T, class U> bool operator == (const LargePageAllocator<T>&, const LargePageAllocator<U>&) { return true; }
+/// Test for allocator inequality.
+template <class T, class U> bool operator != (const LargePageAllocator<T>&, const LargePageAllocator<U>&) { return false; }
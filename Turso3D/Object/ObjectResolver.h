@@ -47,6 +47,9 @@ public:
     /// Resolve the object ref attributes.
     void Resolve();
 
+    /// Return the stored objects by their old ids.
+    const std::map<unsigned, Serializable*>& Objects() const { return objects; }
+
 private:
     /// Mapping of old id's to objects.
     std::map<unsigned, Serializable*> objects;
@@ -3,9 +3,12 @@
 #include "../IO/JSONValue.h"
 #include "../IO/ObjectRef.h"
 #include "../IO/Stream.h"
+#include "../IO/VectorBuffer.h"
 #include "ObjectResolver.h"
 #include "Serializable.h"
 
+#include <cstring>
+
 std::map<StringHash, std::vector<SharedPtr<Attribute> > > Serializable::classAttributes;
 
 void Serializable::Load(Stream& source, ObjectResolver& resolver)
@@ -94,6 +97,78 @@ void Serializable::SaveJSON(JSONValue& dest)
     }
 }
 
+void Serializable::SaveValues(VectorBuffer& dest, std::vector<unsigned>& offsets)
+{
+    dest.Clear();
+    offsets.clear();
+
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attributes)
+        return;
+
+    for (auto it = attributes->begin(); it != attributes->end(); ++it)
+    {
+        Attribute* attr = *it;
+        attr->ToBinary(this, dest);
+        offsets.push_back((unsigned)dest.Size());
+    }
+}
+
+size_t Serializable::SaveChangedValues(Stream& dest, const VectorBuffer& baseline, const std::vector<unsigned>& baselineOffsets, VectorBuffer& current,
+    std::vector<unsigned>& currentOffsets)
+{
+    SaveValues(current, currentOffsets);
+
+    // Compare the binary values one attribute at a time. If the attribute count does not match the baseline, the extra attributes count as changed
+    std::vector<unsigned> changed;
+    for (size_t i = 0; i < currentOffsets.size(); ++i)
+    {
+        unsigned start = i ? currentOffsets[i - 1] : 0;
+        unsigned length = currentOffsets[i] - start;
+
+        if (i < baselineOffsets.size())
+        {
+            unsigned baselineStart = i ? baselineOffsets[i - 1] : 0;
+            if (baselineOffsets[i] - baselineStart == length && (!length || !memcmp(current.Data() + start, baseline.Data() + baselineStart, length)))
+                continue;
+        }
+
+        changed.push_back((unsigned)i);
+    }
+
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+
+    dest.WriteVLE(changed.size());
+    for (auto it = changed.begin(); it != changed.end(); ++it)
+    {
+        unsigned index = *it;
+        unsigned start = index ? currentOffsets[index - 1] : 0;
+        dest.WriteVLE(index);
+        dest.Write<unsigned char>((unsigned char)attributes->at(index)->Type());
+        dest.Write(current.Data() + start, currentOffsets[index] - start);
+    }
+
+    return changed.size();
+}
+
+void Serializable::LoadChangedValues(Stream& source)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+
+    size_t numAttrs = source.ReadVLE();
+    for (size_t i = 0; i < numAttrs; ++i)
+    {
+        // Skip attribute if wrong type or unknown index
+        size_t index = source.ReadVLE();
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+
+        if (attributes && index < attributes->size() && attributes->at(index)->Type() == type)
+            attributes->at(index)->FromBinary(this, source);
+        else
+            Attribute::Skip(type, source);
+    }
+}
+
 void Serializable::SetAttributeValue(Attribute* attr, const void* source)
 {
     if (attr)
@@ -185,3 +260,14 @@ void Serializable::Skip(Stream& source)
         Attribute::Skip(type, source);
     }
 }
+
+void Serializable::SkipChangedValues(Stream& source)
+{
+    size_t numAttrs = source.ReadVLE();
+    for (size_t i = 0; i < numAttrs; ++i)
+    {
+        source.ReadVLE(); // Attribute index
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+        Attribute::Skip(type, source);
+    }
+}
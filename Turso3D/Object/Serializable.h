@@ -6,6 +6,7 @@
 #include "Object.h"
 
 class ObjectResolver;
+class VectorBuffer;
 
 /// Base class for objects with automatic serialization using attributes.
 class Serializable : public Object
@@ -21,6 +22,12 @@ public:
     virtual void SaveJSON(JSONValue& dest);
     /// Return id for referring to the object in serialization.
     virtual unsigned Id() const { return 0; }
+    /// Save attribute values without type information, and the end offset of each value. Used as the baseline for delta serialization.
+    void SaveValues(VectorBuffer& dest, std::vector<unsigned>& offsets);
+    /// Save the attributes whose values differ from a baseline made with SaveValues(), as a count followed by the index, type and value of each. An empty baseline saves all attributes. The current values are left in the current buffers. Return number of attributes saved.
+    size_t SaveChangedValues(Stream& dest, const VectorBuffer& baseline, const std::vector<unsigned>& baselineOffsets, VectorBuffer& current, std::vector<unsigned>& currentOffsets);
+    /// Load attributes saved with SaveChangedValues(). Object refs are set directly, as delta serialization preserves the ids.
+    void LoadChangedValues(Stream& source);
 
     /// Set attribute value from memory.
     void SetAttributeValue(Attribute* attr, const void* source);
@@ -75,6 +82,8 @@ public:
     static void CopyBaseAttribute(StringHash type, StringHash baseType, const std::string& name);
     /// Skip binary data of an object's all attributes.
     static void Skip(Stream& source);
+    /// Skip binary data of attributes saved with SaveChangedValues().
+    static void SkipChangedValues(Stream& source);
     
     /// Register a per-class attribute, template version. Class should always be specified in the function pointers to ensure the attribute is registered to the intended class.
     template <class T, class U> static void RegisterAttribute(const char* name, U (T::*getFunction)() const, void (T::*setFunction)(U), const U& defaultValue = U(), const char** enumNames = 0)
@@ -43,6 +43,7 @@ void Bone::SetDrawable(AnimatedModelDrawable* drawable_)
 
 void Bone::SetAnimationEnabled(bool enable)
 {
+    MarkAttributesDirty();
     animationEnabled = enable;
 }
 
@@ -110,9 +111,9 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
         Drawable::OnWorldBoundingBoxUpdate();
 }
 
-void AnimatedModelDrawable::OnOctreeUpdate(unsigned short frameNumber)
+void AnimatedModelDrawable::OnOctreeUpdate(unsigned short, bool wasInView)
 {
-    if (TestFlag(DF_UPDATE_INVISIBLE) || WasInView(frameNumber))
+    if (TestFlag(DF_UPDATE_INVISIBLE) || wasInView)
     {
         if (animatedModelFlags & AMF_ANIMATION_DIRTY)
             UpdateAnimation();
@@ -389,6 +390,7 @@ void AnimatedModel::RegisterObject()
 void AnimatedModel::SetModel(Model* model_)
 {
     ZoneScoped;
+    MarkAttributesDirty();
 
     StaticModel::SetModel(model_);
     static_cast<AnimatedModelDrawable*>(drawable)->CreateBones();
@@ -82,8 +82,8 @@ public:
     /// Recalculate the world space bounding box.
     void OnWorldBoundingBoxUpdate() const override;
     /// Do animation processing before octree reinsertion, if should update without regard to visibility. Called by Octree in worker threads. Must be opted-in by setting NF_OCTREE_UPDATE_CALL flag.
-    void OnOctreeUpdate(unsigned short frameNumber) override;
-    /// Prepare object for rendering. Reset framenumber and calculate distance from camera, check for LOD level changes, and update animation / skinning if necessary. Called by Renderer in worker threads. Return false if should not render.
+    void OnOctreeUpdate(unsigned short frameNumber, bool wasInView) override;
+    /// Prepare object for rendering. Calculate distance from camera, check for LOD level changes, and update animation / skinning if necessary. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
     /// Update GPU resources and set uniforms for rendering. Called by Renderer when geometry type is not static.
     void OnRender(ShaderProgram* program, size_t geomIndex) override;
@@ -105,6 +105,8 @@ public:
     /// Set animation order dirty when animation state changes layer order and queue octree reinsertion. Note: bounding box will only be dirtied once animation actually updates.
     void OnAnimationOrderChanged()
     {
+        owner->MarkAttributesDirty();
+
         if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
             octree->QueueUpdate(this);
 
@@ -114,6 +116,8 @@ public:
     /// Set animation dirty when animation state changes time position or weight and queue octree reinsertion. Note: bounding box will only be dirtied once animation actually updates.
     void OnAnimationChanged()
     {
+        owner->MarkAttributesDirty();
+
         if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
             octree->QueueUpdate(this);
 
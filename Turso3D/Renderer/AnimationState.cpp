@@ -118,6 +118,8 @@ void AnimationState::SetStartBone(Bone* startBone_)
 void AnimationState::SetLooped(bool looped_)
 {
     looped = looped_;
+    if (drawable)
+        drawable->Owner()->MarkAttributesDirty();
 }
 
 void AnimationState::SetWeight(float weight_)
@@ -140,8 +142,14 @@ void AnimationState::SetTime(float time_)
     if (time_ != time)
     {
         time = time_;
-        if (drawable && weight > 0.0f)
-            drawable->OnAnimationChanged();
+        if (drawable)
+        {
+            // Time is saved regardless of weight, but only affects the animation with nonzero weight
+            if (weight > 0.0f)
+                drawable->OnAnimationChanged();
+            else
+                drawable->Owner()->MarkAttributesDirty();
+        }
     }
 }
 
@@ -17,12 +17,40 @@ inline bool CompareBatchDistance(const Batch& lhs, const Batch& rhs)
     return lhs.distance > rhs.distance;
 }
 
+inline bool CanMultiDraw(const Batch& lhs, const Batch& rhs)
+{
+    Geometry* lhsGeometry = lhs.geometry;
+    Geometry* rhsGeometry = rhs.geometry;
+    Geometry* lhsPositionGeometry = lhsGeometry->positionGeometry;
+    Geometry* rhsPositionGeometry = rhsGeometry->positionGeometry;
+
+    // Both the full and position-only geometries must share buffers, as the choice is made per shader program when rendering
+    return lhs.pass == rhs.pass && lhsGeometry->indexBuffer && lhsGeometry->indexBuffer == rhsGeometry->indexBuffer &&
+        lhsGeometry->vertexBuffer == rhsGeometry->vertexBuffer && (lhsPositionGeometry ? (rhsPositionGeometry &&
+        lhsPositionGeometry->vertexBuffer == rhsPositionGeometry->vertexBuffer && lhsPositionGeometry->indexBuffer == rhsPositionGeometry->indexBuffer) :
+        !rhsPositionGeometry);
+}
+
+inline size_t AddInstance(const Batch& batch, InstanceDataVector& instanceData, UserInstanceDataVector& userInstanceData)
+{
+    if (batch.pass->ReadsUserData())
+    {
+        userInstanceData.push_back(UserInstanceData(*batch.worldTransform, batch.textureLayer, *batch.userData));
+        return userInstanceData.size() - 1;
+    }
+    else
+    {
+        instanceData.push_back(InstanceData(*batch.worldTransform, batch.textureLayer));
+        return instanceData.size() - 1;
+    }
+}
+
 void BatchQueue::Clear()
 {
     batches.clear();
 }
 
-void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced)
+void BatchQueue::Sort(InstanceDataVector& instanceData, UserInstanceDataVector& userInstanceData, BatchSortMode sortMode, bool convertToInstanced, bool convertForMultiDraw)
 {
     ZoneScoped;
 
@@ -55,39 +83,111 @@ void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode
         break;
     }
 
-    if (!convertToInstanced || batches.size() < 2)
-        return;
+    // Write instancing groups as single queue entries, compacting the queue in place
+    size_t numEntries = 0;
 
-    for (auto it = batches.begin(); it < batches.end() - 1; ++it)
+    for (size_t i = 0; i < batches.size(); )
     {
-        // Check if batch is static geometry and can be converted to instanced
-        if (it->programBits)
-            continue;
+        Batch& batch = batches[i];
 
-        size_t start = instanceTransforms.size();
-        auto next = it + 1;
-
-        if (next->pass == it->pass && next->geometry == it->geometry && !next->programBits)
+        // Drawables of instanced geometry type supply their own instances. They can not be rendered without instancing
+        if ((batch.programBits & SP_GEOMETRYBITS) == SP_INSTANCED)
         {
-            // Convert to instances if at least one batch with same state found, then loop for more of the same
-            it->instanceStart = (unsigned)start;
-            it->programBits = SP_INSTANCED;
-            instanceTransforms.push_back(*it->worldTransform);
-            instanceTransforms.push_back(*next->worldTransform);
-            ++next;
-
-            for (; next < batches.end(); ++next)
+            if (convertToInstanced)
             {
-                if (next->pass == it->pass && next->geometry == it->geometry && !next->programBits)
-                    instanceTransforms.push_back(*next->worldTransform);
-                else
-                    break;
+                UserInstanceDataVector* userDest = batch.pass->ReadsUserData() ? &userInstanceData : nullptr;
+                size_t start = userDest ? userDest->size() : instanceData.size();
+                batch.drawable->OnAddInstances(instanceData, userDest, batch.geomIndex, batch.textureLayer);
+                size_t count = (userDest ? userDest->size() : instanceData.size()) - start;
+
+                if (count)
+                {
+                    batch.instanceStart = (unsigned)start;
+                    batch.instanceCount = (unsigned)count;
+                    batches[numEntries++] = batch;
+                }
             }
 
-            // Finalize the conversion by writing instance count
-            size_t count = instanceTransforms.size() - start;
-            it->instanceCount = (unsigned)count;
-            it += count - 1;
+            ++i;
+            continue;
+        }
+
+        // Check if batch is static geometry and can be converted to instanced together with following batches of same state
+        size_t next = i + 1;
+
+        if (convertToInstanced && !batch.programBits)
+        {
+            while (next < batches.size() && batches[next].pass == batch.pass && batches[next].geometry == batch.geometry && !batches[next].programBits)
+                ++next;
+        }
+
+        if (next - i > 1)
+        {
+            size_t start = AddInstance(batch, instanceData, userInstanceData);
+
+            for (size_t j = i + 1; j < next; ++j)
+                AddInstance(batches[j], instanceData, userInstanceData);
+
+            batch.instanceStart = (unsigned)start;
+            batch.programBits = SP_INSTANCED;
+            batch.instanceCount = (unsigned)(next - i);
         }
+
+        if (numEntries != i)
+            batches[numEntries] = batch;
+        ++numEntries;
+        i = next;
+    }
+
+    batches.resize(numEntries);
+
+    if (!convertToInstanced || !convertForMultiDraw)
+        return;
+
+    // Convert the remaining static batches to single instances if they can join a multi-draw with the previous or next batch
+    bool prevCanJoin = false;
+
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+        Batch& batch = batches[i];
+        size_t nextIdx = i + 1;
+        bool nextCanJoin = nextIdx < batches.size() && (batch.programBits == SP_STATIC || batch.programBits == SP_INSTANCED) &&
+            (batches[nextIdx].programBits == SP_STATIC || batches[nextIdx].programBits == SP_INSTANCED) && CanMultiDraw(batch, batches[nextIdx]);
+
+        if (batch.programBits == SP_STATIC && (prevCanJoin || nextCanJoin))
+        {
+            batch.instanceStart = (unsigned)AddInstance(batch, instanceData, userInstanceData);
+            batch.programBits = SP_INSTANCED;
+            batch.instanceCount = 1;
+        }
+
+        prevCanJoin = nextCanJoin;
     }
 }
+
+size_t BatchQueue::BuildMultiDraw(size_t index, bool usePositionGeometry, std::vector<DrawIndirectCommand>& commands) const
+{
+    const Batch& first = batches[index];
+    size_t i = index;
+
+    while (i < batches.size())
+    {
+        const Batch& batch = batches[i];
+        if (batch.programBits != first.programBits || (batch.programBits & SP_GEOMETRYBITS) != SP_INSTANCED || !CanMultiDraw(first, batch))
+            break;
+
+        Geometry* geometry = usePositionGeometry ? batch.geometry->positionGeometry.Get() : batch.geometry;
+
+        DrawIndirectCommand command;
+        command.count = (unsigned)geometry->drawCount;
+        command.instanceCount = batch.instanceCount;
+        command.firstIndex = (unsigned)geometry->drawStart;
+        command.baseVertex = 0;
+        command.baseInstance = batch.instanceStart;
+        commands.push_back(command);
+
+        ++i;
+    }
+
+    return i - index;
+}
@@ -2,8 +2,11 @@
 
 #pragma once
 
+#include "../Graphics/GraphicsDefs.h"
 #include "../Math/AreaAllocator.h"
 #include "../Math/Matrix3x4.h"
+#include "../Math/Vector4.h"
+#include "../Object/LargePages.h"
 #include "../Object/Ptr.h"
 
 #include <vector>
@@ -20,6 +23,41 @@ enum BatchSortMode
     SORT_DISTANCE
 };
 
+/// Per-instance data in the instancing vertex buffer.
+struct InstanceData
+{
+    /// Construct.
+    InstanceData(const Matrix3x4& worldTransform_, float textureLayer_) :
+        worldTransform(worldTransform_),
+        textureLayer(textureLayer_)
+    {
+    }
+
+    /// World transform.
+    Matrix3x4 worldTransform;
+    /// Array texture layer.
+    float textureLayer;
+};
+
+/// Per-instance data including the drawable's user data, in the separate instancing vertex buffer used by passes that read user data.
+struct UserInstanceData : public InstanceData
+{
+    /// Construct.
+    UserInstanceData(const Matrix3x4& worldTransform_, float textureLayer_, const Vector4& userData_) :
+        InstanceData(worldTransform_, textureLayer_),
+        userData(userData_)
+    {
+    }
+
+    /// User data of the drawable.
+    Vector4 userData;
+};
+
+/// Instance data array. Allocated from the large page pool, as it is refilled each frame and can hold a transform per visible object.
+typedef std::vector<InstanceData, LargePageAllocator<InstanceData> > InstanceDataVector;
+/// Instance data array with user data.
+typedef std::vector<UserInstanceData, LargePageAllocator<UserInstanceData> > UserInstanceDataVector;
+
 /// Stored draw call.
 struct Batch
 {
@@ -29,7 +67,7 @@ struct Batch
         unsigned sortKey;
         /// Distance for alpha batches.
         float distance;
-        /// Start position in the instance vertex buffer if instanced.
+        /// Start position in the instance vertex buffer if instanced. Indexes the user data instance buffer if the pass reads user data.
         unsigned instanceStart;
     };
 
@@ -41,6 +79,8 @@ struct Batch
     unsigned char programBits;
     /// Geometry index.
     unsigned char geomIndex;
+    /// Array texture layer of the material variant.
+    unsigned short textureLayer;
 
     union
     {
@@ -51,6 +91,9 @@ struct Batch
         /// Instance count if instanced.
         unsigned instanceCount;
     };
+
+    /// Pointer to the drawable's per-instance user data.
+    const Vector4* userData;
 };
 
 /// Collection of draw calls with sorting and instancing functionality.
@@ -58,8 +101,10 @@ struct BatchQueue
 {
     /// Clear for the next frame.
     void Clear();
-    /// Sort batches and setup instancing groups.
-    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced);
+    /// Sort batches and setup instancing groups, which occupy one queue entry each. Batches of instanced geometry drawables get their instances from the drawable, and are removed if instancing is not in use or the drawable has no instances. Instances of passes that read user data go to the user data array. Optionally convert also single static batches to instanced when an adjacent batch can be submitted in the same multi-draw.
+    void Sort(InstanceDataVector& instanceData, UserInstanceDataVector& userInstanceData, BatchSortMode sortMode, bool convertToInstanced, bool convertForMultiDraw = false);
+    /// Append indirect draw commands for the run of instanced batches starting from an index, which share the pass and the vertex and index buffers. Use the position-only geometries if specified. Return number of batch queue entries covered by the run.
+    size_t BuildMultiDraw(size_t index, bool usePositionGeometry, std::vector<DrawIndirectCommand>& commands) const;
     /// Return whether has batches added.
     bool HasBatches() const { return batches.size(); }
 
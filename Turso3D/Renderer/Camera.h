@@ -30,33 +30,33 @@ class Camera : public SpatialNode
     static void RegisterObject();
 
     /// Set near clip distance.
-    void SetNearClip(float distance) { nearClip = Max(distance, M_EPSILON); }
+    void SetNearClip(float distance) { MarkAttributesDirty(); nearClip = Max(distance, M_EPSILON); }
     /// Set far clip distance.
-    void SetFarClip(float distance) { farClip = Max(distance, M_EPSILON); }
+    void SetFarClip(float distance) { MarkAttributesDirty(); farClip = Max(distance, M_EPSILON); }
     /// Set vertical field of view in degrees.
-    void SetFov(float degrees) { fov = Clamp(degrees, 0.0f, 180.0f); }
+    void SetFov(float degrees) { MarkAttributesDirty(); fov = Clamp(degrees, 0.0f, 180.0f); }
     /// Set orthographic mode view uniform size.
-    void SetOrthoSize(float size) { orthoSize = size; aspectRatio = 1.0f; }
+    void SetOrthoSize(float size) { MarkAttributesDirty(); orthoSize = size; aspectRatio = 1.0f; }
     /// Set orthographic mode view non-uniform size.
-    void SetOrthoSize(const Vector2& size) { orthoSize = size.y; aspectRatio = size.x / size.y; }
+    void SetOrthoSize(const Vector2& size) { MarkAttributesDirty(); orthoSize = size.y; aspectRatio = size.x / size.y; }
     /// Set aspect ratio.
-    void SetAspectRatio(float ratio) { aspectRatio = Max(ratio, M_EPSILON); }
+    void SetAspectRatio(float ratio) { MarkAttributesDirty(); aspectRatio = Max(ratio, M_EPSILON); }
     /// Set zoom level, where 1 is no zooming.
-    void SetZoom(float level) { zoom = Max(level, M_EPSILON); }
+    void SetZoom(float level) { MarkAttributesDirty(); zoom = Max(level, M_EPSILON); }
     /// Set LOD bias. Values higher than 1 uses higher quality LOD (acts if distance is smaller.)
-    void SetLodBias(float bias) { lodBias = Max(bias, M_EPSILON); }
+    void SetLodBias(float bias) { MarkAttributesDirty(); lodBias = Max(bias, M_EPSILON); }
     /// Set view layer mask. Will be checked against scene objects' layers to see what to render.
-    void SetViewMask(unsigned mask) { viewMask = mask; }
+    void SetViewMask(unsigned mask) { MarkAttributesDirty(); viewMask = mask; }
     /// Set orthographic projection mode.
-    void SetOrthographic(bool enable) { orthographic = enable; }
+    void SetOrthographic(bool enable) { MarkAttributesDirty(); orthographic = enable; }
     /// Set reflection mode.
-    void SetUseReflection(bool enable) { useReflection = enable; viewMatrixDirty = true; }
+    void SetUseReflection(bool enable) { MarkAttributesDirty(); useReflection = enable; viewMatrixDirty = true; }
     /// Set reflection plane in world space for reflection mode.
-    void SetReflectionPlane(const Plane& plane) { reflectionPlane = plane; reflectionMatrix = plane.ReflectionMatrix(); viewMatrixDirty = true; }
+    void SetReflectionPlane(const Plane& plane) { MarkAttributesDirty(); reflectionPlane = plane; reflectionMatrix = plane.ReflectionMatrix(); viewMatrixDirty = true; }
     /// Set whether to use a custom clip plane.
-    void SetUseClipping(bool enable) { useClipping = enable; }
+    void SetUseClipping(bool enable) { MarkAttributesDirty(); useClipping = enable; }
     /// Set custom clipping plane in world space.
-    void SetClipPlane(const Plane& plane) { clipPlane = plane; }
+    void SetClipPlane(const Plane& plane) { MarkAttributesDirty(); clipPlane = plane; }
     /// Set vertical flipping mode.
     void SetFlipVertical(bool enable) { flipVertical = enable; }
 
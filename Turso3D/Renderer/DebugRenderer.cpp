@@ -5,15 +5,30 @@
 #include "../Graphics/ShaderProgram.h"
 #include "../Graphics/VertexBuffer.h"
 #include "../Math/Polyhedron.h"
+#include "../Thread/WorkQueue.h"
 #include "Camera.h"
 #include "DebugRenderer.h"
 
 #include <tracy/Tracy.hpp>
 
-DebugRenderer::DebugRenderer()
+void ThreadDebugGeometry::Clear()
+{
+    vertices.clear();
+    indices.clear();
+    noDepthIndices.clear();
+}
+
+DebugRenderer::DebugRenderer() :
+    maxVertices(0)
 {
     RegisterSubsystem(this);
-    
+
+    // Allocate geometry buffers for each worker thread so that tasks can add geometry without locking
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    numThreads = workQueue ? workQueue->NumThreads() : 1;
+    threadGeometry = new ThreadDebugGeometry[numThreads];
+    numVertices.store(0);
+
     vertexBuffer = new VertexBuffer();
     vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
     vertexElements.push_back(VertexElement(ELEM_UBYTE4, SEM_COLOR));
@@ -38,6 +53,11 @@ void DebugRenderer::SetView(Camera* camera)
     frustum = camera->WorldFrustum();
 }
 
+void DebugRenderer::SetMaxVertices(size_t num)
+{
+    maxVertices = num;
+}
+
 void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, const Color& color, bool depthTest)
 {
     AddLine(start, end, color.ToUInt(), depthTest);
@@ -45,18 +65,28 @@ void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, const Colo
 
 void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, unsigned color, bool depthTest)
 {
+    ThreadDebugGeometry* dest = ReserveVertices(2);
+    if (!dest)
+        return;
+
+    std::vector<DebugVertex>& vertices = dest->vertices;
     unsigned startVertex = (unsigned)vertices.size();
 
     vertices.push_back(DebugVertex(start, color));
     vertices.push_back(DebugVertex(end, color));
 
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
+    std::vector<unsigned>& destIndices = depthTest ? dest->indices : dest->noDepthIndices;
+    destIndices.push_back(startVertex);
+    destIndices.push_back(startVertex + 1);
 }
 
 void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Color& color, bool depthTest)
 {
+    ThreadDebugGeometry* dest = ReserveVertices(8);
+    if (!dest)
+        return;
+
+    std::vector<DebugVertex>& vertices = dest->vertices;
     unsigned startVertex = (unsigned)vertices.size();
     unsigned uintColor = color.ToUInt();
 
@@ -72,47 +102,52 @@ void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Color& color, b
     vertices.push_back(DebugVertex(Vector3(min.x, max.y, max.z), uintColor));
     vertices.push_back(DebugVertex(max, uintColor));
 
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
+    std::vector<unsigned>& destIndices = depthTest ? dest->indices : dest->noDepthIndices;
 
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
+    destIndices.push_back(startVertex);
+    destIndices.push_back(startVertex + 1);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 2);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 3);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex);
 
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 7);
 
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 6);
 
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex + 0);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 0);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 7);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 6);
 }
 
 void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Matrix3x4& transform, const Color& color, bool depthTest)
 {
+    ThreadDebugGeometry* dest = ReserveVertices(8);
+    if (!dest)
+        return;
+
+    std::vector<DebugVertex>& vertices = dest->vertices;
     unsigned startVertex = (unsigned)vertices.size();
     unsigned uintColor = color.ToUInt();
 
@@ -128,47 +163,52 @@ void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Matrix3x4& tran
     vertices.push_back(DebugVertex(Vector3(transform * Vector3(min.x, max.y, max.z)), uintColor));
     vertices.push_back(DebugVertex(Vector3(transform * max), uintColor));
 
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
+    std::vector<unsigned>& destIndices = depthTest ? dest->indices : dest->noDepthIndices;
 
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
+    destIndices.push_back(startVertex);
+    destIndices.push_back(startVertex + 1);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 2);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 3);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex);
 
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 7);
 
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 6);
 
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex + 0);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 0);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 7);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 6);
 }
 
 void DebugRenderer::AddFrustum(const Frustum& frustum_, const Color& color, bool depthTest)
 {
+    ThreadDebugGeometry* dest = ReserveVertices(8);
+    if (!dest)
+        return;
+
+    std::vector<DebugVertex>& vertices = dest->vertices;
     unsigned startVertex = (unsigned)vertices.size();
     unsigned uintColor = color.ToUInt();
 
@@ -181,43 +221,43 @@ void DebugRenderer::AddFrustum(const Frustum& frustum_, const Color& color, bool
     vertices.push_back(DebugVertex(frustum_.vertices[6], uintColor));
     vertices.push_back(DebugVertex(frustum_.vertices[7], uintColor));
 
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
+    std::vector<unsigned>& destIndices = depthTest ? dest->indices : dest->noDepthIndices;
 
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
+    destIndices.push_back(startVertex);
+    destIndices.push_back(startVertex + 1);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 2);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 3);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex);
 
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 6);
 
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 7);
 
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 4);
+    destIndices.push_back(startVertex);
+    destIndices.push_back(startVertex + 4);
 
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
+    destIndices.push_back(startVertex + 1);
+    destIndices.push_back(startVertex + 5);
 
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 6);
+    destIndices.push_back(startVertex + 2);
+    destIndices.push_back(startVertex + 6);
 
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 7);
+    destIndices.push_back(startVertex + 3);
+    destIndices.push_back(startVertex + 7);
 }
 
 void DebugRenderer::AddPolyhedron(const Polyhedron& poly, const Color& color, bool depthTest)
@@ -237,6 +277,13 @@ void DebugRenderer::AddPolyhedron(const Polyhedron& poly, const Color& color, bo
 
 void DebugRenderer::AddSphere(const Sphere& sphere, const Color& color, bool depthTest)
 {
+    // Reserve all of the sphere at once so that it is either drawn fully or not at all
+    ThreadDebugGeometry* dest = ReserveVertices(4 * 4 * 8);
+    if (!dest)
+        return;
+
+    std::vector<DebugVertex>& vertices = dest->vertices;
+    std::vector<unsigned>& destIndices = depthTest ? dest->indices : dest->noDepthIndices;
     unsigned uintColor = color.ToUInt();
 
     for (float j = 0.0f; j < 180.0f; j += 45.0f)
@@ -250,19 +297,17 @@ void DebugRenderer::AddSphere(const Sphere& sphere, const Color& color, bool dep
             vertices.push_back(DebugVertex(sphere.Point(i, j + 45.0f), uintColor));
             vertices.push_back(DebugVertex(sphere.Point(i + 45.0f, j + 45.0f), uintColor));
 
-            std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
+            destIndices.push_back(startVertex);
+            destIndices.push_back(startVertex + 1);
 
-            dest.push_back(startVertex);
-            dest.push_back(startVertex + 1);
+            destIndices.push_back(startVertex + 2);
+            destIndices.push_back(startVertex + 3);
 
-            dest.push_back(startVertex + 2);
-            dest.push_back(startVertex + 3);
+            destIndices.push_back(startVertex);
+            destIndices.push_back(startVertex + 2);
 
-            dest.push_back(startVertex);
-            dest.push_back(startVertex + 2);
-
-            dest.push_back(startVertex + 1);
-            dest.push_back(startVertex + 3);
+            destIndices.push_back(startVertex + 1);
+            destIndices.push_back(startVertex + 3);
         }
     }
 }
@@ -292,17 +337,59 @@ void DebugRenderer::Render()
 {
     ZoneScoped;
 
+    size_t totalVertices = 0;
+    size_t totalIndices = 0;
+    size_t totalNoDepthIndices = 0;
+
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        const ThreadDebugGeometry& geometry = threadGeometry[i];
+        totalVertices += geometry.vertices.size();
+        totalIndices += geometry.indices.size();
+        totalNoDepthIndices += geometry.noDepthIndices.size();
+    }
+
     // Early-out if no geometry to render or shader failed to load
-    if (!vertices.size() || !shaderProgram)
+    if (!totalVertices || !shaderProgram)
+    {
+        for (size_t i = 0; i < numThreads; ++i)
+            threadGeometry[i].Clear();
+        numVertices.store(0);
         return;
+    }
+
+    if (vertexBuffer->NumVertices() < totalVertices)
+        vertexBuffer->Define(USAGE_DYNAMIC, totalVertices, vertexElements);
+
+    indices.clear();
+    noDepthIndices.clear();
+    indices.reserve(totalIndices);
+    noDepthIndices.reserve(totalNoDepthIndices);
 
-    if (vertexBuffer->NumVertices() < vertices.size())
-        vertexBuffer->Define(USAGE_DYNAMIC, vertices.size(), vertexElements);
+    // Upload each thread's vertices at its offset in the buffer, and merge the indices offset accordingly
+    size_t vertexStart = 0;
 
-    if (vertices.size())
-        vertexBuffer->SetData(0, vertices.size(), &vertices[0]);
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        ThreadDebugGeometry& geometry = threadGeometry[i];
+        if (geometry.vertices.empty())
+            continue;
+
+        vertexBuffer->SetData(vertexStart, geometry.vertices.size(), &geometry.vertices[0]);
+
+        unsigned offset = (unsigned)vertexStart;
+        for (auto it = geometry.indices.begin(); it != geometry.indices.end(); ++it)
+            indices.push_back(*it + offset);
+        for (auto it = geometry.noDepthIndices.begin(); it != geometry.noDepthIndices.end(); ++it)
+            noDepthIndices.push_back(*it + offset);
+
+        vertexStart += geometry.vertices.size();
+        geometry.Clear();
+    }
+
+    numVertices.store(0);
 
-    size_t totalIndices = indices.size() + noDepthIndices.size();
+    totalIndices = indices.size() + noDepthIndices.size();
     
     if (indexBuffer->NumIndices() < totalIndices)
         indexBuffer->Define(USAGE_DYNAMIC, totalIndices, sizeof(unsigned));
@@ -329,8 +416,16 @@ void DebugRenderer::Render()
         graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
         graphics->DrawIndexed(PT_LINE_LIST, indices.size(), noDepthIndices.size());
     }
+}
 
-    vertices.clear();
-    indices.clear();
-    noDepthIndices.clear();
+ThreadDebugGeometry* DebugRenderer::ReserveVertices(size_t count)
+{
+    // The budget check is lock-free; the counter may overshoot, but no thread adds past the limit
+    size_t oldNumVertices = numVertices.fetch_add(count);
+    if (maxVertices && oldNumVertices + count > maxVertices)
+        return nullptr;
+
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    assert(threadIndex < numThreads);
+    return &threadGeometry[threadIndex];
 }
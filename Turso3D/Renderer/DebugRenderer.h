@@ -7,6 +7,8 @@
 #include "../Math/Frustum.h"
 #include "../Object/Object.h"
 
+#include <atomic>
+
 class BoundingBox;
 class Camera;
 class IndexBuffer;
@@ -32,7 +34,21 @@ struct DebugVertex
     unsigned color;
 };
 
-/// Debug line geometry rendering subsystem.
+/// Debug geometry recorded by one thread. Indices are relative to the thread's own vertices and are offset when merged for rendering.
+struct ThreadDebugGeometry
+{
+    /// Clear for the next frame.
+    void Clear();
+
+    /// Debug geometry vertices.
+    std::vector<DebugVertex> vertices;
+    /// Indices rendered with depth test.
+    std::vector<unsigned> indices;
+    /// Indices rendered without depth test.
+    std::vector<unsigned> noDepthIndices;
+};
+
+/// Debug line geometry rendering subsystem. Geometry can be added from worker threads; each thread records into its own buffers.
 class DebugRenderer : public Object
 {
     OBJECT(DebugRenderer);
@@ -45,6 +61,8 @@ public:
 
     /// Set the camera viewpoint. Call before rendering, or before adding geometry if you want to use culling.
     void SetView(Camera* camera);
+    /// Set maximum number of vertices that can be added per frame. Geometry exceeding the budget is dropped. 0 is unlimited (default.)
+    void SetMaxVertices(size_t num);
     /// Add a line.
     void AddLine(const Vector3& start, const Vector3& end, const Color& color, bool depthTest = true);
     /// Add a line with color already converted to unsigned.
@@ -61,18 +79,31 @@ public:
     void AddSphere(const Sphere& sphere, const Color& color, bool depthTest = true);
     /// Add a cylinder.
     void AddCylinder(const Vector3& position, float radius, float height, const Color& color, bool depthTest = true);
-    /// Update vertex buffer and render all debug lines to the currently set framebuffer and viewport. Then clear the lines for the next frame.
+    /// Merge the per-thread geometry, update vertex buffer and render all debug lines to the currently set framebuffer and viewport. Then clear the lines for the next frame. Call only from the main thread while no tasks are adding geometry.
     void Render();
 
     /// Check whether a bounding box is inside the view frustum.
     bool IsInside(const BoundingBox& box) const { return frustum.IsInsideFast(box) == INSIDE; }
+    /// Return maximum number of vertices per frame, or 0 if unlimited.
+    size_t MaxVertices() const { return maxVertices; }
+    /// Return number of vertices added so far this frame, including those dropped due to the budget.
+    size_t NumVertices() const { return numVertices.load(); }
 
 private:
-    /// Debug geometry vertices.
-    std::vector<DebugVertex> vertices;
-    /// Indices rendered with depth test.
+    /// Reserve vertices from the frame budget and return the calling thread's geometry buffers, or null if the budget is exhausted.
+    ThreadDebugGeometry* ReserveVertices(size_t count);
+
+    /// Per-thread debug geometry.
+    AutoArrayPtr<ThreadDebugGeometry> threadGeometry;
+    /// Number of per-thread geometry buffers.
+    size_t numThreads;
+    /// Maximum vertices per frame, 0 for unlimited.
+    size_t maxVertices;
+    /// Vertices reserved this frame.
+    std::atomic<size_t> numVertices;
+    /// Merged indices rendered with depth test.
     std::vector<unsigned> indices;
-    /// Indices rendered without depth test.
+    /// Merged indices rendered without depth test.
     std::vector<unsigned> noDepthIndices;
     /// View transform.
     Matrix3x4 view;
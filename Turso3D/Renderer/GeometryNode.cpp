@@ -89,7 +89,8 @@ float Geometry::HitDistance(const Ray& ray, Vector3* outNormal) const
         return ray.HitDistance(cpuPositionData, sizeof(Vector3), cpuDrawStart, drawCount, outNormal);
 }
 
-GeometryDrawable::GeometryDrawable()
+GeometryDrawable::GeometryDrawable() :
+    userData(Vector4::ZERO)
 {
     SetFlag(DF_GEOMETRY, true);
 }
@@ -101,7 +102,6 @@ bool GeometryDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camer
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
 
-    lastFrameNumber = frameNumber;
     return true;
 }
 
@@ -109,12 +109,17 @@ void GeometryDrawable::OnRender(ShaderProgram*, size_t)
 {
 }
 
+void GeometryDrawable::OnAddInstances(InstanceDataVector&, UserInstanceDataVector*, size_t, unsigned short) const
+{
+}
+
 void GeometryNode::RegisterObject()
 {
     RegisterDerivedType<GeometryNode, OctreeNode>();
     CopyBaseAttributes<GeometryNode, OctreeNode>();
     RegisterMixedRefAttribute("materials", &GeometryNode::MaterialsAttr, &GeometryNode::SetMaterialsAttr,
         ResourceRefList(Material::TypeStatic()));
+    RegisterRefAttribute("userData", &GeometryNode::UserData, &GeometryNode::SetUserData, Vector4::ZERO);
 }
 
 void GeometryNode::SetNumGeometries(size_t num)
@@ -138,6 +143,7 @@ void GeometryNode::SetGeometry(size_t index, Geometry* geometry)
 
 void GeometryNode::SetMaterial(Material* material)
 {
+    MarkAttributesDirty();
     if (!material)
         material = Material::DefaultMaterial();
 
@@ -148,6 +154,7 @@ void GeometryNode::SetMaterial(Material* material)
 
 void GeometryNode::SetMaterial(size_t index, Material* material)
 {
+    MarkAttributesDirty();
     if (!material)
         material = Material::DefaultMaterial();
 
@@ -156,6 +163,12 @@ void GeometryNode::SetMaterial(size_t index, Material* material)
         geomDrawable->batches.SetMaterial(index, material);
 }
 
+void GeometryNode::SetUserData(const Vector4& data)
+{
+    MarkAttributesDirty();
+    static_cast<GeometryDrawable*>(drawable)->SetUserData(data);
+}
+
 void GeometryNode::SetMaterialsAttr(const ResourceRefList& value)
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -4,6 +4,8 @@
 
 #include "../Graphics/GraphicsDefs.h"
 #include "../IO/ResourceRef.h"
+#include "../Math/Vector4.h"
+#include "Batch.h"
 #include "OctreeNode.h"
 
 class GeometryNode;
@@ -45,6 +47,8 @@ struct Geometry : public RefCounted
     size_t cpuIndexSize;
     /// Optional draw range start for the CPU data. May be different in case combined vertex and index buffers are in use.
     size_t cpuDrawStart;
+    /// Optional position-only version with deduplicated vertices. Used automatically by passes whose shaders only read positions, such as shadow passes.
+    SharedPtr<Geometry> positionGeometry;
 };
 
 /// Draw call source data with optimal memory storage. 
@@ -116,19 +120,27 @@ public:
     /// Construct.
     GeometryDrawable();
 
-    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    /// Prepare object for rendering. Calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
     /// Update GPU resources and set uniforms for rendering. Called by Renderer when geometry type is not static.
     virtual void OnRender(ShaderProgram* program, size_t geomIndex);
+    /// Append the instances to render for a geometry index. The instances go to userDest instead of dest when it is non-null, as the pass reads user data. Called by Renderer when geometry type is instanced, from batch sorting which may run concurrently in several worker threads, for example when sorting shadow batches. Must only read the drawable's state and be reentrant.
+    virtual void OnAddInstances(InstanceDataVector& dest, UserInstanceDataVector* userDest, size_t geomIndex, unsigned short textureLayer) const;
 
     /// Return geometry type.
     GeometryType GetGeometryType() const { return (GeometryType)(Flags() & DF_GEOMETRY_TYPE_BITS); }
     /// Return the draw call source data for direct access.
     const SourceBatches& Batches() const { return batches; }
+    /// Set per-instance user data, which is passed to shaders without breaking instancing.
+    void SetUserData(const Vector4& data) { userData = data; }
+    /// Return per-instance user data.
+    const Vector4& UserData() const { return userData; }
 
 protected:
     /// Draw call source data.
     SourceBatches batches;
+    /// Per-instance user data.
+    Vector4 userData;
 };
 
 /// Base class for scene nodes that contain geometry to be rendered.
@@ -148,6 +160,8 @@ public:
     void SetMaterial(Material* material);
     /// Set material at geometry index.
     void SetMaterial(size_t index, Material* material);
+    /// Set per-instance user data, which is passed to shaders without breaking instancing. Can be used for example for tinting or fading.
+    void SetUserData(const Vector4& data);
 
     /// Return geometry type.
     GeometryType GetGeometryType() const { return (GeometryType)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS); }
@@ -159,6 +173,8 @@ public:
     Material* GetMaterial(size_t index) const { return static_cast<GeometryDrawable*>(drawable)->batches.GetMaterial(index); }
     /// Return the draw call source data for direct access.
     const SourceBatches& Batches() const { return static_cast<GeometryDrawable*>(drawable)->batches; }
+    /// Return per-instance user data.
+    const Vector4& UserData() const { return static_cast<GeometryDrawable*>(drawable)->userData; }
 
 protected:
     /// Set materials list. Used in serialization.
@@ -90,7 +90,7 @@ void LightDrawable::OnWorldBoundingBoxUpdate() const
     }
 }
 
-bool LightDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+bool LightDrawable::OnPrepareRender(unsigned short, Camera* camera)
 {
     switch (lightType)
     {
@@ -110,11 +110,6 @@ bool LightDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
 
-    // If there was a discontinuity in rendering the light, assume cached shadow map content lost
-    if (!WasInView(frameNumber))
-        SetShadowMap(nullptr);
-
-    lastFrameNumber = frameNumber;
     return true;
 }
 
@@ -473,6 +468,7 @@ void Light::RegisterObject()
 
 void Light::SetLightType(LightType type)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
 
     if (type != lightDrawable->lightType)
@@ -484,12 +480,14 @@ void Light::SetLightType(LightType type)
 
 void Light::SetColor(const Color& color_)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->color = color_;
 }
 
 void Light::SetRange(float range_)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
 
     range_ = Max(range_, 0.0f);
@@ -502,6 +500,7 @@ void Light::SetRange(float range_)
 
 void Light::SetFov(float fov_)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
 
     fov_ = Clamp(fov_, 0.0f, 180.0f);
@@ -514,42 +513,49 @@ void Light::SetFov(float fov_)
 
 void Light::SetFadeStart(float start)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->fadeStart = Clamp(start, 0.0f, 1.0f - M_EPSILON);
 }
 
 void Light::SetShadowMapSize(int size)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowMapSize = NextPowerOfTwo(Max(1, size));
 }
 
 void Light::SetShadowFadeStart(float start)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowFadeStart = Clamp(start, 0.0f, 1.0f - M_EPSILON);
 }
 
 void Light::SetShadowCascadeSplit(float split)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowCascadeSplit = Clamp(split, M_EPSILON, 1.0f - M_EPSILON);
 }
 
 void Light::SetShadowMaxDistance(float distance_)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowMaxDistance = Max(distance_, 0.0f);
 }
 
 void Light::SetShadowMaxStrength(float strength)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowMaxStrength = Clamp(strength, 0.0f, 1.f);
 }
 
 void Light::SetShadowQuantize(float quantize)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowQuantize = Max(quantize, M_EPSILON);
 }
@@ -557,18 +563,21 @@ void Light::SetShadowQuantize(float quantize)
 
 void Light::SetShadowMinView(float minView)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->shadowMinView = Max(minView, M_EPSILON);
 }
 
 void Light::SetDepthBias(float bias)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->depthBias = Max(bias, 0.0f);
 }
 
 void Light::SetSlopeScaleBias(float bias)
 {
+    MarkAttributesDirty();
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
     lightDrawable->slopeScaleBias = Max(bias, 0.0f);
 }
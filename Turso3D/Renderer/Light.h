@@ -82,7 +82,7 @@ public:
 
     /// Recalculate the world space bounding box.
     virtual void OnWorldBoundingBoxUpdate() const override;
-    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    /// Prepare object for rendering. Calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
@@ -1,5 +1,6 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Graphics/Graphics.h"
 #include "../Graphics/Texture.h"
 #include "../Graphics/UniformBuffer.h"
 #include "../IO/StringUtils.h"
@@ -7,6 +8,8 @@
 #include "../Resource/ResourceCache.h"
 #include "Material.h"
 
+#include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
 const char* passNames[] = 
@@ -27,6 +30,8 @@ const char* geometryDefines[] =
 };
 
 std::set<Material*> Material::allMaterials;
+std::vector<AutoPtr<MaterialUniformPage> > Material::uniformPages;
+std::vector<Material*> Material::dirtyMaterials;
 SharedPtr<Material> Material::defaultMaterial;
 std::string Material::globalVSDefines;
 std::string Material::globalFSDefines;
@@ -36,7 +41,8 @@ Pass::Pass(Material* parent_) :
     blendMode(BLEND_REPLACE),
     depthTest(CMP_LESS_EQUAL),
     colorWrite(true),
-    depthWrite(true)
+    depthWrite(true),
+    userData(false)
 {
 }
 
@@ -58,6 +64,8 @@ void Pass::LoadJSON(const JSONValue& source)
         source.Contains("colorWrite") ? source["colorWrite"].GetBool() : true, 
         source.Contains("depthWrite") ? source["depthWrite"].GetBool() : true
     );
+
+    SetUserData(source["userData"].GetBool());
 }
 
 void Pass::SetShader(Shader* shader_, const std::string& vsDefines_, const std::string& fsDefines_)
@@ -81,6 +89,15 @@ void Pass::SetRenderState(BlendMode blendMode_, CompareMode depthTest_, bool col
     depthWrite = depthWrite_;
 }
 
+void Pass::SetUserData(bool enable)
+{
+    if (enable != userData)
+    {
+        userData = enable;
+        ResetShaderPrograms();
+    }
+}
+
 void Pass::ResetShaderPrograms()
 {
     for (size_t i = 0; i < MAX_SHADER_VARIATIONS; ++i)
@@ -89,6 +106,10 @@ void Pass::ResetShaderPrograms()
 
 Material::Material() :
     cullMode(CULL_BACK),
+    textureLayer(0),
+    uniformPage(nullptr),
+    uniformOffset(0),
+    uniformSize(0),
     uniformsDirty(false)
 {
     allMaterials.insert(this);
@@ -96,6 +117,14 @@ Material::Material() :
 
 Material::~Material()
 {
+    if (uniformsDirty)
+    {
+        auto it = std::find(dirtyMaterials.begin(), dirtyMaterials.end(), this);
+        if (it != dirtyMaterials.end())
+            dirtyMaterials.erase(it);
+    }
+
+    ReleaseUniforms();
     allMaterials.erase(this);
 }
 
@@ -114,10 +143,10 @@ bool Material::BeginLoad(Stream& source)
 
     const JSONValue& root = loadJSON->Root();
 
+    // Only parse the uniforms here, as defining them queues the material to the shared dirty list, which must happen in the main thread
+    loadUniforms.clear();
     if (root.Contains("uniforms"))
     {
-        std::vector<std::pair<std::string, Vector4> > newUniforms;
-
         const JSONArray& jsonUniforms = root["uniforms"].GetArray();
         for (auto it = jsonUniforms.begin(); it != jsonUniforms.end(); ++it)
         {
@@ -125,11 +154,9 @@ bool Material::BeginLoad(Stream& source)
             if (jsonUniform.size() == 1)
             {
                 auto uIt = jsonUniform.begin();
-                newUniforms.push_back(std::make_pair(uIt->first, Vector4(uIt->second.GetString())));
+                loadUniforms.push_back(std::make_pair(uIt->first, Vector4(uIt->second.GetString())));
             }
         }
-
-        DefineUniforms(newUniforms);
     }
 
     if (root.Contains("cullMode"))
@@ -151,6 +178,9 @@ bool Material::EndLoad()
 
     SetShaderDefines(root["vsDefines"].GetString(), root["fsDefines"].GetString());
 
+    if (root.Contains("uniforms"))
+        DefineUniforms(loadUniforms);
+
     if (root.Contains("passes"))
     {
         const JSONObject& jsonPasses = root["passes"].GetObject();
@@ -176,6 +206,7 @@ bool Material::EndLoad()
     }
 
     loadJSON.Reset();
+    loadUniforms.clear();
     return true;
 }
 
@@ -183,7 +214,7 @@ SharedPtr<Material> Material::Clone()
 {
     SharedPtr<Material> ret(Object::Create<Material>());
     
-    ret->cullMode = cullMode;
+    ret->cullMode = GetCullMode();
 
     for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
     {
@@ -194,17 +225,33 @@ SharedPtr<Material> Material::Clone()
             Pass* clonePass = ret->CreatePass((PassType)i);
             clonePass->SetShader(pass->GetShader(), pass->VSDefines(), pass->FSDefines());
             clonePass->SetRenderState(pass->GetBlendMode(), pass->GetDepthTest(), pass->GetColorWrite(), pass->GetDepthWrite());
+            clonePass->SetUserData(pass->ReadsUserData());
         }
     }
 
     for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
-        ret->textures[i] = textures[i];
+        ret->textures[i] = GetTexture(i);
+
+    ret->uniformValues = BaseMaterial()->uniformValues;
+    ret->uniformNameHashes = BaseMaterial()->uniformNameHashes;
+    ret->MarkUniformsDirty();
+    ret->vsDefines = VSDefines();
+    ret->fsDefines = FSDefines();
 
-    ret->uniformBuffer = uniformBuffer;
-    ret->uniformValues = uniformValues;
-    ret->uniformNameHashes = uniformNameHashes;
-    ret->vsDefines = vsDefines;
-    ret->fsDefines = fsDefines;
+    return ret;
+}
+
+SharedPtr<Material> Material::CreateLayerVariant(unsigned layer)
+{
+    Material* base = BaseMaterial();
+    SharedPtr<Material> ret(Object::Create<Material>());
+
+    ret->baseMaterial = base;
+    ret->textureLayer = layer;
+
+    // Share the pass objects so that batches from all variants compare equal for sorting and instancing. Textures, uniforms, cull mode and defines are read through the base material
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+        ret->passes[i] = base->passes[i];
 
     return ret;
 }
@@ -224,18 +271,32 @@ void Material::RemovePass(PassType type)
 
 void Material::SetTexture(size_t index, Texture* texture)
 {
-    if (index < MAX_MATERIAL_TEXTURE_UNITS)
+    if (baseMaterial)
+        baseMaterial->SetTexture(index, texture);
+    else if (index < MAX_MATERIAL_TEXTURE_UNITS)
         textures[index] = texture;
 }
 
 void Material::ResetTextures()
 {
+    if (baseMaterial)
+    {
+        baseMaterial->ResetTextures();
+        return;
+    }
+
     for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
         textures[i].Reset();
 }
 
 void Material::SetShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->SetShaderDefines(vsDefines_, fsDefines_);
+        return;
+    }
+
     vsDefines = vsDefines_;
     fsDefines = fsDefines_;
     if (vsDefines.length())
@@ -252,28 +313,46 @@ void Material::SetShaderDefines(const std::string& vsDefines_, const std::string
 
 void Material::DefineUniforms(size_t numUniforms, const char** uniformNames)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->DefineUniforms(numUniforms, uniformNames);
+        return;
+    }
+
     uniformNameHashes.resize(numUniforms);
     uniformValues.resize(numUniforms);
 
     for (size_t i = 0; i < numUniforms; ++i)
         uniformNameHashes[i] = StringHash(uniformNames[i]);
 
-    uniformsDirty = true;
+    MarkUniformsDirty();
 }
 
 void Material::DefineUniforms(const std::vector<std::string>& uniformNames)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->DefineUniforms(uniformNames);
+        return;
+    }
+
     uniformNameHashes.resize(uniformNames.size());
     uniformValues.resize(uniformNames.size());
 
     for (size_t i = 0; i < uniformNames.size(); ++i)
         uniformNameHashes[i] = StringHash(uniformNames[i]);
 
-    uniformsDirty = true;
+    MarkUniformsDirty();
 }
 
 void Material::DefineUniforms(const std::vector<std::pair<std::string, Vector4> >& uniforms)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->DefineUniforms(uniforms);
+        return;
+    }
+
     uniformValues.resize(uniforms.size());
     uniformNameHashes.resize(uniforms.size());
 
@@ -283,16 +362,22 @@ void Material::DefineUniforms(const std::vector<std::pair<std::string, Vector4>
         uniformValues[i] = uniforms[i].second;
     }
 
-    uniformsDirty = true;
+    MarkUniformsDirty();
 }
 
 void Material::SetUniform(size_t index, const Vector4& value)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->SetUniform(index, value);
+        return;
+    }
+
     if (index >= uniformValues.size())
         return;
 
     uniformValues[index] = value;
-    uniformsDirty = true;
+    MarkUniformsDirty();
 }
 
 void Material::SetUniform(const std::string& name_, const Vector4& value)
@@ -307,12 +392,18 @@ void Material::SetUniform(const char* name_, const Vector4& value)
 
 void Material::SetUniform(StringHash nameHash_, const Vector4& value)
 {
+    if (baseMaterial)
+    {
+        baseMaterial->SetUniform(nameHash_, value);
+        return;
+    }
+
     for (size_t i = 0; i < uniformNameHashes.size(); ++i)
     {
         if (uniformNameHashes[i] == nameHash_)
         {
             uniformValues[i] = value;
-            uniformsDirty = true;
+            MarkUniformsDirty();
             return;
         }
     }
@@ -341,29 +432,22 @@ void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::
 
 void Material::SetCullMode(CullMode mode)
 {
-    cullMode = mode;
+    if (baseMaterial)
+        baseMaterial->SetCullMode(mode);
+    else
+        cullMode = mode;
 }
 
 UniformBuffer* Material::GetUniformBuffer() const
 {
-    if (uniformsDirty)
-    {
-        // If is a shared uniform buffer from clone operation, make unique now
-        if (!uniformBuffer || uniformBuffer->Refs() > 1)
-            uniformBuffer = new UniformBuffer();
-
-        if (uniformValues.size())
-        {
-            if (uniformBuffer->Size() != uniformValues.size() * sizeof(Vector4))
-                uniformBuffer->Define(USAGE_DEFAULT, uniformValues.size() * sizeof(Vector4), &uniformValues[0]);
-            else
-                uniformBuffer->SetData(0, uniformValues.size() * sizeof(Vector4), &uniformValues[0]);
-        }
+    // Layer variants alias the base material's uniform block
+    if (baseMaterial)
+        return baseMaterial->GetUniformBuffer();
 
-        uniformsDirty = false;
-    }
+    if (uniformsDirty)
+        UpdateUniforms();
 
-    return uniformBuffer;
+    return uniformPage ? uniformPage->buffer.Get() : nullptr;
 }
 
 const Vector4& Material::Uniform(const std::string& name_) const
@@ -378,15 +462,154 @@ const Vector4& Material::Uniform(const char* name_) const
 
 const Vector4& Material::Uniform(StringHash nameHash_) const
 {
-    for (size_t i = 0; i < uniformNameHashes.size(); ++i)
+    const Material* source = BaseMaterial();
+
+    for (size_t i = 0; i < source->uniformNameHashes.size(); ++i)
     {
-        if (uniformNameHashes[i] == nameHash_)
-            return uniformValues[i];
+        if (source->uniformNameHashes[i] == nameHash_)
+            return source->uniformValues[i];
     }
 
     return Vector4::ZERO;
 }
 
+void Material::UpdateUniforms()
+{
+    if (dirtyMaterials.empty())
+        return;
+
+    ZoneScoped;
+
+    Graphics* graphics = Subsystem<Graphics>();
+    size_t alignment = graphics ? graphics->UniformBufferAlignment() : 256;
+
+    for (auto it = dirtyMaterials.begin(); it != dirtyMaterials.end(); ++it)
+    {
+        Material* material = *it;
+        material->uniformsDirty = false;
+
+        size_t dataSize = material->UniformDataSize();
+        size_t allocSize = (dataSize + alignment - 1) / alignment * alignment;
+        if (material->uniformPage && material->uniformSize != allocSize)
+            material->ReleaseUniforms();
+        if (!dataSize)
+            continue;
+        if (!material->uniformPage)
+            material->AllocateUniforms(allocSize);
+
+        MaterialUniformPage* page = material->uniformPage;
+        memcpy(&page->data[material->uniformOffset], &material->uniformValues[0], dataSize);
+        if (page->dirtyStart > material->uniformOffset)
+            page->dirtyStart = material->uniformOffset;
+        if (page->dirtyEnd < material->uniformOffset + dataSize)
+            page->dirtyEnd = material->uniformOffset + dataSize;
+    }
+
+    dirtyMaterials.clear();
+
+    // Upload the changed range of each page at once
+    for (auto it = uniformPages.begin(); it != uniformPages.end(); ++it)
+    {
+        MaterialUniformPage* page = *it;
+        if (page->dirtyEnd > page->dirtyStart)
+        {
+            page->buffer->SetData(page->dirtyStart, page->dirtyEnd - page->dirtyStart, &page->data[page->dirtyStart]);
+            page->dirtyStart = page->data.size();
+            page->dirtyEnd = 0;
+        }
+    }
+}
+
+void Material::ReleaseUniformBuffers()
+{
+    for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
+    {
+        Material* material = *it;
+        if (material->uniformPage)
+        {
+            material->uniformPage = nullptr;
+            material->uniformOffset = 0;
+            material->uniformSize = 0;
+            // Reallocate and upload on next use
+            material->MarkUniformsDirty();
+        }
+    }
+
+    uniformPages.clear();
+}
+
+void Material::MarkUniformsDirty()
+{
+    if (!uniformsDirty)
+    {
+        uniformsDirty = true;
+        dirtyMaterials.push_back(this);
+    }
+}
+
+void Material::AllocateUniforms(size_t size)
+{
+    // Reuse a same-sized released allocation if possible, else allocate from the end of a page
+    for (auto it = uniformPages.begin(); it != uniformPages.end(); ++it)
+    {
+        MaterialUniformPage* page = *it;
+        for (auto rIt = page->freeRanges.begin(); rIt != page->freeRanges.end(); ++rIt)
+        {
+            if (rIt->second == size)
+            {
+                uniformPage = page;
+                uniformOffset = rIt->first;
+                uniformSize = size;
+                page->freeRanges.erase(rIt);
+                return;
+            }
+        }
+    }
+
+    for (auto it = uniformPages.begin(); it != uniformPages.end(); ++it)
+    {
+        MaterialUniformPage* page = *it;
+        if (page->used + size <= page->data.size())
+        {
+            uniformPage = page;
+            uniformOffset = page->used;
+            uniformSize = size;
+            page->used += size;
+            return;
+        }
+    }
+
+    size_t pageSize = size > MATERIAL_UNIFORM_PAGE_SIZE ? size : MATERIAL_UNIFORM_PAGE_SIZE;
+
+    MaterialUniformPage* page = new MaterialUniformPage();
+    page->buffer = new UniformBuffer();
+    page->buffer->Define(USAGE_DYNAMIC, pageSize);
+    page->data.resize(pageSize);
+    page->used = size;
+    page->dirtyStart = pageSize;
+    page->dirtyEnd = 0;
+    uniformPages.push_back(page);
+
+    uniformPage = page;
+    uniformOffset = 0;
+    uniformSize = size;
+}
+
+void Material::ReleaseUniforms()
+{
+    if (!uniformPage)
+        return;
+
+    if (uniformOffset + uniformSize == uniformPage->used)
+        uniformPage->used = uniformOffset;
+    else
+        uniformPage->freeRanges.push_back(std::make_pair(uniformOffset, uniformSize));
+
+    uniformPage = nullptr;
+    uniformOffset = 0;
+    uniformSize = 0;
+}
+
 Material* Material::DefaultMaterial()
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -33,6 +33,24 @@ static const unsigned SP_CUSTOMGEOM = 0x3;
 static const unsigned SP_GEOMETRYBITS = 0x3;
 
 static const size_t MAX_SHADER_VARIATIONS = 4;
+static const size_t MATERIAL_UNIFORM_PAGE_SIZE = 65536;
+
+/// Pooled uniform buffer storage shared by the uniforms of several materials.
+struct MaterialUniformPage
+{
+    /// Uniform buffer.
+    SharedPtr<UniformBuffer> buffer;
+    /// CPU copy of the buffer data.
+    std::vector<unsigned char> data;
+    /// Released allocations as offset and size, for reuse by same-sized allocations.
+    std::vector<std::pair<size_t, size_t> > freeRanges;
+    /// Bytes allocated from the page start.
+    size_t used;
+    /// Start of the byte range to upload.
+    size_t dirtyStart;
+    /// End of the byte range to upload.
+    size_t dirtyEnd;
+};
 
 /// Render pass, which defines render state and shaders. A material may define several of these.
 class Pass : public RefCounted
@@ -51,6 +69,8 @@ public:
     void ResetShaderPrograms();
     /// Set render state.
     void SetRenderState(BlendMode blendMode, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
+    /// Set whether the shaders read the drawables' user data. Instances of such passes are written to a wider instance stream and the shaders are compiled with the USERDATA define. Existing shader programs will be cleared.
+    void SetUserData(bool enable);
     /// Get a shader program and cache for later use.
     ShaderProgram* GetShaderProgram(unsigned char programBits);
 
@@ -70,6 +90,8 @@ public:
     bool GetColorWrite() const { return colorWrite; }
     /// Return depth write flag.
     bool GetDepthWrite() const { return depthWrite; }
+    /// Return whether the shaders read the drawables' user data.
+    bool ReadsUserData() const { return userData; }
 
     /// Last sort key for combined distance and state sorting. Used by Renderer.
     std::pair<unsigned short, unsigned short> lastSortKey;
@@ -85,6 +107,8 @@ private:
     bool colorWrite;
     /// Depth write flag.
     bool depthWrite;
+    /// User data read flag.
+    bool userData;
     /// Cached shader variations.
     SharedPtr<ShaderProgram> shaderPrograms[MAX_SHADER_VARIATIONS];
     /// Shader resource.
@@ -116,6 +140,8 @@ public:
 
     /// Return a clone of the material.
     SharedPtr<Material> Clone();
+    /// Return a variant that shares this material's passes, textures and uniforms, but selects a different layer of its array textures. Variants of the same base material batch and instance together. The variant forwards its textures, uniforms, cull mode and shader defines to the base material, so setting them on either affects all variants.
+    SharedPtr<Material> CreateLayerVariant(unsigned layer);
     /// Create and return a new pass. If pass with same name exists, it will be returned.
     Pass* CreatePass(PassType type);
     /// Remove a pass.
@@ -146,13 +172,17 @@ public:
     /// Return pass by index or null if not found.
     Pass* GetPass(PassType type) const { return passes[type]; }
     /// Return texture by texture unit.
-    Texture* GetTexture(size_t index) const { return textures[index]; }
-    /// Return the uniform buffer. Update first if dirty.
+    Texture* GetTexture(size_t index) const { return baseMaterial ? baseMaterial->textures[index].Get() : textures[index].Get(); }
+    /// Return the pooled uniform buffer that holds this material's uniforms, or null if no uniforms. Update first if dirty.
     UniformBuffer* GetUniformBuffer() const;
+    /// Return byte offset of this material's uniforms in the pooled uniform buffer.
+    size_t UniformOffset() const { return baseMaterial ? baseMaterial->uniformOffset : uniformOffset; }
+    /// Return byte size of the uniform data.
+    size_t UniformDataSize() const { return BaseMaterial()->uniformValues.size() * sizeof(Vector4); }
     /// Return number of uniforms.
-    size_t NumUniforms() const { return uniformValues.size(); }
+    size_t NumUniforms() const { return BaseMaterial()->uniformValues.size(); }
     /// Return uniform value by index.
-    const Vector4& Uniform(size_t index) const { return uniformValues[index]; }
+    const Vector4& Uniform(size_t index) const { return BaseMaterial()->uniformValues[index]; }
     /// Return uniform value by name.
     const Vector4& Uniform(const std::string& name) const;
     /// Return uniform value by name.
@@ -160,48 +190,77 @@ public:
     /// Return uniform value by name hash.
     const Vector4& Uniform(StringHash nameHash) const;
     /// Return culling mode.
-    CullMode GetCullMode() const { return cullMode; }
+    CullMode GetCullMode() const { return baseMaterial ? baseMaterial->cullMode : cullMode; }
+    /// Return the material whose passes are used for rendering. This is the batching key, which ignores the array texture layer.
+    Material* BaseMaterial() const { return baseMaterial ? baseMaterial.Get() : const_cast<Material*>(this); }
+    /// Return array texture layer.
+    unsigned TextureLayer() const { return textureLayer; }
 
     /// Return vertex shader defines.
-    const std::string& VSDefines() const { return vsDefines; }
+    const std::string& VSDefines() const { return baseMaterial ? baseMaterial->vsDefines : vsDefines; }
     /// Return fragment shader defines.
-    const std::string& FSDefines() const { return fsDefines; }
+    const std::string& FSDefines() const { return baseMaterial ? baseMaterial->fsDefines : fsDefines; }
 
     /// Set global (lighting-related) shader defines. Resets all loaded pass shaders.
     static void SetGlobalShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
     /// Return a default opaque untextured material.
     static Material* DefaultMaterial();
+    /// Copy the uniforms of all dirty materials to the pooled uniform buffers and upload each changed buffer once. Called by Renderer before rendering.
+    static void UpdateUniforms();
+    /// Release the pooled uniform buffers. Materials reallocate their uniforms on next use. Called by Renderer on destruction, before the Graphics subsystem is destroyed.
+    static void ReleaseUniformBuffers();
     /// Return global vertex shader defines.
     static const std::string& GlobalVSDefines() { return globalVSDefines; }
     /// Return global fragment shader defines.
     static const std::string& GlobalFSDefines() { return globalFSDefines; }
 
 private:
+    /// Mark uniforms changed and queue for the next update.
+    void MarkUniformsDirty();
+    /// Allocate storage from the pooled uniform buffers.
+    void AllocateUniforms(size_t size);
+    /// Release the pooled uniform storage.
+    void ReleaseUniforms();
+
     /// Culling mode.
     CullMode cullMode;
+    /// Base material if this is a layer variant.
+    SharedPtr<Material> baseMaterial;
+    /// Array texture layer.
+    unsigned textureLayer;
     /// Passes.
     SharedPtr<Pass> passes[MAX_PASS_TYPES];
-    /// Material textures.
+    /// Material textures. Unused in layer variants.
     SharedPtr<Texture> textures[MAX_MATERIAL_TEXTURE_UNITS];
-    /// Uniform buffer.
-    mutable SharedPtr<UniformBuffer> uniformBuffer;
-    /// Uniform name hashes.
+    /// Pooled uniform buffer page, or null if not allocated.
+    MaterialUniformPage* uniformPage;
+    /// Byte offset in the uniform buffer page.
+    size_t uniformOffset;
+    /// Allocated byte size in the uniform buffer page.
+    size_t uniformSize;
+    /// Uniform name hashes. Unused in layer variants.
     std::vector<StringHash> uniformNameHashes;
-    /// Uniform values.
+    /// Uniform values. Unused in layer variants.
     std::vector<Vector4> uniformValues;
     /// Uniforms dirty flag.
-    mutable bool uniformsDirty;
+    bool uniformsDirty;
     /// Vertex shader defines for all passes.
     std::string vsDefines;
     /// Fragment shader defines for all passes.
     std::string fsDefines;
     /// JSON data used for loading.
     AutoPtr<JSONFile> loadJSON;
+    /// Uniforms parsed during loading, defined in the main thread.
+    std::vector<std::pair<std::string, Vector4> > loadUniforms;
 
     /// Default material.
     static SharedPtr<Material> defaultMaterial;
     /// All materials.
     static std::set<Material*> allMaterials;
+    /// Pooled uniform buffer pages.
+    static std::vector<AutoPtr<MaterialUniformPage> > uniformPages;
+    /// Materials whose uniforms have changed since the last update.
+    static std::vector<Material*> dirtyMaterials;
     /// Global vertex shader defines.
     static std::string globalVSDefines;
     /// Global fragment shader defines.
@@ -224,7 +283,7 @@ inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
         unsigned char geomBits = programBits & SP_GEOMETRYBITS;
 
         ShaderProgram* newShaderProgram = shader->CreateProgram(
-            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits],
+            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits] + (userData ? "USERDATA " : ""),
             Material::GlobalFSDefines() + parent->FSDefines() + fsDefines
         );
 
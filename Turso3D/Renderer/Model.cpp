@@ -8,6 +8,8 @@
 #include "Material.h"
 #include "Model.h"
 
+#include <cstring>
+#include <unordered_map>
 #include <tracy/Tracy.hpp>
 
 // Vertex and index allocation for the combined model buffers
@@ -18,6 +20,29 @@ static const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
 static const float BONE_SIZE_THRESHOLD = 0.05f;
 
 std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
+bool Model::generatePositionGeometries = true;
+
+/// Exact bitwise key of a vertex position for deduplication.
+struct PositionKey
+{
+    /// Construct from a position.
+    PositionKey(const Vector3& position)
+    {
+        memcpy(bits, position.Data(), sizeof bits);
+    }
+
+    /// Test for equality.
+    bool operator == (const PositionKey& rhs) const { return bits[0] == rhs.bits[0] && bits[1] == rhs.bits[1] && bits[2] == rhs.bits[2]; }
+
+    /// Position component bits.
+    unsigned bits[3];
+};
+
+/// Hash function for position keys.
+struct PositionKeyHash
+{
+    size_t operator () (const PositionKey& key) const { return (key.bits[0] * 73856093) ^ (key.bits[1] * 19349663) ^ (key.bits[2] * 83492791); }
+};
 
 CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
     usedVertices(0),
@@ -417,6 +442,9 @@ bool Model::EndLoad()
         }
     }
 
+    if (generatePositionGeometries && !hasWeights)
+        CreatePositionGeometries();
+
     // Check if can use combined vertex / index buffers
     if (vbDescs.size() == 1 && vbDescs[0].numVertices < COMBINEDBUFFER_VERTICES && totalIndices < COMBINEDBUFFER_INDICES && hasSameIndexSize && !hasWeights)
     {
@@ -517,6 +545,115 @@ bool Model::EndLoad()
     return true;
 }
 
+void Model::CreatePositionGeometries()
+{
+    ZoneScoped;
+
+    // Deduplicate positions of each vertex buffer. Vertices split only by normals or UV seams collapse to one
+    std::vector<std::vector<unsigned> > remaps(vbDescs.size());
+    std::vector<Vector3> positions;
+
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        const VertexBufferDesc& vbDesc = vbDescs[i];
+        if (!vbDesc.cpuPositionData)
+            return;
+
+        std::unordered_map<PositionKey, unsigned, PositionKeyHash> uniquePositions;
+        std::vector<unsigned>& remap = remaps[i];
+        remap.resize(vbDesc.numVertices);
+
+        for (size_t j = 0; j < vbDesc.numVertices; ++j)
+        {
+            const Vector3& position = vbDesc.cpuPositionData[j];
+            auto it = uniquePositions.find(PositionKey(position));
+            if (it != uniquePositions.end())
+                remap[j] = it->second;
+            else
+            {
+                unsigned newIndex = (unsigned)positions.size();
+                uniquePositions[PositionKey(position)] = newIndex;
+                positions.push_back(position);
+                remap[j] = newIndex;
+            }
+        }
+    }
+
+    // Remap the draw ranges of all geometries into one index list
+    std::vector<unsigned> indices;
+    std::vector<size_t> drawStarts;
+
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& geomDesc = geomDescs[i][j];
+            const IndexBufferDesc& ibDesc = ibDescs[geomDesc.ibRef];
+            const std::vector<unsigned>& remap = remaps[geomDesc.vbRef];
+
+            drawStarts.push_back(indices.size());
+            for (size_t k = geomDesc.drawStart; k < geomDesc.drawStart + geomDesc.drawCount; ++k)
+            {
+                unsigned index = ibDesc.indexSize == sizeof(unsigned short) ? ((const unsigned short*)ibDesc.indexData.Get())[k] : ((const unsigned*)ibDesc.indexData.Get())[k];
+                indices.push_back(remap[index]);
+            }
+        }
+    }
+
+    if (positions.empty() || indices.empty())
+        return;
+
+    std::vector<VertexElement> positionElements;
+    positionElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+
+    SharedPtr<VertexBuffer> vb;
+    SharedPtr<IndexBuffer> ib;
+    size_t indexStart = 0;
+
+    // Prefer the combined buffers, which share the position-only vertex format with other models
+    if (positions.size() < COMBINEDBUFFER_VERTICES && indices.size() < COMBINEDBUFFER_INDICES)
+    {
+        positionCombinedBuffer = CombinedBuffer::Allocate(positionElements, positions.size(), indices.size());
+        unsigned vertexStart = (unsigned)positionCombinedBuffer->UsedVertices();
+        for (auto it = indices.begin(); it != indices.end(); ++it)
+            *it += vertexStart;
+
+        indexStart = positionCombinedBuffer->UsedIndices();
+        positionCombinedBuffer->FillVertices(positions.size(), &positions[0]);
+        positionCombinedBuffer->FillIndices(indices.size(), &indices[0]);
+        vb = positionCombinedBuffer->GetVertexBuffer();
+        ib = positionCombinedBuffer->GetIndexBuffer();
+    }
+    else
+    {
+        vb = new VertexBuffer();
+        vb->Define(USAGE_DEFAULT, positions.size(), positionElements, &positions[0]);
+        ib = new IndexBuffer();
+        ib->Define(USAGE_DEFAULT, indices.size(), sizeof(unsigned), &indices[0]);
+    }
+
+    size_t geomIndex = 0;
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            SharedPtr<Geometry> positionGeom(new Geometry());
+            positionGeom->vertexBuffer = vb;
+            positionGeom->indexBuffer = ib;
+            positionGeom->drawStart = drawStarts[geomIndex++] + indexStart;
+            positionGeom->drawCount = geomDescs[i][j].drawCount;
+            positionGeom->lodDistance = geomDescs[i][j].lodDistance;
+
+            geometries[i][j]->positionGeometry = positionGeom;
+        }
+    }
+}
+
+void Model::SetGeneratePositionGeometries(bool enable)
+{
+    generatePositionGeometries = enable;
+}
+
 void Model::SetNumGeometries(size_t num)
 {
     geometries.resize(num);
@@ -160,9 +160,16 @@ public:
     /// Return the model's bone descriptions.
     const std::vector<ModelBone>& Bones() const { return bones; }
 
+    /// Set whether to generate position-only geometries for depth-only passes when loading non-skinned models. Default true.
+    static void SetGeneratePositionGeometries(bool enable);
+    /// Return whether generates position-only geometries.
+    static bool GeneratePositionGeometries() { return generatePositionGeometries; }
+
 private:
     /// Apply per-geometry bone mappings (legacy feature, not needed anymore.)
     void ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<unsigned>& boneMappings, std::set<std::pair<unsigned, unsigned> >& processedVertices);
+    /// Create deduplicated position-only geometries from the load-time data.
+    void CreatePositionGeometries();
 
     /// Local space bounding box.
     BoundingBox boundingBox;
@@ -172,10 +179,15 @@ private:
     std::vector<std::vector<SharedPtr<Geometry> > > geometries;
     /// Combined buffer if in use.
     SharedPtr<CombinedBuffer> combinedBuffer;
+    /// Combined buffer for position-only geometries if in use.
+    SharedPtr<CombinedBuffer> positionCombinedBuffer;
     /// Vertex buffer data for loading.
     std::vector<VertexBufferDesc> vbDescs;
     /// Index buffer data for loading.
     std::vector<IndexBufferDesc> ibDescs;
     /// Geometry descriptions for loading.
     std::vector<std::vector<GeometryDesc> > geomDescs;
+
+    /// Position-only geometry generation flag.
+    static bool generatePositionGeometries;
 };
@@ -4,6 +4,8 @@
 #include "../IO/Log.h"
 #include "../Math/Random.h"
 #include "../Math/Ray.h"
+#include "../Math/Sphere.h"
+#include "../Scene/Scene.h"
 #include "DebugRenderer.h"
 #include "Octree.h"
 
@@ -15,6 +17,18 @@ static const float DEFAULT_OCTREE_SIZE = 1000.0f;
 static const int DEFAULT_OCTREE_LEVELS = 8;
 static const int MAX_OCTREE_LEVELS = 255;
 static const size_t MIN_THREADED_UPDATE = 16;
+static const unsigned AUTO_RESIZE_INTERVAL = 120;
+static const int MAX_AUTO_RESIZE_LEVELS = 16;
+static const float MIN_AUTO_RESIZE_SIZE = 16.0f;
+static const float MAX_AUTO_RESIZE_SIZE = 65536.0f;
+static const float AUTO_RESIZE_MARGIN = 1.25f;
+static const float MIN_MOTION_SLACK = 0.1f;
+static const float MOTION_SMOOTHING = 0.5f;
+static const float DEFAULT_HASH_CELL_SIZE = 8.0f;
+static const int HASH_CELL_COORD_BITS = 21;
+static const int HASH_CELL_COORD_LIMIT = (1 << (HASH_CELL_COORD_BITS - 1)) - 1;
+static const size_t MIN_HASH_CELL_PRUNE = 64;
+static const size_t BATCHED_QUERY_GROUP_SIZE = 64;
 
 static std::vector<unsigned> freeQueries;
 
@@ -38,6 +52,73 @@ static inline bool CompareDrawables(Drawable* lhs, Drawable* rhs)
         return lhs < rhs;
 }
 
+static inline bool IsBulkRemoved(Drawable* drawable)
+{
+    return drawable && drawable->TestFlag(DF_BULK_REMOVE);
+}
+
+static inline unsigned char TestObserver(const Frustum& frustum, const BoundingBox& box, unsigned char planeMask)
+{
+    return frustum.IsInsideMasked(box, planeMask);
+}
+
+static inline unsigned char TestObserver(const Sphere& sphere, const BoundingBox& box, unsigned char)
+{
+    // A sphere has no planes, so use a single mask bit for partial intersection
+    Intersection res = sphere.IsInside(box);
+    return res == OUTSIDE ? 0xff : (res == INSIDE ? 0 : 1);
+}
+
+static inline bool TestObserverFast(const Frustum& frustum, const BoundingBox& box, unsigned char planeMask)
+{
+    return frustum.IsInsideMaskedFast(box, planeMask) != OUTSIDE;
+}
+
+static inline bool TestObserverFast(const Sphere& sphere, const BoundingBox& box, unsigned char)
+{
+    return sphere.IsInsideFast(box) != OUTSIDE;
+}
+
+/// Observer state during a batched query.
+struct BatchedObserver
+{
+    /// Observer index within the task's group.
+    unsigned index;
+    /// Planes that still need testing. Zero if the octant is completely inside.
+    unsigned char planeMask;
+};
+
+/// %Task for a batched query of one observer group within one octree subtree.
+struct BatchedQueryTask : public MemberFunctionTask<Octree>
+{
+    /// Construct.
+    BatchedQueryTask(Octree* object_, MemberWorkFunctionPtr function_) :
+        MemberFunctionTask<Octree>(object_, function_)
+    {
+    }
+
+    /// Starting point octant.
+    Octant* startOctant;
+    /// Whether to recurse into child octants. False for the root octant, as its children have tasks of their own.
+    bool recursive;
+    /// Frustum observers, or null if querying spheres.
+    const Frustum* frustums;
+    /// Sphere observers, or null if querying frustums.
+    const Sphere* spheres;
+    /// First observer index of the group.
+    size_t firstObserver;
+    /// Number of observers in the group.
+    size_t numObservers;
+    /// Drawable flags to match.
+    unsigned short drawableFlags;
+    /// Layer mask to match.
+    unsigned layerMask;
+    /// Results per observer of the group. May be larger than the group, as it is reused.
+    std::vector<std::vector<Drawable*> > results;
+    /// Stack of active observers. Each recursion level appends the observers that remain active for its octant.
+    std::vector<BatchedObserver> activeObservers;
+};
+
 /// %Task for octree drawables reinsertion.
 struct ReinsertDrawablesTask : public MemberFunctionTask<Octree>
 {
@@ -170,18 +251,50 @@ const BoundingBox& Octant::CullingBox() const
     return cullingBox;
 }
 
+OctreeStats::OctreeStats()
+{
+    Clear();
+}
+
+void OctreeStats::Clear()
+{
+    drawablesPerLevel.clear();
+    numDrawables = 0;
+    numOctants = 0;
+    numEmptyOctants = 0;
+    maxOctantDrawables = 0;
+    numOutsideDrawables = 0;
+    numDormantDrawables = 0;
+    numQueuedUpdates = 0;
+    numReinsertions = 0;
+    drawableBounds.Undefine();
+    averageDrawableSize = 0.0f;
+}
+
 Octree::Octree() :
     threadedUpdate(false),
+    autoResize(false),
+    bulkRemove(false),
+    parallelUpdate(false),
     frameNumber(0),
+    lastVisibleDrawables(nullptr),
+    motionSlack(0.0f),
+    hashCellSize(DEFAULT_HASH_CELL_SIZE),
+    autoResizeTimer(0),
+    numQueuedUpdates(0),
+    numReinsertions(0),
     workQueue(Subsystem<WorkQueue>())
 {
     assert(workQueue);
 
     root.Initialize(nullptr, BoundingBox(-DEFAULT_OCTREE_SIZE, DEFAULT_OCTREE_SIZE), DEFAULT_OCTREE_LEVELS, 0);
+    dormantOctant.Initialize(nullptr, BoundingBox(0.0f, 0.0f), 0, 0);
+    dormantOctant.SetFlag(OF_DORMANT, true);
 
     // Have at least 1 task for reinsert processing
     reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
     reinsertQueues = new std::vector<Drawable*>[workQueue->NumThreads()];
+    deferredUpdateQueues = new std::vector<Drawable*>[workQueue->NumThreads()];
 }
 
 Octree::~Octree()
@@ -199,6 +312,15 @@ Octree::~Octree()
     }
 
     DeleteChildOctants(&root, true);
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+        DeleteChildOctants(*it, true);
+    DeleteChildOctants(&dormantOctant, true);
+
+    for (auto it = drawablesById.begin(); it != drawablesById.end(); ++it)
+    {
+        if (*it)
+            (*it)->id = M_MAX_UNSIGNED;
+    }
 }
 
 void Octree::RegisterObject()
@@ -209,13 +331,27 @@ void Octree::RegisterObject()
     RegisterDerivedType<Octree, Node>();
     RegisterRefAttribute("boundingBox", &Octree::BoundingBoxAttr, &Octree::SetBoundingBoxAttr);
     RegisterAttribute("numLevels", &Octree::NumLevelsAttr, &Octree::SetNumLevelsAttr);
+    RegisterAttribute("autoResize", &Octree::AutoResize, &Octree::SetAutoResize, false);
+    RegisterAttribute("motionSlack", &Octree::MotionSlack, &Octree::SetMotionSlack, 0.0f);
+    RegisterAttribute("hashGridCellSize", &Octree::HashGridCellSize, &Octree::SetHashGridCellSize, DEFAULT_HASH_CELL_SIZE);
 }
 
-void Octree::Update(unsigned short frameNumber_)
+void Octree::Update(unsigned short frameNumber_, const VisibilitySet* lastVisibleDrawables_)
 {
     ZoneScoped;
 
     frameNumber = frameNumber_;
+    lastVisibleDrawables = lastVisibleDrawables_;
+
+    // Resizing is safe here, as no reinsertion is in progress. A resize queues all drawables for reinsertion below
+    if (autoResize && autoResizeTimer-- == 0)
+    {
+        CheckAutoResize();
+        autoResizeTimer = AUTO_RESIZE_INTERVAL;
+    }
+
+    numQueuedUpdates = (unsigned)updateQueue.size();
+    numReinsertions = 0;
 
     // Avoid overhead of threaded update if only a small number of objects to update / reinsert
     if (updateQueue.size())
@@ -255,6 +391,7 @@ void Octree::FinishUpdate()
         workQueue->TryComplete();
 
     SetThreadedUpdate(false);
+    lastVisibleDrawables = nullptr;
 
     // Now reinsert drawables that actually need reinsertion into a different octant
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
@@ -271,23 +408,127 @@ void Octree::FinishUpdate()
     }
 
     sortDirtyOctants.clear();
+
+    PruneHashGridCells();
 }
 
 void Octree::Resize(const BoundingBox& boundingBox, int numLevels)
 {
     ZoneScoped;
 
-    // Collect nodes to the root and delete all child octants
-    updateQueue.clear();
-    std::vector<Drawable*> occluders;
-    
+    MarkAttributesDirty();
+
+    // Keep queued drawables that were not inserted yet, use the hash grid or are dormant, then collect the rest to be reinserted and delete all child octants
+    for (auto it = updateQueue.begin(); it != updateQueue.end();)
+    {
+        if (!*it || ((*it)->GetOctant() && !(*it)->GetOctant()->TestFlag(OF_HASH_CELL | OF_DORMANT)))
+            it = updateQueue.erase(it);
+        else
+            ++it;
+    }
+
     CollectDrawables(updateQueue, &root);
     DeleteChildOctants(&root, false);
 
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+        (*it)->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+
     allocator.Reset();
+    worldBoundingBox = boundingBox;
     root.Initialize(nullptr, boundingBox, (unsigned char)Clamp(numLevels, 1, MAX_OCTREE_LEVELS), 0);
 }
 
+void Octree::SetMotionSlack(float updates)
+{
+    MarkAttributesDirty();
+    motionSlack = Max(updates, 0.0f);
+
+    if (motionSlack > 0.0f)
+    {
+        // Start tracking from the current bounds. The first move reinserts with a predicted box
+        drawableMotion.resize(drawablesById.size());
+        for (size_t i = 0; i < drawablesById.size(); ++i)
+        {
+            if (drawablesById[i])
+            {
+                const BoundingBox& box = drawablesById[i]->WorldBoundingBox();
+                drawableMotion[i].slackBox = box;
+                drawableMotion[i].lastCenter = box.Center();
+                drawableMotion[i].velocity = Vector3::ZERO;
+            }
+        }
+    }
+    else
+        drawableMotion.clear();
+}
+
+void Octree::SetHashGridCellSize(float size)
+{
+    MarkAttributesDirty();
+    size = Max(size, M_EPSILON);
+    if (size == hashCellSize)
+        return;
+
+    hashCellSize = size;
+
+    // Detach drawables from the old cells and queue them for reinsertion
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+    {
+        Octant* cell = *it;
+        for (auto dIt = cell->drawables.begin(); dIt != cell->drawables.end(); ++dIt)
+        {
+            Drawable* drawable = *dIt;
+            drawable->octant = nullptr;
+            if (!drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            {
+                updateQueue.push_back(drawable);
+                drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+            }
+        }
+        hashCellAllocator.Free(cell);
+    }
+
+    hashCells.clear();
+    hashCellMap.clear();
+}
+
+void Octree::SetAutoResize(bool enable)
+{
+    MarkAttributesDirty();
+    autoResize = enable;
+    autoResizeTimer = 0;
+}
+
+void Octree::CollectStats(OctreeStats& dest) const
+{
+    ZoneScoped;
+
+    dest.Clear();
+    dest.drawablesPerLevel.resize(root.level);
+    dest.numQueuedUpdates = numQueuedUpdates;
+    dest.numReinsertions = numReinsertions;
+    dest.numDormantDrawables = (unsigned)dormantOctant.drawables.size();
+
+    CollectStats(dest, &root, BoundingBox(root.center - root.halfSize, root.center + root.halfSize));
+
+    unsigned numBounded = 0;
+    for (auto it = drawablesById.begin(); it != drawablesById.end(); ++it)
+    {
+        if (*it && (*it)->GetOctant() && !(*it)->TestFlag(DF_DORMANT))
+        {
+            Vector3 size = (*it)->WorldBoundingBox().Size();
+            float maxSize = Max(Max(size.x, size.y), size.z);
+            if (maxSize <= MAX_AUTO_RESIZE_SIZE)
+            {
+                dest.averageDrawableSize += maxSize;
+                ++numBounded;
+            }
+        }
+    }
+    if (numBounded)
+        dest.averageDrawableSize /= (float)numBounded;
+}
+
 void Octree::OnRenderDebug(DebugRenderer* debug)
 {
     root.OnRenderDebug(debug);
@@ -299,6 +540,8 @@ void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigne
 
     result.clear();
     CollectDrawables(result, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+        CollectDrawables(result, *it, ray, nodeFlags, maxDistance, layerMask);
     std::sort(result.begin(), result.end(), CompareRaycastResults);
 }
 
@@ -309,6 +552,8 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
     // Get the potential hits first
     initialRayResult.clear();
     CollectDrawables(initialRayResult, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+        CollectDrawables(initialRayResult, *it, ray, nodeFlags, maxDistance, layerMask);
     std::sort(initialRayResult.begin(), initialRayResult.end(), CompareDrawableDistances);
 
     // Then perform actual per-node ray tests and early-out when possible
@@ -348,12 +593,36 @@ void Octree::FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum&
     ZoneScoped;
 
     CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+        CollectDrawablesMasked(result, *it, frustum, drawableFlags, layerMask);
+}
+
+void Octree::FindDrawablesBatched(std::vector<std::vector<Drawable*> >& results, const std::vector<Frustum>& frustums, unsigned short drawableFlags, unsigned layerMask) const
+{
+    QueryBatched(results, frustums.size() ? &frustums[0] : nullptr, nullptr, frustums.size(), drawableFlags, layerMask);
+}
+
+void Octree::FindDrawablesBatched(std::vector<std::vector<Drawable*> >& results, const std::vector<Sphere>& spheres, unsigned short drawableFlags, unsigned layerMask) const
+{
+    QueryBatched(results, nullptr, spheres.size() ? &spheres[0] : nullptr, spheres.size(), drawableFlags, layerMask);
 }
 
 void Octree::QueueUpdate(Drawable* drawable)
 {
     assert(drawable);
 
+    // Dormant drawables are reinserted only when woken up
+    if (drawable->TestFlag(DF_DORMANT))
+        return;
+
+    // Octants are shared between threads, so mark them dirty only once the parallel node updates end
+    if (parallelUpdate)
+    {
+        deferredUpdateQueues[WorkQueue::ThreadIndex()].push_back(drawable);
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+        return;
+    }
+
     if (drawable->octant)
         drawable->octant->MarkCullingBoxDirty();
 
@@ -367,9 +636,7 @@ void Octree::QueueUpdate(Drawable* drawable)
         drawable->lastUpdateFrameNumber = frameNumber;
 
         // Do nothing if still fits the current octant
-        const BoundingBox& box = drawable->WorldBoundingBox();
-        Octant* oldOctant = drawable->GetOctant();
-        if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
+        if (NeedsReinsertion(drawable))
         {
             reinsertQueues[WorkQueue::ThreadIndex()].push_back(drawable);
             drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
@@ -382,6 +649,16 @@ void Octree::RemoveDrawable(Drawable* drawable)
     if (!drawable)
         return;
 
+    if (bulkRemove)
+    {
+        if (!drawable->TestFlag(DF_BULK_REMOVE))
+        {
+            drawable->SetFlag(DF_BULK_REMOVE, true);
+            bulkRemoveDrawables.push_back(drawable);
+        }
+        return;
+    }
+
     RemoveDrawable(drawable, drawable->GetOctant());
     if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
     {
@@ -395,10 +672,156 @@ void Octree::RemoveDrawable(Drawable* drawable)
     }
 
     drawable->octant = nullptr;
+    drawable->SetFlag(DF_DORMANT, false);
+    FreeDrawableId(drawable);
+}
+
+void Octree::RemoveDrawables(const std::vector<Drawable*>& drawables)
+{
+    ZoneScoped;
+
+    bool anyQueued = false;
+    bulkRemoveOctants.clear();
+
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        drawable->SetFlag(DF_BULK_REMOVE, true);
+        if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            anyQueued = true;
+
+        Octant* octant = drawable->GetOctant();
+        if (octant && !octant->TestFlag(OF_BULK_REMOVE))
+        {
+            octant->SetFlag(OF_BULK_REMOVE, true);
+            bulkRemoveOctants.push_back(octant);
+        }
+    }
+
+    for (auto it = bulkRemoveOctants.begin(); it != bulkRemoveOctants.end(); ++it)
+    {
+        Octant* octant = *it;
+        octant->drawables.erase(std::remove_if(octant->drawables.begin(), octant->drawables.end(), IsBulkRemoved), octant->drawables.end());
+        octant->MarkCullingBoxDirty();
+    }
+
+    // Erase empty octants deepest first. Stop at parents that are still to be processed, as they would be visited again
+    std::sort(bulkRemoveOctants.begin(), bulkRemoveOctants.end(), [](Octant* lhs, Octant* rhs) { return lhs->level < rhs->level; });
+    for (auto it = bulkRemoveOctants.begin(); it != bulkRemoveOctants.end(); ++it)
+    {
+        Octant* octant = *it;
+        octant->SetFlag(OF_BULK_REMOVE, false);
+
+        while (!octant->drawables.size() && !octant->numChildren && octant->parent)
+        {
+            Octant* parentOctant = octant->parent;
+            DeleteChildOctant(parentOctant, octant->childIndex);
+            octant = parentOctant;
+            if (octant->TestFlag(OF_BULK_REMOVE))
+                break;
+        }
+    }
+
+    if (anyQueued)
+    {
+        std::replace_if(updateQueue.begin(), updateQueue.end(), IsBulkRemoved, (Drawable*)nullptr);
+        for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+            std::replace_if(reinsertQueues[i].begin(), reinsertQueues[i].end(), IsBulkRemoved, (Drawable*)nullptr);
+    }
+
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        drawable->octant = nullptr;
+        drawable->SetFlag(DF_BULK_REMOVE | DF_OCTREE_REINSERT_QUEUED | DF_DORMANT, false);
+        FreeDrawableId(drawable);
+    }
+}
+
+void Octree::SetDrawableDormant(Drawable* drawable, bool dormant)
+{
+    if (!drawable || drawable->TestFlag(DF_DORMANT) == dormant)
+        return;
+
+    if (dormant)
+    {
+        // Add first, then remove, same as in reinsertion. Assigns an id if was not inserted yet. A pending reinsertion is left in the queue to be skipped, as searching the queue would be slow
+        Octant* oldOctant = drawable->GetOctant();
+        AddDrawable(drawable, &dormantOctant);
+        if (oldOctant)
+            RemoveDrawable(drawable, oldOctant);
+
+        drawable->SetFlag(DF_DORMANT, true);
+    }
+    else
+    {
+        drawable->SetFlag(DF_DORMANT, false);
+        if (!drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            QueueUpdate(drawable);
+    }
+}
+
+void Octree::OnSceneSet(Scene* newScene, Scene* oldScene)
+{
+    // If removed during a bulk removal, finish it now
+    if (bulkRemove)
+        HandleBulkRemoveEnd(oldScene->bulkRemoveEndEvent);
+
+    if (oldScene)
+    {
+        UnsubscribeFromEvent(oldScene->bulkRemoveBeginEvent);
+        UnsubscribeFromEvent(oldScene->bulkRemoveEndEvent);
+        UnsubscribeFromEvent(oldScene->parallelUpdateBeginEvent);
+        UnsubscribeFromEvent(oldScene->parallelUpdateEndEvent);
+    }
+    if (newScene)
+    {
+        SubscribeToEvent(newScene->bulkRemoveBeginEvent, &Octree::HandleBulkRemoveBegin);
+        SubscribeToEvent(newScene->bulkRemoveEndEvent, &Octree::HandleBulkRemoveEnd);
+        SubscribeToEvent(newScene->parallelUpdateBeginEvent, &Octree::HandleParallelUpdateBegin);
+        SubscribeToEvent(newScene->parallelUpdateEndEvent, &Octree::HandleParallelUpdateEnd);
+    }
+}
+
+void Octree::HandleBulkRemoveBegin(Event&)
+{
+    bulkRemove = true;
+}
+
+void Octree::HandleBulkRemoveEnd(Event&)
+{
+    bulkRemove = false;
+    RemoveDrawables(bulkRemoveDrawables);
+    bulkRemoveDrawables.clear();
+}
+
+void Octree::HandleParallelUpdateBegin(Event&)
+{
+    parallelUpdate = true;
+}
+
+void Octree::HandleParallelUpdateEnd(Event&)
+{
+    parallelUpdate = false;
+
+    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    {
+        std::vector<Drawable*>& queue = deferredUpdateQueues[i];
+        for (auto it = queue.begin(); it != queue.end(); ++it)
+        {
+            Drawable* drawable = *it;
+            if (drawable->octant)
+                drawable->octant->MarkCullingBoxDirty();
+            updateQueue.push_back(drawable);
+        }
+
+        queue.clear();
+    }
 }
 
 void Octree::SetBoundingBoxAttr(const BoundingBox& value)
 {
+    MarkAttributesDirty();
     worldBoundingBox = value;
 }
 
@@ -423,9 +846,24 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
     {
         Drawable* drawable = *it;
-
-        const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
+
+        // Hash grid drawables go to the cell containing their center
+        if (drawable->TestFlag(DF_HASH_GRID))
+        {
+            Octant* newOctant = HashGridCell(drawable->WorldBoundingBox().Center());
+            if (newOctant != oldOctant)
+            {
+                ++numReinsertions;
+                AddDrawable(drawable, newOctant);
+                if (oldOctant)
+                    RemoveDrawable(drawable, oldOctant);
+            }
+            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+            continue;
+        }
+
+        const BoundingBox& box = FittingBox(drawable);
         Octant* newOctant = &root;
         Vector3 boxSize = box.Size();
 
@@ -440,6 +878,7 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
             {
                 if (newOctant != oldOctant)
                 {
+                    ++numReinsertions;
                     // Add first, then remove, because drawable count going to zero deletes the octree branch in question
                     AddDrawable(drawable, newOctant);
                     if (oldOctant)
@@ -469,6 +908,110 @@ void Octree::RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>&
     }
 }
 
+void Octree::AddVisibilitySet(VisibilitySet* set)
+{
+    if (set && std::find(visibilitySets.begin(), visibilitySets.end(), set) == visibilitySets.end())
+        visibilitySets.push_back(set);
+}
+
+void Octree::RemoveVisibilitySet(VisibilitySet* set)
+{
+    auto it = std::find(visibilitySets.begin(), visibilitySets.end(), set);
+    if (it != visibilitySets.end())
+        visibilitySets.erase(it);
+}
+
+void Octree::AssignDrawableId(Drawable* drawable)
+{
+    if (freeDrawableIds.size())
+    {
+        drawable->id = freeDrawableIds.back();
+        freeDrawableIds.pop_back();
+        drawablesById[drawable->id] = drawable;
+
+        // Sets registered after the id was freed may still hold the previous holder's bit
+        for (auto it = visibilitySets.begin(); it != visibilitySets.end(); ++it)
+            (*it)->Clear(drawable->id);
+    }
+    else
+    {
+        drawable->id = (unsigned)drawablesById.size();
+        drawablesById.push_back(drawable);
+    }
+
+    if (motionSlack > 0.0f)
+    {
+        if (drawableMotion.size() < drawablesById.size())
+            drawableMotion.resize(drawablesById.size());
+
+        const BoundingBox& box = drawable->WorldBoundingBox();
+        DrawableMotion& motion = drawableMotion[drawable->id];
+        motion.slackBox = box;
+        motion.lastCenter = box.Center();
+        motion.velocity = Vector3::ZERO;
+    }
+}
+
+bool Octree::NeedsReinsertion(Drawable* drawable)
+{
+    const BoundingBox& box = drawable->WorldBoundingBox();
+    Octant* oldOctant = drawable->GetOctant();
+
+    // Drawables without an octant, such as after a resize, and woken up drawables restart motion tracking from their current bounds
+    if (!oldOctant || oldOctant->TestFlag(OF_DORMANT))
+    {
+        if (drawable->id < drawableMotion.size())
+        {
+            DrawableMotion& motion = drawableMotion[drawable->id];
+            motion.slackBox = box;
+            motion.lastCenter = box.Center();
+            motion.velocity = Vector3::ZERO;
+        }
+        return true;
+    }
+
+    // Moving between the octants and the hash grid always needs reinsertion. Hash grid cells are loose, so use their fitting box as is
+    bool inHashCell = oldOctant->TestFlag(OF_HASH_CELL);
+    if (drawable->TestFlag(DF_HASH_GRID) != inHashCell)
+        return true;
+    if (inHashCell)
+        return oldOctant->fittingBox.IsInside(box) != INSIDE;
+
+    if (motionSlack <= 0.0f || drawable->id >= drawableMotion.size())
+        return oldOctant->fittingBox.IsInside(box) != INSIDE;
+
+    DrawableMotion& motion = drawableMotion[drawable->id];
+    Vector3 center = box.Center();
+    motion.velocity = motion.velocity.Lerp(center - motion.lastCenter, MOTION_SMOOTHING);
+    motion.lastCenter = center;
+
+    // Moving within the slack box needs no octree changes; culling uses the actual box
+    if (motion.slackBox.IsInside(box) == INSIDE)
+        return false;
+
+    // Predict a new slack box ahead in the direction of motion, with a small margin for jitter
+    Vector3 margin = box.HalfSize() * MIN_MOTION_SLACK;
+    Vector3 ahead = motion.velocity * motionSlack;
+    Vector3 aheadMin(Min(ahead.x, 0.0f), Min(ahead.y, 0.0f), Min(ahead.z, 0.0f));
+    Vector3 aheadMax(Max(ahead.x, 0.0f), Max(ahead.y, 0.0f), Max(ahead.z, 0.0f));
+    motion.slackBox.Define(box.min - margin + aheadMin, box.max + margin + aheadMax);
+
+    return oldOctant->fittingBox.IsInside(motion.slackBox) != INSIDE;
+}
+
+void Octree::FreeDrawableId(Drawable* drawable)
+{
+    if (drawable->id == M_MAX_UNSIGNED)
+        return;
+
+    for (auto it = visibilitySets.begin(); it != visibilitySets.end(); ++it)
+        (*it)->Clear(drawable->id);
+
+    drawablesById[drawable->id] = nullptr;
+    freeDrawableIds.push_back(drawable->id);
+    drawable->id = M_MAX_UNSIGNED;
+}
+
 Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
 {
     if (octant->children[index])
@@ -625,6 +1168,262 @@ void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result,
     }
 }
 
+void Octree::QueryBatched(std::vector<std::vector<Drawable*> >& results, const Frustum* frustums, const Sphere* spheres, size_t numObservers, unsigned short drawableFlags, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    results.resize(numObservers);
+    for (auto it = results.begin(); it != results.end(); ++it)
+        it->clear();
+    if (!numObservers)
+        return;
+
+    // Update dirty culling boxes beforehand, so that tasks sharing a subtree do not all update them
+    root.CullingBox();
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+        (*it)->CullingBox();
+
+    // Split the work both by top-level subtree and by observer group, so that there is enough to go around and the active observer sets stay small.
+    // The root octant's own drawables get a non-recursive task
+    Octant* childOctants[NUM_OCTANTS];
+    size_t numChildOctants = 0;
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (root.children[i])
+            childOctants[numChildOctants++] = root.children[i];
+    }
+
+    size_t numUnits = 1 + numChildOctants + hashCells.size();
+    size_t numGroups = (numObservers + BATCHED_QUERY_GROUP_SIZE - 1) / BATCHED_QUERY_GROUP_SIZE;
+    size_t numTasks = numUnits * numGroups;
+    while (batchedQueryTasks.size() < numTasks)
+        batchedQueryTasks.push_back(new BatchedQueryTask(const_cast<Octree*>(this), &Octree::BatchedQueryWork));
+
+    std::atomic<int> numPendingTasks(0);
+
+    for (size_t i = 0; i < numGroups; ++i)
+    {
+        for (size_t j = 0; j < numUnits; ++j)
+        {
+            BatchedQueryTask* task = batchedQueryTasks[i * numUnits + j];
+            if (j == 0)
+                task->startOctant = const_cast<Octant*>(&root);
+            else if (j <= numChildOctants)
+                task->startOctant = childOctants[j - 1];
+            else
+                task->startOctant = hashCells[j - 1 - numChildOctants];
+            task->recursive = j > 0;
+            task->frustums = frustums;
+            task->spheres = spheres;
+            task->firstObserver = i * BATCHED_QUERY_GROUP_SIZE;
+            task->numObservers = Min(BATCHED_QUERY_GROUP_SIZE, numObservers - task->firstObserver);
+            task->drawableFlags = drawableFlags;
+            task->layerMask = layerMask;
+            workQueue->AddCounter(task, numPendingTasks);
+        }
+    }
+
+    workQueue->QueueTasks(numTasks, reinterpret_cast<Task**>(&batchedQueryTasks[0]));
+    workQueue->Wait(numPendingTasks, WorkQueue::ThreadIndex());
+
+    // Merge in task order, which matches the traversal order of FindDrawables()
+    for (size_t i = 0; i < numObservers; ++i)
+    {
+        size_t firstTask = (i / BATCHED_QUERY_GROUP_SIZE) * numUnits;
+        size_t groupIndex = i % BATCHED_QUERY_GROUP_SIZE;
+        std::vector<Drawable*>& result = results[i];
+
+        size_t numDrawables = 0;
+        for (size_t j = 0; j < numUnits; ++j)
+            numDrawables += batchedQueryTasks[firstTask + j]->results[groupIndex].size();
+        result.reserve(numDrawables);
+
+        for (size_t j = 0; j < numUnits; ++j)
+        {
+            const std::vector<Drawable*>& taskResult = batchedQueryTasks[firstTask + j]->results[groupIndex];
+            result.insert(result.end(), taskResult.begin(), taskResult.end());
+        }
+    }
+}
+
+template <class T> void Octree::CollectDrawablesBatched(BatchedQueryTask* task, Octant* octant, const T* observers, size_t activeStart, size_t numActive) const
+{
+    std::vector<BatchedObserver>& activeObservers = task->activeObservers;
+    const BoundingBox& octantBox = octant->CullingBox();
+    size_t start = activeObservers.size();
+
+    // Test the octant against the observers still active in the parent. Observers containing the whole subtree take it without further tests
+    for (size_t i = activeStart; i < activeStart + numActive; ++i)
+    {
+        BatchedObserver observer = activeObservers[i];
+        observer.planeMask = TestObserver(observers[observer.index], octantBox, observer.planeMask);
+        if (observer.planeMask == 0xff)
+            continue;
+
+        if (!observer.planeMask && task->recursive)
+            CollectDrawables(task->results[observer.index], octant, task->drawableFlags, task->layerMask);
+        else
+            activeObservers.push_back(observer);
+    }
+
+    size_t count = activeObservers.size() - start;
+    if (!count)
+        return;
+
+    std::vector<Drawable*>& drawables = octant->drawables;
+    unsigned short drawableFlags = task->drawableFlags;
+    unsigned layerMask = task->layerMask;
+
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        if ((drawable->Flags() & drawableFlags) != drawableFlags || !(drawable->LayerMask() & layerMask))
+            continue;
+
+        const BoundingBox& box = drawable->WorldBoundingBox();
+        for (size_t i = start; i < start + count; ++i)
+        {
+            const BatchedObserver& observer = activeObservers[i];
+            if (!observer.planeMask || TestObserverFast(observers[observer.index], box, observer.planeMask))
+                task->results[observer.index].push_back(drawable);
+        }
+    }
+
+    if (task->recursive && octant->numChildren)
+    {
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->children[i])
+                CollectDrawablesBatched(task, octant->children[i], observers, start, count);
+        }
+    }
+
+    activeObservers.resize(start);
+}
+
+void Octree::CollectStats(OctreeStats& dest, const Octant* octant, const BoundingBox& rootBox) const
+{
+    unsigned numDrawables = (unsigned)octant->drawables.size();
+    size_t depth = root.level - octant->level;
+
+    ++dest.numOctants;
+    if (!numDrawables)
+        ++dest.numEmptyOctants;
+    if (depth < dest.drawablesPerLevel.size())
+        dest.drawablesPerLevel[depth] += numDrawables;
+    dest.numDrawables += numDrawables;
+    if (numDrawables > dest.maxOctantDrawables)
+        dest.maxOctantDrawables = numDrawables;
+
+    for (auto it = octant->drawables.begin(); it != octant->drawables.end(); ++it)
+    {
+        const BoundingBox& box = (*it)->WorldBoundingBox();
+        Vector3 size = box.Size();
+        if (Max(Max(size.x, size.y), size.z) > MAX_AUTO_RESIZE_SIZE)
+            continue;
+
+        dest.drawableBounds.Merge(box);
+        if (octant == &root && rootBox.IsInside(box) != INSIDE)
+            ++dest.numOutsideDrawables;
+    }
+
+    if (octant->numChildren)
+    {
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->children[i])
+                CollectStats(dest, octant->children[i], rootBox);
+        }
+    }
+}
+
+void Octree::CheckAutoResize()
+{
+    ZoneScoped;
+
+    OctreeStats stats;
+    CollectStats(stats);
+    if (!stats.drawableBounds.IsDefined() || stats.averageDrawableSize <= 0.0f)
+        return;
+
+    // Use a cubic power of two size with margin, so that small changes in the drawable extents do not cause a resize
+    Vector3 halfSize = stats.drawableBounds.HalfSize();
+    float requiredSize = Clamp(Max(Max(halfSize.x, halfSize.y), halfSize.z) * AUTO_RESIZE_MARGIN, MIN_AUTO_RESIZE_SIZE, MAX_AUTO_RESIZE_SIZE);
+    float newSize = MIN_AUTO_RESIZE_SIZE;
+    while (newSize < requiredSize)
+        newSize *= 2.0f;
+
+    // Snap the center to a grid of a quarter of the size for the same reason
+    float snap = newSize * 0.25f;
+    Vector3 center = stats.drawableBounds.Center();
+    Vector3 newCenter(floorf(center.x / snap + 0.5f) * snap, floorf(center.y / snap + 0.5f) * snap, floorf(center.z / snap + 0.5f) * snap);
+    BoundingBox newBox(newCenter - Vector3(newSize, newSize, newSize), newCenter + Vector3(newSize, newSize, newSize));
+
+    // Subdivide until the smallest octants are about the average drawable size
+    int newLevels = Clamp((int)ceilf(log2f(2.0f * newSize / stats.averageDrawableSize)), 1, MAX_AUTO_RESIZE_LEVELS);
+
+    // Grow immediately when drawables no longer fit, but shrink or change depth only when clearly mismatched
+    float currentSize = Max(Max(root.halfSize.x, root.halfSize.y), root.halfSize.z);
+    bool resize = stats.numOutsideDrawables > 0 || newSize * 4.0f <= currentSize || Abs(newLevels - (int)root.level) > 1;
+
+    if (resize && (newBox != BoundingBox(root.center - root.halfSize, root.center + root.halfSize) || newLevels != (int)root.level))
+    {
+        LOGDEBUGF("Auto-resizing octree to size %f levels %d", newSize, newLevels);
+        Resize(newBox, newLevels);
+    }
+}
+
+Octant* Octree::HashGridCell(const Vector3& position)
+{
+    int x = Clamp((int)floorf(position.x / hashCellSize), -HASH_CELL_COORD_LIMIT, HASH_CELL_COORD_LIMIT);
+    int y = Clamp((int)floorf(position.y / hashCellSize), -HASH_CELL_COORD_LIMIT, HASH_CELL_COORD_LIMIT);
+    int z = Clamp((int)floorf(position.z / hashCellSize), -HASH_CELL_COORD_LIMIT, HASH_CELL_COORD_LIMIT);
+    unsigned long long mask = (1ULL << HASH_CELL_COORD_BITS) - 1;
+    unsigned long long key = ((unsigned long long)(x + HASH_CELL_COORD_LIMIT) & mask) | (((unsigned long long)(y + HASH_CELL_COORD_LIMIT) & mask) << HASH_CELL_COORD_BITS) |
+        (((unsigned long long)(z + HASH_CELL_COORD_LIMIT) & mask) << (2 * HASH_CELL_COORD_BITS));
+
+    auto it = hashCellMap.find(key);
+    if (it != hashCellMap.end())
+        return it->second;
+
+    Vector3 cellMin(x * hashCellSize, y * hashCellSize, z * hashCellSize);
+    Octant* cell = hashCellAllocator.Allocate();
+    cell->Initialize(nullptr, BoundingBox(cellMin, cellMin + Vector3(hashCellSize, hashCellSize, hashCellSize)), 0, 0);
+    cell->SetFlag(OF_HASH_CELL, true);
+    hashCellMap[key] = cell;
+    hashCells.push_back(cell);
+    return cell;
+}
+
+void Octree::PruneHashGridCells()
+{
+    size_t numEmpty = 0;
+    for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+    {
+        if ((*it)->drawables.empty())
+            ++numEmpty;
+    }
+
+    // Keep empty cells around unless they dominate, to avoid recreating them as objects move back and forth
+    if (numEmpty < MIN_HASH_CELL_PRUNE || numEmpty * 2 < hashCells.size())
+        return;
+
+    for (auto it = hashCellMap.begin(); it != hashCellMap.end();)
+    {
+        if (it->second->drawables.empty())
+        {
+            hashCellAllocator.Free(it->second);
+            it = hashCellMap.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    hashCells.clear();
+    for (auto it = hashCellMap.begin(); it != hashCellMap.end(); ++it)
+        hashCells.push_back(it->second);
+}
+
 void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
 {
     ZoneScoped;
@@ -641,15 +1440,20 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
         if (!drawable)
             continue;
 
+        // Likewise skip drawables that became dormant while queued
+        if (drawable->TestFlag(DF_DORMANT))
+        {
+            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+            continue;
+        }
+
         if (drawable->TestFlag(DF_OCTREE_UPDATE_CALL))
-            drawable->OnOctreeUpdate(frameNumber);
+            drawable->OnOctreeUpdate(frameNumber, lastVisibleDrawables && lastVisibleDrawables->Test(drawable->id));
 
         drawable->lastUpdateFrameNumber = frameNumber;
 
         // Do nothing if still fits the current octant
-        const BoundingBox& box = drawable->WorldBoundingBox();
-        Octant* oldOctant = drawable->GetOctant();
-        if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
+        if (NeedsReinsertion(drawable))
             reinsertQueue.push_back(drawable);
         else
             drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
@@ -657,3 +1461,29 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
 
     numPendingReinsertionTasks.fetch_add(-1);
 }
+
+void Octree::BatchedQueryWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    BatchedQueryTask* task = static_cast<BatchedQueryTask*>(task_);
+    if (task->results.size() < task->numObservers)
+        task->results.resize(task->numObservers);
+    for (size_t i = 0; i < task->numObservers; ++i)
+        task->results[i].clear();
+
+    // All observers of the group start active, with all planes to test
+    task->activeObservers.clear();
+    for (size_t i = 0; i < task->numObservers; ++i)
+    {
+        BatchedObserver observer;
+        observer.index = (unsigned)i;
+        observer.planeMask = 0x3f;
+        task->activeObservers.push_back(observer);
+    }
+
+    if (task->frustums)
+        CollectDrawablesBatched(task, task->startOctant, task->frustums + task->firstObserver, 0, task->numObservers);
+    else
+        CollectDrawablesBatched(task, task->startOctant, task->spheres + task->firstObserver, 0, task->numObservers);
+}
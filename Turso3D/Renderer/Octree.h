@@ -5,16 +5,23 @@
 #include "../Math/Frustum.h"
 #include "../Thread/WorkQueue.h"
 #include "OctreeNode.h"
+#include "VisibilitySet.h"
 
 #include <atomic>
+#include <unordered_map>
 
 static const size_t NUM_OCTANTS = 8;
 static const unsigned char OF_DRAWABLES_SORT_DIRTY = 0x1;
 static const unsigned char OF_CULLING_BOX_DIRTY = 0x2;
+static const unsigned char OF_HASH_CELL = 0x4;
+static const unsigned char OF_DORMANT = 0x8;
+static const unsigned char OF_BULK_REMOVE = 0x10;
 static const float OCCLUSION_QUERY_INTERVAL = 0.133333f; // About 8 frame stagger at 60fps
 
 class Ray;
+class Sphere;
 class WorkQueue;
+struct BatchedQueryTask;
 struct ReinsertDrawablesTask;
 
 /// %Octant occlusion query visibility states.
@@ -42,6 +49,50 @@ struct RaycastResult
     size_t subObject;
 };
 
+/// Per-drawable motion tracking for motion slack reinsertion.
+struct DrawableMotion
+{
+    /// Inflated bounding box the drawable may move within without reinsertion.
+    BoundingBox slackBox;
+    /// World bounding box center on the last update.
+    Vector3 lastCenter;
+    /// Smoothed movement of the center per update.
+    Vector3 velocity;
+};
+
+/// %Octree occupancy statistics.
+struct OctreeStats
+{
+    /// Construct with zero values.
+    OctreeStats();
+
+    /// Reset to zero values.
+    void Clear();
+
+    /// Number of drawables per subdivision depth, root first.
+    std::vector<unsigned> drawablesPerLevel;
+    /// Total number of drawables in the octree.
+    unsigned numDrawables;
+    /// Number of octants including the root.
+    unsigned numOctants;
+    /// Number of octants without drawables. These only exist to hold child octants.
+    unsigned numEmptyOctants;
+    /// Highest drawable count in a single octant.
+    unsigned maxOctantDrawables;
+    /// Number of drawables not fully inside the root octant bounds. Excludes drawables with unbounded size, such as directional lights.
+    unsigned numOutsideDrawables;
+    /// Number of dormant drawables. These are not included in the other counts.
+    unsigned numDormantDrawables;
+    /// Number of drawables queued for update on the last frame.
+    unsigned numQueuedUpdates;
+    /// Number of drawables that actually moved to another octant on the last frame.
+    unsigned numReinsertions;
+    /// Combined bounding box of drawables with bounded size.
+    BoundingBox drawableBounds;
+    /// Average largest dimension of drawables with bounded size.
+    float averageDrawableSize;
+};
+
 /// %Octree cell, contains up to 8 child octants.
 class Octant
 {
@@ -68,6 +119,8 @@ public:
     const std::vector<Drawable*>& Drawables() const { return drawables; }
     /// Return whether has child octants.
     bool HasChildren() const { return numChildren > 0; }
+    /// Return number of child octants.
+    size_t NumChildren() const { return numChildren; }
     /// Return child octant by index.
     Octant* Child(size_t index) const { return children[index]; }
     /// Return parent octant.
@@ -203,18 +256,32 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
     
-    /// Process the queue of nodes to be reinserted. This will utilize worker threads.
-    void Update(unsigned short frameNumber);
+    /// Process the queue of nodes to be reinserted. This will utilize worker threads. The visibility of the last prepared view, if any, tells the drawables' update calls whether they were in view.
+    void Update(unsigned short frameNumber, const VisibilitySet* lastVisibleDrawables = nullptr);
     /// Finish the octree update.
     void FinishUpdate();
+    /// Register a per-view visibility set. Its bit for a drawable id is cleared when the id is freed or reused, so that a new drawable does not inherit its predecessor's visibility.
+    void AddVisibilitySet(VisibilitySet* set);
+    /// Unregister a per-view visibility set.
+    void RemoveVisibilitySet(VisibilitySet* set);
     /// Resize the octree.
     void Resize(const BoundingBox& boundingBox, int numLevels);
+    /// Set motion slack as the number of updates of movement to predict. When nonzero, moved drawables are fitted to octants using a box inflated by their recent velocity, and are not reinserted while their actual bounds stay inside it. Zero disables.
+    void SetMotionSlack(float updates);
+    /// Set spatial hash grid cell size. Drawables using the grid are reinserted.
+    void SetHashGridCellSize(float size);
+    /// Enable or disable automatic resizing. When enabled, the size and number of levels are periodically fitted to the drawables at the start of Update().
+    void SetAutoResize(bool enable);
     /// Enable or disable threaded update mode. In threaded mode reinsertions go to per-thread queues, which are processed in FinishUpdate().
     void SetThreadedUpdate(bool enable) { threadedUpdate = enable; }
     /// Queue octree reinsertion for a drawable.
     void QueueUpdate(Drawable* drawable);
-    /// Remove a drawable from the octree.
+    /// Remove a drawable from the octree. During a scene bulk removal, the removal is deferred until its end, and the drawable must stay alive until then.
     void RemoveDrawable(Drawable* drawable);
+    /// Remove several drawables from the octree with one pass over each affected octant and update queue.
+    void RemoveDrawables(const std::vector<Drawable*>& drawables);
+    /// Set a drawable dormant or wake it up. A dormant drawable keeps its id and octree membership, but is moved aside from rendering and queries, and its updates are ignored. Waking queues it for reinsertion.
+    void SetDrawableDormant(Drawable* drawable, bool dormant);
     /// Add debug geometry to be rendered. Visualizes the whole octree.
     void OnRenderDebug(DebugRenderer* debug);
 
@@ -223,15 +290,50 @@ public:
     /// Query for drawables with a raycast and return the closest result.
     RaycastResult RaycastSingle(const Ray& ray, unsigned short drawableFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
     /// Query for drawables using a volume such as frustum or sphere.
-    template <class T> void FindDrawables(std::vector<Drawable*>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const { CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask); }
+    template <class T> void FindDrawables(std::vector<Drawable*>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask);
+        for (auto it = hashCells.begin(); it != hashCells.end(); ++it)
+            CollectDrawables(result, *it, volume, drawableFlags, layerMask);
+    }
     /// Query for drawables using a frustum and masked testing.
     void FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using several observer frustums at once. Each octant is tested against the observers still active at its parent, with per-observer plane masks. Results are returned per observer, in the same order as FindDrawables() would, and the work is split to worker threads. Not reentrant.
+    void FindDrawablesBatched(std::vector<std::vector<Drawable*> >& results, const std::vector<Frustum>& frustums, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using several observer spheres at once. Otherwise as the frustum version.
+    void FindDrawablesBatched(std::vector<std::vector<Drawable*> >& results, const std::vector<Sphere>& spheres, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Calculate occupancy statistics. This walks the whole octree, so it should not be called every frame.
+    void CollectStats(OctreeStats& dest) const;
     /// Return whether threaded update is enabled.
     bool ThreadedUpdate() const { return threadedUpdate; }
+    /// Return whether automatic resizing is enabled.
+    bool AutoResize() const { return autoResize; }
+    /// Return motion slack in updates.
+    float MotionSlack() const { return motionSlack; }
+    /// Return spatial hash grid cell size.
+    float HashGridCellSize() const { return hashCellSize; }
+    /// Return the spatial hash grid cells. They are octants without parents or children, and may be empty.
+    const std::vector<Octant*>& HashGridCells() const { return hashCells; }
     /// Return the root octant.
     Octant* Root() const { return const_cast<Octant*>(&root); }
+    /// Return number of drawable ids in use, including free ids. Per-view data indexed by drawable id should be sized by this.
+    unsigned NumDrawableIds() const { return (unsigned)drawablesById.size(); }
+    /// Return drawable by stable id, or null if the id is free.
+    Drawable* DrawableById(unsigned id) const { return id < drawablesById.size() ? drawablesById[id] : nullptr; }
+
+protected:
+    /// Handle being assigned to a new scene. Subscribe to the scene's bulk removal and parallel update events.
+    void OnSceneSet(Scene* newScene, Scene* oldScene) override;
 
 private:
+    /// Handle the beginning of a scene bulk removal.
+    void HandleBulkRemoveBegin(Event& event);
+    /// Handle the end of a scene bulk removal. Remove the collected drawables.
+    void HandleBulkRemoveEnd(Event& event);
+    /// Handle the beginning of scene parallel node updates.
+    void HandleParallelUpdateBegin(Event& event);
+    /// Handle the end of scene parallel node updates. Queue the collected drawables for update.
+    void HandleParallelUpdateEnd(Event& event);
     /// Set bounding box. Used in serialization.
     void SetBoundingBoxAttr(const BoundingBox& value);
     /// Return bounding box. Used in serialization.
@@ -245,9 +347,12 @@ private:
     /// Remove a drawable from a reinsert queue.
     void RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables);
     
-    /// Add drawable to a specific octant.
+    /// Add drawable to a specific octant. Assign an id if not inserted before.
     void AddDrawable(Drawable* drawable, Octant* octant)
     {
+        if (drawable->id == M_MAX_UNSIGNED)
+            AssignDrawableId(drawable);
+
         octant->drawables.push_back(drawable);
         octant->MarkCullingBoxDirty();
         drawable->octant = octant;
@@ -286,6 +391,10 @@ private:
         }
     }
 
+    /// Assign a stable id to a drawable, reusing freed ids first.
+    void AssignDrawableId(Drawable* drawable);
+    /// Free the id of a drawable.
+    void FreeDrawableId(Drawable* drawable);
     /// Create a new child octant.
     Octant* CreateChildOctant(Octant* octant, unsigned char index);
     /// Delete one child octant.
@@ -302,6 +411,24 @@ private:
     void CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
     /// Work function to check reinsertion of nodes.
     void CheckReinsertWork(Task* task, unsigned threadIndex);
+    /// Work function for a batched query of one observer group within one octree subtree.
+    void BatchedQueryWork(Task* task, unsigned threadIndex);
+    /// Split a batched query of either frustums or spheres into tasks, execute them and merge the per-observer results.
+    void QueryBatched(std::vector<std::vector<Drawable*> >& results, const Frustum* frustums, const Sphere* spheres, size_t numObservers, unsigned short drawableFlags, unsigned layerMask) const;
+    /// Collect drawables for the active observers of a batched query task from an octant, recursing into child octants if the task is recursive.
+    template <class T> void CollectDrawablesBatched(BatchedQueryTask* task, Octant* octant, const T* observers, size_t activeStart, size_t numActive) const;
+    /// Check whether a moved drawable needs reinsertion. Updates its motion tracking if motion slack is in use. Safe to call from worker threads for different drawables.
+    bool NeedsReinsertion(Drawable* drawable);
+    /// Return the box used to fit a drawable into an octant.
+    const BoundingBox& FittingBox(Drawable* drawable) const { return (motionSlack > 0.0f && drawable->id < drawableMotion.size()) ? drawableMotion[drawable->id].slackBox : drawable->WorldBoundingBox(); }
+    /// Accumulate occupancy statistics from an octant recursively.
+    void CollectStats(OctreeStats& dest, const Octant* octant, const BoundingBox& rootBox) const;
+    /// Resize to fit the drawables if the current size or number of levels is clearly unsuitable.
+    void CheckAutoResize();
+    /// Return the spatial hash grid cell containing a position. Create if not found.
+    Octant* HashGridCell(const Vector3& position);
+    /// Delete empty spatial hash grid cells if there are many of them.
+    void PruneHashGridCells();
 
     /// Collect nodes matching flags using a volume such as frustum or sphere.
     template <class T> void CollectDrawables(std::vector<Drawable*>& result, Octant* octant, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
@@ -367,8 +494,26 @@ private:
 
     /// Threaded update flag. During threaded update moved drawables should go directly to thread-specific reinsert queues.
     volatile bool threadedUpdate;
+    /// Automatic resize flag.
+    bool autoResize;
+    /// Scene bulk removal in progress flag.
+    bool bulkRemove;
+    /// Scene parallel node updates in progress flag. Drawables queued for update go to thread-specific deferred queues.
+    bool parallelUpdate;
     /// Current framenumber.
     unsigned short frameNumber;
+    /// Visibility of the last prepared view during update, or null if none.
+    const VisibilitySet* lastVisibleDrawables;
+    /// Motion slack in updates, or zero if disabled.
+    float motionSlack;
+    /// Spatial hash grid cell size.
+    float hashCellSize;
+    /// Frames remaining until the next automatic resize check.
+    unsigned autoResizeTimer;
+    /// Number of drawables queued for update on the last frame.
+    unsigned numQueuedUpdates;
+    /// Number of drawables that moved to another octant on the last frame.
+    unsigned numReinsertions;
     /// Queue of nodes to be reinserted.
     std::vector<Drawable*> updateQueue;
     /// Octants which need to have their drawables sorted.
@@ -377,6 +522,8 @@ private:
     BoundingBox worldBoundingBox;
     /// Root octant.
     Octant root;
+    /// Parentless octant holding the dormant drawables. Not visited by rendering or queries.
+    Octant dormantOctant;
     /// Allocator for child octants.
     Allocator<Octant> allocator;
     /// Cached %WorkQueue subsystem.
@@ -385,10 +532,32 @@ private:
     std::vector<AutoPtr<ReinsertDrawablesTask> > reinsertTasks;
     /// Intermediate reinsert queues for threaded execution.
     AutoArrayPtr<std::vector<Drawable*> > reinsertQueues;
+    /// Drawables queued for update from scene parallel node updates, per thread.
+    AutoArrayPtr<std::vector<Drawable*> > deferredUpdateQueues;
+    /// Tasks for batched queries.
+    mutable std::vector<AutoPtr<BatchedQueryTask> > batchedQueryTasks;
     /// RaycastSingle initial coarse result.
     mutable std::vector<std::pair<Drawable*, float> > initialRayResult;
     /// RaycastSingle final result.
     mutable std::vector<RaycastResult> finalRayResult;
     /// Remaining drawable reinsertion tasks.
     std::atomic<int> numPendingReinsertionTasks;
+    /// Drawables indexed by their stable ids.
+    std::vector<Drawable*> drawablesById;
+    /// Free drawable ids for reuse.
+    std::vector<unsigned> freeDrawableIds;
+    /// Registered per-view visibility sets.
+    std::vector<VisibilitySet*> visibilitySets;
+    /// Motion tracking indexed by drawable id. Only used with motion slack.
+    std::vector<DrawableMotion> drawableMotion;
+    /// Drawables collected during a scene bulk removal.
+    std::vector<Drawable*> bulkRemoveDrawables;
+    /// Octants affected by a bulk removal.
+    std::vector<Octant*> bulkRemoveOctants;
+    /// Spatial hash grid cells.
+    std::vector<Octant*> hashCells;
+    /// Spatial hash grid cells by packed cell coordinates.
+    std::unordered_map<unsigned long long, Octant*> hashCellMap;
+    /// Allocator for spatial hash grid cells.
+    Allocator<Octant> hashCellAllocator;
 };
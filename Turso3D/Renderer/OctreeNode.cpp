@@ -21,9 +21,9 @@ void OctreeNodeBase::OnLayerChanged(unsigned char newLayer)
 Drawable::Drawable() :
     owner(nullptr),
     octant(nullptr),
+    id(M_MAX_UNSIGNED),
     flags(0),
     layer(LAYER_DEFAULT),
-    lastFrameNumber(0),
     lastUpdateFrameNumber(0),
     distance(0.0f),
     maxDistance(0.0f)
@@ -41,7 +41,7 @@ void Drawable::OnWorldBoundingBoxUpdate() const
     worldBoundingBox.Define(WorldPosition());
 }
 
-void Drawable::OnOctreeUpdate(unsigned short)
+void Drawable::OnOctreeUpdate(unsigned short, bool)
 {
 }
 
@@ -52,7 +52,6 @@ bool Drawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
 
-    lastFrameNumber = frameNumber;
     return true;
 }
 
@@ -95,10 +94,12 @@ void OctreeNode::RegisterObject()
     RegisterAttribute("castShadows", &OctreeNode::CastShadows, &OctreeNode::SetCastShadows, false);
     RegisterAttribute("updateInvisible", &OctreeNode::UpdateInvisible, &OctreeNode::SetUpdateInvisible, false);
     RegisterAttribute("maxDistance", &OctreeNode::MaxDistance, &OctreeNode::SetMaxDistance, 0.0f);
+    RegisterAttribute("useHashGrid", &OctreeNode::UseHashGrid, &OctreeNode::SetUseHashGrid, false);
 }
 
 void OctreeNode::SetStatic(bool enable)
 {
+    MarkAttributesDirty();
     if (enable != IsStatic())
     {
         drawable->SetFlag(DF_STATIC, enable);
@@ -109,6 +110,7 @@ void OctreeNode::SetStatic(bool enable)
 
 void OctreeNode::SetCastShadows(bool enable)
 {
+    MarkAttributesDirty();
     if (drawable->TestFlag(DF_CAST_SHADOWS) != enable)
     {
         drawable->SetFlag(DF_CAST_SHADOWS, enable);
@@ -119,14 +121,27 @@ void OctreeNode::SetCastShadows(bool enable)
 
 void OctreeNode::SetUpdateInvisible(bool enable)
 {
+    MarkAttributesDirty();
     drawable->SetFlag(DF_UPDATE_INVISIBLE, enable);
 }
 
 void OctreeNode::SetMaxDistance(float distance_)
 {
+    MarkAttributesDirty();
     drawable->maxDistance = Max(distance_, 0.0f);
 }
 
+void OctreeNode::SetUseHashGrid(bool enable)
+{
+    MarkAttributesDirty();
+    if (drawable->TestFlag(DF_HASH_GRID) != enable)
+    {
+        drawable->SetFlag(DF_HASH_GRID, enable);
+        // Reinsert to move between the octants and the hash grid
+        OnBoundingBoxChanged();
+    }
+}
+
 void OctreeNode::OnSceneSet(Scene* newScene, Scene*)
 {
     /// Remove from current octree if any
@@ -138,7 +153,7 @@ void OctreeNode::OnSceneSet(Scene* newScene, Scene*)
         octree = newScene->FindChild<Octree>();
         // Transform may not be final yet. Schedule insertion for next octree update
         if (octree && IsEnabled())
-            octree->QueueUpdate(drawable);
+            InsertToOctree();
     }
 }
 
@@ -158,6 +173,14 @@ void OctreeNode::OnBoundingBoxChanged()
         octree->QueueUpdate(drawable);
 }
 
+void OctreeNode::InsertToOctree()
+{
+    if (IsDormant())
+        octree->SetDrawableDormant(drawable, true);
+    else
+        octree->QueueUpdate(drawable);
+}
+
 void OctreeNode::RemoveFromOctree()
 {
     if (octree)
@@ -172,8 +195,14 @@ void OctreeNode::OnEnabledChanged(bool newEnabled)
     if (octree)
     {
         if (newEnabled)
-            octree->QueueUpdate(drawable);
+            InsertToOctree();
         else
             octree->RemoveDrawable(drawable);
     }
 }
+
+void OctreeNode::OnDormantChanged(bool newDormant)
+{
+    if (octree && IsEnabled())
+        octree->SetDrawableDormant(drawable, newDormant);
+}
@@ -28,6 +28,10 @@ static const unsigned short DF_OCTREE_UPDATE_CALL = 0x100;
 static const unsigned short DF_WORLD_TRANSFORM_DIRTY = 0x200;
 static const unsigned short DF_BOUNDING_BOX_DIRTY = 0x400;
 static const unsigned short DF_OCTREE_REINSERT_QUEUED = 0x800;
+static const unsigned short DF_BULK_PREPARE = 0x1000;
+static const unsigned short DF_HASH_GRID = 0x2000;
+static const unsigned short DF_DORMANT = 0x4000;
+static const unsigned short DF_BULK_REMOVE = 0x8000;
 
 /// Common base class for renderable scene objects and occluders.
 class OctreeNodeBase : public SpatialNode
@@ -62,9 +66,9 @@ public:
 
     /// Recalculate the world space bounding box.
     virtual void OnWorldBoundingBoxUpdate() const;
-    /// Do processing before octree reinsertion, e.g. animation. Called by Octree in worker threads. Must be opted-in by setting DF_OCTREE_UPDATE_CALL flag.
-    virtual void OnOctreeUpdate(unsigned short frameNumber);
-    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    /// Do processing before octree reinsertion, e.g. animation. Called by Octree in worker threads with whether the drawable was visible in the last prepared view. Must be opted-in by setting DF_OCTREE_UPDATE_CALL flag.
+    virtual void OnOctreeUpdate(unsigned short frameNumber, bool wasInView);
+    /// Prepare object for rendering. Calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
     virtual bool OnPrepareRender(unsigned short frameNumber, Camera* camera);
     /// Perform ray test on self and add possible hit to the result vector.
     virtual void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance);
@@ -84,18 +88,16 @@ public:
     OctreeNodeBase* Owner() const { return owner; }
     /// Return current octree octant this drawable resides in.
     Octant* GetOctant() const { return octant; }
+    /// Return stable id within the octree for indexing per-view data, or M_MAX_UNSIGNED if not inserted.
+    unsigned Id() const { return id; }
     /// Return distance from camera in the current view.
     float Distance() const { return distance; }
     /// Return max distance for rendering, or 0 for unlimited.
     float MaxDistance() const { return maxDistance; }
     /// Return whether is static.
     bool IsStatic() const { return TestFlag(DF_STATIC); }
-    /// Return last frame number when was visible. The frames are counted by Renderer internally and have no significance outside it.
-    unsigned short LastFrameNumber() const { return lastFrameNumber; }
     /// Return last frame number when was reinserted to octree (moved or animated.) The frames are counted by Renderer internally and have no significance outside it.
     unsigned short LastUpdateFrameNumber() const { return lastUpdateFrameNumber; }
-    /// Check whether is marked in view this frame.
-    bool InView(unsigned short frameNumber) { return lastFrameNumber == frameNumber; }
     /// Return position in world space.
     Vector3 WorldPosition() const { return WorldTransform().Translation(); }
     /// Return rotation in world space.
@@ -129,15 +131,6 @@ public:
             return *worldTransform;
     }
 
-    /// Check whether was in view last frame, compared to the current.
-    bool WasInView(unsigned short frameNumber) const
-    {
-        unsigned short previousFrameNumber = frameNumber - 1;
-        if (!previousFrameNumber)
-            --previousFrameNumber;
-        return lastFrameNumber == previousFrameNumber;
-    }
-
     /// Set bit flag. Called internally.
     void SetFlag(unsigned short bit, bool set) const { if (set) flags |= bit; else flags &= ~bit; }
     /// Test bit flag. Called internally.
@@ -150,12 +143,12 @@ protected:
     Matrix3x4* worldTransform;
     /// Current octree octant.
     Octant* octant;
+    /// Stable id within the octree.
+    unsigned id;
     /// %Drawable flags. Used to hold several boolean values to reduce memory use.
     mutable unsigned short flags;
     /// Layer number. Copy of the node layer.
     unsigned char layer;
-    /// Last frame number when was visible.
-    unsigned short lastFrameNumber;
     /// Last frame number when was reinserted to octree or other change (LOD etc.) happened.
     unsigned short lastUpdateFrameNumber;
     /// Distance from camera in the current view.
@@ -183,6 +176,8 @@ public:
     void SetUpdateInvisible(bool enable);
     /// Set max distance for rendering. 0 is unlimited.
     void SetMaxDistance(float distance);
+    /// Set whether to use the octree's spatial hash grid instead of octants. Suitable for large numbers of small moving objects. Default false.
+    void SetUseHashGrid(bool enable);
     
     /// Return drawable's world space bounding box. Update if necessary. 
     const BoundingBox& WorldBoundingBox() const { return drawable->WorldBoundingBox(); }
@@ -192,6 +187,8 @@ public:
     bool CastShadows() const { return drawable->TestFlag(DF_CAST_SHADOWS); }
     /// Return whether updates animation when invisible. Not relevant for non-animating geometry.
     bool UpdateInvisible() const { return drawable->TestFlag(DF_UPDATE_INVISIBLE); }
+    /// Return whether uses the spatial hash grid.
+    bool UseHashGrid() const { return drawable->TestFlag(DF_HASH_GRID); }
     /// Return current octree this node resides in.
     Octree* GetOctree() const { return octree; }
     /// Return the drawable for internal use.
@@ -200,14 +197,8 @@ public:
     float Distance() const { return drawable->Distance(); }
     /// Return max distance for rendering, or 0 for unlimited.
     float MaxDistance() const { return drawable->MaxDistance(); }
-    /// Return last frame number when was visible. The frames are counted by Renderer internally and have no significance outside it.
-    unsigned short LastFrameNumber() const { return drawable->LastFrameNumber(); }
     /// Return last frame number when was reinserted to octree (moved or animated.) The frames are counted by Renderer internally and have no significance outside it.
     unsigned short LastUpdateFrameNumber() const { return drawable->LastUpdateFrameNumber(); }
-    /// Check whether is marked in view this frame.
-    bool InView(unsigned short frameNumber) { return drawable->InView(frameNumber); }
-    /// Check whether was in view last frame, compared to the current.
-    bool WasInView(unsigned short frameNumber) const { return drawable->WasInView(frameNumber); }
 
 protected:
     /// Search for an octree from the scene root and add self to it.
@@ -218,6 +209,10 @@ protected:
     void OnBoundingBoxChanged();
     /// Handle the enabled status changing.
     void OnEnabledChanged(bool newEnabled) override;
+    /// Handle the dormant status changing. Keep the drawable in the octree, but out of rendering and queries.
+    void OnDormantChanged(bool newDormant) override;
+    /// Queue insertion to the octree, or keep dormant if the node is dormant.
+    void InsertToOctree();
     /// Remove from the current octree.
     void RemoveFromOctree();
 };
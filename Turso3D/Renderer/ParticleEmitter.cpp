@@ -0,0 +1,456 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Resource/ResourceCache.h"
+#include "Camera.h"
+#include "Model.h"
+#include "ParticleEmitter.h"
+
+#include <tracy/Tracy.hpp>
+
+static const unsigned DEFAULT_MAX_PARTICLES = 1000;
+static const float DEFAULT_EMISSION_RATE = 100.0f;
+static const Vector2 DEFAULT_LIFETIME(1.0f, 2.0f);
+static const Vector3 DEFAULT_VELOCITY_MIN(-1.0f, 2.0f, -1.0f);
+static const Vector3 DEFAULT_VELOCITY_MAX(1.0f, 4.0f, 1.0f);
+
+static Allocator<ParticleEmitterDrawable> drawableAllocator;
+
+ParticleEmitterDrawable::ParticleEmitterDrawable() :
+    numParticles(0),
+    maxParticles(0),
+    pendingTime(0.0f),
+    emissionAccumulator(0.0f),
+    emissionRate(DEFAULT_EMISSION_RATE),
+    emitterSize(Vector3::ZERO),
+    lifetime(DEFAULT_LIFETIME),
+    velocityMin(DEFAULT_VELOCITY_MIN),
+    velocityMax(DEFAULT_VELOCITY_MAX),
+    force(Vector3::ZERO),
+    damping(0.0f),
+    size(Vector2::ONE),
+    rotationSpeedRange(Vector2::ZERO),
+    endUserData(Vector4::ZERO),
+    modelRadius(0.0f),
+    randomState(1),
+    emitting(true)
+{
+    SetFlag(DF_INSTANCED_GEOMETRY | DF_OCTREE_UPDATE_CALL, true);
+    SetMaxParticles(DEFAULT_MAX_PARTICLES);
+}
+
+void ParticleEmitterDrawable::OnWorldBoundingBoxUpdate() const
+{
+    // Include the emitter position so that emission becomes visible even when there are no particles yet
+    worldBoundingBox.Define(WorldPosition());
+    if (numParticles)
+        worldBoundingBox.Merge(particleBox);
+}
+
+void ParticleEmitterDrawable::OnOctreeUpdate(unsigned short, bool)
+{
+    ZoneScoped;
+
+    float timeStep = pendingTime;
+    pendingTime = 0.0f;
+
+    if (timeStep > 0.0f)
+    {
+        SimulateParticles(timeStep);
+        EmitParticles(timeStep);
+    }
+
+    BuildInstances();
+    SetFlag(DF_BOUNDING_BOX_DIRTY, true);
+}
+
+bool ParticleEmitterDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if (instances.empty())
+        return false;
+
+    distance = camera->Distance(WorldBoundingBox().Center());
+
+    if (maxDistance > 0.0f && distance > maxDistance)
+        return false;
+
+    return true;
+}
+
+template <class T> void AppendParticleInstances(T& dest, const UserInstanceDataVector& instances, unsigned short textureLayer)
+{
+    size_t start = dest.size();
+    dest.insert(dest.end(), instances.begin(), instances.end());
+
+    // The instances are built with the default texture layer, so only a material variant requires patching
+    if (textureLayer)
+    {
+        for (size_t i = start; i < dest.size(); ++i)
+            dest[i].textureLayer = (float)textureLayer;
+    }
+}
+
+void ParticleEmitterDrawable::OnAddInstances(InstanceDataVector& dest, UserInstanceDataVector* userDest, size_t, unsigned short textureLayer) const
+{
+    if (userDest)
+        AppendParticleInstances(*userDest, instances, textureLayer);
+    else
+        AppendParticleInstances(dest, instances, textureLayer);
+}
+
+void ParticleEmitterDrawable::SetMaxParticles(size_t num)
+{
+    maxParticles = num;
+    numParticles = Min(numParticles, num);
+
+    positionX.resize(num);
+    positionY.resize(num);
+    positionZ.resize(num);
+    velocityX.resize(num);
+    velocityY.resize(num);
+    velocityZ.resize(num);
+    age.resize(num);
+    invLifetime.resize(num);
+    rotation.resize(num);
+    rotationSpeed.resize(num);
+    instances.reserve(num);
+}
+
+void ParticleEmitterDrawable::EmitParticles(float timeStep)
+{
+    if (!emitting)
+    {
+        emissionAccumulator = 0.0f;
+        return;
+    }
+
+    emissionAccumulator += emissionRate * timeStep;
+    size_t numNew = (size_t)emissionAccumulator;
+    emissionAccumulator -= (float)numNew;
+    numNew = Min(numNew, maxParticles - numParticles);
+
+    const Matrix3x4& transform = WorldTransform();
+
+    for (size_t i = numParticles; i < numParticles + numNew; ++i)
+    {
+        Vector3 localPosition((RandomValue() - 0.5f) * emitterSize.x, (RandomValue() - 0.5f) * emitterSize.y, (RandomValue() - 0.5f) * emitterSize.z);
+        Vector3 localVelocity(Lerp(velocityMin.x, velocityMax.x, RandomValue()), Lerp(velocityMin.y, velocityMax.y, RandomValue()),
+            Lerp(velocityMin.z, velocityMax.z, RandomValue()));
+        Vector3 position = transform * localPosition;
+        Vector3 velocity = transform * Vector4(localVelocity, 0.0f);
+
+        positionX[i] = position.x;
+        positionY[i] = position.y;
+        positionZ[i] = position.z;
+        velocityX[i] = velocity.x;
+        velocityY[i] = velocity.y;
+        velocityZ[i] = velocity.z;
+        age[i] = 0.0f;
+        invLifetime[i] = 1.0f / Max(Lerp(lifetime.x, lifetime.y, RandomValue()), M_EPSILON);
+        rotation[i] = RandomValue() * 360.0f;
+        rotationSpeed[i] = Lerp(rotationSpeedRange.x, rotationSpeedRange.y, RandomValue());
+    }
+
+    numParticles += numNew;
+}
+
+void ParticleEmitterDrawable::SimulateParticles(float timeStep)
+{
+    size_t num = numParticles;
+    if (!num)
+        return;
+
+    float* px = &positionX[0];
+    float* py = &positionY[0];
+    float* pz = &positionZ[0];
+    float* vx = &velocityX[0];
+    float* vy = &velocityY[0];
+    float* vz = &velocityZ[0];
+    float* ages = &age[0];
+    float* invLifetimes = &invLifetime[0];
+    float* rotations = &rotation[0];
+    float* rotationSpeeds = &rotationSpeed[0];
+
+    float velocityScale = Max(1.0f - damping * timeStep, 0.0f);
+    Vector3 deltaVelocity = force * timeStep;
+
+    // Integrate each component array in its own branchless loop, which the compiler can vectorize
+    for (size_t i = 0; i < num; ++i)
+        ages[i] += timeStep;
+    for (size_t i = 0; i < num; ++i)
+        rotations[i] += rotationSpeeds[i] * timeStep;
+    for (size_t i = 0; i < num; ++i)
+    {
+        vx[i] = (vx[i] + deltaVelocity.x) * velocityScale;
+        px[i] += vx[i] * timeStep;
+    }
+    for (size_t i = 0; i < num; ++i)
+    {
+        vy[i] = (vy[i] + deltaVelocity.y) * velocityScale;
+        py[i] += vy[i] * timeStep;
+    }
+    for (size_t i = 0; i < num; ++i)
+    {
+        vz[i] = (vz[i] + deltaVelocity.z) * velocityScale;
+        pz[i] += vz[i] * timeStep;
+    }
+
+    // Remove expired particles by moving the last particle in their place
+    for (size_t i = 0; i < num; )
+    {
+        if (ages[i] * invLifetimes[i] >= 1.0f)
+        {
+            --num;
+            px[i] = px[num];
+            py[i] = py[num];
+            pz[i] = pz[num];
+            vx[i] = vx[num];
+            vy[i] = vy[num];
+            vz[i] = vz[num];
+            ages[i] = ages[num];
+            invLifetimes[i] = invLifetimes[num];
+            rotations[i] = rotations[num];
+            rotationSpeeds[i] = rotationSpeeds[num];
+        }
+        else
+            ++i;
+    }
+
+    numParticles = num;
+}
+
+void ParticleEmitterDrawable::BuildInstances()
+{
+    instances.clear();
+
+    size_t num = numParticles;
+    if (!num)
+        return;
+
+    const float* px = &positionX[0];
+    const float* py = &positionY[0];
+    const float* pz = &positionZ[0];
+    const float* ages = &age[0];
+    const float* invLifetimes = &invLifetime[0];
+    const float* rotations = &rotation[0];
+
+    // Reduce the bounds per component so that the loops can be vectorized
+    float minX = px[0], maxX = px[0];
+    float minY = py[0], maxY = py[0];
+    float minZ = pz[0], maxZ = pz[0];
+    for (size_t i = 1; i < num; ++i)
+    {
+        minX = Min(minX, px[i]);
+        maxX = Max(maxX, px[i]);
+    }
+    for (size_t i = 1; i < num; ++i)
+    {
+        minY = Min(minY, py[i]);
+        maxY = Max(maxY, py[i]);
+    }
+    for (size_t i = 1; i < num; ++i)
+    {
+        minZ = Min(minZ, pz[i]);
+        maxZ = Max(maxZ, pz[i]);
+    }
+
+    // Expand by the largest scaled model extent, as the particles may be rotated
+    float extent = Max(Abs(size.x), Abs(size.y)) * modelRadius;
+    particleBox.Define(Vector3(minX - extent, minY - extent, minZ - extent), Vector3(maxX + extent, maxY + extent, maxZ + extent));
+
+    float sizeDelta = size.y - size.x;
+
+    for (size_t i = 0; i < num; ++i)
+    {
+        float t = ages[i] * invLifetimes[i];
+        float scale = size.x + sizeDelta * t;
+        float cosScaled = Cos(rotations[i]) * scale;
+        float sinScaled = Sin(rotations[i]) * scale;
+
+        instances.push_back(UserInstanceData(Matrix3x4(
+            cosScaled, 0.0f, sinScaled, px[i],
+            0.0f, scale, 0.0f, py[i],
+            -sinScaled, 0.0f, cosScaled, pz[i]
+        ), 0.0f, userData.Lerp(endUserData, t)));
+    }
+}
+
+float ParticleEmitterDrawable::RandomValue()
+{
+    // Xorshift generator
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (randomState >> 8) * (1.0f / 16777216.0f);
+}
+
+ParticleEmitter::ParticleEmitter()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+}
+
+ParticleEmitter::~ParticleEmitter()
+{
+    if (drawable)
+    {
+        RemoveFromOctree();
+        drawableAllocator.Free(static_cast<ParticleEmitterDrawable*>(drawable));
+        drawable = nullptr;
+    }
+}
+
+void ParticleEmitter::RegisterObject()
+{
+    RegisterFactory<ParticleEmitter>();
+    // Copy base attributes from OctreeNode instead of GeometryNode, as the model attribute needs to be set first so that there is the correct amount of materials to assign
+    CopyBaseAttributes<ParticleEmitter, OctreeNode>();
+    RegisterDerivedType<ParticleEmitter, GeometryNode>();
+    RegisterMixedRefAttribute("model", &ParticleEmitter::ModelAttr, &ParticleEmitter::SetModelAttr, ResourceRef(Model::TypeStatic()));
+    CopyBaseAttribute<ParticleEmitter, GeometryNode>("materials");
+    CopyBaseAttribute<ParticleEmitter, GeometryNode>("userData");
+    RegisterRefAttribute("endUserData", &ParticleEmitter::EndUserData, &ParticleEmitter::SetEndUserData, Vector4::ZERO);
+    RegisterAttribute("maxParticles", &ParticleEmitter::MaxParticles, &ParticleEmitter::SetMaxParticles, DEFAULT_MAX_PARTICLES);
+    RegisterAttribute("emissionRate", &ParticleEmitter::EmissionRate, &ParticleEmitter::SetEmissionRate, DEFAULT_EMISSION_RATE);
+    RegisterAttribute("emitting", &ParticleEmitter::IsEmitting, &ParticleEmitter::SetEmitting, true);
+    RegisterRefAttribute("emitterSize", &ParticleEmitter::EmitterSize, &ParticleEmitter::SetEmitterSize, Vector3::ZERO);
+    RegisterRefAttribute("lifetime", &ParticleEmitter::Lifetime, &ParticleEmitter::SetLifetime, DEFAULT_LIFETIME);
+    RegisterRefAttribute("velocityMin", &ParticleEmitter::VelocityMin, &ParticleEmitter::SetVelocityMin, DEFAULT_VELOCITY_MIN);
+    RegisterRefAttribute("velocityMax", &ParticleEmitter::VelocityMax, &ParticleEmitter::SetVelocityMax, DEFAULT_VELOCITY_MAX);
+    RegisterRefAttribute("force", &ParticleEmitter::Force, &ParticleEmitter::SetForce, Vector3::ZERO);
+    RegisterAttribute("damping", &ParticleEmitter::Damping, &ParticleEmitter::SetDamping, 0.0f);
+    RegisterRefAttribute("size", &ParticleEmitter::Size, &ParticleEmitter::SetSize, Vector2::ONE);
+    RegisterRefAttribute("rotationSpeed", &ParticleEmitter::RotationSpeed, &ParticleEmitter::SetRotationSpeed, Vector2::ZERO);
+}
+
+void ParticleEmitter::Update(float timeStep)
+{
+    if (!octree || !IsEnabled() || IsDormant())
+        return;
+
+    static_cast<ParticleEmitterDrawable*>(drawable)->pendingTime += timeStep;
+    // Queue the octree update, which runs the simulation
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetModel(Model* model)
+{
+    ZoneScoped;
+    MarkAttributesDirty();
+
+    ParticleEmitterDrawable* emitterDrawable = static_cast<ParticleEmitterDrawable*>(drawable);
+    emitterDrawable->model = model;
+    emitterDrawable->modelRadius = 0.0f;
+
+    if (model)
+    {
+        SetNumGeometries(model->NumGeometries());
+        for (size_t i = 0; i < model->NumGeometries(); ++i)
+            SetGeometry(i, model->GetGeometry(i, 0));
+
+        const BoundingBox& box = model->LocalBoundingBox();
+        emitterDrawable->modelRadius = Vector3(Max(Abs(box.min.x), Abs(box.max.x)), Max(Abs(box.min.y), Abs(box.max.y)),
+            Max(Abs(box.min.z), Abs(box.max.z))).Length();
+    }
+    else
+    {
+        SetNumGeometries(0);
+    }
+
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetMaxParticles(unsigned num)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->SetMaxParticles(num);
+}
+
+void ParticleEmitter::SetEmissionRate(float rate)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->emissionRate = Max(rate, 0.0f);
+}
+
+void ParticleEmitter::SetEmitting(bool enable)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->emitting = enable;
+}
+
+void ParticleEmitter::SetEmitterSize(const Vector3& size)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->emitterSize = size;
+}
+
+void ParticleEmitter::SetLifetime(const Vector2& minMax)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->lifetime = minMax;
+}
+
+void ParticleEmitter::SetVelocityMin(const Vector3& velocity)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->velocityMin = velocity;
+}
+
+void ParticleEmitter::SetVelocityMax(const Vector3& velocity)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->velocityMax = velocity;
+}
+
+void ParticleEmitter::SetForce(const Vector3& force)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->force = force;
+}
+
+void ParticleEmitter::SetDamping(float damping)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->damping = Max(damping, 0.0f);
+}
+
+void ParticleEmitter::SetSize(const Vector2& startEnd)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->size = startEnd;
+}
+
+void ParticleEmitter::SetRotationSpeed(const Vector2& minMax)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->rotationSpeedRange = minMax;
+}
+
+void ParticleEmitter::SetEndUserData(const Vector4& data)
+{
+    MarkAttributesDirty();
+    static_cast<ParticleEmitterDrawable*>(drawable)->endUserData = data;
+}
+
+void ParticleEmitter::RemoveAllParticles()
+{
+    ParticleEmitterDrawable* emitterDrawable = static_cast<ParticleEmitterDrawable*>(drawable);
+    emitterDrawable->numParticles = 0;
+    emitterDrawable->instances.clear();
+    OnBoundingBoxChanged();
+}
+
+Model* ParticleEmitter::GetModel() const
+{
+    return static_cast<ParticleEmitterDrawable*>(drawable)->model;
+}
+
+void ParticleEmitter::SetModelAttr(const ResourceRef& value)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetModel(cache->LoadResource<Model>(value.name));
+}
+
+ResourceRef ParticleEmitter::ModelAttr() const
+{
+    return ResourceRef(Model::TypeStatic(), ResourceName(GetModel()));
+}
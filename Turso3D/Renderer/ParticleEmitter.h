@@ -0,0 +1,183 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+class Model;
+
+/// Particle emitter drawable. Simulates the particles in world space as separate component arrays and renders them as instances of the model geometries.
+class ParticleEmitterDrawable : public GeometryDrawable
+{
+    friend class ParticleEmitter;
+
+public:
+    /// Construct.
+    ParticleEmitterDrawable();
+
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Simulate the particles for the accumulated time and build the instances. Called by Octree in worker threads.
+    void OnOctreeUpdate(unsigned short frameNumber, bool wasInView) override;
+    /// Prepare object for rendering. Calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Append the instances to render for a geometry index. Called by Renderer concurrently from worker threads; only reads the particles built in the octree update.
+    void OnAddInstances(InstanceDataVector& dest, UserInstanceDataVector* userDest, size_t geomIndex, unsigned short textureLayer) const override;
+
+    /// Return number of live particles.
+    size_t NumParticles() const { return numParticles; }
+
+private:
+    /// Resize the particle arrays.
+    void SetMaxParticles(size_t num);
+    /// Emit new particles for a time step.
+    void EmitParticles(float timeStep);
+    /// Advance the particles by a time step and remove the expired ones.
+    void SimulateParticles(float timeStep);
+    /// Build the instance transforms and the aggregate bounding box.
+    void BuildInstances();
+    /// Return a random value between 0 and 1 from the emitter's own generator, which is safe to use in worker threads.
+    float RandomValue();
+
+    /// Current model resource.
+    SharedPtr<Model> model;
+    /// Particle position X components.
+    std::vector<float> positionX;
+    /// Particle position Y components.
+    std::vector<float> positionY;
+    /// Particle position Z components.
+    std::vector<float> positionZ;
+    /// Particle velocity X components.
+    std::vector<float> velocityX;
+    /// Particle velocity Y components.
+    std::vector<float> velocityY;
+    /// Particle velocity Z components.
+    std::vector<float> velocityZ;
+    /// Particle ages in seconds.
+    std::vector<float> age;
+    /// Particle inverse lifetimes.
+    std::vector<float> invLifetime;
+    /// Particle rotations in degrees.
+    std::vector<float> rotation;
+    /// Particle rotation speeds in degrees per second.
+    std::vector<float> rotationSpeed;
+    /// Instances built from the particles. The user data is only copied when the pass reads it.
+    UserInstanceDataVector instances;
+    /// Combined bounding box of the particles.
+    BoundingBox particleBox;
+    /// Number of live particles.
+    size_t numParticles;
+    /// Maximum number of particles.
+    size_t maxParticles;
+    /// Time accumulated since the last simulation.
+    float pendingTime;
+    /// Fractional particles to emit.
+    float emissionAccumulator;
+    /// Emission rate in particles per second.
+    float emissionRate;
+    /// Emission box size in local space.
+    Vector3 emitterSize;
+    /// Minimum and maximum lifetime.
+    Vector2 lifetime;
+    /// Minimum initial velocity in local space.
+    Vector3 velocityMin;
+    /// Maximum initial velocity in local space.
+    Vector3 velocityMax;
+    /// Constant acceleration in world space.
+    Vector3 force;
+    /// Fraction of velocity lost per second.
+    float damping;
+    /// Scale at the start and end of lifetime.
+    Vector2 size;
+    /// Minimum and maximum rotation speed in degrees per second.
+    Vector2 rotationSpeedRange;
+    /// Per-instance user data at the end of lifetime.
+    Vector4 endUserData;
+    /// Radius of the model around its origin.
+    float modelRadius;
+    /// Random number generator state.
+    unsigned randomState;
+    /// Emitting flag.
+    bool emitting;
+};
+
+/// %Scene node that emits particles simulated on the CPU and renders them instanced. The emitter culls as a single drawable through the combined bounds of its particles.
+class ParticleEmitter : public GeometryNode
+{
+    OBJECT(ParticleEmitter);
+
+public:
+    /// Construct.
+    ParticleEmitter();
+    /// Destruct.
+    ~ParticleEmitter();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Advance the emitter by a time step. The simulation runs during the next octree update. No-op when not in an octree, disabled or dormant.
+    void Update(float timeStep);
+    /// Set the model resource whose geometries are rendered for each particle. LOD levels are not used.
+    void SetModel(Model* model);
+    /// Set maximum number of particles. Default 1000.
+    void SetMaxParticles(unsigned num);
+    /// Set emission rate in particles per second. Default 100.
+    void SetEmissionRate(float rate);
+    /// Set whether is emitting new particles. Existing particles live out their lifetime regardless. Default true.
+    void SetEmitting(bool enable);
+    /// Set emission box size in local space. Default zero, which emits from the node position.
+    void SetEmitterSize(const Vector3& size);
+    /// Set minimum and maximum lifetime in seconds. Default 1-2.
+    void SetLifetime(const Vector2& minMax);
+    /// Set minimum initial velocity in local space.
+    void SetVelocityMin(const Vector3& velocity);
+    /// Set maximum initial velocity in local space.
+    void SetVelocityMax(const Vector3& velocity);
+    /// Set constant acceleration in world space, for example gravity. Default zero.
+    void SetForce(const Vector3& force);
+    /// Set fraction of velocity lost per second. Default 0.
+    void SetDamping(float damping);
+    /// Set scale at the start and end of lifetime. Default 1 for both.
+    void SetSize(const Vector2& startEnd);
+    /// Set minimum and maximum rotation speed around the world Y axis in degrees per second. Default zero.
+    void SetRotationSpeed(const Vector2& minMax);
+    /// Set per-instance user data at the end of lifetime. The node's user data is used at the start, and interpolated between them over the lifetime.
+    void SetEndUserData(const Vector4& data);
+    /// Remove all live particles.
+    void RemoveAllParticles();
+
+    /// Return the model resource.
+    Model* GetModel() const;
+    /// Return maximum number of particles.
+    unsigned MaxParticles() const { return (unsigned)static_cast<ParticleEmitterDrawable*>(drawable)->maxParticles; }
+    /// Return emission rate.
+    float EmissionRate() const { return static_cast<ParticleEmitterDrawable*>(drawable)->emissionRate; }
+    /// Return whether is emitting.
+    bool IsEmitting() const { return static_cast<ParticleEmitterDrawable*>(drawable)->emitting; }
+    /// Return emission box size.
+    const Vector3& EmitterSize() const { return static_cast<ParticleEmitterDrawable*>(drawable)->emitterSize; }
+    /// Return minimum and maximum lifetime.
+    const Vector2& Lifetime() const { return static_cast<ParticleEmitterDrawable*>(drawable)->lifetime; }
+    /// Return minimum initial velocity.
+    const Vector3& VelocityMin() const { return static_cast<ParticleEmitterDrawable*>(drawable)->velocityMin; }
+    /// Return maximum initial velocity.
+    const Vector3& VelocityMax() const { return static_cast<ParticleEmitterDrawable*>(drawable)->velocityMax; }
+    /// Return constant acceleration.
+    const Vector3& Force() const { return static_cast<ParticleEmitterDrawable*>(drawable)->force; }
+    /// Return velocity damping.
+    float Damping() const { return static_cast<ParticleEmitterDrawable*>(drawable)->damping; }
+    /// Return scale at the start and end of lifetime.
+    const Vector2& Size() const { return static_cast<ParticleEmitterDrawable*>(drawable)->size; }
+    /// Return minimum and maximum rotation speed.
+    const Vector2& RotationSpeed() const { return static_cast<ParticleEmitterDrawable*>(drawable)->rotationSpeedRange; }
+    /// Return per-instance user data at the end of lifetime.
+    const Vector4& EndUserData() const { return static_cast<ParticleEmitterDrawable*>(drawable)->endUserData; }
+    /// Return number of live particles.
+    size_t NumParticles() const { return static_cast<ParticleEmitterDrawable*>(drawable)->numParticles; }
+
+protected:
+    /// Set model attribute. Used in serialization.
+    void SetModelAttr(const ResourceRef& value);
+    /// Return model attribute. Used in serialization.
+    ResourceRef ModelAttr() const;
+};
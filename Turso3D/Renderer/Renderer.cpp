@@ -3,6 +3,7 @@
 #include "../Graphics/FrameBuffer.h"
 #include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
+#include "../Graphics/IndirectBuffer.h"
 #include "../Graphics/RenderBuffer.h"
 #include "../Graphics/Shader.h"
 #include "../Graphics/ShaderProgram.h"
@@ -23,8 +24,10 @@
 #include "Material.h"
 #include "Model.h"
 #include "Octree.h"
+#include "ParticleEmitter.h"
 #include "Renderer.h"
 #include "StaticModel.h"
+#include "Terrain.h"
 
 #include <algorithm>
 #include <cstring>
@@ -48,10 +51,16 @@ struct CollectOctantsTask : public MemberFunctionTask<Renderer>
     {
     }
 
-    /// Starting point octant.
+    /// Starting point octant, or null to collect the spatial hash grid cells.
     Octant* startOctant;
     /// Result structure index.
     size_t resultIdx;
+    /// Parent task index, or M_MAX_UNSIGNED if none.
+    size_t parentIdx;
+    /// Frustum plane mask resolved from the ancestor octants.
+    unsigned char planeMask;
+    /// Whether to recurse into child octants. False when the children have tasks of their own.
+    bool recursive;
 };
 
 /// %Task for collecting geometry batches from octants.
@@ -111,6 +120,7 @@ struct CullLightsTask : public MemberFunctionTask<Renderer>
 void ThreadOctantResult::Clear()
 {
     drawableAcc = 0;
+    numDrawables = 0;
     taskOctantIdx = 0;
     batchTaskIdx = 0;
     lights.clear();
@@ -144,7 +154,8 @@ void ShadowMap::Clear()
     freeCasterListIdx = 0;
     allocator.Reset(texture->Width(), texture->Height(), 0, 0, false);
     shadowViews.clear();
-    instanceTransforms.clear();
+    instanceData.clear();
+    userInstanceData.clear();
 
     for (auto it = shadowBatches.begin(); it != shadowBatches.end(); ++it)
         it->Clear();
@@ -155,8 +166,18 @@ void ShadowMap::Clear()
 Renderer::Renderer() :
     graphics(Subsystem<Graphics>()),
     workQueue(Subsystem<WorkQueue>()),
+    debugRenderer(nullptr),
     frameNumber(0),
+    drawDebug(false),
     clusterFrustumsDirty(true),
+    useMultiDraw(true),
+    numOctantTasks(0),
+    viewResult(&viewResults[0]),
+    lastViewResult(&viewResults[1]),
+    maxLights(0),
+    maxShadowedLights(0),
+    lightBudgetHysteresis(1.25f),
+    lightFadeTime(0.25f),
     depthBiasMul(1.0f),
     slopeScaleBiasMul(1.0f)
 {
@@ -173,8 +194,18 @@ Renderer::Renderer() :
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+        instanceVertexElements.push_back(VertexElement(ELEM_FLOAT, SEM_TEXCOORD, 6));
+
+        // Only passes that read user data pay for the wider instances
+        userInstanceVertexBuffer = new VertexBuffer();
+        userInstanceVertexElements = instanceVertexElements;
+        userInstanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 7));
     }
 
+    hasMultiDraw = graphics->HasMultiDrawIndirect();
+    if (hasMultiDraw)
+        indirectBuffer = new IndirectBuffer();
+
     clusterTexture = new Texture();
     clusterTexture->Define(TEX_3D, IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RGBA32U, 1);
     clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
@@ -183,6 +214,7 @@ Renderer::Renderer() :
     clusterData = new unsigned char[MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
     lightData = new LightData[MAX_LIGHTS + 1];
     memset(lightData, 0, (MAX_LIGHTS + 1) * sizeof(LightData));
+    memset(&lightBudgetStats, 0, sizeof lightBudgetStats);
 
     perViewDataBuffer = new UniformBuffer();
     perViewDataBuffer->Define(USAGE_DYNAMIC, sizeof(PerViewUniforms));
@@ -190,10 +222,10 @@ Renderer::Renderer() :
     lightDataBuffer = new UniformBuffer();
     lightDataBuffer->Define(USAGE_DYNAMIC, (MAX_LIGHTS + 1) * sizeof(LightData));
 
-    octantResults = new ThreadOctantResult[NUM_OCTANT_TASKS];
+    octantResults = new ThreadOctantResult[MAX_OCTANT_TASKS];
     batchResults = new ThreadBatchResult[workQueue->NumThreads()];
 
-    for (size_t i = 0; i < NUM_OCTANTS + 1; ++i)
+    for (size_t i = 0; i < MAX_OCTANT_TASKS; ++i)
     {
         collectOctantsTasks[i] = new CollectOctantsTask(this, &Renderer::CollectOctantsWork);
         collectOctantsTasks[i]->resultIdx = i;
@@ -206,14 +238,19 @@ Renderer::Renderer() :
     }
 
     processLightsTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessLightsWork);
-    batchesReadyTask = new MemberFunctionTask<Renderer>(this, &Renderer::BatchesReadyWork);
-    processShadowCastersTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessShadowCastersWork);
 
     DefineBoundingBoxGeometry();
 }
 
 Renderer::~Renderer()
 {
+    if (viewResultOctree)
+    {
+        viewResultOctree->RemoveVisibilitySet(&viewResults[0].visibleDrawables);
+        viewResultOctree->RemoveVisibilitySet(&viewResults[1].visibleDrawables);
+    }
+
+    Material::ReleaseUniformBuffers();
     RemoveSubsystem(this);
 }
 
@@ -253,6 +290,47 @@ void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMu
     shadowMapsDirty = true;
 }
 
+void Renderer::SetDrawDebug(bool enable)
+{
+    drawDebug = enable;
+}
+
+void Renderer::SetLightBudget(unsigned maxLights_, unsigned maxShadowedLights_)
+{
+    maxLights = maxLights_;
+    maxShadowedLights = maxShadowedLights_;
+}
+
+void Renderer::SetLightBudgetHysteresis(float factor)
+{
+    lightBudgetHysteresis = Max(factor, 1.0f);
+}
+
+void Renderer::SetLightFadeTime(float time)
+{
+    lightFadeTime = Max(time, 0.0f);
+}
+
+void Renderer::SetUseMultiDraw(bool enable)
+{
+    useMultiDraw = enable;
+}
+
+void Renderer::ReleaseInstanceData()
+{
+    InstanceDataVector().swap(instanceData);
+    UserInstanceDataVector().swap(userInstanceData);
+
+    if (shadowMaps)
+    {
+        for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+        {
+            InstanceDataVector().swap(shadowMaps[i].instanceData);
+            UserInstanceDataVector().swap(shadowMaps[i].userInstanceData);
+        }
+    }
+}
+
 void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bool useOcclusion_)
 {
     ZoneScoped;
@@ -276,15 +354,18 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     useOcclusion = useOcclusion_;
     frustum = camera->WorldFrustum();
     viewMask = camera->ViewMask();
+    debugRenderer = drawDebug ? Subsystem<DebugRenderer>() : nullptr;
 
     // Clear results from last frame
     dirLight = nullptr;
     lastCamera = nullptr;
-    rootLevelOctants.clear();
+    numOctantTasks = 0;
     opaqueBatches.Clear();
     alphaBatches.Clear();
     lights.clear();
-    instanceTransforms.clear();
+    instanceData.clear();
+    userInstanceData.clear();
+    indirectCommands.clear();
     
     minZ = M_MAX_FLOAT;
     maxZ = 0.0f;
@@ -293,7 +374,7 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     // Stagger for occlusion queries based on last frametime
     lastFrameTime = graphics->LastFrameTime();
 
-    for (size_t i = 0; i < NUM_OCTANT_TASKS; ++i)
+    for (size_t i = 0; i < MAX_OCTANT_TASKS; ++i)
         octantResults[i].Clear();
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
         batchResults[i].Clear();
@@ -304,8 +385,27 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
             shadowMaps[i].Clear();
     }
 
+    // Register the view results with the octree so that freed and reused drawable ids do not report their previous holder as visible.
+    // Results from another octree refer to other drawables, so clear them
+    if (viewResultOctree.Get() != octree)
+    {
+        for (size_t i = 0; i < 2; ++i)
+        {
+            if (viewResultOctree)
+                viewResultOctree->RemoveVisibilitySet(&viewResults[i].visibleDrawables);
+            octree->AddVisibilitySet(&viewResults[i].visibleDrawables);
+            viewResults[i].visibleDrawables.Reset(0);
+            viewResults[i].splitOctants.clear();
+        }
+        viewResultOctree = octree;
+    }
+
+    // The previous view's results become the last view, which tells animation updates and light shadow map caching whether drawables were in view
+    std::swap(viewResult, lastViewResult);
+    viewResult->splitOctants.clear();
+
     // Process moved / animated objects' octree reinsertions
-    octree->Update(frameNumber);
+    octree->Update(frameNumber, &lastViewResult->visibleDrawables);
 
     // Precalculate SAT test parameters for accurate frustum test (verify what octants to occlusion query)
     if (useOcclusion)
@@ -315,48 +415,39 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     CheckOcclusionQueries();
     octree->FinishUpdate();
 
-    // Find the starting points for octree traversal. Include the root if it contains drawables that didn't fit elsewhere
-    Octant* rootOctant = octree->Root();
-    if (rootOctant->Drawables().size())
-        rootLevelOctants.push_back(rootOctant);
+    // Drawable ids are stable until the next octree update, so size the visibility bits now
+    viewResult->visibleDrawables.Reset(octree->NumDrawableIds());
 
-    for (size_t i = 0; i < NUM_OCTANTS; ++i)
-    {
-        if (rootOctant->Child(i))
-            rootLevelOctants.push_back(rootOctant->Child(i));
-    }
+    // Find the starting points for octree traversal
+    SetupOctantTasks();
 
     // If no root level octants, must early-out the view preparation; there is nothing to render and task dependencies would not complete
-    if (rootLevelOctants.empty())
+    if (!numOctantTasks)
         return;
 
     // Enable threaded update during geometry / light gathering in case nodes' OnPrepareRender() causes further reinsertion queuing
     octree->SetThreadedUpdate(workQueue->NumThreads() > 1);
 
     // Keep track of both batch + octant task progress before main batches can be sorted (batch tasks will add to the counter when queued)
-    numPendingBatchTasks.store((int)rootLevelOctants.size());
+    numPendingBatchTasks.store((int)numOctantTasks);
+    numPendingShadowCasterTasks.store(0);
     numPendingShadowViews[0].store(0);
     numPendingShadowViews[1].store(0);
 
-    // Ensure shadowcaster processing doesn't happen before lights have been found and processed, and geometry bounds are known
-    // Note: this task is also needed without shadows, as it initiates light grid culling
-    workQueue->AddDependency(processShadowCastersTask, processLightsTask);
-    workQueue->AddDependency(processShadowCastersTask, batchesReadyTask);
-
     // Find octants in view and their plane masks for node frustum culling. At the same time, find lights and process them
     // When octant collection tasks complete, they queue tasks for collecting batches from those octants.
-    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
-    {
-        collectOctantsTasks[i]->startOctant = rootLevelOctants[i];
+    for (size_t i = 0; i < numOctantTasks; ++i)
         workQueue->AddDependency(processLightsTask, collectOctantsTasks[i]);
-    }
 
-    workQueue->QueueTasks(rootLevelOctants.size(), reinterpret_cast<Task**>(&collectOctantsTasks[0]));
+    workQueue->QueueTasks(numOctantTasks, reinterpret_cast<Task**>(&collectOctantsTasks[0]));
 
     // Execute tasks until can sort the main batches. Perform that in the main thread to potentially run faster
     while (numPendingBatchTasks.load() > 0)
         workQueue->TryComplete();
 
+    // Octant collection has finished, so the drawable counts are final for deciding next frame's task splits
+    UpdateOctantTaskSplits();
+
     SortMainBatches();
 
     // Finish remaining view preparation tasks (shadowcaster batches, light culling to frustum grid)
@@ -368,6 +459,9 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
 
 void Renderer::RenderShadowMaps()
 {
+    // Upload changed material uniforms once before any rendering
+    Material::UpdateUniforms();
+
     if (!shadowMaps)
         return;
 
@@ -383,7 +477,7 @@ void Renderer::RenderShadowMaps()
         if (shadowMap.shadowViews.empty())
             continue;
 
-        UpdateInstanceTransforms(shadowMap.instanceTransforms);
+        UpdateInstanceData(shadowMap.instanceData, shadowMap.userInstanceData);
 
         shadowMap.fbo->Bind();
 
@@ -456,8 +550,9 @@ void Renderer::RenderOpaque(bool clear)
 {
     ZoneScoped;
 
-    // Update main batches' instance transforms & light data
-    UpdateInstanceTransforms(instanceTransforms);
+    // Update material uniforms, main batches' instance data & light data
+    Material::UpdateUniforms();
+    UpdateInstanceData(instanceData, userInstanceData);
     UpdateLightData();
 
     if (shadowMaps)
@@ -510,7 +605,7 @@ void Renderer::RenderDebug()
     for (auto it = lights.begin(); it != lights.end(); ++it)
         (*it)->OnRenderDebug(debug);
 
-    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+    for (size_t i = 0; i < numOctantTasks; ++i)
     {
         const ThreadOctantResult& result = octantResults[i];
 
@@ -523,7 +618,7 @@ void Renderer::RenderDebug()
             for (auto dIt = drawables.begin(); dIt != drawables.end(); ++dIt)
             {
                 Drawable* drawable = *dIt;
-                if (drawable->TestFlag(DF_GEOMETRY) && drawable->LastFrameNumber() == frameNumber)
+                if (drawable->TestFlag(DF_GEOMETRY) && viewResult->visibleDrawables.Test(drawable->Id()))
                     drawable->OnRenderDebug(debug);
             }
         }
@@ -535,7 +630,7 @@ Texture* Renderer::ShadowMapTexture(size_t index) const
     return (shadowMaps && index < NUM_SHADOW_MAPS) ? shadowMaps[index].texture : nullptr;
 }
 
-void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask)
+void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask, bool recursive)
 {
     const BoundingBox& octantBox = octant->CullingBox();
 
@@ -546,8 +641,9 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
         if (planeMask == 0xff)
         {
             // If octant becomes frustum culled, reset its visibility for when it comes back to view, including its children
+            // unless they are being processed by their own tasks
             if (useOcclusion && octant->Visibility() != VIS_OUTSIDE_FRUSTUM)
-                octant->SetVisibility(VIS_OUTSIDE_FRUSTUM, true);
+                octant->SetVisibility(VIS_OUTSIDE_FRUSTUM, recursive);
             return;
         }
     }
@@ -573,7 +669,7 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
             // If octant was occluded previously, but its parent came into view, issue tests along the hierarchy but do not render on this frame
         case VIS_OCCLUDED_UNKNOWN:
             AddOcclusionQuery(octant, result, planeMask);
-            if (octant != octree->Root() && octant->HasChildren())
+            if (recursive && octant->HasChildren())
             {
                 for (size_t i = 0; i < NUM_OCTANTS; ++i)
                 {
@@ -598,6 +694,21 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
         octant->SetVisibility(VIS_VISIBLE_UNKNOWN, false);
     }
 
+    CollectOctantDrawables(octant, result, planeMask);
+
+    // Recurse into child octants unless they have their own tasks
+    if (recursive && octant->HasChildren())
+    {
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->Child(i))
+                CollectOctantsAndLights(octant->Child(i), result, planeMask);
+        }
+    }
+}
+
+void Renderer::CollectOctantDrawables(Octant* octant, ThreadOctantResult& result, unsigned char planeMask)
+{
     const std::vector<Drawable*>& drawables = octant->Drawables();
 
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
@@ -608,13 +719,24 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
         {
             const BoundingBox& lightBox = drawable->WorldBoundingBox();
             if ((drawable->LayerMask() & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(lightBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
-                result.lights.push_back(static_cast<LightDrawable*>(drawable));
+            {
+                LightDrawable* light = static_cast<LightDrawable*>(drawable);
+                // If there was a discontinuity in rendering the light, assume cached shadow map content lost
+                if (!lastViewResult->visibleDrawables.Test(light->Id()))
+                    light->SetShadowMap(nullptr);
+
+                viewResult->visibleDrawables.Set(light->Id());
+                result.lights.push_back(light);
+            }
         }
         // Lights are sorted first in octants, so break when first geometry encountered. Store the octant for batch collecting
         else
         {
             result.octants.push_back(std::make_pair(octant, planeMask));
             result.drawableAcc += drawables.end() - it;
+            result.numDrawables += drawables.end() - it;
+            if (debugRenderer)
+                octant->OnRenderDebug(debugRenderer);
             break;
         }
     }
@@ -635,16 +757,111 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
         result.taskOctantIdx = result.octants.size();
         ++result.batchTaskIdx;
     }
+}
+
+void Renderer::SetupOctantTasks()
+{
+    // Allow more tasks than threads so that the work queue can balance uneven branches. Reserve one task for the spatial hash grid
+    size_t maxTasks = Min(Max(workQueue->NumThreads() * OCTANT_TASKS_PER_THREAD, NUM_OCTANT_TASKS), MAX_OCTANT_TASKS - 1);
+
+    // The root octant is always handled separately from its children. Include it only if it contains drawables that didn't fit elsewhere
+    Octant* rootOctant = octree->Root();
+    if (rootOctant->Drawables().size())
+    {
+        CollectOctantsTask* task = collectOctantsTasks[numOctantTasks++];
+        task->startOctant = rootOctant;
+        task->parentIdx = M_MAX_UNSIGNED;
+        task->planeMask = 0x3f;
+        task->recursive = false;
+    }
 
-    // Root octant is handled separately. Otherwise recurse into child octants
-    if (octant != octree->Root() && octant->HasChildren())
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
-        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        if (rootOctant->Child(i))
         {
-            if (octant->Child(i))
-                CollectOctantsAndLights(octant->Child(i), result, planeMask);
+            CollectOctantsTask* task = collectOctantsTasks[numOctantTasks++];
+            task->startOctant = rootOctant->Child(i);
+            task->parentIdx = M_MAX_UNSIGNED;
+            task->planeMask = 0x3f;
+            task->recursive = true;
         }
     }
+
+    // Split branches that were marked heavy on the previous frame. The task list grows during the loop, so children can be split further.
+    // The split octant keeps a task for its own drawables and occlusion queries, but does not recurse
+    for (size_t i = 0; i < numOctantTasks; ++i)
+    {
+        CollectOctantsTask* task = collectOctantsTasks[i];
+        Octant* octant = task->startOctant;
+        if (!task->recursive || numOctantTasks + octant->NumChildren() > maxTasks)
+            continue;
+        const std::vector<Octant*>& splitOctants = lastViewResult->splitOctants;
+        if (std::find(splitOctants.begin(), splitOctants.end(), octant) == splitOctants.end())
+            continue;
+
+        // Resolve the octant's frustum and occlusion state here, as the child tasks must not start below a culled or occluded octant.
+        // Such branches are left whole to the octant's own task, which skips them or only issues queries along the hierarchy
+        unsigned char planeMask = task->planeMask ? frustum.IsInsideMasked(octant->CullingBox(), task->planeMask) : 0;
+        if (planeMask == 0xff)
+            continue;
+        if (useOcclusion)
+        {
+            OctantVisibility visibility = octant->Visibility();
+            if (visibility == VIS_OCCLUDED || visibility == VIS_OCCLUDED_UNKNOWN)
+                continue;
+            // Reset visibility on coming back to view now, so that the octant's own task does not write it while the child tasks read it
+            if (visibility == VIS_OUTSIDE_FRUSTUM)
+                octant->SetVisibility(VIS_VISIBLE_UNKNOWN, false);
+        }
+
+        task->recursive = false;
+        for (size_t j = 0; j < NUM_OCTANTS; ++j)
+        {
+            if (octant->Child(j))
+            {
+                CollectOctantsTask* childTask = collectOctantsTasks[numOctantTasks++];
+                childTask->startOctant = octant->Child(j);
+                childTask->parentIdx = i;
+                childTask->planeMask = planeMask;
+                childTask->recursive = true;
+            }
+        }
+    }
+
+    if (octree->HashGridCells().size())
+    {
+        CollectOctantsTask* task = collectOctantsTasks[numOctantTasks++];
+        task->startOctant = nullptr;
+        task->parentIdx = M_MAX_UNSIGNED;
+        task->planeMask = 0x3f;
+        task->recursive = false;
+    }
+}
+
+void Renderer::UpdateOctantTaskSplits()
+{
+    // Child tasks are always after their parents, so accumulate the branch totals in reverse
+    size_t totalDrawables = 0;
+    for (size_t i = numOctantTasks - 1; i < numOctantTasks; --i)
+    {
+        size_t parentIdx = collectOctantsTasks[i]->parentIdx;
+        if (parentIdx < numOctantTasks)
+            octantResults[parentIdx].numDrawables += octantResults[i].numDrawables;
+        else
+            totalDrawables += octantResults[i].numDrawables;
+    }
+
+    // A branch is heavy if it holds more than one thread's fair share of the drawables
+    size_t numThreads = workQueue->NumThreads();
+    size_t threshold = Max(totalDrawables / numThreads, DRAWABLES_PER_BATCH_TASK);
+
+    // Only octants measured this frame are recorded, so descendants of recursive tasks are not split on stale counts from earlier frames
+    for (size_t i = 0; i < numOctantTasks && numThreads > 1; ++i)
+    {
+        Octant* octant = collectOctantsTasks[i]->startOctant;
+        if (octant && octant != octree->Root() && octant->HasChildren() && octantResults[i].numDrawables > threshold)
+            viewResult->splitOctants.push_back(octant);
+    }
 }
 
 void Renderer::AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, unsigned char planeMask)
@@ -655,6 +872,160 @@ void Renderer::AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, uns
         result.occlusionQueries.push_back(octant);
 }
 
+void Renderer::SelectLights()
+{
+    ZoneScoped;
+
+    lightBudgetStats.numVisible = lights.size();
+    lightBudgetStats.numFading = 0;
+
+    if (!maxLights && !maxShadowedLights)
+    {
+        lightStates.clear();
+
+        std::sort(lights.begin(), lights.end(), CompareDrawableDistances);
+        if (lights.size() > MAX_LIGHTS)
+            lights.resize(MAX_LIGHTS);
+
+        lightBudgetStats.numSelected = lights.size();
+        lightBudgetStats.numShadowed = 0;
+        for (auto it = lights.begin(); it != lights.end(); ++it)
+        {
+            if (drawShadows && (*it)->ShadowStrength() < 1.0f)
+                ++lightBudgetStats.numShadowed;
+        }
+        lightBudgetStats.numCulled = lightBudgetStats.numVisible - lights.size();
+        return;
+    }
+
+    if (lightStates.size() < octree->NumDrawableIds())
+        lightStates.resize(octree->NumDrawableIds());
+
+    // Lights not in frustum on the previous view start over, so that lights entering the view appear without fading
+    unsigned short lastFrameNumber = frameNumber - 1;
+    if (!lastFrameNumber)
+        --lastFrameNumber;
+
+    float fadeStep = lightFadeTime > 0.0f ? lastFrameTime / lightFadeTime : 1.0f;
+    // Half height of the view at unit distance, or in world units for orthographic cameras
+    float viewHalfHeight = (camera->IsOrthographic() ? camera->OrthoSize() * 0.5f : tanf(camera->Fov() * M_DEGTORAD * 0.5f)) /
+        Max(camera->Zoom(), M_EPSILON);
+
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+    {
+        LightDrawable* light = *it;
+        LightBudgetState& state = lightStates[light->Id()];
+        if (state.light != light)
+        {
+            state.light = light;
+            state.frameNumber = 0;
+        }
+        if (state.frameNumber != lastFrameNumber)
+        {
+            state.fade = 0.0f;
+            state.selected = false;
+            state.shadowed = false;
+        }
+
+        // Importance is brightness times the fraction of the view height covered by the light range
+        float halfHeight = camera->IsOrthographic() ? viewHalfHeight : viewHalfHeight * Max(light->Distance(), M_EPSILON);
+        float coverage = Min(light->Range() / halfHeight, 1.0f);
+        state.importance = light->EffectiveColor().Average() * coverage * coverage;
+    }
+
+    float hysteresis = lightBudgetHysteresis;
+    const std::vector<LightBudgetState>& states = lightStates;
+
+    // Rank by importance, favoring the previous selection
+    std::sort(lights.begin(), lights.end(), [&states, hysteresis](LightDrawable* lhs, LightDrawable* rhs)
+    {
+        const LightBudgetState& lhsState = states[lhs->Id()];
+        const LightBudgetState& rhsState = states[rhs->Id()];
+        return lhsState.importance * (lhsState.selected ? hysteresis : 1.0f) > rhsState.importance * (rhsState.selected ? hysteresis : 1.0f);
+    });
+
+    size_t numSelect = maxLights && maxLights < MAX_LIGHTS ? maxLights : MAX_LIGHTS;
+    size_t numKept = 0;
+    lightBudgetStats.numSelected = 0;
+
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
+        LightBudgetState& state = lightStates[light->Id()];
+        bool isNew = state.frameNumber != lastFrameNumber;
+        state.frameNumber = frameNumber;
+
+        if (i < numSelect)
+        {
+            // Newly seen lights appear at full strength, previously rejected lights fade in
+            state.fade = isNew ? 1.0f : Min(state.fade + fadeStep, 1.0f);
+            state.selected = true;
+            ++lightBudgetStats.numSelected;
+        }
+        else
+        {
+            // Rejected lights fade out while still rendered, up to the hard limit
+            state.selected = false;
+            state.shadowed = false;
+            state.fade = Max(state.fade - fadeStep, 0.0f);
+            if (state.fade <= 0.0f || numKept >= MAX_LIGHTS)
+            {
+                state.fade = 0.0f;
+                light->SetShadowMap(nullptr);
+                continue;
+            }
+        }
+
+        if (state.fade < 1.0f)
+            ++lightBudgetStats.numFading;
+        lights[numKept++] = light;
+    }
+
+    lights.resize(numKept);
+
+    // Rank the shadow candidates among the selected lights separately, favoring the previous shadowed lights
+    lightBudgetStats.numShadowed = 0;
+    if (drawShadows)
+    {
+        shadowCandidates.clear();
+        for (auto it = lights.begin(); it != lights.end(); ++it)
+        {
+            LightDrawable* light = *it;
+            if (lightStates[light->Id()].selected && light->ShadowStrength() < 1.0f)
+                shadowCandidates.push_back(light);
+        }
+
+        std::sort(shadowCandidates.begin(), shadowCandidates.end(), [&states, hysteresis](LightDrawable* lhs, LightDrawable* rhs)
+        {
+            const LightBudgetState& lhsState = states[lhs->Id()];
+            const LightBudgetState& rhsState = states[rhs->Id()];
+            return lhsState.importance * (lhsState.shadowed ? hysteresis : 1.0f) > rhsState.importance * (rhsState.shadowed ? hysteresis : 1.0f);
+        });
+
+        size_t numShadowed = maxShadowedLights && maxShadowedLights < shadowCandidates.size() ? maxShadowedLights : shadowCandidates.size();
+        for (size_t i = 0; i < shadowCandidates.size(); ++i)
+        {
+            LightBudgetState& state = lightStates[shadowCandidates[i]->Id()];
+            state.shadowed = i < numShadowed;
+        }
+        lightBudgetStats.numShadowed = numShadowed;
+    }
+    else
+    {
+        for (auto it = lights.begin(); it != lights.end(); ++it)
+            lightStates[(*it)->Id()].shadowed = false;
+    }
+
+    lightBudgetStats.numCulled = lightBudgetStats.numVisible - lights.size();
+
+    std::sort(lights.begin(), lights.end(), CompareDrawableDistances);
+}
+
+bool Renderer::IsShadowAllowed(LightDrawable* light) const
+{
+    return lightStates.empty() || lightStates[light->Id()].shadowed;
+}
+
 bool Renderer::AllocateShadowMap(LightDrawable* light)
 {
     size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
@@ -694,10 +1065,8 @@ bool Renderer::AllocateShadowMap(LightDrawable* light)
     return false;
 }
 
-void Renderer::SortMainBatches()
+void Renderer::MergeGeometryBounds()
 {
-    ZoneScoped;
-
     // Shadowcaster processing needs accurate scene min / max Z results, combine them from per-thread data
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
     {
@@ -709,9 +1078,11 @@ void Renderer::SortMainBatches()
     }
 
     minZ = Max(minZ, camera->NearClip());
+}
 
-    // Signal that shadowcaster processing is OK to happen
-    workQueue->QueueTask(batchesReadyTask);
+void Renderer::SortMainBatches()
+{
+    ZoneScoped;
 
     // Join per-thread collected batches and sort
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
@@ -723,8 +1094,9 @@ void Renderer::SortMainBatches()
             alphaBatches.batches.insert(alphaBatches.batches.end(), res.alphaBatches.begin(), res.alphaBatches.end());
     }
 
-    opaqueBatches.Sort(instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing);
-    alphaBatches.Sort(instanceTransforms, SORT_DISTANCE, hasInstancing);
+    bool multiDraw = hasMultiDraw && useMultiDraw;
+    opaqueBatches.Sort(instanceData, userInstanceData, SORT_STATE_AND_DISTANCE, hasInstancing, multiDraw);
+    alphaBatches.Sort(instanceData, userInstanceData, SORT_DISTANCE, hasInstancing, multiDraw);
 }
 
 void Renderer::SortShadowBatches(ShadowMap& shadowMap)
@@ -744,23 +1116,31 @@ void Renderer::SortShadowBatches(ShadowMap& shadowMap)
         BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
 
         if (destStatic && destStatic->HasBatches())
-            destStatic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+            destStatic->Sort(shadowMap.instanceData, shadowMap.userInstanceData, SORT_STATE, hasInstancing, hasMultiDraw && useMultiDraw);
 
         if (destDynamic->HasBatches())
-            destDynamic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+            destDynamic->Sort(shadowMap.instanceData, shadowMap.userInstanceData, SORT_STATE, hasInstancing, hasMultiDraw && useMultiDraw);
     }
 }
 
-void Renderer::UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms)
+void Renderer::UpdateInstanceData(const InstanceDataVector& data, const UserInstanceDataVector& userData)
 {
     ZoneScoped;
 
-    if (hasInstancing && transforms.size())
+    if (hasInstancing && data.size())
+    {
+        if (instanceVertexBuffer->NumVertices() < data.size())
+            instanceVertexBuffer->Define(USAGE_DYNAMIC, data.size(), instanceVertexElements, &data[0]);
+        else
+            instanceVertexBuffer->SetData(0, data.size(), &data[0]);
+    }
+
+    if (hasInstancing && userData.size())
     {
-        if (instanceVertexBuffer->NumVertices() < transforms.size())
-            instanceVertexBuffer->Define(USAGE_DYNAMIC, transforms.size(), instanceVertexElements, &transforms[0]);
+        if (userInstanceVertexBuffer->NumVertices() < userData.size())
+            userInstanceVertexBuffer->Define(USAGE_DYNAMIC, userData.size(), userInstanceVertexElements, &userData[0]);
         else
-            instanceVertexBuffer->SetData(0, transforms.size(), &transforms[0]);
+            userInstanceVertexBuffer->SetData(0, userData.size(), &userData[0]);
     }
 }
 
@@ -846,6 +1226,13 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
 
     perViewDataBuffer->Bind(UB_PERVIEWDATA);
 
+    // Per-object uniforms of non-instanced draws are set only if the current program declares them, and only when their value changes
+    ShaderProgram* lastProgram = nullptr;
+    bool hasTextureLayer = false;
+    bool hasUserData = false;
+    unsigned short lastTextureLayer = 0;
+    Vector4 lastUserData(Vector4::ZERO);
+
     for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
     {
         const Batch& batch = *it;
@@ -867,9 +1254,10 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
                         texture->Bind(i);
                 }
 
+                // Material uniforms are pooled, so consecutive materials usually only change the bound range
                 UniformBuffer* materialUniforms = material->GetUniformBuffer();
                 if (materialUniforms)
-                    materialUniforms->Bind(UB_MATERIALDATA);
+                    materialUniforms->Bind(UB_MATERIALDATA, material->UniformOffset(), material->UniformDataSize());
 
                 lastMaterial = material;
             }
@@ -889,6 +1277,10 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
         }
 
         Geometry* geometry = batch.geometry;
+        // Use the position-only geometry if the shader reads no other attributes from the vertex buffer, for example in shadow passes
+        if (geometry->positionGeometry && (program->Attributes() & geometry->vertexBuffer->Attributes()) == MASK_POSITION)
+            geometry = geometry->positionGeometry;
+
         VertexBuffer* vb = geometry->vertexBuffer;
         IndexBuffer* ib = geometry->indexBuffer;
         vb->Bind(program->Attributes());
@@ -897,12 +1289,20 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
 
         if (geometryBits == GEOM_INSTANCED)
         {
-            if (ib)
-                graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
-            else
-                graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
+            // Submit a run of instanced batches sharing the buffers as one multi-draw if possible
+            size_t numEntries = ib && hasMultiDraw && useMultiDraw ? MultiDrawBatches(queue, it - queue.batches.begin(), geometry != batch.geometry) : 0;
+            if (!numEntries)
+            {
+                VertexBuffer* instanceVb = batch.pass->ReadsUserData() ? userInstanceVertexBuffer.Get() : instanceVertexBuffer.Get();
+                if (ib)
+                    graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVb, batch.instanceStart, batch.instanceCount);
+                else
+                    graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVb, batch.instanceStart, batch.instanceCount);
 
-            it += batch.instanceCount - 1;
+                numEntries = 1;
+            }
+
+            it += numEntries - 1;
         }
         else
         {
@@ -911,6 +1311,25 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
             else
                 batch.drawable->OnRender(program, batch.geomIndex);
 
+            bool newProgram = program != lastProgram;
+            if (newProgram)
+            {
+                hasTextureLayer = program->Uniform(U_TEXTURELAYER) >= 0;
+                hasUserData = program->Uniform(U_USERDATA) >= 0;
+                lastProgram = program;
+            }
+
+            if (hasTextureLayer && (newProgram || batch.textureLayer != lastTextureLayer))
+            {
+                graphics->SetUniform(program, U_TEXTURELAYER, (float)batch.textureLayer);
+                lastTextureLayer = batch.textureLayer;
+            }
+            if (hasUserData && (newProgram || *batch.userData != lastUserData))
+            {
+                graphics->SetUniform(program, U_USERDATA, *batch.userData);
+                lastUserData = *batch.userData;
+            }
+
             if (ib)
                 graphics->DrawIndexed(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
             else
@@ -919,6 +1338,37 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
     }
 }
 
+size_t Renderer::MultiDrawBatches(const BatchQueue& queue, size_t index, bool usePositionGeometry)
+{
+    size_t commandStart = indirectCommands.size();
+    size_t numEntries = queue.BuildMultiDraw(index, usePositionGeometry, indirectCommands);
+    size_t commandCount = indirectCommands.size() - commandStart;
+
+    // A single command gains nothing over a normal instanced draw
+    if (commandCount < 2)
+    {
+        indirectCommands.resize(commandStart);
+        return 0;
+    }
+
+    // Commands are appended for the whole frame, so that already submitted ranges are not overwritten
+    if (indirectBuffer->NumCommands() < indirectCommands.size())
+    {
+        size_t newSize = indirectCommands.size() * 2;
+        if (newSize < MIN_INDIRECT_COMMANDS)
+            newSize = MIN_INDIRECT_COMMANDS;
+
+        indirectBuffer->Define(USAGE_DYNAMIC, newSize);
+        indirectBuffer->SetData(0, indirectCommands.size(), &indirectCommands[0]);
+    }
+    else
+        indirectBuffer->SetData(commandStart, commandCount, &indirectCommands[commandStart]);
+
+    VertexBuffer* instanceVb = queue.batches[index].pass->ReadsUserData() ? userInstanceVertexBuffer.Get() : instanceVertexBuffer.Get();
+    graphics->MultiDrawIndexedIndirect(PT_TRIANGLE_LIST, indirectBuffer, commandStart, commandCount, instanceVb);
+    return numEntries;
+}
+
 void Renderer::CheckOcclusionQueries()
 {
     static std::vector<OcclusionQueryResult> results;
@@ -956,7 +1406,7 @@ void Renderer::RenderOcclusionQueries()
     boundingBoxShaderProgram->Bind();
     graphics->SetRenderState(BLEND_REPLACE, CULL_BACK, CMP_LESS_EQUAL, false, false);
 
-    for (size_t i = 0; i < NUM_OCTANT_TASKS; ++i)
+    for (size_t i = 0; i < numOctantTasks; ++i)
     {
         for (auto it = octantResults[i].occlusionQueries.begin(); it != octantResults[i].occlusionQueries.end(); ++it)
         {
@@ -1138,12 +1588,26 @@ void Renderer::CollectOctantsWork(Task* task_, unsigned)
     ZoneScoped;
 
     CollectOctantsTask* task = static_cast<CollectOctantsTask*>(task_);
-
-    // Go through octants in this task's octree branch
-    Octant* octant = task->startOctant;
     ThreadOctantResult& result = octantResults[task->resultIdx];
 
-    CollectOctantsAndLights(octant, result);
+    // Go through octants in this task's octree branch, or the spatial hash grid cells if no start octant
+    if (task->startOctant)
+        CollectOctantsAndLights(task->startOctant, result, task->planeMask, task->recursive);
+    else
+    {
+        const std::vector<Octant*>& cells = octree->HashGridCells();
+        for (auto it = cells.begin(); it != cells.end(); ++it)
+        {
+            Octant* cell = *it;
+            if (cell->Drawables().empty())
+                continue;
+
+            // Hash grid cells only use frustum culling, not occlusion
+            unsigned char planeMask = frustum.IsInsideMasked(cell->CullingBox(), 0x3f);
+            if (planeMask != 0xff)
+                CollectOctantDrawables(cell, result, planeMask);
+        }
+    }
 
     // Queue final batch task for leftover nodes if needed
     if (result.drawableAcc)
@@ -1161,12 +1625,12 @@ void Renderer::CollectOctantsWork(Task* task_, unsigned)
     numPendingBatchTasks.fetch_add(-1);
 }
 
-void Renderer::ProcessLightsWork(Task*, unsigned)
+void Renderer::ProcessLightsWork(Task*, unsigned threadIndex)
 {
     ZoneScoped;
 
     // Merge the light collection results
-    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+    for (size_t i = 0; i < numOctantTasks; ++i)
         lights.insert(lights.end(), octantResults[i].lights.begin(), octantResults[i].lights.end());
 
     // Find the directional light if any
@@ -1183,12 +1647,14 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             ++it;
     }
 
-    // Sort localized lights by increasing distance
-    std::sort(lights.begin(), lights.end(), CompareDrawableDistances);
+    // Apply the light budget, then sort localized lights by increasing distance
+    SelectLights();
 
-    // Clamp to maximum supported
-    if (lights.size() > MAX_LIGHTS)
-        lights.resize(MAX_LIGHTS);
+    if (debugRenderer)
+    {
+        for (auto it = lights.begin(); it != lights.end(); ++it)
+            (*it)->OnRenderDebug(debugRenderer);
+    }
 
     // Pre-step for shadow map caching: reallocate all lights' shadow map rectangles which are non-zero at this point.
     // If shadow maps were dirtied (size or bias change) reset all allocations instead
@@ -1197,7 +1663,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         LightDrawable* light = *it;
         if (shadowMapsDirty)
             light->SetShadowMap(nullptr);
-        else if (drawShadows && light->ShadowStrength() < 1.0f && light->ShadowRect() != IntRect::ZERO)
+        else if (drawShadows && light->ShadowStrength() < 1.0f && light->ShadowRect() != IntRect::ZERO && IsShadowAllowed(light))
             AllocateShadowMap(light);
     }
 
@@ -1225,11 +1691,11 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         lightData[i + 1].position = Vector4(light->WorldPosition(), 1.0f);
         lightData[i + 1].direction = Vector4(-light->WorldDirection(), 0.0f);
         lightData[i + 1].attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
-        lightData[i + 1].color = light->EffectiveColor();
+        lightData[i + 1].color = lightStates.empty() ? light->EffectiveColor() : light->EffectiveColor() * lightStates[light->Id()].fade;
         lightData[i + 1].shadowParameters = Vector4::ONE; // Assume unshadowed
 
-        // Check if not shadowcasting or beyond shadow range
-        if (!drawShadows || light->ShadowStrength() >= 1.0f)
+        // Check if not shadowcasting, beyond shadow range or over the shadowed light budget
+        if (!drawShadows || light->ShadowStrength() >= 1.0f || !IsShadowAllowed(light))
         {
             light->SetShadowMap(nullptr);
             continue;
@@ -1276,7 +1742,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             collectShadowCastersTasks.push_back(new CollectShadowCastersTask(this, &Renderer::CollectShadowCastersWork));
 
         collectShadowCastersTasks[lightTaskIdx]->light = light;
-        workQueue->AddDependency(processShadowCastersTask, collectShadowCastersTasks[lightTaskIdx]);
+        workQueue->AddCounter(collectShadowCastersTasks[lightTaskIdx], numPendingShadowCasterTasks);
         ++lightTaskIdx;
     }
 
@@ -1308,6 +1774,14 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
     // Now queue all shadowcaster collection tasks
     if (lightTaskIdx > 0)
         workQueue->QueueTasks(lightTaskIdx, reinterpret_cast<Task**>(&collectShadowCastersTasks[0]));
+
+    // Shadowcaster processing needs the shadowcaster queries and the main view geometry bounds. Help with the remaining tasks until they are done
+    // Note: this is also needed without shadows, as it initiates light grid culling
+    workQueue->Wait(numPendingShadowCasterTasks, threadIndex);
+    workQueue->Wait(numPendingBatchTasks, threadIndex);
+
+    MergeGeometryBounds();
+    ProcessShadowCasters();
 }
 
 void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
@@ -1321,13 +1795,15 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
     std::vector<std::pair<Octant*, unsigned char> >& octants = task->octants;
     std::vector<Batch>& opaqueQueue = threaded ? result.opaqueBatches : opaqueBatches.batches;
     std::vector<Batch>& alphaQueue = threaded ? result.alphaBatches : alphaBatches.batches;
+    std::vector<StaticModelDrawable*>& staticDrawables = result.staticDrawables;
+    staticDrawables.clear();
 
     const Matrix3x4& viewMatrix = camera->ViewMatrix();
     Vector3 viewZ = Vector3(viewMatrix.m20, viewMatrix.m21, viewMatrix.m22);
     Vector3 absViewZ = viewZ.Abs();
     float farClipMul = 32767.0f / camera->FarClip();
 
-    // Scan octants for geometries
+    // Scan octants for geometries. Plain static models are only frustum culled here and deferred to the bulk path below
     for (auto it = octants.begin(); it != octants.end(); ++it)
     {
         Octant* octant = it->first;
@@ -1344,74 +1820,110 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
 
                 // Note: to strike a balance between performance and occlusion accuracy, per-geometry occlusion tests are skipped for now,
                 // as octants are already tested with combined actual drawable bounds
-                if ((!planeMask || frustum.IsInsideMaskedFast(geometryBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
+                if (planeMask && !frustum.IsInsideMaskedFast(geometryBox, planeMask))
+                    continue;
+
+                if (drawable->TestFlag(DF_BULK_PREPARE))
+                    staticDrawables.push_back(static_cast<StaticModelDrawable*>(drawable));
+                else if (drawable->OnPrepareRender(frameNumber, camera))
                 {
-                    result.geometryBounds.Merge(geometryBox);
-
-                    Vector3 center = geometryBox.Center();
-                    Vector3 edge = geometryBox.Size() * 0.5f;
-
-                    float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
-                    float viewEdgeZ = absViewZ.DotProduct(edge);
-                    result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
-                    result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
- 
-                    Batch newBatch;
-
-                    unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
-                    const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->Batches();
-                    size_t numGeometries = batches.NumGeometries();
-        
-                    for (size_t j = 0; j < numGeometries; ++j)
-                    {
-                        Material* material = batches.GetMaterial(j);
-
-                        // Assume opaque first
-                        newBatch.pass = material->GetPass(PASS_OPAQUE);
-                        newBatch.geometry = batches.GetGeometry(j);
-                        newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
-                        newBatch.geomIndex = (unsigned char)j;
-
-                        if (!newBatch.programBits)
-                            newBatch.worldTransform = &drawable->WorldTransform();
-                        else
-                            newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
-
-                        if (newBatch.pass)
-                        {
-                            // Perform distance sort in addition to state sort
-                            if (newBatch.pass->lastSortKey.first != frameNumber || newBatch.pass->lastSortKey.second > distance)
-                            {
-                                newBatch.pass->lastSortKey.first = frameNumber;
-                                newBatch.pass->lastSortKey.second = distance;
-                            }
-                            if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)j)
-                            {
-                                newBatch.geometry->lastSortKey.first = frameNumber;
-                                newBatch.geometry->lastSortKey.second = distance + (unsigned short)j;
-                            }
-
-                            opaqueQueue.push_back(newBatch);
-                        }
-                        else
-                        {
-                            // If not opaque, try transparent
-                            newBatch.pass = material->GetPass(PASS_ALPHA);
-                            if (!newBatch.pass)
-                                continue;
-
-                            newBatch.distance = drawable->Distance();
-                            alphaQueue.push_back(newBatch);
-                        }
-                    }
+                    AddVisibleGeometry(result, drawable, viewZ, absViewZ, viewMatrix.m23);
+                    if (!drawable->TestFlag(DF_GEOMETRY_TYPE_BITS))
+                        EmitGeometryBatches<true>(static_cast<GeometryDrawable*>(drawable), farClipMul, opaqueQueue, alphaQueue);
+                    else
+                        EmitGeometryBatches<false>(static_cast<GeometryDrawable*>(drawable), farClipMul, opaqueQueue, alphaQueue);
                 }
             }
         }
     }
 
+    // Prepare and emit the gathered static models without virtual dispatch
+    for (auto it = staticDrawables.begin(); it != staticDrawables.end(); ++it)
+    {
+        StaticModelDrawable* drawable = *it;
+        if (drawable->PrepareStaticRender(frameNumber, camera))
+        {
+            AddVisibleGeometry(result, drawable, viewZ, absViewZ, viewMatrix.m23);
+            EmitGeometryBatches<true>(drawable, farClipMul, opaqueQueue, alphaQueue);
+        }
+    }
+
     numPendingBatchTasks.fetch_add(-1);
 }
 
+void Renderer::AddVisibleGeometry(ThreadBatchResult& result, Drawable* drawable, const Vector3& viewZ, const Vector3& absViewZ, float viewZOffset)
+{
+    const BoundingBox& geometryBox = drawable->WorldBoundingBox();
+
+    viewResult->visibleDrawables.Set(drawable->Id());
+    result.geometryBounds.Merge(geometryBox);
+
+    if (debugRenderer)
+        drawable->OnRenderDebug(debugRenderer);
+
+    Vector3 center = geometryBox.Center();
+    Vector3 edge = geometryBox.Size() * 0.5f;
+
+    float viewCenterZ = viewZ.DotProduct(center) + viewZOffset;
+    float viewEdgeZ = absViewZ.DotProduct(edge);
+    result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+    result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
+}
+
+template <bool staticGeometry> void Renderer::EmitGeometryBatches(GeometryDrawable* drawable, float farClipMul, std::vector<Batch>& opaqueQueue, std::vector<Batch>& alphaQueue)
+{
+    Batch newBatch;
+
+    unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
+    const SourceBatches& batches = drawable->Batches();
+    size_t numGeometries = batches.NumGeometries();
+
+    newBatch.programBits = staticGeometry ? (unsigned char)0 : (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+    newBatch.userData = &drawable->UserData();
+    if (staticGeometry)
+        newBatch.worldTransform = &drawable->WorldTransform();
+    else
+        newBatch.drawable = drawable;
+
+    for (size_t j = 0; j < numGeometries; ++j)
+    {
+        Material* material = batches.GetMaterial(j);
+
+        // Assume opaque first
+        newBatch.pass = material->GetPass(PASS_OPAQUE);
+        newBatch.geometry = batches.GetGeometry(j);
+        newBatch.geomIndex = (unsigned char)j;
+        newBatch.textureLayer = (unsigned short)material->TextureLayer();
+
+        if (newBatch.pass)
+        {
+            // Perform distance sort in addition to state sort
+            if (newBatch.pass->lastSortKey.first != frameNumber || newBatch.pass->lastSortKey.second > distance)
+            {
+                newBatch.pass->lastSortKey.first = frameNumber;
+                newBatch.pass->lastSortKey.second = distance;
+            }
+            if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)j)
+            {
+                newBatch.geometry->lastSortKey.first = frameNumber;
+                newBatch.geometry->lastSortKey.second = distance + (unsigned short)j;
+            }
+
+            opaqueQueue.push_back(newBatch);
+        }
+        else
+        {
+            // If not opaque, try transparent
+            newBatch.pass = material->GetPass(PASS_ALPHA);
+            if (!newBatch.pass)
+                continue;
+
+            newBatch.distance = drawable->Distance();
+            alphaQueue.push_back(newBatch);
+        }
+    }
+}
+
 void Renderer::CollectShadowCastersWork(Task* task, unsigned)
 {
     ZoneScoped;
@@ -1454,11 +1966,7 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
     }
 }
 
-void Renderer::BatchesReadyWork(Task*, unsigned)
-{
-}
-
-void Renderer::ProcessShadowCastersWork(Task*, unsigned)
+void Renderer::ProcessShadowCasters()
 {
     ZoneScoped;
 
@@ -1584,7 +2092,7 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                 Drawable* drawable = *it;
                 const BoundingBox& geometryBox = drawable->WorldBoundingBox();
 
-                bool inView = drawable->InView(frameNumber);
+                bool inView = viewResult->visibleDrawables.Test(drawable->Id());
                 bool staticNode = drawable->IsStatic();
 
                 // Check shadowcaster frustum visibility for point lights; may be visible in view, but not in each cube map face
@@ -1632,6 +2140,7 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                 {
                     if (!drawable->OnPrepareRender(frameNumber, camera))
                         continue;
+                    viewResult->visibleDrawables.Set(drawable->Id());
                 }
 
                 ++totalShadowCasters;
@@ -1665,6 +2174,8 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                     newBatch.geometry = batches.GetGeometry(j);
                     newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
                     newBatch.geomIndex = (unsigned char)j;
+                    newBatch.textureLayer = (unsigned short)material->TextureLayer();
+                    newBatch.userData = &static_cast<GeometryDrawable*>(drawable)->UserData();
 
                     if (!newBatch.programBits)
                         newBatch.worldTransform = &drawable->WorldTransform();
@@ -1828,6 +2339,8 @@ void RegisterRendererLibrary()
     GeometryNode::RegisterObject();
     StaticModel::RegisterObject();
     AnimatedModel::RegisterObject();
+    ParticleEmitter::RegisterObject();
+    Terrain::RegisterObject();
     Light::RegisterObject();
     LightEnvironment::RegisterObject();
     Material::RegisterObject();
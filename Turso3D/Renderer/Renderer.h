@@ -9,11 +9,14 @@
 #include "../Resource/Image.h"
 #include "../Thread/WorkQueue.h"
 #include "Batch.h"
+#include "VisibilitySet.h"
 
 #include <atomic>
 
 class Camera;
+class DebugRenderer;
 class FrameBuffer;
+class IndirectBuffer;
 class GeometryDrawable;
 class Graphics;
 class LightDrawable;
@@ -24,6 +27,7 @@ class Octree;
 class RenderBuffer;
 class Scene;
 class ShaderProgram;
+class StaticModelDrawable;
 class Texture;
 class UniformBuffer;
 class VertexBuffer;
@@ -41,6 +45,9 @@ static const size_t NUM_CLUSTER_Z = 8;
 static const size_t MAX_LIGHTS = 255;
 static const size_t MAX_LIGHTS_CLUSTER = 16;
 static const size_t NUM_OCTANT_TASKS = 9;
+static const size_t MAX_OCTANT_TASKS = 64;
+static const size_t OCTANT_TASKS_PER_THREAD = 4;
+static const size_t MIN_INDIRECT_COMMANDS = 256;
 static const size_t NUM_SHADOW_MAPS = 2; // One for directional lights and another for the rest
 
 // Texture units with built-in meanings.
@@ -58,6 +65,8 @@ struct ThreadOctantResult
 
     /// Drawable accumulator. When full, queue the next batch collection task.
     size_t drawableAcc;
+    /// Total geometry drawables found in the task's octants. Accumulated to parent tasks afterward to decide splitting on the next frame.
+    size_t numDrawables;
     /// Starting octant index for current task.
     size_t taskOctantIdx;
     /// Batch collection task index.
@@ -72,6 +81,15 @@ struct ThreadOctantResult
     std::vector<Octant*> occlusionQueries;
 };
 
+/// Per-view results of view preparation. Culling writes the visibility here instead of to the drawables.
+struct ViewResult
+{
+    /// Visibility bits of the drawables prepared for rendering, including shadowcasters, indexed by drawable id.
+    VisibilitySet visibleDrawables;
+    /// Octants whose collection had too many drawables for one task. The next preparation of the view splits them into child tasks. Only compared by address, never accessed.
+    std::vector<Octant*> splitOctants;
+};
+
 /// Per-thread results for batch collection.
 struct ThreadBatchResult
 {
@@ -88,6 +106,8 @@ struct ThreadBatchResult
     std::vector<Batch> opaqueBatches;
     /// Initial alpha batches.
     std::vector<Batch> alphaBatches;
+    /// Scratch list of frustum-culled static model drawables for the devirtualized batch collection path.
+    std::vector<StaticModelDrawable*> staticDrawables;
 };
 
 /// Shadow map data structure. May be shared by several lights.
@@ -117,8 +137,10 @@ struct ShadowMap
     std::vector<BatchQueue> shadowBatches;
     /// Intermediate shadowcaster lists for processing.
     std::vector<std::vector<Drawable*> > shadowCasters;
-    /// Instancing transforms for shadowcasters.
-    std::vector<Matrix3x4> instanceTransforms;
+    /// Instance data for shadowcasters.
+    InstanceDataVector instanceData;
+    /// Instance data with user data for shadowcasters.
+    UserInstanceDataVector userInstanceData;
 };
 
 /// Per-view uniform buffer data.
@@ -180,6 +202,38 @@ struct ClusterCullData
     unsigned char numLights;
 };
 
+/// %Light budget selection statistics of the last prepared view.
+struct LightBudgetStats
+{
+    /// Point and spot lights in frustum.
+    size_t numVisible;
+    /// Lights selected by the budget.
+    size_t numSelected;
+    /// Selected lights allowed to cast shadows.
+    size_t numShadowed;
+    /// Rendered lights fading in or out.
+    size_t numFading;
+    /// Lights in frustum not rendered.
+    size_t numCulled;
+};
+
+/// Persistent light budget selection state, indexed by drawable id.
+struct LightBudgetState
+{
+    /// %Light the state belongs to. Used to detect reuse of the drawable id.
+    LightDrawable* light;
+    /// Screen-space importance for the current view.
+    float importance;
+    /// Fade level from 0 to 1.
+    float fade;
+    /// Last frame number the light was in frustum.
+    unsigned short frameNumber;
+    /// Selected flag.
+    bool selected;
+    /// Shadowed flag.
+    bool shadowed;
+};
+
 /// High-level rendering subsystem. Performs rendering of 3D scenes.
 class Renderer : public Object
 {
@@ -195,6 +249,18 @@ public:
     void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format);
     /// Set global depth bias multipiers for shadow maps.
     void SetShadowDepthBiasMul(float depthBiasMul, float slopeScaleBiasMul);
+    /// Set whether to record debug geometry of visible octants, geometries and lights into DebugRenderer from the worker threads during PrepareView(). Default false.
+    void SetDrawDebug(bool enable);
+    /// Set maximum number of point and spot lights, and how many of them may cast shadows. Lights are ranked by screen-space importance. 0 is unlimited for both. Default unlimited.
+    void SetLightBudget(unsigned maxLights, unsigned maxShadowedLights);
+    /// Set importance multiplier for lights selected on the previous frame, to avoid flickering between lights of similar importance. Default 1.25.
+    void SetLightBudgetHysteresis(float factor);
+    /// Set time in seconds for lights to fade in and out when the light budget selection changes. Default 0.25.
+    void SetLightFadeTime(float time);
+    /// Set whether to submit runs of instanced batches that share vertex and index buffers as indirect multi-draws, if supported. Default true.
+    void SetUseMultiDraw(bool enable);
+    /// Release the CPU-side instance data buffers, so that they are reallocated on the next view preparation. Call after changing the large page mode to move them to the new backing memory.
+    void ReleaseInstanceData();
     /// Prepare view for rendering. This will utilize worker threads.
     void PrepareView(Scene* scene, Camera* camera, bool drawShadows, bool useOcclusion);
     /// Render shadowmaps before rendering the view. Last shadow framebuffer will be left bound.
@@ -203,29 +269,57 @@ public:
     void RenderOpaque(bool clear = true);
     /// Render transparent objects into the currently set framebuffer and viewport.
     void RenderAlpha();
-    /// Add debug geometry from the objects in frustum into DebugRenderer. Note: does not automatically render, to allow more geometry to be added elsewhere.
+    /// Add debug geometry from the objects in frustum into DebugRenderer in the main thread. Not needed if debug geometry is recorded during PrepareView(). Note: does not automatically render, to allow more geometry to be added elsewhere.
     void RenderDebug();
 
     /// Return a shadow map texture by index for debugging.
     Texture* ShadowMapTexture(size_t index) const;
+    /// Return whether debug geometry is recorded during PrepareView().
+    bool DrawDebug() const { return drawDebug; }
+    /// Return the drawables prepared for rendering in the last view, including shadowcasters, indexed by drawable id.
+    const VisibilitySet& VisibleDrawables() const { return viewResult->visibleDrawables; }
+    /// Return whether indirect multi-draws are used.
+    bool UseMultiDraw() const { return useMultiDraw && hasMultiDraw; }
+    /// Return maximum number of point and spot lights, or 0 if unlimited.
+    unsigned MaxLights() const { return maxLights; }
+    /// Return maximum number of shadowed point and spot lights, or 0 if unlimited.
+    unsigned MaxShadowedLights() const { return maxShadowedLights; }
+    /// Return importance multiplier for lights selected on the previous frame.
+    float LightBudgetHysteresis() const { return lightBudgetHysteresis; }
+    /// Return light fade time in seconds.
+    float LightFadeTime() const { return lightFadeTime; }
+    /// Return light budget selection statistics of the last prepared view.
+    const LightBudgetStats& GetLightBudgetStats() const { return lightBudgetStats; }
 
 private:
     /// Collect octants and lights from the octree recursively. Queue batch collection tasks while ongoing.
-    void CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask = 0x3f);
+    void CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask = 0x3f, bool recursive = true);
+    /// Collect lights and store the octant for batch collection if it has geometries. Queue a batch collection task if over the drawable limit.
+    void CollectOctantDrawables(Octant* octant, ThreadOctantResult& result, unsigned char planeMask);
+    /// Setup octant collection tasks. Start from the root level octants and split branches that were heavy on the previous frame, up to a thread count based limit.
+    void SetupOctantTasks();
+    /// Mark octants whose branches should be split into several octant collection tasks on the next frame, based on this frame's drawable counts.
+    void UpdateOctantTaskSplits();
     /// Add an occlusion query for the octant if applicable.
     void AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, unsigned char planeMask);
+    /// Rank and select the point and spot lights in frustum according to the light budget, and sort them by distance.
+    void SelectLights();
+    /// Return whether a selected light is allowed shadows by the light budget.
+    bool IsShadowAllowed(LightDrawable* light) const;
     /// Allocate shadow map for a light. Return true on success.
     bool AllocateShadowMap(LightDrawable* light);
     /// Sort main opaque and alpha batch queues.
     void SortMainBatches();
     /// Sort all batch queues of a shadowmap.
     void SortShadowBatches(ShadowMap& shadowMap);
-    /// Upload instance transforms before rendering.
-    void UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms);
+    /// Upload instance data before rendering.
+    void UpdateInstanceData(const InstanceDataVector& data, const UserInstanceDataVector& userData);
     /// Upload light uniform buffer and cluster texture data.
     void UpdateLightData();
     /// Render a batch queue.
     void RenderBatches(Camera* camera, const BatchQueue& queue);
+    /// Submit the run of instanced batches starting from an index as an indirect multi-draw. Return number of batch queue entries covered, or 0 if the run is too short to benefit.
+    size_t MultiDrawBatches(const BatchQueue& queue, size_t index, bool usePositionGeometry);
     /// Check occlusion query results and propagate visibility hierarchically.
     void CheckOcclusionQueries();
     /// Render occlusion queries for octants.
@@ -238,16 +332,20 @@ private:
     void DefineClusterFrustums();
     /// Work function to collect octants.
     void CollectOctantsWork(Task* task, unsigned threadIndex);
-    /// Process lights collected by octant tasks, and queue shadowcaster query tasks for them as necessary.
+    /// Process lights collected by octant tasks and queue shadowcaster query tasks for them as necessary. Then wait for the queries and main view batch collection while executing other tasks, and continue to shadow batch collection and light culling.
     void ProcessLightsWork(Task* task, unsigned threadIndex);
     /// Work function to collect main view batches from geometries.
     void CollectBatchesWork(Task* task, unsigned threadIndex);
+    /// Mark a prepared geometry drawable visible and accumulate its bounds and view depth range.
+    void AddVisibleGeometry(ThreadBatchResult& result, Drawable* drawable, const Vector3& viewZ, const Vector3& absViewZ, float viewZOffset);
+    /// Emit the batches of a prepared geometry drawable to the opaque and alpha queues. Static geometry skips the geometry type lookup.
+    template <bool staticGeometry> void EmitGeometryBatches(GeometryDrawable* drawable, float farClipMul, std::vector<Batch>& opaqueQueue, std::vector<Batch>& alphaQueue);
     /// Work function to collect shadowcasters per shadowcasting light.
     void CollectShadowCastersWork(Task* task, unsigned threadIndex);
-    /// Work function for dummy task that signals batches are ready for sorting.
-    void BatchesReadyWork(Task* task, unsigned threadIndex);
-    /// Work function to queue shadowcaster batch collection tasks. Requires batch collection and shadowcaster query tasks to be complete.
-    void ProcessShadowCastersWork(Task* task, unsigned threadIndex);
+    /// Combine the per-thread geometry bounds and view depth ranges. Requires batch collection to be complete.
+    void MergeGeometryBounds();
+    /// Queue shadowcaster batch collection and light culling tasks. Requires batch collection and shadowcaster query tasks to be complete.
+    void ProcessShadowCasters();
     /// Work function to collect shadowcaster batches per shadow view.
     void CollectShadowBatchesWork(Task* task, unsigned threadIndex);
     /// Work function to cull lights against a Z-slice of the frustum grid.
@@ -267,6 +365,8 @@ private:
     Graphics* graphics;
     /// Cached work queue subsystem.
     WorkQueue* workQueue;
+    /// Debug renderer subsystem for recording debug geometry during view preparation, or null if not in use.
+    DebugRenderer* debugRenderer;
     /// Camera view mask.
     unsigned viewMask;
     /// Framenumber.
@@ -275,20 +375,36 @@ private:
     bool drawShadows;
     /// Occlusion use flag.
     bool useOcclusion;
+    /// Debug geometry recording flag.
+    bool drawDebug;
     /// Shadow maps globally dirty flag. All cached shadow content should be reset.
     bool shadowMapsDirty;
     /// Cluster frustums dirty flag.
     bool clusterFrustumsDirty;
     /// Instancing supported flag.
     bool hasInstancing;
+    /// Indirect multi-draw supported flag.
+    bool hasMultiDraw;
+    /// Indirect multi-draw use flag.
+    bool useMultiDraw;
     /// Previous frame camera position for occlusion culling bounding box elongation.
     Vector3 previousCameraPosition;
     /// Last frame time for occlusion query staggering.
     float lastFrameTime;
-    /// Root-level octants, used as a starting point for octant and batch collection. The root octant is included if it also contains drawables.
-    std::vector<Octant*> rootLevelOctants;
+    /// Number of octant collection tasks in use for the current view.
+    size_t numOctantTasks;
+    /// Results of the current view being prepared or rendered.
+    ViewResult* viewResult;
+    /// Results of the view prepared before the current one, for detecting drawables coming into view.
+    ViewResult* lastViewResult;
+    /// Storage for the current and last view results, which swap on each view preparation.
+    ViewResult viewResults[2];
+    /// Octree that the view results' visibility sets are registered to.
+    WeakPtr<Octree> viewResultOctree;
     /// Counter for batch collection tasks remaining. When zero, main batch sorting can begin while other tasks go on.
     std::atomic<int> numPendingBatchTasks;
+    /// Counter for shadowcaster query tasks remaining.
+    std::atomic<int> numPendingShadowCasterTasks;
     /// Counters for shadow views remaining per shadowmap. When zero, the shadow batches can be sorted.
     std::atomic<int> numPendingShadowViews[2];
     /// Per-octree branch octant collection results.
@@ -305,14 +421,32 @@ private:
     LightDrawable* dirLight;
     /// Accepted point and spot lights in frustum.
     std::vector<LightDrawable*> lights;
+    /// Light budget selection state of lights, indexed by drawable id.
+    std::vector<LightBudgetState> lightStates;
+    /// Scratch list of shadowed light candidates for the light budget.
+    std::vector<LightDrawable*> shadowCandidates;
+    /// Light budget selection statistics.
+    LightBudgetStats lightBudgetStats;
+    /// Maximum point and spot lights, 0 if unlimited.
+    unsigned maxLights;
+    /// Maximum shadowed point and spot lights, 0 if unlimited.
+    unsigned maxShadowedLights;
+    /// Importance multiplier for lights selected on the previous frame.
+    float lightBudgetHysteresis;
+    /// Light fade time in seconds.
+    float lightFadeTime;
     /// Shadow maps.
     AutoArrayPtr<ShadowMap> shadowMaps;
     /// Opaque batches.
     BatchQueue opaqueBatches;
     /// Transparent batches.
     BatchQueue alphaBatches;
-    /// Instance transforms for opaque and alpha batches.
-    std::vector<Matrix3x4> instanceTransforms;
+    /// Instance data for opaque and alpha batches.
+    InstanceDataVector instanceData;
+    /// Instance data with user data for opaque and alpha batches.
+    UserInstanceDataVector userInstanceData;
+    /// Indirect draw commands submitted during the frame.
+    std::vector<DrawIndirectCommand> indirectCommands;
     /// Last camera used for rendering.
     Camera* lastCamera;
     /// Last material pass used for rendering.
@@ -336,15 +470,11 @@ private:
     /// Frustum SAT test data for verifying whether to add an occlusion query.
     SATData frustumSATData;
     /// Tasks for octant collection.
-    AutoPtr<CollectOctantsTask> collectOctantsTasks[NUM_OCTANT_TASKS];
+    AutoPtr<CollectOctantsTask> collectOctantsTasks[MAX_OCTANT_TASKS];
     /// %Task for light processing.
     AutoPtr<Task> processLightsTask;
     /// Tasks for shadow light processing.
     std::vector<AutoPtr<CollectShadowCastersTask> > collectShadowCastersTasks;
-    /// Dummy task to ensure batches have been collected.
-    AutoPtr<Task> batchesReadyTask;
-    /// %Task for queuing shadow views for further processing.
-    AutoPtr<Task> processShadowCastersTask;
     /// Tasks for shadow batch processing.
     std::vector<AutoPtr<CollectShadowBatchesTask> > collectShadowBatchesTasks;
     /// Tasks for light grid culling.
@@ -361,6 +491,10 @@ private:
     AutoPtr<UniformBuffer> lightDataBuffer;
     /// Instancing vertex buffer.
     AutoPtr<VertexBuffer> instanceVertexBuffer;
+    /// Instancing vertex buffer with user data.
+    AutoPtr<VertexBuffer> userInstanceVertexBuffer;
+    /// Indirect draw command buffer.
+    AutoPtr<IndirectBuffer> indirectBuffer;
     /// Bounding box vertex buffer.
     AutoPtr<VertexBuffer> boundingBoxVertexBuffer;
     /// Bounding box index buffer.
@@ -373,6 +507,8 @@ private:
     AutoPtr<FrameBuffer> staticObjectShadowFbo;
     /// Vertex elements for the instancing buffer.
     std::vector<VertexElement> instanceVertexElements;
+    /// Vertex elements for the instancing buffer with user data.
+    std::vector<VertexElement> userInstanceVertexElements;
 };
 
 /// Register Renderer related object factories and attributes.
@@ -27,14 +27,17 @@ void StaticModelDrawable::OnWorldBoundingBoxUpdate() const
 }
 
 bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    return PrepareStaticRender(frameNumber, camera);
+}
+
+bool StaticModelDrawable::PrepareStaticRender(unsigned short frameNumber, Camera* camera)
 {
     distance = camera->Distance(WorldBoundingBox().Center());
 
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
 
-    lastFrameNumber = frameNumber;
-
     // If model was last updated long ago, reset update framenumber to illegal
     if (frameNumber - lastUpdateFrameNumber == 0x8000)
         lastUpdateFrameNumber = 0;
@@ -47,20 +50,21 @@ bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* ca
 
         for (size_t i = 0; i < numGeometries; ++i)
         {
+            // LOD distances are ascending, so the level is the count of switch distances exceeded
             const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
-            if (lodGeometries.size() > 1)
+            size_t numLevels = lodGeometries.size();
+            if (numLevels <= 1)
+                continue;
+
+            size_t level = 0;
+            for (size_t j = 1; j < numLevels; ++j)
+                level += lodDistance > lodGeometries[j]->lodDistance ? 1 : 0;
+
+            Geometry* lodGeometry = lodGeometries[level];
+            if (batches.GetGeometry(i) != lodGeometry)
             {
-                size_t j;
-                for (j = 1; j < lodGeometries.size(); ++j)
-                {
-                    if (lodDistance <= lodGeometries[j]->lodDistance)
-                        break;
-                }
-                if (batches.GetGeometry(i) != lodGeometries[j - 1])
-                {
-                    batches.SetGeometry(i, lodGeometries[j - 1]);
-                    lastUpdateFrameNumber = frameNumber;
-                }
+                batches.SetGeometry(i, lodGeometry);
+                lastUpdateFrameNumber = frameNumber;
             }
         }
     }
@@ -112,6 +116,8 @@ StaticModel::StaticModel()
 {
     drawable = drawableAllocator.Allocate();
     drawable->SetOwner(this);
+    // The drawable is exactly of the static model type, so the renderer may prepare it without virtual dispatch
+    drawable->SetFlag(DF_BULK_PREPARE, true);
 }
 
 StaticModel::~StaticModel()
@@ -138,6 +144,7 @@ void StaticModel::RegisterObject()
 void StaticModel::SetModel(Model* model)
 {
     ZoneScoped;
+    MarkAttributesDirty();
 
     StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
 
@@ -165,6 +172,7 @@ void StaticModel::SetModel(Model* model)
 
 void StaticModel::SetLodBias(float bias)
 {
+    MarkAttributesDirty();
     StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
     modelDrawable->lodBias = Max(bias, M_EPSILON);
 }
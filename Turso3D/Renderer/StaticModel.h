@@ -17,8 +17,10 @@ public:
 
     /// Recalculate the world space bounding box.
     void OnWorldBoundingBoxUpdate() const override;
-    /// Prepare object for rendering. Reset framenumber and calculate distance from camera, and check for LOD level changes. Called by Renderer in worker threads. Return false if should not render.
+    /// Prepare object for rendering. Calculate distance from camera, and check for LOD level changes. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform the same preparation as OnPrepareRender without virtual dispatch. Used by Renderer for drawables that have the DF_BULK_PREPARE flag, which is opt-in and set by StaticModel only on drawables of exactly this type, so that subclasses overriding OnPrepareRender are not bypassed.
+    bool PrepareStaticRender(unsigned short frameNumber, Camera* camera);
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
 
@@ -0,0 +1,744 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/File.h"
+#include "../IO/Log.h"
+#include "../Math/Frustum.h"
+#include "../Math/Sphere.h"
+#include "../Resource/ResourceCache.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Terrain.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+static const IntVector2 DEFAULT_NUM_TILES(1, 1);
+static const int DEFAULT_TILE_RESOLUTION = 257;
+static const int MAX_TILE_RESOLUTION = 4097;
+static const float DEFAULT_TILE_SIZE = 256.0f;
+static const float DEFAULT_HEIGHT_SCALE = 64.0f;
+static const float DEFAULT_LOD_DISTANCE = 64.0f;
+static const unsigned DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+static const size_t MAX_HEIGHT_LAYERS = 256;
+static const size_t HEIGHT_TEXTURE_UNIT = 7;
+static const StringHash LOD_CAMERA_POSITION("lodCameraPosition");
+
+static Allocator<TerrainDrawable> drawableAllocator;
+
+/// Heightmap tile load request, processed by the streaming thread.
+struct TerrainTileLoad
+{
+    /// Tile index.
+    unsigned tileIndex;
+    /// Resource name of the heightmap.
+    std::string name;
+    /// Full path of the heightmap file, or empty if not found.
+    std::string fileName;
+    /// Number of height samples along a tile edge.
+    int resolution;
+    /// Offsets of each LOD level in the node heights.
+    std::vector<size_t> levelOffsets;
+    /// Loaded height samples.
+    std::vector<unsigned short> heights;
+    /// Calculated node heights.
+    std::vector<Vector2> nodeHeights;
+    /// Success flag.
+    bool success;
+};
+
+/// Calculate the minimum and maximum normalized heights of each quadtree node, from the finest level upward.
+static void CalculateNodeHeights(TerrainTileLoad& load)
+{
+    int resolution = load.resolution;
+    int numLevels = (int)load.levelOffsets.size();
+    int numLeafNodes = 1 << (numLevels - 1);
+    const unsigned short* heights = &load.heights[0];
+    const float normalize = 1.0f / 65535.0f;
+
+    load.nodeHeights.resize(load.levelOffsets[0] + numLeafNodes * numLeafNodes);
+
+    for (int z = 0; z < numLeafNodes; ++z)
+    {
+        for (int x = 0; x < numLeafNodes; ++x)
+        {
+            // Include the shared edge samples, as the patch vertices reach them
+            unsigned short minHeight = 65535, maxHeight = 0;
+            for (int sz = z * TERRAIN_PATCH_SIZE; sz <= (z + 1) * TERRAIN_PATCH_SIZE; ++sz)
+            {
+                const unsigned short* row = heights + sz * resolution;
+                for (int sx = x * TERRAIN_PATCH_SIZE; sx <= (x + 1) * TERRAIN_PATCH_SIZE; ++sx)
+                {
+                    minHeight = Min(minHeight, row[sx]);
+                    maxHeight = Max(maxHeight, row[sx]);
+                }
+            }
+
+            load.nodeHeights[load.levelOffsets[0] + z * numLeafNodes + x] = Vector2(minHeight * normalize, maxHeight * normalize);
+        }
+    }
+
+    for (int level = 1; level < numLevels; ++level)
+    {
+        int numNodes = numLeafNodes >> level;
+        const Vector2* children = &load.nodeHeights[load.levelOffsets[level - 1]];
+        Vector2* nodes = &load.nodeHeights[load.levelOffsets[level]];
+
+        for (int z = 0; z < numNodes; ++z)
+        {
+            for (int x = 0; x < numNodes; ++x)
+            {
+                const Vector2& c0 = children[(z * 2) * numNodes * 2 + x * 2];
+                const Vector2& c1 = children[(z * 2) * numNodes * 2 + x * 2 + 1];
+                const Vector2& c2 = children[(z * 2 + 1) * numNodes * 2 + x * 2];
+                const Vector2& c3 = children[(z * 2 + 1) * numNodes * 2 + x * 2 + 1];
+                nodes[z * numNodes + x] = Vector2(Min(Min(c0.x, c1.x), Min(c2.x, c3.x)), Max(Max(c0.y, c1.y), Max(c2.y, c3.y)));
+            }
+        }
+    }
+}
+
+TerrainDrawable::TerrainDrawable() :
+    terrainSize(Vector3::ZERO)
+{
+    SetFlag(DF_INSTANCED_GEOMETRY, true);
+}
+
+void TerrainDrawable::OnWorldBoundingBoxUpdate() const
+{
+    // The terrain is axis-aligned and unscaled, so only the position is used
+    Vector3 origin = WorldPosition();
+    worldBoundingBox.Define(origin, origin + terrainSize);
+}
+
+bool TerrainDrawable::OnPrepareRender(unsigned short, Camera* camera)
+{
+    bool hasPatches = false;
+    for (size_t i = 0; i < NUM_TERRAIN_PATCH_GEOMETRIES; ++i)
+        hasPatches |= !patchInstances[i].empty();
+    if (!hasPatches)
+        return false;
+
+    distance = WorldBoundingBox().Distance(camera->WorldPosition());
+
+    if (maxDistance > 0.0f && distance > maxDistance)
+        return false;
+
+    return true;
+}
+
+void TerrainDrawable::OnAddInstances(InstanceDataVector& dest, UserInstanceDataVector* userDest, size_t geomIndex, unsigned short) const
+{
+    if (geomIndex >= NUM_TERRAIN_PATCH_GEOMETRIES)
+        return;
+
+    // Passes that do not read user data get only the patch transforms and heightmap layers
+    if (userDest)
+        userDest->insert(userDest->end(), patchInstances[geomIndex].begin(), patchInstances[geomIndex].end());
+    else
+        dest.insert(dest.end(), patchInstances[geomIndex].begin(), patchInstances[geomIndex].end());
+}
+
+Terrain::Terrain() :
+    numTiles(DEFAULT_NUM_TILES),
+    tileResolution(0),
+    tileSize(DEFAULT_TILE_SIZE),
+    heightScale(DEFAULT_HEIGHT_SCALE),
+    lodDistance(DEFAULT_LOD_DISTANCE),
+    viewDistance(0.0f),
+    memoryBudget(DEFAULT_MEMORY_BUDGET),
+    numLodLevels(0),
+    maxResidentTiles(0),
+    frameNumber(0),
+    streamingExit(false)
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+
+    SetTileResolution(DEFAULT_TILE_RESOLUTION);
+    UpdateTerrainSize();
+}
+
+Terrain::~Terrain()
+{
+    ResetStreaming();
+
+    if (drawable)
+    {
+        RemoveFromOctree();
+        drawableAllocator.Free(static_cast<TerrainDrawable*>(drawable));
+        drawable = nullptr;
+    }
+}
+
+void Terrain::RegisterObject()
+{
+    RegisterFactory<Terrain>();
+    CopyBaseAttributes<Terrain, OctreeNode>();
+    RegisterDerivedType<Terrain, GeometryNode>();
+    RegisterMixedRefAttribute("material", &Terrain::MaterialAttr, &Terrain::SetMaterialAttr, ResourceRef(Material::TypeStatic()));
+    RegisterRefAttribute("tileName", &Terrain::TileName, &Terrain::SetTileName);
+    RegisterRefAttribute("numTiles", &Terrain::NumTiles, &Terrain::SetNumTiles, DEFAULT_NUM_TILES);
+    RegisterAttribute("tileResolution", &Terrain::TileResolution, &Terrain::SetTileResolution, DEFAULT_TILE_RESOLUTION);
+    RegisterAttribute("tileSize", &Terrain::TileSize, &Terrain::SetTileSize, DEFAULT_TILE_SIZE);
+    RegisterAttribute("heightScale", &Terrain::HeightScale, &Terrain::SetHeightScale, DEFAULT_HEIGHT_SCALE);
+    RegisterAttribute("lodDistance", &Terrain::LodDistance, &Terrain::SetLodDistance, DEFAULT_LOD_DISTANCE);
+    RegisterAttribute("viewDistance", &Terrain::ViewDistance, &Terrain::SetViewDistance, 0.0f);
+    RegisterAttribute("memoryBudget", &Terrain::MemoryBudget, &Terrain::SetMemoryBudget, DEFAULT_MEMORY_BUDGET);
+}
+
+void Terrain::Update(Camera* camera)
+{
+    if (!octree || !camera || !IsEnabled() || IsDormant() || tileName.empty())
+        return;
+
+    ZoneScoped;
+
+    InitializeStreaming();
+    ++frameNumber;
+    ProcessCompletedLoads();
+
+    TerrainDrawable* terrainDrawable = static_cast<TerrainDrawable*>(drawable);
+    for (size_t i = 0; i < NUM_TERRAIN_PATCH_GEOMETRIES; ++i)
+        terrainDrawable->patchInstances[i].clear();
+    newSelectionKeys.clear();
+
+    // Each level doubles the range. The finest range must cover a few patches for the morph to complete before the next level
+    float leafPatchSize = tileSize * TERRAIN_PATCH_SIZE / (tileResolution - 1);
+    float range = Max(lodDistance, 2.0f * leafPatchSize);
+    lodRanges.resize(numLodLevels);
+    for (int i = 0; i < numLodLevels; ++i)
+    {
+        lodRanges[i] = range;
+        range *= 2.0f;
+    }
+
+    Vector3 origin = WorldPosition();
+    Vector3 cameraPosition = camera->WorldPosition();
+    Frustum frustum = camera->WorldFrustum();
+
+    // The shader morphs against the selection camera instead of the per-view camera, which differs in shadow passes
+    if (terrainMaterial)
+        terrainMaterial->SetUniform(LOD_CAMERA_POSITION, Vector4(cameraPosition, 1.0f));
+    float maxDistance = viewDistance > 0.0f ? Min(viewDistance, camera->FarClip()) : camera->FarClip();
+
+    candidateTiles.clear();
+    for (int z = 0; z < numTiles.y; ++z)
+    {
+        for (int x = 0; x < numTiles.x; ++x)
+        {
+            Vector3 tileOrigin = origin + Vector3(x * tileSize, 0.0f, z * tileSize);
+            BoundingBox tileBox(tileOrigin, tileOrigin + Vector3(tileSize, heightScale, tileSize));
+            float distance = tileBox.Distance(cameraPosition);
+            if (distance <= maxDistance)
+                candidateTiles.push_back(std::make_pair(distance, (unsigned)(z * numTiles.x + x)));
+        }
+    }
+
+    // Nearest tiles take priority when not all fit in the budget
+    std::sort(candidateTiles.begin(), candidateTiles.end());
+    if (candidateTiles.size() > maxResidentTiles)
+        candidateTiles.resize(maxResidentTiles);
+
+    // Mark all candidates used before requesting loads, so that loading a near tile never evicts another candidate
+    for (auto it = candidateTiles.begin(); it != candidateTiles.end(); ++it)
+        tiles[it->second].lastUsedFrame = frameNumber;
+
+    for (auto it = candidateTiles.begin(); it != candidateTiles.end(); ++it)
+    {
+        const TerrainTile& tile = tiles[it->second];
+        if (tile.state == TILE_RESIDENT)
+        {
+            Vector3 tileOrigin = origin + Vector3((it->second % numTiles.x) * tileSize, 0.0f, (it->second / numTiles.x) * tileSize);
+            SelectNode(tile, tileOrigin, numLodLevels - 1, 0, 0, cameraPosition, frustum);
+        }
+    }
+
+    bool newRequests = false;
+    for (auto it = candidateTiles.begin(); it != candidateTiles.end(); ++it)
+    {
+        TerrainTile& tile = tiles[it->second];
+        if (tile.state != TILE_UNLOADED)
+            continue;
+
+        int layer = ReserveLayer();
+        if (layer < 0)
+            break;
+
+        tile.state = TILE_LOADING;
+        tile.layer = layer;
+
+        AutoPtr<TerrainTileLoad> load(new TerrainTileLoad());
+        load->tileIndex = it->second;
+        load->name = tileName + "_" + std::to_string(it->second % numTiles.x) + "_" + std::to_string(it->second / numTiles.x) + ".raw";
+        load->fileName = Subsystem<ResourceCache>()->ResourceFileName(load->name);
+        load->resolution = tileResolution;
+        load->levelOffsets = levelOffsets;
+        load->success = false;
+
+        std::lock_guard<std::mutex> lock(streamingMutex);
+        loadRequests.push_back(std::move(load));
+        newRequests = true;
+    }
+
+    if (newRequests)
+        streamingSignal.notify_one();
+
+    // Requeue the drawable only when the selection changes, so that cached shadow maps are not needlessly invalidated
+    if (newSelectionKeys != selectionKeys)
+    {
+        selectionKeys.swap(newSelectionKeys);
+        OnBoundingBoxChanged();
+    }
+}
+
+void Terrain::SetMaterial(Material* material_)
+{
+    MarkAttributesDirty();
+    material = material_;
+    UpdateMaterial();
+}
+
+void Terrain::SetTileName(const std::string& name)
+{
+    MarkAttributesDirty();
+
+    if (name != tileName)
+    {
+        tileName = name;
+        ResetStreaming();
+    }
+}
+
+void Terrain::SetNumTiles(const IntVector2& num)
+{
+    MarkAttributesDirty();
+
+    IntVector2 newNumTiles(Max(num.x, 1), Max(num.y, 1));
+    if (newNumTiles != numTiles)
+    {
+        numTiles = newNumTiles;
+        ResetStreaming();
+        UpdateTerrainSize();
+    }
+}
+
+void Terrain::SetTileResolution(int resolution)
+{
+    MarkAttributesDirty();
+
+    // Round up to the nearest supported resolution, so that each level halves the patch count exactly
+    int cells = TERRAIN_PATCH_SIZE;
+    while (cells + 1 < resolution && cells + 1 < MAX_TILE_RESOLUTION)
+        cells *= 2;
+    if (cells + 1 != resolution)
+        LOGWARNINGF("Terrain tile resolution %d is not a power of two multiple of %d plus one, using %d", resolution, TERRAIN_PATCH_SIZE, cells + 1);
+
+    if (cells + 1 == tileResolution)
+        return;
+
+    tileResolution = cells + 1;
+    ResetStreaming();
+
+    numLodLevels = 1;
+    while ((TERRAIN_PATCH_SIZE << (numLodLevels - 1)) < cells)
+        ++numLodLevels;
+
+    // Store the node heights coarsest level first
+    levelOffsets.resize(numLodLevels);
+    size_t offset = 0;
+    for (int level = numLodLevels - 1; level >= 0; --level)
+    {
+        size_t numNodes = (size_t)1 << (numLodLevels - 1 - level);
+        levelOffsets[level] = offset;
+        offset += numNodes * numNodes;
+    }
+}
+
+void Terrain::SetTileSize(float size)
+{
+    MarkAttributesDirty();
+    tileSize = Max(size, M_EPSILON);
+    UpdateTerrainSize();
+}
+
+void Terrain::SetHeightScale(float scale)
+{
+    MarkAttributesDirty();
+    heightScale = Max(scale, 0.0f);
+    UpdateTerrainSize();
+}
+
+void Terrain::SetLodDistance(float distance)
+{
+    MarkAttributesDirty();
+    lodDistance = Max(distance, 0.0f);
+}
+
+void Terrain::SetViewDistance(float distance)
+{
+    MarkAttributesDirty();
+    viewDistance = Max(distance, 0.0f);
+}
+
+void Terrain::SetMemoryBudget(unsigned bytes)
+{
+    MarkAttributesDirty();
+
+    if (bytes != memoryBudget)
+    {
+        memoryBudget = bytes;
+        ResetStreaming();
+    }
+}
+
+size_t Terrain::NumResidentTiles() const
+{
+    size_t ret = 0;
+    for (auto it = tiles.begin(); it != tiles.end(); ++it)
+    {
+        if (it->state == TILE_RESIDENT)
+            ++ret;
+    }
+    return ret;
+}
+
+size_t Terrain::NumLoadingTiles() const
+{
+    size_t ret = 0;
+    for (auto it = tiles.begin(); it != tiles.end(); ++it)
+    {
+        if (it->state == TILE_LOADING)
+            ++ret;
+    }
+    return ret;
+}
+
+size_t Terrain::NumPatches() const
+{
+    TerrainDrawable* terrainDrawable = static_cast<TerrainDrawable*>(drawable);
+
+    size_t ret = 0;
+    for (size_t i = 0; i < NUM_TERRAIN_PATCH_GEOMETRIES; ++i)
+        ret += terrainDrawable->patchInstances[i].size();
+    return ret;
+}
+
+void Terrain::InitializeStreaming()
+{
+    if (streamingThread.joinable())
+        return;
+
+    ZoneScoped;
+
+    size_t tileBytes = (size_t)tileResolution * tileResolution * sizeof(unsigned short);
+    size_t numLayers = Min(Max(memoryBudget / tileBytes, (size_t)1), MAX_HEIGHT_LAYERS);
+    maxResidentTiles = Min(numLayers, (size_t)numTiles.x * numTiles.y);
+
+    tiles.clear();
+    tiles.resize(numTiles.x * numTiles.y);
+    freeLayers.clear();
+    for (int i = (int)maxResidentTiles - 1; i >= 0; --i)
+        freeLayers.push_back(i);
+
+    // Without the graphics subsystem the tiles are still streamed and patches selected, but nothing is uploaded
+    if (Subsystem<Graphics>())
+    {
+        if (!patchGeometries[0])
+            CreatePatchGeometry();
+
+        heightTexture = new Texture();
+        heightTexture->Define(TEX_2D_ARRAY, IntVector3(tileResolution, tileResolution, (int)maxResidentTiles), FMT_R16);
+        heightTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        UpdateMaterial();
+    }
+
+    streamingExit = false;
+    streamingThread = std::thread(&Terrain::StreamingLoop, this);
+}
+
+void Terrain::ResetStreaming()
+{
+    if (streamingThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(streamingMutex);
+            streamingExit = true;
+        }
+        streamingSignal.notify_one();
+        streamingThread.join();
+    }
+
+    loadRequests.clear();
+    completedLoads.clear();
+    tiles.clear();
+    freeLayers.clear();
+    selectionKeys.clear();
+    maxResidentTiles = 0;
+
+    TerrainDrawable* terrainDrawable = static_cast<TerrainDrawable*>(drawable);
+    for (size_t i = 0; i < NUM_TERRAIN_PATCH_GEOMETRIES; ++i)
+        terrainDrawable->patchInstances[i].clear();
+
+    if (heightTexture)
+    {
+        heightTexture.Reset();
+        UpdateMaterial();
+    }
+}
+
+void Terrain::CreatePatchGeometry()
+{
+    const int edgeVertices = TERRAIN_PATCH_SIZE + 1;
+    const int halfSize = TERRAIN_PATCH_SIZE / 2;
+
+    // Vertices are in patch grid units. The instance transform scales them to world units and the height scale
+    std::vector<Vector3> vertexData;
+    for (int z = 0; z < edgeVertices; ++z)
+    {
+        for (int x = 0; x < edgeVertices; ++x)
+            vertexData.push_back(Vector3((float)x, 0.0f, (float)z));
+    }
+
+    // Order the indices by quadrant, so that each quadrant is a contiguous range and the whole patch spans all of them
+    std::vector<unsigned short> indexData;
+    for (int q = 0; q < 4; ++q)
+    {
+        int startX = (q & 1) * halfSize;
+        int startZ = (q >> 1) * halfSize;
+
+        for (int z = startZ; z < startZ + halfSize; ++z)
+        {
+            for (int x = startX; x < startX + halfSize; ++x)
+            {
+                unsigned short a = (unsigned short)(z * edgeVertices + x);
+                unsigned short b = (unsigned short)(a + 1);
+                unsigned short c = (unsigned short)(a + edgeVertices + 1);
+                unsigned short d = (unsigned short)(a + edgeVertices);
+                indexData.push_back(c);
+                indexData.push_back(b);
+                indexData.push_back(a);
+                indexData.push_back(d);
+                indexData.push_back(c);
+                indexData.push_back(a);
+            }
+        }
+    }
+
+    SharedPtr<VertexBuffer> vertexBuffer(new VertexBuffer());
+    vertexBuffer->Define(USAGE_DEFAULT, vertexData.size(), std::vector<VertexElement>{ VertexElement(ELEM_VECTOR3, SEM_POSITION) }, &vertexData[0]);
+    SharedPtr<IndexBuffer> indexBuffer(new IndexBuffer());
+    indexBuffer->Define(USAGE_DEFAULT, indexData.size(), sizeof(unsigned short), &indexData[0]);
+
+    size_t quadrantIndices = indexData.size() / 4;
+
+    SetNumGeometries(NUM_TERRAIN_PATCH_GEOMETRIES);
+    for (size_t i = 0; i < NUM_TERRAIN_PATCH_GEOMETRIES; ++i)
+    {
+        Geometry* geometry = new Geometry();
+        geometry->vertexBuffer = vertexBuffer;
+        geometry->indexBuffer = indexBuffer;
+        geometry->drawStart = i ? (i - 1) * quadrantIndices : 0;
+        geometry->drawCount = i ? quadrantIndices : indexData.size();
+        patchGeometries[i] = geometry;
+        SetGeometry(i, geometry);
+    }
+}
+
+void Terrain::ProcessCompletedLoads()
+{
+    std::vector<AutoPtr<TerrainTileLoad> > loads;
+    {
+        std::lock_guard<std::mutex> lock(streamingMutex);
+        loads.swap(completedLoads);
+    }
+
+    for (auto it = loads.begin(); it != loads.end(); ++it)
+    {
+        TerrainTileLoad* load = *it;
+        TerrainTile& tile = tiles[load->tileIndex];
+
+        if (!load->success)
+        {
+            LOGERROR("Could not load terrain tile " + load->name);
+            freeLayers.push_back(tile.layer);
+            tile.state = TILE_FAILED;
+            tile.layer = -1;
+            continue;
+        }
+
+        ZoneScopedN("UploadTerrainTile");
+
+        if (heightTexture)
+        {
+            heightTexture->SetData(0, IntBox(0, 0, tile.layer, tileResolution, tileResolution, tile.layer + 1), ImageLevel(IntVector2(tileResolution,
+                tileResolution), FMT_R16, &load->heights[0]));
+        }
+
+        tile.nodeHeights.swap(load->nodeHeights);
+        tile.state = TILE_RESIDENT;
+    }
+}
+
+int Terrain::ReserveLayer()
+{
+    if (freeLayers.empty())
+    {
+        // Evict the least recently used resident tile. Tiles used this frame are kept, as their patches are already selected
+        TerrainTile* evictTile = nullptr;
+        for (auto it = tiles.begin(); it != tiles.end(); ++it)
+        {
+            if (it->state == TILE_RESIDENT && it->lastUsedFrame != frameNumber && (!evictTile || it->lastUsedFrame < evictTile->lastUsedFrame))
+                evictTile = &(*it);
+        }
+
+        if (!evictTile)
+            return -1;
+
+        freeLayers.push_back(evictTile->layer);
+        evictTile->state = TILE_UNLOADED;
+        evictTile->layer = -1;
+        evictTile->nodeHeights.clear();
+    }
+
+    int layer = freeLayers.back();
+    freeLayers.pop_back();
+    return layer;
+}
+
+bool Terrain::SelectNode(const TerrainTile& tile, const Vector3& tileOrigin, int level, int x, int z, const Vector3& cameraPosition, const Frustum& frustum)
+{
+    BoundingBox box = NodeBoundingBox(tileOrigin, level, x, z, tile.nodeHeights[NodeIndex(level, x, z)]);
+
+    // The coarsest level covers any distance
+    if (level < numLodLevels - 1 && Sphere(cameraPosition, lodRanges[level]).IsInsideFast(box) == OUTSIDE)
+        return false;
+
+    // Culled nodes are handled, so that the parent does not draw them either
+    if (frustum.IsInsideFast(box) == OUTSIDE)
+        return true;
+
+    if (!level || Sphere(cameraPosition, lodRanges[level - 1]).IsInsideFast(box) == OUTSIDE)
+    {
+        AddPatch(tile, tileOrigin, level, x, z, 0);
+        return true;
+    }
+
+    // Cover the children out of the finer range with quadrants of this level's patch
+    for (int cz = 0; cz < 2; ++cz)
+    {
+        for (int cx = 0; cx < 2; ++cx)
+        {
+            if (!SelectNode(tile, tileOrigin, level - 1, x * 2 + cx, z * 2 + cz, cameraPosition, frustum))
+                AddPatch(tile, tileOrigin, level, x, z, 1 + cx + cz * 2);
+        }
+    }
+
+    return true;
+}
+
+void Terrain::AddPatch(const TerrainTile& tile, const Vector3& tileOrigin, int level, int x, int z, size_t geomIndex)
+{
+    int step = 1 << level;
+    int offsetX = x * TERRAIN_PATCH_SIZE * step;
+    int offsetZ = z * TERRAIN_PATCH_SIZE * step;
+    float sampleSpacing = tileSize / (tileResolution - 1);
+    float cellSize = sampleSpacing * step;
+    float invResolution = 1.0f / tileResolution;
+
+    // User data holds the heightmap texture coordinate of the patch origin sample, the coordinate step per grid cell and the morph range
+    static_cast<TerrainDrawable*>(drawable)->patchInstances[geomIndex].push_back(UserInstanceData(Matrix3x4(
+        cellSize, 0.0f, 0.0f, tileOrigin.x + offsetX * sampleSpacing,
+        0.0f, heightScale, 0.0f, tileOrigin.y,
+        0.0f, 0.0f, cellSize, tileOrigin.z + offsetZ * sampleSpacing
+    ), (float)tile.layer, Vector4((offsetX + 0.5f) * invResolution, (offsetZ + 0.5f) * invResolution, step * invResolution,
+        level < numLodLevels - 1 ? lodRanges[level] : 0.0f)));
+
+    newSelectionKeys.push_back((unsigned)tile.layer);
+    newSelectionKeys.push_back(((unsigned)level << 28) | ((unsigned)x << 16) | ((unsigned)z << 4) | (unsigned)geomIndex);
+}
+
+BoundingBox Terrain::NodeBoundingBox(const Vector3& tileOrigin, int level, int x, int z, const Vector2& heights) const
+{
+    float nodeSize = tileSize * (TERRAIN_PATCH_SIZE << level) / (tileResolution - 1);
+    Vector3 nodeOrigin = tileOrigin + Vector3(x * nodeSize, 0.0f, z * nodeSize);
+    return BoundingBox(nodeOrigin + Vector3(0.0f, heights.x * heightScale, 0.0f), nodeOrigin + Vector3(nodeSize, heights.y * heightScale, nodeSize));
+}
+
+size_t Terrain::NodeIndex(int level, int x, int z) const
+{
+    return levelOffsets[level] + ((size_t)z << (numLodLevels - 1 - level)) + x;
+}
+
+void Terrain::StreamingLoop()
+{
+    for (;;)
+    {
+        AutoPtr<TerrainTileLoad> load;
+        {
+            std::unique_lock<std::mutex> lock(streamingMutex);
+            streamingSignal.wait(lock, [this] { return streamingExit || !loadRequests.empty(); });
+            if (streamingExit)
+                return;
+
+            load = std::move(loadRequests.front());
+            loadRequests.pop_front();
+        }
+
+        {
+            ZoneScopedN("LoadTerrainTile");
+
+            size_t numSamples = (size_t)load->resolution * load->resolution;
+            File file;
+            if (!load->fileName.empty() && file.Open(load->fileName) && file.IsReadable() && file.Size() == numSamples * sizeof(unsigned short))
+            {
+                load->heights.resize(numSamples);
+                if (file.Read(&load->heights[0], file.Size()) == file.Size())
+                {
+                    CalculateNodeHeights(*load);
+                    load->success = true;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(streamingMutex);
+        completedLoads.push_back(std::move(load));
+    }
+}
+
+void Terrain::UpdateMaterial()
+{
+    terrainMaterial.Reset();
+
+    Material* renderMaterial = material ? material.Get() : Material::DefaultMaterial();
+    if (heightTexture)
+    {
+        terrainMaterial = renderMaterial->Clone();
+        terrainMaterial->SetTexture(HEIGHT_TEXTURE_UNIT, heightTexture);
+        renderMaterial = terrainMaterial;
+    }
+
+    TerrainDrawable* terrainDrawable = static_cast<TerrainDrawable*>(drawable);
+    for (size_t i = 0; i < terrainDrawable->batches.NumGeometries(); ++i)
+        terrainDrawable->batches.SetMaterial(i, renderMaterial);
+}
+
+void Terrain::UpdateTerrainSize()
+{
+    static_cast<TerrainDrawable*>(drawable)->terrainSize = Vector3(numTiles.x * tileSize, heightScale, numTiles.y * tileSize);
+    OnBoundingBoxChanged();
+}
+
+void Terrain::SetMaterialAttr(const ResourceRef& value)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetMaterial(cache->LoadResource<Material>(value.name));
+}
+
+ResourceRef Terrain::MaterialAttr() const
+{
+    return ResourceRef(Material::TypeStatic(), ResourceName(material));
+}
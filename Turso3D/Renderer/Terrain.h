@@ -0,0 +1,229 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Object/AutoPtr.h"
+#include "GeometryNode.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class Frustum;
+class Texture;
+struct TerrainTileLoad;
+
+/// Number of grid cells along a patch edge.
+static const int TERRAIN_PATCH_SIZE = 32;
+/// Number of geometries in the shared patch mesh: the full patch followed by its four quadrants.
+static const size_t NUM_TERRAIN_PATCH_GEOMETRIES = 5;
+
+/// Residency state of a terrain heightmap tile.
+enum TerrainTileState
+{
+    TILE_UNLOADED = 0,
+    TILE_LOADING,
+    TILE_RESIDENT,
+    TILE_FAILED
+};
+
+/// Streaming state of a terrain heightmap tile.
+struct TerrainTile
+{
+    /// Construct.
+    TerrainTile() :
+        state(TILE_UNLOADED),
+        layer(-1),
+        lastUsedFrame(0)
+    {
+    }
+
+    /// Residency state.
+    TerrainTileState state;
+    /// Heightmap texture layer if loading or resident, -1 otherwise.
+    int layer;
+    /// Last frame the tile was selected for rendering.
+    unsigned lastUsedFrame;
+    /// Minimum and maximum normalized height of each quadtree node, coarsest level first.
+    std::vector<Vector2> nodeHeights;
+};
+
+/// Terrain drawable. Renders the patches selected by the owning Terrain node as instances of a shared patch mesh.
+class TerrainDrawable : public GeometryDrawable
+{
+    friend class Terrain;
+
+public:
+    /// Construct.
+    TerrainDrawable();
+
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Prepare object for rendering. Calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Append the selected patches of a patch mesh geometry. The material's texture layer is ignored, as the instance texture layer selects the heightmap tile. Called by Renderer from batch sorting, which may run concurrently in several worker threads. Only reads the patches selected in Update().
+    void OnAddInstances(InstanceDataVector& dest, UserInstanceDataVector* userDest, size_t geomIndex, unsigned short textureLayer) const override;
+
+private:
+    /// Selected patch instances per patch mesh geometry.
+    UserInstanceDataVector patchInstances[NUM_TERRAIN_PATCH_GEOMETRIES];
+    /// Terrain size in world units.
+    Vector3 terrainSize;
+};
+
+/// %Scene node that renders a large heightmap terrain with continuous distance-dependent LOD (CDLOD). The terrain is split into square tiles whose heightmaps are streamed from disk on a background thread into a texture array within a memory budget. A quadtree of patches per tile is culled and LOD-selected on the CPU, and all patches are drawn as instances of one shared grid mesh whose vertices are displaced and morphed between LOD levels by the terrain shader. The terrain is aligned to the world axes and extends along the positive X and Z axes from the node's world position; node rotation and scale are not applied.
+class Terrain : public GeometryNode
+{
+    OBJECT(Terrain);
+
+public:
+    /// Construct.
+    Terrain();
+    /// Destruct. Stop the streaming thread.
+    ~Terrain();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Select the patches to render for a camera, and request and upload heightmap tiles as needed. Should be called once per frame on the main thread before rendering. No-op when not in an octree, disabled or dormant.
+    void Update(Camera* camera);
+    /// Set the material. The terrain renders with a copy of it, to which the heightmap texture array is assigned at texture unit 7. The material should define a "lodCameraPosition" uniform, which is set to the selection camera position on each update for the vertex morph.
+    void SetMaterial(Material* material);
+    /// Set the heightmap tile resource name prefix. The tile at (x, z) is loaded from "<prefix>_<x>_<z>.raw", which contains tileResolution * tileResolution little-endian 16-bit unsigned heights in rows of increasing Z.
+    void SetTileName(const std::string& name);
+    /// Set number of tiles along the X and Z axes. Default 1 x 1.
+    void SetNumTiles(const IntVector2& num);
+    /// Set number of height samples along a tile edge. Must be a power of two multiple of the patch size plus one, for example 257. Default 257.
+    void SetTileResolution(int resolution);
+    /// Set tile size in world units. Default 256.
+    void SetTileSize(float size);
+    /// Set the world space height of the maximum heightmap value. Default 64.
+    void SetHeightScale(float scale);
+    /// Set the LOD range of the finest level. Each coarser level doubles the range. Clamped to at least twice the finest patch size. Default 64.
+    void SetLodDistance(float distance);
+    /// Set the maximum distance at which tiles are streamed and rendered, or 0 to use the camera far clip distance. Default 0.
+    void SetViewDistance(float distance);
+    /// Set the GPU memory budget for resident heightmap tiles in bytes. Tiles nearest to the camera take priority when the budget is exceeded. Default 64 MB.
+    void SetMemoryBudget(unsigned bytes);
+
+    /// Return the material.
+    Material* GetMaterial() const { return material; }
+    /// Return the heightmap tile resource name prefix.
+    const std::string& TileName() const { return tileName; }
+    /// Return number of tiles.
+    const IntVector2& NumTiles() const { return numTiles; }
+    /// Return number of height samples along a tile edge.
+    int TileResolution() const { return tileResolution; }
+    /// Return tile size in world units.
+    float TileSize() const { return tileSize; }
+    /// Return the world space height of the maximum heightmap value.
+    float HeightScale() const { return heightScale; }
+    /// Return the LOD range of the finest level.
+    float LodDistance() const { return lodDistance; }
+    /// Return the maximum streaming and rendering distance.
+    float ViewDistance() const { return viewDistance; }
+    /// Return the memory budget for resident heightmap tiles.
+    unsigned MemoryBudget() const { return memoryBudget; }
+    /// Return number of LOD levels within a tile.
+    int NumLodLevels() const { return numLodLevels; }
+    /// Return number of tiles that fit in the memory budget.
+    size_t MaxResidentTiles() const { return maxResidentTiles; }
+    /// Return number of resident tiles.
+    size_t NumResidentTiles() const;
+    /// Return number of tiles being loaded.
+    size_t NumLoadingTiles() const;
+    /// Return number of patches selected on the last update.
+    size_t NumPatches() const;
+    /// Return the tile streaming states.
+    const std::vector<TerrainTile>& Tiles() const { return tiles; }
+
+private:
+    /// Create the patch mesh, heightmap texture array and tile states, and start the streaming thread if not done yet.
+    void InitializeStreaming();
+    /// Stop the streaming thread and release all tiles, so that they are reloaded with the current settings.
+    void ResetStreaming();
+    /// Create the shared patch mesh geometries.
+    void CreatePatchGeometry();
+    /// Upload the tiles completed by the streaming thread.
+    void ProcessCompletedLoads();
+    /// Reserve a texture layer for loading a tile, evicting the least recently used tile not selected this frame if necessary. Return -1 if the budget is exhausted.
+    int ReserveLayer();
+    /// Select the patches of a quadtree node. Return false if the node is out of its LOD range and should be covered by its parent.
+    bool SelectNode(const TerrainTile& tile, const Vector3& tileOrigin, int level, int x, int z, const Vector3& cameraPosition, const Frustum& frustum);
+    /// Add a patch instance for a quadtree node or one of its quadrants.
+    void AddPatch(const TerrainTile& tile, const Vector3& tileOrigin, int level, int x, int z, size_t geomIndex);
+    /// Return world space bounding box of a quadtree node.
+    BoundingBox NodeBoundingBox(const Vector3& tileOrigin, int level, int x, int z, const Vector2& heights) const;
+    /// Return index of a quadtree node in the tile's node heights.
+    size_t NodeIndex(int level, int x, int z) const;
+    /// Streaming thread function.
+    void StreamingLoop();
+    /// Assign the material with the current heightmap texture array to the patch geometries.
+    void UpdateMaterial();
+    /// Update the drawable's terrain size.
+    void UpdateTerrainSize();
+    /// Set material attribute. Used in serialization.
+    void SetMaterialAttr(const ResourceRef& value);
+    /// Return material attribute. Used in serialization.
+    ResourceRef MaterialAttr() const;
+
+    /// Material as assigned.
+    SharedPtr<Material> material;
+    /// Copy of the material with the heightmap texture array assigned.
+    SharedPtr<Material> terrainMaterial;
+    /// Heightmap texture array.
+    SharedPtr<Texture> heightTexture;
+    /// Patch mesh geometries.
+    SharedPtr<Geometry> patchGeometries[NUM_TERRAIN_PATCH_GEOMETRIES];
+    /// Heightmap tile resource name prefix.
+    std::string tileName;
+    /// Number of tiles.
+    IntVector2 numTiles;
+    /// Number of height samples along a tile edge.
+    int tileResolution;
+    /// Tile size in world units.
+    float tileSize;
+    /// World space height of the maximum heightmap value.
+    float heightScale;
+    /// LOD range of the finest level.
+    float lodDistance;
+    /// Maximum streaming and rendering distance.
+    float viewDistance;
+    /// Memory budget for resident tiles.
+    unsigned memoryBudget;
+    /// Number of LOD levels within a tile.
+    int numLodLevels;
+    /// Number of tiles that fit in the memory budget.
+    size_t maxResidentTiles;
+    /// LOD ranges per level.
+    std::vector<float> lodRanges;
+    /// Offsets of each level in the node heights.
+    std::vector<size_t> levelOffsets;
+    /// Tile streaming states.
+    std::vector<TerrainTile> tiles;
+    /// Heightmap texture layers not reserved by any tile.
+    std::vector<int> freeLayers;
+    /// Tiles within view distance sorted by distance, used during update.
+    std::vector<std::pair<float, unsigned> > candidateTiles;
+    /// Selected patch keys of the last update, for detecting changes.
+    std::vector<unsigned> selectionKeys;
+    /// Selected patch keys of the current update.
+    std::vector<unsigned> newSelectionKeys;
+    /// Update frame counter.
+    unsigned frameNumber;
+
+    /// Streaming thread.
+    std::thread streamingThread;
+    /// Mutex for the load queues.
+    std::mutex streamingMutex;
+    /// Signal for new load requests.
+    std::condition_variable streamingSignal;
+    /// Pending load requests.
+    std::deque<AutoPtr<TerrainTileLoad> > loadRequests;
+    /// Completed loads waiting for upload.
+    std::vector<AutoPtr<TerrainTileLoad> > completedLoads;
+    /// Streaming thread exit flag.
+    bool streamingExit;
+};
@@ -0,0 +1,29 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "VisibilitySet.h"
+
+#include <tracy/Tracy.hpp>
+
+VisibilitySet::VisibilitySet() :
+    capacity(0),
+    numIds(0)
+{
+}
+
+void VisibilitySet::Reset(unsigned numIds_)
+{
+    ZoneScoped;
+
+    size_t numWords = (numIds_ + 63) >> 6;
+    if (numWords > capacity)
+    {
+        // Grow with headroom to avoid reallocating each time drawables are added
+        capacity = numWords + (numWords >> 1);
+        words = new std::atomic<unsigned long long>[capacity];
+    }
+
+    for (size_t i = 0; i < numWords; ++i)
+        words[i].store(0, std::memory_order_relaxed);
+
+    numIds = numIds_;
+}
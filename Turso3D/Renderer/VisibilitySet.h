@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+
+#include <atomic>
+#include <cassert>
+
+/// Dense visibility bitset for one view, indexed by stable drawable ids. Bits can be set concurrently from worker threads.
+class VisibilitySet
+{
+public:
+    /// Construct.
+    VisibilitySet();
+
+    /// Clear all bits and ensure capacity for the given number of ids.
+    void Reset(unsigned numIds);
+    /// Set a bit. The id must be within the covered range. Safe to call from multiple threads.
+    void Set(unsigned id) { assert(id < numIds); words[id >> 6].fetch_or(1ULL << (id & 63), std::memory_order_relaxed); }
+    /// Clear a bit. Ids outside the covered range are ignored. Safe to call from multiple threads.
+    void Clear(unsigned id) { if (id < numIds) words[id >> 6].fetch_and(~(1ULL << (id & 63)), std::memory_order_relaxed); }
+    /// Test a bit. Ids outside the covered range, for example drawables inserted after the view was prepared, test as not set.
+    bool Test(unsigned id) const { return id < numIds && (words[id >> 6].load(std::memory_order_relaxed) & (1ULL << (id & 63))) != 0; }
+
+    /// Call a function for each set bit in ascending id order.
+    template <class T> void ForEach(T function) const
+    {
+        size_t numWords = (numIds + 63) >> 6;
+
+        for (size_t i = 0; i < numWords; ++i)
+        {
+            unsigned long long word = words[i].load(std::memory_order_relaxed);
+            for (unsigned bit = 0; word; ++bit, word >>= 1)
+            {
+                if (word & 1)
+                    function((unsigned)(i << 6) + bit);
+            }
+        }
+    }
+
+    /// Return number of ids covered.
+    unsigned NumIds() const { return numIds; }
+
+private:
+    /// Bit storage.
+    AutoArrayPtr<std::atomic<unsigned long long> > words;
+    /// Number of allocated words.
+    size_t capacity;
+    /// Number of ids covered.
+    unsigned numIds;
+};
@@ -4,13 +4,33 @@
 #include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "../IO/StringUtils.h"
+#include "../Thread/WorkQueue.h"
 #include "Image.h"
 #include "JSONFile.h"
 #include "ResourceCache.h"
 
 #include <tracy/Tracy.hpp>
 
-ResourceCache::ResourceCache()
+/// %Task for loading a prefetched resource in a worker thread.
+struct PrefetchResourceTask : public MemberFunctionTask<ResourceCache>
+{
+    /// Construct.
+    PrefetchResourceTask(ResourceCache* object_, MemberWorkFunctionPtr function_) :
+        MemberFunctionTask<ResourceCache>(object_, function_),
+        success(false)
+    {
+    }
+
+    /// Resource being loaded.
+    SharedPtr<Resource> resource;
+    /// Stream to load from.
+    AutoPtr<Stream> stream;
+    /// BeginLoad() result.
+    bool success;
+};
+
+ResourceCache::ResourceCache() :
+    recordingManifest(false)
 {
     RegisterSubsystem(this);
     RegisterResourceLibrary();
@@ -260,7 +280,10 @@ Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn
     auto key = std::make_pair(type, StringHash(name));
     auto it = resources.find(key);
     if (it != resources.end())
+    {
+        RecordManifestEntry(it->second);
         return it->second;
+    }
 
     SharedPtr<Object> newObject = Create(type);
     if (!newObject)
@@ -285,9 +308,190 @@ Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn
     newResource->Load(*stream);
     // Store to cache
     resources[key] = newResource;
+    RecordManifestEntry(newResource);
     return newResource;
 }
 
+void ResourceCache::BeginManifestRecording()
+{
+    manifestEntries.clear();
+    manifestKeys.clear();
+    recordingManifest = true;
+}
+
+bool ResourceCache::SaveManifest(const std::string& fileName)
+{
+    ZoneScoped;
+
+    recordingManifest = false;
+
+    JSONFile json;
+    JSONValue& root = json.Root();
+    root.SetEmptyArray();
+
+    for (auto it = manifestEntries.begin(); it != manifestEntries.end(); ++it)
+    {
+        JSONValue entry;
+        entry["type"] = TypeNameFromType(it->type);
+        entry["name"] = it->name;
+        entry["modified"] = it->modifiedTime;
+        root.Push(entry);
+    }
+
+    File file(fileName, FILE_WRITE);
+    if (!file.IsWritable())
+    {
+        LOGERROR("Could not open manifest file " + fileName + " for writing");
+        return false;
+    }
+
+    LOGINFOF("Saving resource manifest %s with %d resources", fileName.c_str(), (int)manifestEntries.size());
+    return json.Save(file);
+}
+
+size_t ResourceCache::PrefetchManifest(const std::string& fileName)
+{
+    ZoneScoped;
+
+    JSONFile json;
+    AutoPtr<Stream> manifestStream = OpenResource(fileName);
+    if (!manifestStream || !json.Load(*manifestStream))
+        return 0;
+
+    const JSONArray& jsonEntries = json.Root().GetArray();
+    std::vector<ResourceManifestEntry> entries;
+
+    for (auto it = jsonEntries.begin(); it != jsonEntries.end(); ++it)
+    {
+        ResourceManifestEntry entry;
+        entry.type = StringHash((*it)["type"].GetString());
+        entry.name = (*it)["name"].GetString();
+        entry.modifiedTime = (unsigned)(*it)["modified"].GetNumber();
+        entries.push_back(entry);
+    }
+
+    size_t numLoaded = PrefetchResources(entries);
+    LOGINFOF("Prefetched %d resources from manifest %s", (int)numLoaded, fileName.c_str());
+    return numLoaded;
+}
+
+size_t ResourceCache::PrefetchResources(const std::vector<ResourceManifestEntry>& entries)
+{
+    ZoneScoped;
+
+    std::vector<AutoPtr<PrefetchResourceTask> > tasks;
+    size_t numStale = 0;
+
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        StringHash type = it->type;
+        const std::string& name = it->name;
+        unsigned modifiedTime = it->modifiedTime;
+
+        if (resources.find(std::make_pair(type, StringHash(name))) != resources.end())
+            continue;
+
+        // Discard entries whose file was removed or changed since recording, they will be loaded on demand instead
+        if (!modifiedTime || LastModifiedTime(name) != modifiedTime)
+        {
+            ++numStale;
+            continue;
+        }
+
+        SharedPtr<Object> newObject = Create(type);
+        Resource* newResource = dynamic_cast<Resource*>(newObject.Get());
+        if (!newResource)
+        {
+            ++numStale;
+            continue;
+        }
+
+        AutoPtr<Stream> stream = OpenResource(name);
+        if (!stream)
+        {
+            ++numStale;
+            continue;
+        }
+
+        newResource->SetName(name);
+        PrefetchResourceTask* task = new PrefetchResourceTask(this, &ResourceCache::PrefetchWork);
+        task->resource = newResource;
+        task->stream = stream;
+        tasks.push_back(task);
+    }
+
+    if (numStale)
+        LOGWARNINGF("Discarded %d stale resource prefetch entries", (int)numStale);
+
+    // Begin loading in worker threads, or sequentially if no work queue
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue && tasks.size())
+    {
+        // Wait only for the prefetch tasks, not for unrelated work that may be queued
+        std::atomic<int> counter(0);
+        for (auto it = tasks.begin(); it != tasks.end(); ++it)
+            workQueue->AddCounter(*it, counter);
+
+        workQueue->QueueTasks(tasks.size(), reinterpret_cast<Task**>(&tasks[0]));
+        workQueue->Wait(counter, WorkQueue::ThreadIndex());
+    }
+    else
+    {
+        for (auto it = tasks.begin(); it != tasks.end(); ++it)
+            PrefetchWork(*it, 0);
+    }
+
+    // Finish loading in list order. Manifests record resources after their dependencies, so those are cached by now
+    size_t numLoaded = 0;
+    for (auto it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        PrefetchResourceTask* task = *it;
+        Resource* resource = task->resource;
+        if (task->success && resource->EndLoad())
+        {
+            resources[std::make_pair(resource->Type(), resource->NameHash())] = resource;
+            RecordManifestEntry(resource);
+            ++numLoaded;
+        }
+        else
+            LOGERROR("Failed to prefetch resource " + resource->Name());
+    }
+
+    return numLoaded;
+}
+
+void ResourceCache::RecordManifestEntry(Resource* resource)
+{
+    if (!recordingManifest)
+        return;
+
+    auto key = std::make_pair(resource->Type(), resource->NameHash());
+    if (manifestKeys.find(key) != manifestKeys.end())
+        return;
+
+    // Manual resources have no file and cannot be prefetched
+    unsigned modifiedTime = LastModifiedTime(resource->Name());
+    if (!modifiedTime)
+        return;
+
+    manifestKeys.insert(key);
+
+    ResourceManifestEntry entry;
+    entry.type = resource->Type();
+    entry.name = resource->Name();
+    entry.modifiedTime = modifiedTime;
+    manifestEntries.push_back(entry);
+}
+
+void ResourceCache::PrefetchWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    PrefetchResourceTask* task = static_cast<PrefetchResourceTask*>(task_);
+    task->success = task->resource->BeginLoad(*task->stream);
+    task->stream.Reset();
+}
+
 void ResourceCache::ResourcesByType(std::vector<Resource*>& result, StringHash type) const
 {
     result.clear();
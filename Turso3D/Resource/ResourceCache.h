@@ -4,10 +4,24 @@
 
 #include "../Object/Object.h"
 
+#include <set>
+
 class Resource;
 class Stream;
+struct Task;
 
 typedef std::map<std::pair<StringHash, StringHash>, SharedPtr<Resource> > ResourceMap;
+
+/// Resource prefetch manifest entry.
+struct ResourceManifestEntry
+{
+    /// Resource type.
+    StringHash type;
+    /// Resource name.
+    std::string name;
+    /// Last modified time of the resource file when recorded.
+    unsigned modifiedTime;
+};
  
 /// %Resource cache subsystem. Loads resources on demand and stores them for later access.
 class ResourceCache : public Object
@@ -42,6 +56,14 @@ public:
     void UnloadAllResources(bool force = false);
     /// Reload an existing resource. Return true on success.
     bool ReloadResource(Resource* resource);
+    /// Begin recording the resources that are requested, for example during a scene load. Clears any previous recording.
+    void BeginManifestRecording();
+    /// Stop recording and save the resources requested so far as a prefetch manifest. Return true on success.
+    bool SaveManifest(const std::string& fileName);
+    /// Load the resources listed in a prefetch manifest. BeginLoad() runs in parallel on the WorkQueue, then EndLoad() runs in the recorded order, so that dependencies are cached before the resources that use them. Entries whose file is missing or has been modified are discarded. Return number of resources loaded.
+    size_t PrefetchManifest(const std::string& fileName);
+    /// Load the listed resources that are not loaded yet. BeginLoad() runs in parallel on the WorkQueue, then EndLoad() runs in list order. Entries whose file is missing or has been modified since the recorded time are discarded. Return number of resources loaded.
+    size_t PrefetchResources(const std::vector<ResourceManifestEntry>& entries);
     /// Load and return a resource, template version.
     template <class T> T* LoadResource(const std::string& name) { return static_cast<T*>(LoadResource(T::TypeStatic(), name)); }
     /// Load and return a resource, template version.
@@ -51,6 +73,8 @@ public:
     void ResourcesByType(std::vector<Resource*>& result, StringHash type) const;
     /// Return resource directories.
     const std::vector<std::string>& ResourceDirs() const { return resourceDirs; }
+    /// Return whether is recording a prefetch manifest.
+    bool IsRecordingManifest() const { return recordingManifest; }
     /// Return whether a file exists in the resource directories.
     bool Exists(const std::string& name) const;
     /// Return last modified time of a file from the resource directories, or 0 if doesn't exist.
@@ -79,8 +103,21 @@ public:
     std::string SanitateResourceDirName(const std::string& name) const;
 
 private:
+    /// Record a requested resource to the manifest if recording.
+    void RecordManifestEntry(Resource* resource);
+    /// Work function to begin loading a prefetched resource.
+    void PrefetchWork(Task* task, unsigned threadIndex);
+
+    /// Loaded resources.
     ResourceMap resources;
+    /// Resource directories.
     std::vector<std::string> resourceDirs;
+    /// Recorded manifest entries in the order their loading finished.
+    std::vector<ResourceManifestEntry> manifestEntries;
+    /// Resources already recorded to the manifest.
+    std::set<std::pair<StringHash, StringHash> > manifestKeys;
+    /// Manifest recording flag.
+    bool recordingManifest;
 };
 
 /// Register Resource related object factories and attributes.
@@ -9,6 +9,17 @@
 static std::vector<SharedPtr<Node> > noChildren;
 static Allocator<NodeImpl> nodeImplAllocator;
 
+static bool HasTemporaryAncestor(Node* node)
+{
+    for (; node; node = node->Parent())
+    {
+        if (node->IsTemporary())
+            return true;
+    }
+
+    return false;
+}
+
 Node::Node() :
     impl(nodeImplAllocator.Allocate()),
     parent(nullptr),
@@ -17,6 +28,7 @@ Node::Node() :
 {
     impl->scene = nullptr;
     impl->id = 0;
+    impl->updateIndex = 0;
 }
 
 Node::~Node()
@@ -136,12 +148,14 @@ bool Node::SaveJSON(Stream& dest)
 
 void Node::SetName(const std::string& newName)
 {
+    MarkAttributesDirty();
     impl->name = newName;
     impl->nameHash = StringHash(newName);
 }
 
 void Node::SetName(const char* newName)
 {
+    MarkAttributesDirty();
     impl->name = newName;
     impl->nameHash = StringHash(newName);
 }
@@ -150,6 +164,7 @@ void Node::SetLayer(unsigned char newLayer)
 {
     if (layer < 32)
     {
+        MarkAttributesDirty();
         layer = newLayer;
         OnLayerChanged(newLayer);
     }
@@ -161,6 +176,7 @@ void Node::SetEnabled(bool enable)
 {
     if (enable != TestFlag(NF_ENABLED))
     {
+        MarkAttributesDirty();
         SetFlag(NF_ENABLED, enable);
         OnEnabledChanged(enable);
     }
@@ -176,11 +192,52 @@ void Node::SetEnabledRecursive(bool enable)
     }
 }
 
+void Node::SetDormant(bool enable)
+{
+    if (enable != TestFlag(NF_DORMANT))
+    {
+        SetFlag(NF_DORMANT, enable);
+        OnDormantChanged(enable);
+    }
+}
+
+void Node::SetDormantRecursive(bool enable)
+{
+    SetDormant(enable);
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* child = *it;
+        child->SetDormantRecursive(enable);
+    }
+}
+
 void Node::SetTemporary(bool enable)
 {
+    if (enable != TestFlag(NF_TEMPORARY) && impl->scene && impl->scene->IsTrackingChanges())
+    {
+        // Whether the whole subtree is saved changes, so mark it for delta serialization. When saved again, it is added last on load, so the child order must also be sent
+        MarkSubtreeAttributesDirty();
+        if (parent)
+            impl->scene->QueueChildOrder(parent);
+    }
+
     SetFlag(NF_TEMPORARY, enable);
 }
 
+void Node::QueueAttributesDirty()
+{
+    impl->scene->QueueDirtyNode(this);
+}
+
+void Node::MarkSubtreeAttributesDirty()
+{
+    std::vector<Node*> descendants;
+    FindAllChildren(descendants);
+    MarkAttributesDirty();
+    for (auto it = descendants.begin(); it != descendants.end(); ++it)
+        (*it)->MarkAttributesDirty();
+}
+
 void Node::SetParent(Node* newParent)
 {
     if (newParent)
@@ -253,14 +310,20 @@ void Node::AddChild(Node* child)
     }
 #endif
 
+    // Hold a reference while moving, in case the old parent has the only one
+    SharedPtr<Node> childRef(child);
     Node* oldParent = child->parent;
+    // Moving within the scene between a temporary and a persistent parent changes whether the whole subtree is saved
+    bool persistenceChanged = impl->scene && child->impl->scene == impl->scene && impl->scene->IsTrackingChanges() &&
+        HasTemporaryAncestor(oldParent) != HasTemporaryAncestor(this);
     if (oldParent)
     {
-        for (auto it = oldParent->children.begin(); it != oldParent->children.end(); ++it)
+        // Search from the back, as recently added children are the most likely to be moved again, for example when pooling
+        for (auto it = oldParent->children.rbegin(); it != oldParent->children.rend(); ++it)
         {
             if (*it == child)
             {
-                oldParent->children.erase(it);
+                oldParent->children.erase(std::next(it).base());
                 break;
             }
         }
@@ -270,7 +333,14 @@ void Node::AddChild(Node* child)
     child->parent = this;
     child->OnParentSet(this, oldParent);
     if (impl->scene)
+    {
+        // Reparenting within the scene is tracked as a change, while adding is tracked by the scene. The child goes last, so the child order is also tracked
+        child->MarkAttributesDirty();
         impl->scene->AddNode(child);
+        impl->scene->QueueChildOrder(this);
+        if (persistenceChanged)
+            child->MarkSubtreeAttributesDirty();
+    }
 }
 
 void Node::RemoveChild(Node* child)
@@ -323,6 +393,31 @@ void Node::RemoveSelf()
         parent->RemoveChild(this);
 }
 
+void Node::SetChildIndex(Node* child, size_t index)
+{
+    if (!child || child->parent != this)
+        return;
+
+    if (index >= children.size())
+        index = children.size() - 1;
+
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        if (children[i] == child)
+        {
+            if (i != index)
+            {
+                SharedPtr<Node> childRef(child);
+                children.erase(children.begin() + i);
+                children.insert(children.begin() + index, childRef);
+                if (impl->scene)
+                    impl->scene->QueueChildOrder(this);
+            }
+            return;
+        }
+    }
+}
+
 size_t Node::NumPersistentChildren() const
 {
     size_t ret = 0;
@@ -488,6 +583,30 @@ void Node::FindChildrenByLayer(std::vector<Node*>& result, unsigned layerMask, b
     }
 }
 
+void Node::DetachQueuedChildren(std::vector<SharedPtr<Node> >& dest)
+{
+    size_t numKept = 0;
+
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        Node* child = children[i];
+        if (child->TestFlag(NF_DESTROY_QUEUED))
+        {
+            child->parent = nullptr;
+            child->SetFlag(NF_DESTROY_QUEUED | NF_SPATIAL_PARENT, false);
+            dest.push_back(children[i]);
+        }
+        else
+        {
+            if (numKept != i)
+                children[numKept] = children[i];
+            ++numKept;
+        }
+    }
+
+    children.resize(numKept);
+}
+
 void Node::SetScene(Scene* newScene)
 {
     Scene* oldScene = impl->scene;
@@ -525,6 +644,10 @@ void Node::OnEnabledChanged(bool)
 {
 }
 
+void Node::OnDormantChanged(bool)
+{
+}
+
 void Node::OnLayerChanged(unsigned char)
 {
 }
@@ -15,6 +15,9 @@ static const unsigned char NF_TEMPORARY = 0x2;
 static const unsigned char NF_SPATIAL = 0x4;
 static const unsigned char NF_SPATIAL_PARENT = 0x8;
 static const unsigned char NF_WORLD_TRANSFORM_DIRTY = 0x10;
+static const unsigned char NF_DORMANT = 0x20;
+static const unsigned char NF_DESTROY_QUEUED = 0x40;
+static const unsigned char NF_ATTRIBUTES_DIRTY = 0x80;
 
 static const unsigned char LAYER_DEFAULT = 0x0;
 static const unsigned LAYERMASK_ALL = 0xffffffff;
@@ -30,6 +33,8 @@ struct NodeImpl
     std::string name;
     /// &Node name hash.
     StringHash nameHash;
+    /// Index in the update scheduler's node list of the node type.
+    unsigned updateIndex;
 };
 
 /// Base class for scene nodes.
@@ -69,6 +74,10 @@ public:
     void SetEnabled(bool enable);
     /// Set enabled status recursively in the child hierarchy.
     void SetEnabledRecursive(bool enable);
+    /// Set dormant status. Dormant nodes stay in the scene with their ids, but suspend subclass specific processing, for example rendering. Used for pooling.
+    void SetDormant(bool enable);
+    /// Set dormant status recursively in the child hierarchy.
+    void SetDormantRecursive(bool enable);
     /// Set temporary mode. Temporary scene nodes are not saved.
     void SetTemporary(bool enable);
     /// Reparent the node.
@@ -89,6 +98,8 @@ public:
     void RemoveAllChildren();
     /// Remove self from the parent node. No-op if no parent. Potentially causes deletion of self, if no other strong references exist.
     void RemoveSelf();
+    /// Move a child node to an index in the child list. The index is clamped to the last child.
+    void SetChildIndex(Node* child, size_t index);
     /// Create child node of the specified type, template version.
     template <class T> T* CreateChild() { return static_cast<T*>(CreateChild(T::TypeStatic())); }
     /// Create named child node of the specified type, template version.
@@ -106,6 +117,8 @@ public:
     unsigned LayerMask() const { return 1 << layer; }
     /// Return enabled status.
     bool IsEnabled() const { return TestFlag(NF_ENABLED); }
+    /// Return dormant status.
+    bool IsDormant() const { return TestFlag(NF_DORMANT); }
     /// Return whether is temporary.
     bool IsTemporary() const { return TestFlag(NF_TEMPORARY); }
     /// Return parent node.
@@ -159,10 +172,18 @@ public:
     bool TestFlag(unsigned char bit) const { return (flags & bit) != 0; }
     /// Return bit flags.
     unsigned char Flags() const { return flags; }
+    /// Mark attributes changed for scene delta serialization. Attribute setters call this; subclasses should also call it when they change saved state by other means. No-op unless the scene is tracking changes.
+    void MarkAttributesDirty() { if (!TestFlag(NF_ATTRIBUTES_DIRTY) && impl->scene) QueueAttributesDirty(); }
+    /// Detach child nodes queued for destruction in one pass and move them to the destination vector. They are not removed from the scene. Called internally.
+    void DetachQueuedChildren(std::vector<SharedPtr<Node> >& dest);
     /// Assign node to a new scene. Called internally.
     void SetScene(Scene* newScene);
     /// Assign new id. Called internally.
     void SetId(unsigned newId);
+    /// Assign index in the update scheduler's node list. Called internally.
+    void SetUpdateIndex(unsigned index) { impl->updateIndex = index; }
+    /// Return index in the update scheduler's node list. Called internally.
+    unsigned UpdateIndex() const { return impl->updateIndex; }
     
     /// Skip the binary data of a node hierarchy, in case the node could not be created.
     static void SkipHierarchy(Stream& source);
@@ -174,10 +195,17 @@ protected:
     virtual void OnSceneSet(Scene* newScene, Scene* oldScene);
     /// Handle the enabled status changing.
     virtual void OnEnabledChanged(bool newEnabled);
+    /// Handle the dormant status changing.
+    virtual void OnDormantChanged(bool newDormant);
     /// Handle the layer changing.
     virtual void OnLayerChanged(unsigned char newLayer);
 
 private:
+    /// Queue to the scene's changed nodes if it is tracking changes.
+    void QueueAttributesDirty();
+    /// Mark self and all children changed for delta serialization, when whether the subtree is saved changes.
+    void MarkSubtreeAttributesDirty();
+
     /// Node implementation.
     NodeImpl* impl;
     /// Parent node.
@@ -0,0 +1,188 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../Resource/JSONFile.h"
+#include "../Resource/ResourceCache.h"
+#include "NodePool.h"
+#include "Scene.h"
+#include "SpatialNode.h"
+
+#include <tracy/Tracy.hpp>
+
+NodePool::NodePool()
+{
+}
+
+NodePool::~NodePool()
+{
+}
+
+void NodePool::RegisterObject()
+{
+    RegisterFactory<NodePool>(1);
+    CopyBaseAttributes<NodePool, Node>();
+    RegisterDerivedType<NodePool, Node>();
+}
+
+Node* NodePool::Spawn(JSONFile* prefab, Node* parent)
+{
+    ZoneScoped;
+
+    Scene* scene = ParentScene();
+    if (!scene)
+    {
+        LOGERROR("Node pool must be in a scene to spawn nodes");
+        return nullptr;
+    }
+    if (!prefab)
+        return nullptr;
+    if (!parent)
+        parent = scene;
+
+    PrefabPool* pool = FindPool(prefab);
+    Node* node;
+
+    if (pool->container->NumChildren())
+    {
+        // Take the most recently despawned subtree. Reparent and reset while still dormant, so that the octree sees only one update when woken
+        node = pool->container->Children().back();
+        parent->AddChild(node);
+        size_t index = 0;
+        ResetState(node, pool->initialState, index);
+        node->SetDormantRecursive(false);
+    }
+    else
+    {
+        node = Instantiate(pool);
+        if (!node)
+            return nullptr;
+        parent->AddChild(node);
+    }
+
+    spawned[node] = std::make_pair(SharedPtr<Node>(node), pool);
+    return node;
+}
+
+Node* NodePool::Spawn(const std::string& prefabName, Node* parent)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    return Spawn(cache->LoadResource<JSONFile>(prefabName), parent);
+}
+
+bool NodePool::Despawn(Node* node)
+{
+    ZoneScoped;
+
+    auto it = spawned.find(node);
+    if (it == spawned.end())
+    {
+        LOGERROR("Node was not spawned from this node pool");
+        return false;
+    }
+
+    // Go dormant first so that the reparenting does not queue octree updates
+    node->SetDormantRecursive(true);
+    it->second.second->container->AddChild(node);
+    spawned.erase(it);
+    return true;
+}
+
+void NodePool::Reserve(JSONFile* prefab, size_t count)
+{
+    ZoneScoped;
+
+    if (!prefab || !ParentScene())
+        return;
+
+    PrefabPool* pool = FindPool(prefab);
+    while (pool->container->NumChildren() < count)
+    {
+        Node* node = Instantiate(pool);
+        if (!node)
+            return;
+
+        node->SetDormantRecursive(true);
+        pool->container->AddChild(node);
+    }
+}
+
+void NodePool::ClearPooled()
+{
+    for (auto it = pools.begin(); it != pools.end(); ++it)
+        it->second->container->RemoveAllChildren();
+}
+
+size_t NodePool::NumPooled(JSONFile* prefab) const
+{
+    auto it = pools.find(prefab);
+    return it != pools.end() ? it->second->container->NumChildren() : 0;
+}
+
+PrefabPool* NodePool::FindPool(JSONFile* prefab)
+{
+    auto it = pools.find(prefab);
+    if (it != pools.end())
+        return it->second.Get();
+
+    PrefabPool* pool = new PrefabPool();
+    pool->prefab = prefab;
+    // The container is temporary, so despawned subtrees are not saved with the scene
+    pool->container = CreateChild<Node>(prefab->Name());
+    pool->container->SetTemporary(true);
+    pools[prefab] = pool;
+    return pool;
+}
+
+Node* NodePool::Instantiate(PrefabPool* pool)
+{
+    Node* node = ParentScene()->InstantiateJSON(pool->prefab->Root());
+    if (!node)
+    {
+        LOGERROR("Failed to instantiate prefab " + pool->prefab->Name());
+        return nullptr;
+    }
+
+    if (pool->initialState.empty())
+        CaptureState(node, pool->initialState);
+
+    return node;
+}
+
+void NodePool::CaptureState(Node* node, std::vector<PooledNodeState>& dest)
+{
+    PooledNodeState state;
+    state.enabled = node->IsEnabled();
+    if (node->TestFlag(NF_SPATIAL))
+    {
+        SpatialNode* spatial = static_cast<SpatialNode*>(node);
+        state.position = spatial->Position();
+        state.rotation = spatial->Rotation();
+        state.scale = spatial->Scale();
+    }
+    dest.push_back(state);
+
+    const std::vector<SharedPtr<Node> >& nodeChildren = node->Children();
+    for (auto it = nodeChildren.begin(); it != nodeChildren.end(); ++it)
+        CaptureState(*it, dest);
+}
+
+void NodePool::ResetState(Node* node, const std::vector<PooledNodeState>& initialState, size_t& index)
+{
+    if (index >= initialState.size())
+        return;
+
+    const PooledNodeState& state = initialState[index++];
+    if (node->IsEnabled() != state.enabled)
+        node->SetEnabled(state.enabled);
+
+    if (node->TestFlag(NF_SPATIAL))
+    {
+        SpatialNode* spatial = static_cast<SpatialNode*>(node);
+        if (spatial->Position() != state.position || spatial->Rotation() != state.rotation || spatial->Scale() != state.scale)
+            spatial->SetTransform(state.position, state.rotation, state.scale);
+    }
+
+    const std::vector<SharedPtr<Node> >& nodeChildren = node->Children();
+    for (auto it = nodeChildren.begin(); it != nodeChildren.end(); ++it)
+        ResetState(*it, initialState, index);
+}
@@ -0,0 +1,91 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "Node.h"
+
+#include <unordered_map>
+
+class JSONFile;
+
+/// Initial state of a node in a pooled subtree. Used to reset only what was changed while spawned.
+struct PooledNodeState
+{
+    /// Construct with identity transform.
+    PooledNodeState() :
+        enabled(true),
+        position(Vector3::ZERO),
+        rotation(Quaternion::IDENTITY),
+        scale(Vector3::ONE)
+    {
+    }
+
+    /// Enabled status.
+    bool enabled;
+    /// Position, if is a spatial node.
+    Vector3 position;
+    /// Rotation, if is a spatial node.
+    Quaternion rotation;
+    /// Scale, if is a spatial node.
+    Vector3 scale;
+};
+
+/// Pooled subtrees of one prefab.
+struct PrefabPool
+{
+    /// Prefab JSON data.
+    SharedPtr<JSONFile> prefab;
+    /// Container node for the despawned subtrees.
+    Node* container;
+    /// Initial state of the subtree nodes in hierarchy order, captured from the first instance.
+    std::vector<PooledNodeState> initialState;
+};
+
+/// %Scene node that recycles node subtrees instantiated from JSON prefabs, for high-rate spawning and despawning. Despawned subtrees are parked as dormant temporary children of the pool, so they keep their node ids and octree membership. Respawning resets only the enabled status and transforms that were changed. Structural changes to a spawned subtree are not reverted.
+class NodePool : public Node
+{
+    OBJECT(NodePool);
+
+public:
+    /// Construct.
+    NodePool();
+    /// Destruct.
+    ~NodePool();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Spawn a subtree from a prefab under a parent node, or under the scene root if null. Reuse a despawned subtree if available. Return the subtree root node, or null on failure.
+    Node* Spawn(JSONFile* prefab, Node* parent = nullptr);
+    /// Spawn a subtree from a prefab resource loaded by name.
+    Node* Spawn(const std::string& prefabName, Node* parent = nullptr);
+    /// Return a spawned subtree to the pool. Return false if it was not spawned from this pool.
+    bool Despawn(Node* node);
+    /// Instantiate despawned subtrees in advance, so that spawning up to the count does not need to instantiate.
+    void Reserve(JSONFile* prefab, size_t count);
+    /// Destroy the despawned subtrees of all prefabs. Spawned subtrees are not affected.
+    void ClearPooled();
+
+    /// Return number of despawned subtrees available for a prefab.
+    size_t NumPooled(JSONFile* prefab) const;
+    /// Return number of spawned subtrees currently in use.
+    size_t NumSpawned() const { return spawned.size(); }
+    /// Return whether a node is the root of a subtree spawned from this pool.
+    bool IsSpawned(Node* node) const { return spawned.find(node) != spawned.end(); }
+
+private:
+    /// Return the pool for a prefab. Create if not found.
+    PrefabPool* FindPool(JSONFile* prefab);
+    /// Instantiate a new subtree into the scene root. Capture the initial state on first instantiation.
+    Node* Instantiate(PrefabPool* pool);
+    /// Capture the initial state of a subtree recursively.
+    void CaptureState(Node* node, std::vector<PooledNodeState>& dest);
+    /// Reset changed state of a subtree recursively.
+    void ResetState(Node* node, const std::vector<PooledNodeState>& initialState, size_t& index);
+
+    /// Pools by prefab.
+    std::unordered_map<JSONFile*, AutoPtr<PrefabPool> > pools;
+    /// Spawned subtree roots and their pools. Holds strong references so that a directly destroyed subtree can still be despawned safely.
+    std::unordered_map<Node*, std::pair<SharedPtr<Node>, PrefabPool*> > spawned;
+};
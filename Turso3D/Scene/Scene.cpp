@@ -4,13 +4,50 @@
 #include "../IO/Stream.h"
 #include "../Object/ObjectResolver.h"
 #include "../Resource/JSONFile.h"
+#include "NodePool.h"
 #include "Scene.h"
 #include "SpatialNode.h"
+#include "UpdateScheduler.h"
 
+#include <algorithm>
 #include <tracy/Tracy.hpp>
 
+static bool IsPersistent(Node* node)
+{
+    for (; node; node = node->Parent())
+    {
+        if (node->IsTemporary())
+            return false;
+    }
+
+    return true;
+}
+
+static size_t NodeDepth(Node* node)
+{
+    size_t depth = 0;
+    for (node = node->Parent(); node; node = node->Parent())
+        ++depth;
+    return depth;
+}
+
+static bool CheckDeltaBytes(Stream& source, size_t numBytes)
+{
+    if (source.Size() - source.Position() >= numBytes)
+        return true;
+
+    LOGERROR("Truncated scene delta in " + source.Name());
+    return false;
+}
+
+static bool CompareNodeDepths(const std::pair<size_t, Node*>& lhs, const std::pair<size_t, Node*>& rhs)
+{
+    return lhs.first < rhs.first;
+}
+
 Scene::Scene() :
-    nextNodeId(1)
+    nextNodeId(1),
+    trackChanges(false)
 {
     // Register self to allow finding by ID
     AddNode(this);
@@ -18,6 +55,8 @@ Scene::Scene() :
 
 Scene::~Scene()
 {
+    ClearDestroyQueue();
+
     // Node destructor will also remove children. But at that point the node<>id maps have been destroyed so must tear down the scene tree already here
     RemoveAllChildren();
     RemoveNode(this);
@@ -49,6 +88,8 @@ bool Scene::Load(Stream& source)
     LOGINFO("Loading scene from " + source.Name());
     
     std::string fileId = source.ReadFileID();
+    if (fileId == "SDLT")
+        return LoadDelta(source);
     if (fileId != "SCNE")
     {
         LOGERROR("File is not a binary scene file");
@@ -63,11 +104,13 @@ bool Scene::Load(Stream& source)
         return false;
     }
 
+    ClearDeltaBaseline();
     Clear();
 
     ObjectResolver resolver;
     resolver.StoreObject(ownId, this);
     Node::Load(source, resolver);
+    RestoreNodeIds(resolver);
     resolver.Resolve();
 
     return true;
@@ -86,11 +129,13 @@ bool Scene::LoadJSON(const JSONValue& source)
         return false;
     }
 
+    ClearDeltaBaseline();
     Clear();
 
     ObjectResolver resolver;
     resolver.StoreObject(ownId, this);
     Node::LoadJSON(source, resolver);
+    RestoreNodeIds(resolver);
     resolver.Resolve();
 
     return true;
@@ -168,8 +213,270 @@ Node* Scene::InstantiateJSON(Stream& source)
 
 void Scene::Clear()
 {
+    ClearDestroyQueue();
     RemoveAllChildren();
-    nextNodeId = 1;
+    // Ids must not be reused while tracking changes, as the removed nodes are identified by them
+    if (!trackChanges)
+        nextNodeId = 1;
+}
+
+void Scene::SetDeltaBaseline()
+{
+    ZoneScoped;
+
+    baseline.clear();
+    dirtyNodeIds.clear();
+    reorderedNodeIds.clear();
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        Node* node = it->second;
+        node->SetFlag(NF_ATTRIBUTES_DIRTY, false);
+        if (IsPersistent(node))
+            StoreBaseline(node);
+    }
+
+    trackChanges = true;
+}
+
+void Scene::ClearDeltaBaseline()
+{
+    for (auto it = dirtyNodeIds.begin(); it != dirtyNodeIds.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        if (node)
+            node->SetFlag(NF_ATTRIBUTES_DIRTY, false);
+    }
+
+    baseline.clear();
+    dirtyNodeIds.clear();
+    reorderedNodeIds.clear();
+    trackChanges = false;
+}
+
+bool Scene::SaveDelta(Stream& dest, bool updateBaseline)
+{
+    ZoneScoped;
+
+    if (!trackChanges)
+    {
+        LOGERROR("Can not save scene delta without a baseline");
+        return false;
+    }
+
+    std::sort(dirtyNodeIds.begin(), dirtyNodeIds.end());
+    dirtyNodeIds.erase(std::unique(dirtyNodeIds.begin(), dirtyNodeIds.end()), dirtyNodeIds.end());
+
+    // Classify the dirty nodes. Ids are not reused while tracking, so a node found in the baseline is the same node.
+    // Nodes that became temporary count as removed
+    std::vector<unsigned> removedIds;
+    std::vector<std::pair<size_t, Node*> > addedNodes;
+    std::vector<Node*> changedNodes;
+
+    for (auto it = dirtyNodeIds.begin(); it != dirtyNodeIds.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        bool persistent = node && IsPersistent(node);
+        bool inBaseline = baseline.find(*it) != baseline.end();
+
+        if (persistent)
+        {
+            if (inBaseline)
+                changedNodes.push_back(node);
+            else
+                addedNodes.push_back(std::make_pair(NodeDepth(node), node));
+        }
+        else if (inBaseline)
+            removedIds.push_back(*it);
+    }
+
+    // Create added parents before their children
+    std::stable_sort(addedNodes.begin(), addedNodes.end(), CompareNodeDepths);
+
+    dest.WriteFileID("SDLT");
+
+    // Added nodes: first the hierarchy, then the attributes in reverse order so that children are loaded first, like in a full load
+    VectorBuffer values;
+    std::vector<unsigned> offsets;
+    VectorBuffer emptyValues;
+    std::vector<unsigned> emptyOffsets;
+
+    dest.WriteVLE(addedNodes.size());
+    for (auto it = addedNodes.begin(); it != addedNodes.end(); ++it)
+    {
+        Node* node = it->second;
+        dest.Write(node->Parent()->Id());
+        dest.Write(node->Type());
+        dest.Write(node->Id());
+    }
+    for (auto it = addedNodes.rbegin(); it != addedNodes.rend(); ++it)
+    {
+        Node* node = it->second;
+        node->SaveChangedValues(dest, emptyValues, emptyOffsets, values, offsets);
+        if (updateBaseline)
+            StoreBaseline(node);
+    }
+
+    // Changed nodes: new parent id and the attributes that differ from the baseline. Nodes marked dirty without actual changes are left out
+    VectorBuffer changes;
+    size_t numChanged = 0;
+
+    for (auto it = changedNodes.begin(); it != changedNodes.end(); ++it)
+    {
+        Node* node = *it;
+        NodeBaseline& nodeBaseline = baseline[node->Id()];
+        unsigned parentId = node->Parent() ? node->Parent()->Id() : 0;
+        size_t start = changes.Size();
+
+        changes.Write(node->Id());
+        changes.Write(parentId);
+        if (!node->SaveChangedValues(changes, nodeBaseline.values, nodeBaseline.offsets, values, offsets) && parentId == nodeBaseline.parentId)
+        {
+            changes.Resize(start);
+            continue;
+        }
+
+        ++numChanged;
+        if (updateBaseline)
+        {
+            nodeBaseline.parentId = parentId;
+            nodeBaseline.values.SetData(values.Buffer());
+            nodeBaseline.offsets.swap(offsets);
+        }
+    }
+
+    dest.WriteVLE(numChanged);
+    if (changes.Size())
+        dest.Write(changes.Data(), changes.Size());
+
+    // Removed nodes: only the subtree roots, as removing them also removes their children on load
+    size_t numRemovedRoots = 0;
+    for (auto it = removedIds.begin(); it != removedIds.end(); ++it)
+    {
+        if (!std::binary_search(removedIds.begin(), removedIds.end(), baseline[*it].parentId))
+            ++numRemovedRoots;
+    }
+
+    dest.WriteVLE(numRemovedRoots);
+    for (auto it = removedIds.begin(); it != removedIds.end(); ++it)
+    {
+        if (!std::binary_search(removedIds.begin(), removedIds.end(), baseline[*it].parentId))
+            dest.Write(*it);
+    }
+
+    // Child orders: children attached since the baseline went last, which adding and reparenting on load does not reproduce. Removal keeps the order of the rest
+    std::sort(reorderedNodeIds.begin(), reorderedNodeIds.end());
+    reorderedNodeIds.erase(std::unique(reorderedNodeIds.begin(), reorderedNodeIds.end()), reorderedNodeIds.end());
+
+    changes.Clear();
+    size_t numReordered = 0;
+    for (auto it = reorderedNodeIds.begin(); it != reorderedNodeIds.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        if (!node || !IsPersistent(node) || !node->NumPersistentChildren())
+            continue;
+
+        const std::vector<SharedPtr<Node> >& nodeChildren = node->Children();
+        changes.Write(node->Id());
+        changes.WriteVLE(node->NumPersistentChildren());
+        for (auto childIt = nodeChildren.begin(); childIt != nodeChildren.end(); ++childIt)
+        {
+            if (!(*childIt)->IsTemporary())
+                changes.Write((*childIt)->Id());
+        }
+        ++numReordered;
+    }
+
+    dest.WriteVLE(numReordered);
+    if (changes.Size())
+        dest.Write(changes.Data(), changes.Size());
+
+    if (updateBaseline)
+    {
+        reorderedNodeIds.clear();
+
+        for (auto it = removedIds.begin(); it != removedIds.end(); ++it)
+            baseline.erase(*it);
+
+        for (auto it = dirtyNodeIds.begin(); it != dirtyNodeIds.end(); ++it)
+        {
+            Node* node = FindNode(*it);
+            if (node)
+                node->SetFlag(NF_ATTRIBUTES_DIRTY, false);
+        }
+        dirtyNodeIds.clear();
+    }
+
+    return true;
+}
+
+void Scene::QueueDestroy(Node* node)
+{
+    if (!node || node == this || node->ParentScene() != this || node->TestFlag(NF_DESTROY_QUEUED))
+        return;
+
+    node->SetFlag(NF_DESTROY_QUEUED, true);
+    destroyQueue.push_back(SharedPtr<Node>(node));
+}
+
+bool Scene::UpdateDestroyQueue(size_t maxNodes)
+{
+    ZoneScoped;
+
+    if (destroyQueue.size())
+    {
+        // Skip nodes that left the scene after queuing, or that will be removed along with a queued parent
+        destroyParents.clear();
+        for (auto it = destroyQueue.begin(); it != destroyQueue.end(); ++it)
+        {
+            Node* node = *it;
+            bool skip = node->ParentScene() != this;
+            for (Node* current = node->Parent(); current && !skip; current = current->Parent())
+                skip = current->TestFlag(NF_DESTROY_QUEUED);
+
+            if (skip)
+                node->SetFlag(NF_DESTROY_QUEUED, false);
+            else
+                destroyParents.push_back(node->Parent());
+        }
+
+        // Detach from parents with one pass over each parent's children
+        std::sort(destroyParents.begin(), destroyParents.end());
+        destroyParents.erase(std::unique(destroyParents.begin(), destroyParents.end()), destroyParents.end());
+
+        std::vector<SharedPtr<Node> > roots;
+        for (auto it = destroyParents.begin(); it != destroyParents.end(); ++it)
+            (*it)->DetachQueuedChildren(roots);
+        destroyQueue.clear();
+
+        // Remove from the scene, letting scene systems batch their removal work
+        SendEvent(bulkRemoveBeginEvent);
+        for (auto it = roots.begin(); it != roots.end(); ++it)
+            RemoveNode(*it);
+        SendEvent(bulkRemoveEndEvent);
+
+        // When spreading the release, hold each node individually, so that releasing a parent does not recursively destroy the whole subtree at once.
+        // The queue is released from the end, so store each parent after its descendants to release it first. Its destructor then only unlinks
+        // the children, which the queue still holds, and they are released later one by one
+        if (!maxNodes && releaseQueue.empty())
+            return false;
+
+        std::vector<Node*> children;
+        for (auto it = roots.begin(); it != roots.end(); ++it)
+        {
+            children.clear();
+            (*it)->FindAllChildren(children);
+            for (auto cIt = children.rbegin(); cIt != children.rend(); ++cIt)
+                releaseQueue.push_back(SharedPtr<Node>(*cIt));
+            releaseQueue.push_back(*it);
+        }
+    }
+
+    size_t numRelease = (maxNodes && maxNodes < releaseQueue.size()) ? maxNodes : releaseQueue.size();
+    for (size_t i = 0; i < numRelease; ++i)
+        releaseQueue.pop_back();
+
+    return !releaseQueue.empty();
 }
 
 Node* Scene::FindNode(unsigned id_) const
@@ -178,6 +485,14 @@ Node* Scene::FindNode(unsigned id_) const
     return it != nodes.end() ? it->second : nullptr;
 }
 
+UpdateScheduler* Scene::GetUpdateScheduler()
+{
+    if (!updateScheduler)
+        updateScheduler = new UpdateScheduler(this);
+
+    return updateScheduler.Get();
+}
+
 void Scene::AddNode(Node* node)
 {
     if (!node || node->ParentScene() == this)
@@ -195,11 +510,16 @@ void Scene::AddNode(Node* node)
     {
         unsigned oldId = node->Id();
         oldScene->nodes.erase(oldId);
+        if (oldScene->updateScheduler)
+            oldScene->updateScheduler->RemoveNode(node);
     }
 
     nodes[nextNodeId] = node;
     node->SetScene(this);
     node->SetId(nextNodeId);
+    QueueDirtyNode(node);
+    if (updateScheduler)
+        updateScheduler->AddNode(node);
 
     ++nextNodeId;
 
@@ -217,6 +537,13 @@ void Scene::RemoveNode(Node* node)
     if (!node || node->ParentScene() != this)
         return;
 
+    if (trackChanges)
+        dirtyNodeIds.push_back(node->Id());
+    node->SetFlag(NF_ATTRIBUTES_DIRTY, false);
+
+    if (updateScheduler)
+        updateScheduler->RemoveNode(node);
+
     nodes.erase(node->Id());
     node->SetScene(nullptr);
     node->SetId(0);
@@ -230,6 +557,210 @@ void Scene::RemoveNode(Node* node)
     }
 }
 
+void Scene::QueueDirtyNode(Node* node)
+{
+    if (trackChanges && node && node->ParentScene() == this)
+    {
+        node->SetFlag(NF_ATTRIBUTES_DIRTY, true);
+
+        // Parallel node updates defer the queuing to the end of the update
+        DeferredNodeChanges* deferred = UpdateScheduler::DeferredChanges();
+        if (deferred)
+            deferred->dirtyNodes.push_back(node);
+        else
+            dirtyNodeIds.push_back(node->Id());
+    }
+}
+
+void Scene::QueueChildOrder(Node* node)
+{
+    if (trackChanges && node && node->ParentScene() == this)
+        reorderedNodeIds.push_back(node->Id());
+}
+
+void Scene::ClearDestroyQueue()
+{
+    for (auto it = destroyQueue.begin(); it != destroyQueue.end(); ++it)
+        (*it)->SetFlag(NF_DESTROY_QUEUED, false);
+
+    destroyQueue.clear();
+    releaseQueue.clear();
+}
+
+bool Scene::LoadDelta(Stream& source)
+{
+    // Create the added nodes with their original ids, then load their attributes children first
+    // Check the remaining size before each fixed-size read, as a short read does not fail otherwise. A truncated delta leaves the changes before the truncation applied
+    std::vector<Node*> addedNodes;
+    if (!CheckDeltaBytes(source, 1))
+        return false;
+    size_t numAdded = source.ReadVLE();
+    if (!CheckDeltaBytes(source, numAdded * (2 * sizeof(unsigned) + sizeof(StringHash))))
+        return false;
+    addedNodes.reserve(numAdded);
+
+    for (size_t i = 0; i < numAdded; ++i)
+    {
+        unsigned parentId = source.Read<unsigned>();
+        StringHash childType = source.Read<StringHash>();
+        unsigned childId = source.Read<unsigned>();
+
+        Node* parentNode = FindNode(parentId);
+        Node* child = parentNode ? parentNode->CreateChild(childType) : nullptr;
+        if (child)
+            SetNodeId(child, childId);
+        else if (!parentNode)
+            LOGERRORF("Parent node %u not found for added node %u in scene delta", parentId, childId);
+
+        addedNodes.push_back(child);
+    }
+
+    for (auto it = addedNodes.rbegin(); it != addedNodes.rend(); ++it)
+    {
+        if (!CheckDeltaBytes(source, 1))
+            return false;
+        if (*it)
+            (*it)->LoadChangedValues(source);
+        else
+            Serializable::SkipChangedValues(source);
+    }
+
+    // Reparent and set attributes of changed nodes. This is done before removal, so that nodes moved out of a removed parent survive
+    if (!CheckDeltaBytes(source, 1))
+        return false;
+    size_t numChanged = source.ReadVLE();
+    for (size_t i = 0; i < numChanged; ++i)
+    {
+        if (!CheckDeltaBytes(source, 2 * sizeof(unsigned) + 1))
+            return false;
+        unsigned nodeId = source.Read<unsigned>();
+        unsigned parentId = source.Read<unsigned>();
+
+        Node* node = FindNode(nodeId);
+        if (!node)
+        {
+            LOGWARNINGF("Changed node %u not found in scene delta", nodeId);
+            Serializable::SkipChangedValues(source);
+            continue;
+        }
+
+        if (parentId && (!node->Parent() || node->Parent()->Id() != parentId))
+        {
+            Node* parentNode = FindNode(parentId);
+            if (parentNode)
+                parentNode->AddChild(node);
+        }
+
+        node->LoadChangedValues(source);
+    }
+
+    if (!CheckDeltaBytes(source, 1))
+        return false;
+    size_t numRemoved = source.ReadVLE();
+    if (!CheckDeltaBytes(source, numRemoved * sizeof(unsigned)))
+        return false;
+    for (size_t i = 0; i < numRemoved; ++i)
+    {
+        Node* node = FindNode(source.Read<unsigned>());
+        if (node && node != this)
+            node->RemoveSelf();
+    }
+
+    if (!CheckDeltaBytes(source, 1))
+        return false;
+    size_t numReordered = source.ReadVLE();
+    for (size_t i = 0; i < numReordered; ++i)
+    {
+        if (!CheckDeltaBytes(source, sizeof(unsigned) + 1))
+            return false;
+        Node* node = FindNode(source.Read<unsigned>());
+        size_t numChildren = source.ReadVLE();
+        if (!CheckDeltaBytes(source, numChildren * sizeof(unsigned)))
+            return false;
+
+        // Children not in the list, such as temporary ones, go last
+        size_t index = 0;
+        for (size_t j = 0; j < numChildren; ++j)
+        {
+            Node* child = FindNode(source.Read<unsigned>());
+            if (node && child && child->Parent() == node)
+                node->SetChildIndex(child, index++);
+        }
+    }
+
+    return true;
+}
+
+void Scene::RestoreNodeIds(const ObjectResolver& resolver)
+{
+    // Reassign all ids at once, as the ids given during load may overlap the saved ones
+    std::unordered_map<unsigned, Node*> loadedNodes;
+    loadedNodes.swap(nodes);
+    nextNodeId = 1;
+
+    const std::map<unsigned, Serializable*>& objects = resolver.Objects();
+    for (auto it = objects.begin(); it != objects.end(); ++it)
+    {
+        Node* node = static_cast<Node*>(it->second);
+        if (it->first && node->ParentScene() == this)
+        {
+            nodes[it->first] = node;
+            node->SetId(it->first);
+            if (it->first >= nextNodeId)
+                nextNodeId = it->first + 1;
+        }
+    }
+
+    if (!nextNodeId)
+        nextNodeId = 1;
+
+    // Nodes created during load without saved ids, for example by other nodes' attributes, get new ids
+    for (auto it = loadedNodes.begin(); it != loadedNodes.end(); ++it)
+    {
+        Node* node = it->second;
+        auto nodeIt = nodes.find(node->Id());
+        if (nodeIt != nodes.end() && nodeIt->second == node)
+            continue;
+
+        while (nodes.find(nextNodeId) != nodes.end())
+        {
+            ++nextNodeId;
+            if (!nextNodeId)
+                ++nextNodeId;
+        }
+
+        nodes[nextNodeId] = node;
+        node->SetId(nextNodeId);
+        ++nextNodeId;
+    }
+}
+
+void Scene::SetNodeId(Node* node, unsigned newId)
+{
+    if (node->Id() == newId)
+        return;
+
+    if (!newId || nodes.find(newId) != nodes.end())
+    {
+        LOGWARNINGF("Node id %u is already in use, keeping id %u", newId, node->Id());
+        return;
+    }
+
+    // The node was queued with its old id, so queue again if tracking changes
+    nodes.erase(node->Id());
+    nodes[newId] = node;
+    node->SetId(newId);
+    node->SetFlag(NF_ATTRIBUTES_DIRTY, false);
+    QueueDirtyNode(node);
+}
+
+void Scene::StoreBaseline(Node* node)
+{
+    NodeBaseline& nodeBaseline = baseline[node->Id()];
+    nodeBaseline.parentId = node->Parent() ? node->Parent()->Id() : 0;
+    node->SaveValues(nodeBaseline.values, nodeBaseline.offsets);
+}
+
 void RegisterSceneLibrary()
 {
     static bool registered = false;
@@ -239,6 +770,7 @@ void RegisterSceneLibrary()
     Node::RegisterObject();
     Scene::RegisterObject();
     SpatialNode::RegisterObject();
+    NodePool::RegisterObject();
 
     registered = true;
 }
@@ -2,8 +2,24 @@
 
 #pragma once
 
+#include "../IO/VectorBuffer.h"
 #include "Node.h"
 
+#include <unordered_map>
+
+class UpdateScheduler;
+
+/// Baseline state of a node for delta serialization.
+struct NodeBaseline
+{
+    /// Parent node id.
+    unsigned parentId;
+    /// Attribute values without type information.
+    VectorBuffer values;
+    /// End offsets of the attribute values.
+    std::vector<unsigned> offsets;
+};
+
 /// %Scene root node, which also represents the whole scene.
 class Scene : public Node
 {
@@ -21,11 +37,11 @@ public:
     /// Save scene to binary stream.
     void Save(Stream& dest) override;
     
-    /// Load scene from a binary stream. Existing nodes will be destroyed. Return true on success.
+    /// Load scene from a binary stream. Existing nodes will be destroyed and change tracking stops. Node ids are restored from the data. If the stream holds a delta saved with SaveDelta(), it is instead applied on the existing nodes, which must have the ids of the scene the delta was saved from, for example by having loaded its baseline. Return true on success, or false if the delta is truncated, in which case it may have been partially applied.
     bool Load(Stream& source);
-    /// Load scene from JSON data. Existing nodes will be destroyed. Return true on success.
+    /// Load scene from JSON data. Existing nodes will be destroyed and change tracking stops. Node ids are restored from the data. Return true on success.
     bool LoadJSON(const JSONValue& source);
-    /// Load scene from JSON text data read from a binary stream. Existing nodes will be destroyed. Return true if the JSON was correctly parsed; otherwise the data may be partial.
+    /// Load scene from JSON text data read from a binary stream. Existing nodes will be destroyed and change tracking stops. Return true if the JSON was correctly parsed; otherwise the data may be partial.
     bool LoadJSON(Stream& source);
     /// Save scene as JSON text data to a binary stream. Return true on success.
     bool SaveJSON(Stream& dest);
@@ -37,24 +53,81 @@ public:
     Node* InstantiateJSON(Stream& source);
     /// Destroy child nodes recursively, leaving the scene empty.
     void Clear();
+    /// Start tracking changes for delta serialization, with the current state as the baseline. Stores the attribute values of all persistent nodes.
+    void SetDeltaBaseline();
+    /// Stop tracking changes and free the baseline.
+    void ClearDeltaBaseline();
+    /// Save the changes since the baseline to a binary stream: added, reparented and removed nodes, changed attributes and the child order of nodes that had children attached. Optionally make the current state the new baseline. Requires SetDeltaBaseline() first. Return true on success.
+    bool SaveDelta(Stream& dest, bool updateBaseline = true);
+
+    /// Queue a node and its children for deferred destruction. Queued nodes are removed from the scene together in the next UpdateDestroyQueue() call.
+    void QueueDestroy(Node* node);
+    /// Remove the queued nodes from the scene in bulk, then release memory of removed nodes. If maxNodes is nonzero, release at most that many nodes per call to spread the work over frames. Return true if nodes are still pending release.
+    bool UpdateDestroyQueue(size_t maxNodes = 0);
 
     /// Find node by id.
     Node* FindNode(unsigned id) const;
+    /// Return the node update scheduler, creating it on first call. Requires the WorkQueue subsystem.
+    UpdateScheduler* GetUpdateScheduler();
+    /// Return number of nodes queued for destruction or pending release.
+    size_t NumPendingDestroy() const { return destroyQueue.size() + releaseQueue.size(); }
+    /// Return whether is tracking changes for delta serialization.
+    bool IsTrackingChanges() const { return trackChanges; }
 
     /// Add node to the scene. This assigns a scene-unique id to it. Called internally.
     void AddNode(Node* node);
     /// Remove node from the scene. This removes the id mapping but does not destroy the node. Called internally.
     void RemoveNode(Node* node);
+    /// Queue a node with changed attributes for delta serialization. No-op if not tracking changes. Called internally.
+    void QueueDirtyNode(Node* node);
+    /// Queue a node whose child order changed for delta serialization. No-op if not tracking changes. Called internally.
+    void QueueChildOrder(Node* node);
     
+    /// Event sent before a bulk removal of nodes. Scene systems such as the octree may defer their per-node removal work until the end event.
+    Event bulkRemoveBeginEvent;
+    /// Event sent after a bulk removal of nodes. The removed nodes are still alive at this point.
+    Event bulkRemoveEndEvent;
+    /// Event sent before parallel node updates start. Scene systems such as the octree should collect work queued from the updates per thread.
+    Event parallelUpdateBeginEvent;
+    /// Event sent after parallel node updates have finished, before their deferred transform changes are applied.
+    Event parallelUpdateEndEvent;
+
     using Node::Load;
     using Node::LoadJSON;
     using Node::SaveJSON;
 
 private:
+    /// Clear the destruction queues without bulk removal.
+    void ClearDestroyQueue();
+    /// Apply a delta after the file id has been read. Return true on success.
+    bool LoadDelta(Stream& source);
+    /// Give the loaded nodes their ids from the serialized data.
+    void RestoreNodeIds(const ObjectResolver& resolver);
+    /// Change the id of a node. If the new id is in use, log a warning and keep the old.
+    void SetNodeId(Node* node, unsigned newId);
+    /// Store the baseline state of a node.
+    void StoreBaseline(Node* node);
+
     /// Map from id's to nodes.
-    std::map<unsigned, Node*> nodes;
+    std::unordered_map<unsigned, Node*> nodes;
     /// Next free node id.
     unsigned nextNodeId;
+    /// Subtree root nodes queued for destruction.
+    std::vector<SharedPtr<Node> > destroyQueue;
+    /// Removed nodes pending release, flattened so that each can be released individually. Released from the end, parents before their descendants.
+    std::vector<SharedPtr<Node> > releaseQueue;
+    /// Parents of the queued nodes, used during bulk removal.
+    std::vector<Node*> destroyParents;
+    /// Baseline states of persistent nodes by id, when tracking changes.
+    std::unordered_map<unsigned, NodeBaseline> baseline;
+    /// Ids of nodes that have changed, been added or removed since the baseline. May contain duplicates.
+    std::vector<unsigned> dirtyNodeIds;
+    /// Ids of nodes whose child order has changed since the baseline. May contain duplicates.
+    std::vector<unsigned> reorderedNodeIds;
+    /// Node update scheduler.
+    AutoPtr<UpdateScheduler> updateScheduler;
+    /// Change tracking flag.
+    bool trackChanges;
 };
 
 /// Register Scene related object factories and attributes.
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "SpatialNode.h"
+#include "UpdateScheduler.h"
 
 static Allocator<Matrix3x4> worldMatrixAllocator;
 
@@ -32,19 +33,22 @@ void SpatialNode::RegisterObject()
 void SpatialNode::SetPosition(const Vector3& newPosition)
 {
     position = newPosition;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetRotation(const Quaternion& newRotation)
 {
     rotation = newRotation;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetDirection(const Vector3& newDirection)
 {
     rotation = Quaternion(Vector3::FORWARD, newDirection);
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetScale(const Vector3& newScale)
@@ -59,7 +63,8 @@ void SpatialNode::SetScale(const Vector3& newScale)
     if (scale.z == 0.0f)
         scale.z = M_EPSILON;
 
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetScale(float newScale)
@@ -71,7 +76,8 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
 {
     position = newPosition;
     rotation = newRotation;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& newRotation, const Vector3& newScale)
@@ -79,7 +85,8 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
     position = newPosition;
     rotation = newRotation;
     scale = newScale;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& newRotation, float newScale)
@@ -169,7 +176,8 @@ void SpatialNode::Translate(const Vector3& delta, TransformSpace space)
         break;
     }
 
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::Rotate(const Quaternion& delta, TransformSpace space)
@@ -198,7 +206,8 @@ void SpatialNode::Rotate(const Quaternion& delta, TransformSpace space)
     }
 
     rotation.Normalize();
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::RotateAround(const Vector3& point, const Quaternion& delta, TransformSpace space)
@@ -237,7 +246,8 @@ void SpatialNode::RotateAround(const Vector3& point, const Quaternion& delta, Tr
     Vector3 oldRelativePos = oldRotation.Inverse() * (position - parentSpacePoint);
     rotation.Normalize();
     position = rotation * oldRelativePos + parentSpacePoint;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::Yaw(float angle, TransformSpace space)
@@ -296,7 +306,8 @@ void SpatialNode::ApplyScale(float delta)
 void SpatialNode::ApplyScale(const Vector3& delta)
 {
     scale *= delta;
-    OnTransformChanged();
+    MarkAttributesDirty();
+    NotifyTransformChanged();
 }
 
 void SpatialNode::OnParentSet(Node* newParent, Node*)
@@ -305,6 +316,16 @@ void SpatialNode::OnParentSet(Node* newParent, Node*)
     OnTransformChanged();
 }
 
+void SpatialNode::NotifyTransformChanged()
+{
+    // Parallel node updates defer the hierarchy dirtying and octree queuing, as they touch other nodes
+    DeferredNodeChanges* deferred = UpdateScheduler::DeferredChanges();
+    if (deferred)
+        deferred->transformChanged.push_back(this);
+    else
+        OnTransformChanged();
+}
+
 void SpatialNode::OnTransformChanged()
 {
     SpatialNode* curr = this;
@@ -16,6 +16,8 @@ enum TransformSpace
 /// Base class for scene nodes with position in three-dimensional space.
 class SpatialNode : public Node
 {
+    friend class UpdateScheduler;
+
     OBJECT(SpatialNode);
 
 public:
@@ -138,4 +140,8 @@ protected:
     Vector3 scale;
     /// World transform matrix. Allocated from a block allocator to keep the memory footprint of scene nodes and drawables smaller.
     mutable Matrix3x4* worldTransform;
+
+private:
+    /// Handle a transform setter changing the local transform. Calls OnTransformChanged(), or defers it when called from a parallel node update.
+    void NotifyTransformChanged();
 };
@@ -0,0 +1,302 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "../Thread/WorkQueue.h"
+#include "Scene.h"
+#include "SpatialNode.h"
+#include "UpdateScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <tracy/Tracy.hpp>
+
+static const size_t MIN_NODES_PER_UPDATE_TASK = 64;
+
+thread_local DeferredNodeChanges* UpdateScheduler::deferredChanges = nullptr;
+
+/// %Task for updating a chunk of nodes in parallel.
+struct NodeUpdateTask : public MemberFunctionTask<UpdateScheduler>
+{
+    /// Construct.
+    NodeUpdateTask(UpdateScheduler* object_, MemberWorkFunctionPtr function_) :
+        MemberFunctionTask<UpdateScheduler>(object_, function_)
+    {
+    }
+
+    /// Update function to call.
+    const NodeUpdateRegistration* registration;
+    /// Start pointer.
+    Node** start;
+    /// End pointer.
+    Node** end;
+    /// Changes deferred during the update.
+    DeferredNodeChanges changes;
+};
+
+UpdateScheduler::UpdateScheduler(Scene* scene_) :
+    scene(scene_),
+    workQueue(Object::Subsystem<WorkQueue>()),
+    timeStep(0.0f),
+    serialUpdate(false),
+    nodesRemoved(false)
+{
+    assert(scene);
+    assert(workQueue);
+
+    numPendingUpdateTasks.store(0);
+}
+
+UpdateScheduler::~UpdateScheduler()
+{
+}
+
+void UpdateScheduler::RegisterUpdate(StringHash type, NodeUpdateFunctionPtr function, UpdateMode mode, unsigned phase, void* userData)
+{
+    if (!function)
+        return;
+
+    // Collect the existing nodes when the type is first registered
+    auto listIt = nodeLists.find(type);
+    if (listIt == nodeLists.end())
+    {
+        std::vector<Node*>& nodes = nodeLists[type];
+        if (scene->Type() == type)
+            nodes.push_back(scene);
+        scene->FindChildren(nodes, type, true);
+
+        // The search also returns derived types, which are not included
+        size_t numNodes = 0;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (nodes[i]->Type() == type)
+            {
+                nodes[i]->SetUpdateIndex((unsigned)numNodes);
+                nodes[numNodes++] = nodes[i];
+            }
+        }
+        nodes.resize(numNodes);
+
+        listIt = nodeLists.find(type);
+    }
+
+    NodeUpdateRegistration registration;
+    registration.type = type;
+    registration.function = function;
+    registration.mode = mode;
+    registration.phase = phase;
+    registration.userData = userData;
+    registration.nodes = &listIt->second;
+
+    // Keep sorted by phase, preserving registration order within the phase
+    auto it = registrations.begin();
+    while (it != registrations.end() && it->phase <= phase)
+        ++it;
+    registrations.insert(it, registration);
+}
+
+bool UpdateScheduler::UnregisterUpdate(StringHash type, NodeUpdateFunctionPtr function)
+{
+    for (auto it = registrations.begin(); it != registrations.end(); ++it)
+    {
+        if (it->type == type && it->function == function)
+        {
+            registrations.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void UpdateScheduler::UnregisterAllUpdates()
+{
+    registrations.clear();
+}
+
+void UpdateScheduler::Update(float timeStep_)
+{
+    ZoneScoped;
+
+    timeStep = timeStep_;
+
+    size_t start = 0;
+    while (start < registrations.size())
+    {
+        size_t end = start + 1;
+        while (end < registrations.size() && registrations[end].phase == registrations[start].phase)
+            ++end;
+
+        UpdateParallel(start, end);
+        UpdateSerial(start, end);
+        start = end;
+    }
+}
+
+size_t UpdateScheduler::NumNodes(StringHash type) const
+{
+    auto it = nodeLists.find(type);
+    return it != nodeLists.end() ? it->second.size() : 0;
+}
+
+void UpdateScheduler::AddNode(Node* node)
+{
+    auto it = nodeLists.find(node->Type());
+    if (it != nodeLists.end())
+    {
+        if (serialUpdate)
+        {
+            node->SetUpdateIndex(M_MAX_UNSIGNED);
+            addedNodes.push_back(node);
+            return;
+        }
+
+        node->SetUpdateIndex((unsigned)it->second.size());
+        it->second.push_back(node);
+    }
+}
+
+void UpdateScheduler::RemoveNode(Node* node)
+{
+    auto it = nodeLists.find(node->Type());
+    if (it != nodeLists.end())
+    {
+        std::vector<Node*>& nodes = it->second;
+        unsigned index = node->UpdateIndex();
+
+        if (serialUpdate)
+        {
+            // Leave a null entry so that the range being updated does not shift. A node both added and removed during the update is simply dropped
+            if (index == M_MAX_UNSIGNED)
+                addedNodes.erase(std::find(addedNodes.begin(), addedNodes.end(), node));
+            else
+            {
+                assert(index < nodes.size() && nodes[index] == node);
+                nodes[index] = nullptr;
+                nodesRemoved = true;
+            }
+            return;
+        }
+
+        assert(index < nodes.size() && nodes[index] == node);
+
+        // Swap with the last node to remove in constant time
+        nodes[index] = nodes.back();
+        nodes[index]->SetUpdateIndex(index);
+        nodes.pop_back();
+    }
+}
+
+void UpdateScheduler::UpdateParallel(size_t start, size_t end)
+{
+    size_t numThreads = workQueue->NumThreads();
+    size_t taskIdx = 0;
+
+    // Split into smaller tasks to encourage work stealing in case some thread is slower
+    for (size_t i = start; i < end; ++i)
+    {
+        const NodeUpdateRegistration& registration = registrations[i];
+        std::vector<Node*>& nodes = *registration.nodes;
+        if (registration.mode != UPDATE_PARALLEL || nodes.empty())
+            continue;
+
+        size_t nodesPerTask = Max(MIN_NODES_PER_UPDATE_TASK, nodes.size() / numThreads / 4);
+
+        for (size_t first = 0; first < nodes.size(); first += nodesPerTask)
+        {
+            size_t last = Min(first + nodesPerTask, nodes.size());
+
+            if (updateTasks.size() <= taskIdx)
+                updateTasks.push_back(new NodeUpdateTask(this, &UpdateScheduler::UpdateNodesWork));
+            NodeUpdateTask* task = updateTasks[taskIdx];
+            task->registration = &registration;
+            task->start = &nodes[0] + first;
+            task->end = &nodes[0] + last;
+            ++taskIdx;
+        }
+    }
+
+    if (!taskIdx)
+        return;
+
+    ZoneScoped;
+
+    // Let scene systems such as the octree collect their queued work per thread
+    scene->SendEvent(scene->parallelUpdateBeginEvent);
+
+    for (size_t i = 0; i < taskIdx; ++i)
+        workQueue->AddCounter(updateTasks[i], numPendingUpdateTasks);
+    workQueue->QueueTasks(taskIdx, reinterpret_cast<Task**>(&updateTasks[0]));
+    workQueue->Wait(numPendingUpdateTasks, WorkQueue::ThreadIndex());
+
+    scene->SendEvent(scene->parallelUpdateEndEvent);
+
+    // Apply the deferred changes in task order, so that the result does not depend on thread scheduling
+    for (size_t i = 0; i < taskIdx; ++i)
+    {
+        DeferredNodeChanges& changes = updateTasks[i]->changes;
+
+        for (auto it = changes.transformChanged.begin(); it != changes.transformChanged.end(); ++it)
+            (*it)->OnTransformChanged();
+        for (auto it = changes.dirtyNodes.begin(); it != changes.dirtyNodes.end(); ++it)
+            scene->QueueDirtyNode(*it);
+
+        changes.transformChanged.clear();
+        changes.dirtyNodes.clear();
+    }
+}
+
+void UpdateScheduler::UpdateSerial(size_t start, size_t end)
+{
+    for (size_t i = start; i < end; ++i)
+    {
+        const NodeUpdateRegistration& registration = registrations[i];
+        if (registration.mode != UPDATE_SERIAL || registration.nodes->empty())
+            continue;
+
+        serialUpdate = true;
+        registration.function(&(*registration.nodes)[0], registration.nodes->size(), timeStep, registration.userData);
+        serialUpdate = false;
+        ApplyDeferredNodeChanges();
+    }
+}
+
+void UpdateScheduler::ApplyDeferredNodeChanges()
+{
+    if (nodesRemoved)
+    {
+        for (auto it = nodeLists.begin(); it != nodeLists.end(); ++it)
+        {
+            std::vector<Node*>& nodes = it->second;
+            size_t numNodes = 0;
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                if (nodes[i])
+                {
+                    nodes[i]->SetUpdateIndex((unsigned)numNodes);
+                    nodes[numNodes++] = nodes[i];
+                }
+            }
+            nodes.resize(numNodes);
+        }
+
+        nodesRemoved = false;
+    }
+
+    for (auto it = addedNodes.begin(); it != addedNodes.end(); ++it)
+        AddNode(*it);
+    addedNodes.clear();
+}
+
+void UpdateScheduler::UpdateNodesWork(Task* task_, unsigned)
+{
+    ZoneScoped;
+
+    NodeUpdateTask* task = static_cast<NodeUpdateTask*>(task_);
+    const NodeUpdateRegistration* registration = task->registration;
+
+    // Restore the previous target afterward, in case this task ran nested inside another one's wait
+    DeferredNodeChanges* previousChanges = deferredChanges;
+    deferredChanges = &task->changes;
+    registration->function(task->start, task->end - task->start, timeStep, registration->userData);
+    deferredChanges = previousChanges;
+}
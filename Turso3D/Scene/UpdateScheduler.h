@@ -0,0 +1,126 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/StringHash.h"
+#include "../Object/AutoPtr.h"
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+class Node;
+class Scene;
+class SpatialNode;
+class WorkQueue;
+struct NodeUpdateTask;
+struct Task;
+
+/// Node update function. Called with a range of nodes of the registered type, including disabled and dormant nodes, the frame time step and the registered user data.
+typedef void (*NodeUpdateFunctionPtr)(Node** nodes, size_t count, float timeStep, void* userData);
+
+/// Declared data access of a node update function, which determines how it is scheduled within its phase.
+enum UpdateMode
+{
+    /// Reads the scene and changes only the local state of the nodes it is called with, such as transforms, animation and attributes. Must not create, remove or reparent nodes, or change their enabled or dormant status. Runs in parallel chunks on worker threads. Transform change notifications and octree queuing are batched and applied at the end of the parallel part, so world transforms reflect the changes only after it.
+    UPDATE_PARALLEL = 0,
+    /// Reads and writes the scene freely. Runs on the main thread after the parallel updates of the same phase have been applied. The function is called with the live node list; nodes created during the call are added after it returns, and nodes removed during the call are left as null entries in the remaining range until it returns. Prefer Scene::QueueDestroy() for removal so that no null checks are needed.
+    UPDATE_SERIAL
+};
+
+/// Node changes deferred during a parallel node update.
+struct DeferredNodeChanges
+{
+    /// Spatial nodes whose local transform changed. May contain duplicates.
+    std::vector<SpatialNode*> transformChanged;
+    /// Nodes whose attributes changed, for delta serialization.
+    std::vector<Node*> dirtyNodes;
+};
+
+/// Registered node update function.
+struct NodeUpdateRegistration
+{
+    /// Node type.
+    StringHash type;
+    /// Update function.
+    NodeUpdateFunctionPtr function;
+    /// Scheduling mode.
+    UpdateMode mode;
+    /// Phase number.
+    unsigned phase;
+    /// User data passed to the function.
+    void* userData;
+    /// Nodes of the type.
+    std::vector<Node*>* nodes;
+};
+
+/// Scheduler for per-frame node update functions registered by node type. Updates run in ascending phase order. Within a phase the parallel updates are first split to worker threads and their batched changes applied, after which the serial updates run in registration order. Owned by the scene.
+class UpdateScheduler
+{
+public:
+    /// Construct for a scene.
+    UpdateScheduler(Scene* scene);
+    /// Destruct.
+    ~UpdateScheduler();
+
+    /// Register an update function for nodes of an exact type; derived types are not included. The same function can be registered for several types and phases.
+    void RegisterUpdate(StringHash type, NodeUpdateFunctionPtr function, UpdateMode mode, unsigned phase = 0, void* userData = nullptr);
+    /// Unregister an update function from a type. Return true if it was registered.
+    bool UnregisterUpdate(StringHash type, NodeUpdateFunctionPtr function);
+    /// Unregister all update functions.
+    void UnregisterAllUpdates();
+    /// Run the registered updates for one frame. Update functions must not register or unregister updates. Should not be called during the octree update.
+    void Update(float timeStep);
+
+    /// Register an update function for nodes of a type, template version.
+    template <class T> void RegisterUpdate(NodeUpdateFunctionPtr function, UpdateMode mode, unsigned phase = 0, void* userData = nullptr) { RegisterUpdate(T::TypeStatic(), function, mode, phase, userData); }
+    /// Unregister an update function from a type, template version.
+    template <class T> bool UnregisterUpdate(NodeUpdateFunctionPtr function) { return UnregisterUpdate(T::TypeStatic(), function); }
+
+    /// Return the registered update functions in execution order.
+    const std::vector<NodeUpdateRegistration>& Registrations() const { return registrations; }
+    /// Return number of nodes of a registered type.
+    size_t NumNodes(StringHash type) const;
+
+    /// Add a node to its type's node list if the type is registered. Called by Scene.
+    void AddNode(Node* node);
+    /// Remove a node from its type's node list. Called by Scene.
+    void RemoveNode(Node* node);
+
+    /// Return the changes to defer in the calling thread, or null if not running a parallel node update.
+    static DeferredNodeChanges* DeferredChanges() { return deferredChanges; }
+
+private:
+    /// Run the parallel updates of a phase and apply their deferred changes.
+    void UpdateParallel(size_t start, size_t end);
+    /// Run the serial updates of a phase.
+    void UpdateSerial(size_t start, size_t end);
+    /// Apply node list changes deferred during a serial update.
+    void ApplyDeferredNodeChanges();
+    /// Work function to update a chunk of nodes.
+    void UpdateNodesWork(Task* task, unsigned threadIndex);
+
+    /// Parent scene.
+    Scene* scene;
+    /// Work queue subsystem.
+    WorkQueue* workQueue;
+    /// Registered update functions sorted by phase.
+    std::vector<NodeUpdateRegistration> registrations;
+    /// Nodes of registered types.
+    std::map<StringHash, std::vector<Node*> > nodeLists;
+    /// Tasks for parallel updates.
+    std::vector<AutoPtr<NodeUpdateTask> > updateTasks;
+    /// Nodes added during a serial update, appended to their type's node list after the update function returns.
+    std::vector<Node*> addedNodes;
+    /// Counter for parallel update tasks.
+    std::atomic<int> numPendingUpdateTasks;
+    /// Current frame time step.
+    float timeStep;
+    /// Serial update in progress flag. Node list changes are deferred so that the list being updated stays valid.
+    bool serialUpdate;
+    /// Nodes removed during a serial update flag. Their null entries are compacted after the update function returns.
+    bool nodesRemoved;
+
+    /// Changes to defer in the calling thread.
+    static thread_local DeferredNodeChanges* deferredChanges;
+};
@@ -3,11 +3,13 @@
 #include "ThreadUtils.h"
 #include "WorkQueue.h"
 
+#include <thread>
 #include <tracy/Tracy.hpp>
 
 thread_local unsigned WorkQueue::threadIndex = 0;
 
-Task::Task()
+Task::Task() :
+    counter(nullptr)
 {
     numDependencies.store(0);
 }
@@ -23,6 +25,7 @@ WorkQueue::WorkQueue(unsigned numThreads) :
 
     numQueuedTasks.store(0);
     numPendingTasks.store(0);
+    numWaiters.store(0);
 
     if (numThreads == 0)
     {
@@ -66,6 +69,7 @@ void WorkQueue::QueueTask(Task* task)
         numQueuedTasks.fetch_add(1);
 
         signal.notify_one();
+        NotifyWaiters();
     }
     else
     {
@@ -101,6 +105,8 @@ void WorkQueue::QueueTasks(size_t count, Task** tasks_)
             for (size_t i = 0; i < count; ++i)
                 signal.notify_one();
         }
+
+        NotifyWaiters();
     }
     else
     {
@@ -126,6 +132,42 @@ void WorkQueue::AddDependency(Task* task, Task* dependency)
     dependency->dependentTasks.push_back(task);
 }
 
+void WorkQueue::AddCounter(Task* task, std::atomic<int>& counter)
+{
+    assert(task);
+    assert(!task->counter);
+
+    counter.fetch_add(1);
+    task->counter = &counter;
+}
+
+void WorkQueue::Wait(std::atomic<int>& counter, unsigned threadIndex_)
+{
+    ZoneScoped;
+
+    while (counter.load() > 0)
+    {
+        if (!ExecuteQueuedTask(threadIndex_))
+        {
+            // Nothing would ever decrement the counter if there are no other threads
+            if (!threads.size())
+            {
+                assert(!"Waiting on a counter that can not reach zero");
+                return;
+            }
+
+            // Sleep until a task is queued or the counter reaches zero. The waiter count is raised before checking, so that a completion either sees it or is seen by the check
+            std::unique_lock<std::mutex> lock(queueMutex);
+            numWaiters.fetch_add(1);
+            waitSignal.wait(lock, [this, &counter]
+            {
+                return !tasks.empty() || counter.load() <= 0;
+            });
+            numWaiters.fetch_add(-1);
+        }
+    }
+}
+
 void WorkQueue::Complete()
 {
     ZoneScoped;
@@ -159,24 +201,7 @@ void WorkQueue::Complete()
 
 bool WorkQueue::TryComplete()
 {
-    if (!threads.size() || !numQueuedTasks.load())
-        return false;
-
-    Task* task;
-
-    {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        if (!tasks.size())
-            return false;
-
-        task = tasks.front();
-        tasks.pop();
-    }
-
-    numQueuedTasks.fetch_add(-1);
-    CompleteTask(task, 0);
-
-    return true;
+    return ExecuteQueuedTask(0);
 }
 
 void WorkQueue::WorkerLoop(unsigned threadIndex_)
@@ -206,6 +231,35 @@ void WorkQueue::WorkerLoop(unsigned threadIndex_)
     }
 }
 
+bool WorkQueue::ExecuteQueuedTask(unsigned threadIndex_)
+{
+    if (!threads.size() || !numQueuedTasks.load())
+        return false;
+
+    Task* task;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!tasks.size())
+            return false;
+
+        task = tasks.front();
+        tasks.pop();
+    }
+
+    numQueuedTasks.fetch_add(-1);
+    CompleteTask(task, threadIndex_);
+
+    return true;
+}
+
+void WorkQueue::NotifyWaiters()
+{
+    // The tasks were pushed under the queue lock, so a waiter has either seen them in its check or is already asleep
+    if (numWaiters.load() > 0)
+        waitSignal.notify_all();
+}
+
 void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
 {
     task->Complete(threadIndex_);
@@ -229,6 +283,7 @@ void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
                     numQueuedTasks.fetch_add(1);
 
                     signal.notify_one();
+                    NotifyWaiters();
                 }
                 else
                 {
@@ -241,6 +296,21 @@ void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
         task->dependentTasks.clear();
     }
 
+    // Signal waiters after the dependent tasks have been queued
+    if (task->counter)
+    {
+        std::atomic<int>* counter = task->counter;
+        task->counter = nullptr;
+        if (counter->fetch_add(-1) == 1 && numWaiters.load() > 0)
+        {
+            // Take the queue lock so that the notification can not fall between a waiter's check and its sleep
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+            }
+            waitSignal.notify_all();
+        }
+    }
+
     // Decrement pending task counter last, so that WorkQueue::Complete() will also wait for the potentially added dependent tasks
     numPendingTasks.fetch_add(-1);
 }
@@ -25,6 +25,8 @@ struct Task
     std::vector<Task*> dependentTasks;
     /// Dependency counter. Once zero, this task will be automatically queue itself.
     std::atomic<int> numDependencies;
+    /// Counter to decrement on completion, or null.
+    std::atomic<int>* counter;
 };
 
 /// Free function task.
@@ -89,6 +91,10 @@ public:
     void QueueTasks(size_t count, Task** tasks);
     /// Add a dependency to a task. These tasks should not be queued via QueueTask(), they will instead queue themselves when the dependencies have finished.
     void AddDependency(Task* task, Task* dependency);
+    /// Attach a counter to a task. The counter is incremented now and decremented when the task completes, so that it can be waited on with Wait(). Several tasks can share a counter.
+    void AddCounter(Task* task, std::atomic<int>& counter);
+    /// Wait until a counter reaches zero, executing queued tasks in the calling thread meanwhile so that it does not sit idle. When the queue is empty, blocks until a task is queued or the counter reaches zero. Can be called from work functions or the main thread. Tasks executed while waiting run nested on the same thread, so per-thread data must not be held across the wait, and the counter must not depend on the waiting task's own completion.
+    void Wait(std::atomic<int>& counter, unsigned threadIndex);
     /// Complete all currently queued tasks and tasks with dependencies. To be called only from the main thread. Ensure that all dependencies either have been queued or will be queued by other tasks, otherwise this function never returns.
     void Complete();
     /// Execute a task from the queue if available, then return. To be called only from the main thread. Return true if a task was executed.
@@ -103,13 +109,19 @@ public:
 private:
     /// Worker thread function.
     void WorkerLoop(unsigned threadIndex);
+    /// Execute a task from the queue if available. Return true if a task was executed.
+    bool ExecuteQueuedTask(unsigned threadIndex);
     /// Complete a task by calling its work function and signal dependents.
     void CompleteTask(Task*, unsigned threadIndex);
+    /// Wake threads blocked in Wait() after queuing tasks. Must be called after the tasks are in the queue.
+    void NotifyWaiters();
 
     /// Mutex for the work queue.
     std::mutex queueMutex;
     /// Condition variable to wake up workers.
     std::condition_variable signal;
+    /// Condition variable to wake up threads waiting on a counter, when tasks are queued or a counter reaches zero.
+    std::condition_variable waitSignal;
     /// Exit flag.
     volatile bool shouldExit;
     /// Task queue.
@@ -120,6 +132,8 @@ private:
     std::atomic<int> numQueuedTasks;
     /// Amount of queued tasks. Used to check for completion.
     std::atomic<int> numPendingTasks;
+    /// Amount of threads blocked in Wait().
+    std::atomic<int> numWaiters;
 
     /// Thread index for queries outside the work functions.
     static thread_local unsigned threadIndex;
@@ -1,13 +1,19 @@
 #include "Graphics/FrameBuffer.h"
 #include "Graphics/Graphics.h"
+#include "Graphics/IndexBuffer.h"
 #include "Graphics/Texture.h"
+#include "Graphics/VertexBuffer.h"
 #include "Input/Input.h"
 #include "IO/Arguments.h"
+#include "IO/File.h"
 #include "IO/FileSystem.h"
 #include "IO/Log.h"
 #include "IO/StringUtils.h"
+#include "IO/VectorBuffer.h"
 #include "Math/Math.h"
 #include "Math/Random.h"
+#include "Math/Sphere.h"
+#include "Object/LargePages.h"
 #include "Renderer/AnimatedModel.h"
 #include "Renderer/Animation.h"
 #include "Renderer/AnimationState.h"
@@ -18,10 +24,16 @@
 #include "Renderer/Material.h"
 #include "Renderer/Model.h"
 #include "Renderer/Octree.h"
+#include "Renderer/ParticleEmitter.h"
 #include "Renderer/Renderer.h"
+#include "Resource/JSONFile.h"
 #include "Resource/ResourceCache.h"
 #include "Renderer/StaticModel.h"
+#include "Renderer/Terrain.h"
+#include "Scene/NodePool.h"
 #include "Scene/Scene.h"
+#include "Scene/SpatialNode.h"
+#include "Scene/UpdateScheduler.h"
 #include "Time/Timer.h"
 #include "Time/Profiler.h"
 #include "Thread/ThreadUtils.h"
@@ -29,200 +41,1712 @@
 #include <SDL3/SDL.h>
 #include <tracy/Tracy.hpp>
 
-std::vector<StaticModel*> rotatingObjects;
-std::vector<AnimatedModel*> animatingObjects;
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+static const int TERRAIN_TILES = 8;
+static const int TERRAIN_TILE_RESOLUTION = 257;
+
+void GenerateTerrainTiles()
+{
+    std::string tileDir = ExecutableDir() + "Data/TerrainTiles/";
+    if (FileExists(tileDir + "Terrain_" + std::to_string(TERRAIN_TILES - 1) + "_" + std::to_string(TERRAIN_TILES - 1) + ".raw"))
+        return;
+
+    ZoneScoped;
+
+    // Rolling hills from a few octaves of sines, evaluated in terrain-global sample coordinates so that tile edges match
+    CreateDir(tileDir);
+    std::vector<unsigned short> heights(TERRAIN_TILE_RESOLUTION * TERRAIN_TILE_RESOLUTION);
+
+    for (int tz = 0; tz < TERRAIN_TILES; ++tz)
+    {
+        for (int tx = 0; tx < TERRAIN_TILES; ++tx)
+        {
+            for (int z = 0; z < TERRAIN_TILE_RESOLUTION; ++z)
+            {
+                for (int x = 0; x < TERRAIN_TILE_RESOLUTION; ++x)
+                {
+                    float gx = (float)(tx * (TERRAIN_TILE_RESOLUTION - 1) + x);
+                    float gz = (float)(tz * (TERRAIN_TILE_RESOLUTION - 1) + z);
+                    float h = 0.5f + 0.25f * Sin(gx * 0.35f) * Cos(gz * 0.3f) + 0.125f * Sin(gx * 1.1f + gz * 0.7f) + 0.0625f * Cos(gx * 3.3f - gz * 2.9f);
+                    heights[z * TERRAIN_TILE_RESOLUTION + x] = (unsigned short)(Clamp(h, 0.0f, 1.0f) * 65535.0f);
+                }
+            }
+
+            File file(tileDir + "Terrain_" + std::to_string(tx) + "_" + std::to_string(tz) + ".raw", FILE_WRITE);
+            file.Write(&heights[0], heights.size() * sizeof(unsigned short));
+        }
+    }
+}
 
 void CreateScene(Scene* scene, Camera* camera, int preset)
 {
-    rotatingObjects.clear();
-    animatingObjects.clear();
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    scene->Clear();
+    scene->CreateChild<Octree>();
+    LightEnvironment* lightEnvironment = scene->CreateChild<LightEnvironment>();
+
+    SetRandomSeed(1);
+
+    // Preset 0: occluders, static meshes and many local shadowcasting lights in addition to ambient light
+    if (preset == 0)
+    {
+        lightEnvironment->SetAmbientColor(Color(0.3f, 0.3f, 0.3f));
+        camera->SetFarClip(1000.0f);
+
+        for (int y = -55; y <= 55; ++y)
+        {
+            for (int x = -55; x <= 55; ++x)
+            {
+                StaticModel* object = scene->CreateChild<StaticModel>();
+                object->SetStatic(true);
+                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
+                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
+                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            }
+        }
+
+        for (unsigned i = 0; i < 10000; ++i)
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
+            object->SetScale(1.5f);
+            object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
+            object->SetCastShadows(true);
+            object->SetLodBias(2.0f);
+            object->SetMaxDistance(600.0f);
+        }
+
+        Vector3 quadrantCenters[] = 
+        {
+            Vector3(-290.0f, 0.0f, -290.0f),
+            Vector3(290.0f, 0.0f, -290.0f),
+            Vector3(-290.0f, 0.0f, 290.0f),
+            Vector3(290.0f, 0.0f, 290.0f),
+        };
+
+        std::vector<Light*> lights;
+
+        for (unsigned i = 0; i < 100; ++i)
+        {
+            Light* light = scene->CreateChild<Light>();
+            light->SetStatic(true);
+            light->SetLightType(LIGHT_POINT);
+            light->SetCastShadows(true);
+            Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
+            light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z, 0.5f));
+            light->SetRange(40.0f);
+            light->SetShadowMapSize(256);
+            light->SetShadowMaxDistance(200.0f);
+            light->SetMaxDistance(900.0f);
+
+            for (;;)
+            {
+                Vector3 newPos = quadrantCenters[i % 4] + Vector3(Random() * 500.0f - 250.0f, 10.0f, Random() * 500.0f - 250.0f);
+                bool posOk = true;
+
+                for (unsigned j = 0; j < lights.size(); ++j)
+                {
+                    if ((newPos - lights[j]->Position()).Length() < 80.0f)
+                    {
+                        posOk = false;
+                        break;
+                    }
+                }
+
+                if (posOk)
+                {
+                    light->SetPosition(newPos);
+                    break;
+                }
+            }
+
+            lights.push_back(light);
+        }
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
+            object->SetScale(Vector3(1165.0f, 50.0f, 1.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            object->SetCastShadows(true);
+        }
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
+            object->SetScale(Vector3(1.0f, 50.0f, 1165.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            object->SetCastShadows(true);
+        }
+    }
+    // Preset 1: high number of animating cubes
+    else if (preset == 1)
+    {
+        lightEnvironment->SetFogColor(Color(0.3f, 0.3f, 0.3f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        SharedPtr<Material> customMat = Material::DefaultMaterial()->Clone();
+        customMat->SetUniform("matDiffColor", Vector4(0.75f, 0.35f, 0.0f, 1.0f));
+        customMat->SetUniform("matSpecColor", Vector4(0.75f / 3.0f, 0.35f / 3.0f, 0.0f, 1.0f));
+
+        for (int y = -125; y <= 125; ++y)
+        {
+            for (int x = -125; x <= 125; ++x)
+            {
+                StaticModel* object = scene->CreateChild<StaticModel>();
+                //object->SetStatic(true);
+                object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
+                object->SetScale(0.25f);
+                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                object->SetMaterial(customMat);
+            }
+        }
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 0.5f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+    }
+    // Preset 2: skinned characters with directional light shadows
+    else if (preset == 2)
+    {
+        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0, -0.05f, 0));
+            object->SetScale(Vector3(100.0f, 0.1f, 100.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+        }
+
+        for (int i = 0; i < 500; ++i)
+        {
+            AnimatedModel* object = scene->CreateChild<AnimatedModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(Random() * 90.0f - 45.0f, 0.0f, Random() * 90.0f - 45.0f));
+            object->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
+            object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
+            object->SetCastShadows(true);
+            object->SetMaxDistance(600.0f);
+            AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
+            state->SetWeight(1.0f);
+            state->SetLooped(true);
+        }
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetCastShadows(true);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+        light->SetShadowMapSize(2048);
+        light->SetShadowMaxDistance(100.0f);
+    }
+    // Preset 3: particle fountains simulated on the CPU and drawn instanced, one drawable per emitter
+    else if (preset == 3)
+    {
+        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        {
+            StaticModel* object = scene->CreateChild<StaticModel>();
+            object->SetStatic(true);
+            object->SetPosition(Vector3(0, -0.05f, 0));
+            object->SetScale(Vector3(100.0f, 0.1f, 100.0f));
+            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+        }
+
+        SharedPtr<Material> particleMat = Material::DefaultMaterial()->Clone();
+        particleMat->SetUniform("matDiffColor", Vector4(0.75f, 0.35f, 0.0f, 1.0f));
+
+        for (int y = -4; y <= 4; ++y)
+        {
+            for (int x = -4; x <= 4; ++x)
+            {
+                ParticleEmitter* emitter = scene->CreateChild<ParticleEmitter>();
+                emitter->SetPosition(Vector3(x * 10.0f, 0.0f, y * 10.0f));
+                emitter->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                emitter->SetMaterial(particleMat);
+                emitter->SetCastShadows(true);
+                emitter->SetMaxParticles(2000);
+                emitter->SetEmissionRate(800.0f);
+                emitter->SetLifetime(Vector2(2.0f, 2.5f));
+                emitter->SetVelocityMin(Vector3(-1.5f, 8.0f, -1.5f));
+                emitter->SetVelocityMax(Vector3(1.5f, 10.0f, 1.5f));
+                emitter->SetForce(Vector3(0.0f, -9.81f, 0.0f));
+                emitter->SetSize(Vector2(0.2f, 0.05f));
+                emitter->SetRotationSpeed(Vector2(-180.0f, 180.0f));
+            }
+        }
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetCastShadows(true);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+        light->SetShadowMapSize(2048);
+        light->SetShadowMaxDistance(100.0f);
+    }
+    // Preset 4: streamed heightmap terrain, drawn as instanced LOD patches from a single drawable
+    else if (preset == 4)
+    {
+        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
+        lightEnvironment->SetFogStart(300.0f);
+        lightEnvironment->SetFogEnd(500.0f);
+        camera->SetFarClip(500.0f);
+
+        GenerateTerrainTiles();
+
+        // 8x8 tiles of 128 units, with a budget of 32 resident tiles
+        Terrain* terrain = scene->CreateChild<Terrain>();
+        terrain->SetPosition(Vector3(-512.0f, -40.0f, -512.0f));
+        terrain->SetTileName("TerrainTiles/Terrain");
+        terrain->SetNumTiles(IntVector2(TERRAIN_TILES, TERRAIN_TILES));
+        terrain->SetTileResolution(TERRAIN_TILE_RESOLUTION);
+        terrain->SetTileSize(128.0f);
+        terrain->SetHeightScale(50.0f);
+        terrain->SetLodDistance(24.0f);
+        terrain->SetMemoryBudget(32 * TERRAIN_TILE_RESOLUTION * TERRAIN_TILE_RESOLUTION * sizeof(unsigned short));
+        terrain->SetMaterial(cache->LoadResource<Material>("Terrain.json"));
+        terrain->SetCastShadows(true);
+
+        Light* light = scene->CreateChild<Light>();
+        light->SetLightType(LIGHT_DIRECTIONAL);
+        light->SetCastShadows(true);
+        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
+        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+        light->SetShadowMapSize(2048);
+        light->SetShadowMaxDistance(100.0f);
+    }
+}
+
+void RotateObjects(Node** nodes, size_t count, float, void* userData)
+{
+    const Quaternion& rotation = *static_cast<Quaternion*>(userData);
+
+    // Static models that are not marked static are the rotating cubes
+    for (size_t i = 0; i < count; ++i)
+    {
+        StaticModel* object = static_cast<StaticModel*>(nodes[i]);
+        if (!object->IsStatic() && !object->IsDormant())
+            object->SetRotation(rotation);
+    }
+}
+
+void WalkObjects(Node** nodes, size_t count, float timeStep, void*)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        AnimatedModel* object = static_cast<AnimatedModel*>(nodes[i]);
+        if (object->AnimationStates().empty())
+            continue;
+
+        AnimationState* state = object->AnimationStates()[0];
+        state->AddTime(timeStep);
+        object->Translate(Vector3::FORWARD * 2.0f * timeStep);
+
+        // Rotate to avoid going outside the plane
+        Vector3 pos = object->Position();
+        if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
+            object->Yaw(45.0f * timeStep);
+    }
+}
+
+void UpdateEmitters(Node** nodes, size_t count, float timeStep, void*)
+{
+    // The emitters only accumulate time here, the simulation runs in the octree update
+    for (size_t i = 0; i < count; ++i)
+        static_cast<ParticleEmitter*>(nodes[i])->Update(timeStep);
+}
+
+void RegisterSceneUpdates(Scene* scene, UpdateMode mode, Quaternion* rotation)
+{
+    UpdateScheduler* scheduler = scene->GetUpdateScheduler();
+    scheduler->UnregisterAllUpdates();
+    scheduler->RegisterUpdate<StaticModel>(RotateObjects, mode, 0, rotation);
+    scheduler->RegisterUpdate<AnimatedModel>(WalkObjects, mode);
+    scheduler->RegisterUpdate<ParticleEmitter>(UpdateEmitters, mode);
+}
+
+void BenchmarkNodePool(Scene* scene)
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    Octree* octree = scene->FindChild<Octree>();
+    if (!octree)
+        return;
+
+    // Build an in-memory prefab of a small shadowcasting model
+    SharedPtr<StaticModel> original = Object::Create<StaticModel>();
+    original->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
+    original->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
+    original->SetCastShadows(true);
+    SharedPtr<JSONFile> prefab = Object::Create<JSONFile>();
+    prefab->SetName("PoolBenchmark");
+    original->SaveJSON(prefab->Root());
+
+    const size_t numObjects = 2000;
+    const int numRounds = 10;
+    std::vector<Node*> objects;
+    HiresTimer timer;
+
+    // Each round spawns on one frame and despawns on the next, with octree updates in between like the renderer would do
+    for (int i = 0; i < numRounds; ++i)
+    {
+        for (size_t j = 0; j < numObjects; ++j)
+        {
+            StaticModel* object = static_cast<StaticModel*>(scene->InstantiateJSON(prefab->Root()));
+            object->SetPosition(Vector3(Random() * 100.0f - 50.0f, 0.0f, Random() * 100.0f - 50.0f));
+            objects.push_back(object);
+        }
+        octree->Update(0);
+        octree->FinishUpdate();
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+            (*it)->RemoveSelf();
+        objects.clear();
+        octree->Update(0);
+        octree->FinishUpdate();
+    }
+    long long instantiateTime = timer.ElapsedUSec();
+
+    NodePool* pool = scene->CreateChild<NodePool>();
+    pool->Reserve(prefab, numObjects);
+    octree->Update(0);
+    octree->FinishUpdate();
+    timer.Reset();
+
+    for (int i = 0; i < numRounds; ++i)
+    {
+        for (size_t j = 0; j < numObjects; ++j)
+        {
+            StaticModel* object = static_cast<StaticModel*>(pool->Spawn(prefab));
+            object->SetPosition(Vector3(Random() * 100.0f - 50.0f, 0.0f, Random() * 100.0f - 50.0f));
+            objects.push_back(object);
+        }
+        octree->Update(0);
+        octree->FinishUpdate();
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+            pool->Despawn(*it);
+        objects.clear();
+        octree->Update(0);
+        octree->FinishUpdate();
+    }
+    long long poolTime = timer.ElapsedUSec();
+
+    pool->RemoveSelf();
+
+    double numSpawns = (double)numObjects * numRounds;
+    LOGINFOF("Instantiate/destroy: %.0f spawns/s", numSpawns * 1000000.0 / (double)(instantiateTime + 1));
+    LOGINFOF("Pooled spawn/despawn: %.0f spawns/s", numSpawns * 1000000.0 / (double)(poolTime + 1));
+}
+
+void BenchmarkPrepareView(Renderer* renderer, Scene* scene, Camera* camera, int preset)
+{
+    ZoneScoped;
+
+    const int numIterations = 100;
+    static const char* modeNames[] = { "off", "transparent", "explicit" };
+
+    // Compare regular heap memory against the selected large page mode, or transparent huge pages if none was selected
+    LargePageMode originalMode = GetLargePageMode();
+    LargePageMode modes[2] = { LARGE_PAGES_OFF, originalMode != LARGE_PAGES_OFF ? originalMode : LARGE_PAGES_TRANSPARENT };
+    double prepareTimes[2];
+
+    for (int i = 0; i < 2; ++i)
+    {
+        // Recreate the scene and instance data so that the octree and instance pools are allocated in the mode being measured
+        SetLargePageMode(modes[i]);
+        CreateScene(scene, camera, preset);
+        renderer->ReleaseInstanceData();
+        renderer->PrepareView(scene, camera, false, false);
+
+        HiresTimer timer;
+
+        // Shadows and occlusion are left out, as their per-frame state would go out of sync without rendering
+        for (int j = 0; j < numIterations; ++j)
+            renderer->PrepareView(scene, camera, false, false);
+
+        prepareTimes[i] = timer.ElapsedUSec() / 1000.0 / numIterations;
+    }
+
+    LargePageStats stats = GetLargePageStats();
+    LOGINFOF("Prepare view: %.3f ms average with large pages %s, %.3f ms with large pages %s", prepareTimes[0], modeNames[modes[0]], prepareTimes[1], modeNames[modes[1]]);
+    LOGINFOF("Large page pools: %u KB mapped, %u KB used, %u fallbacks", (unsigned)(stats.mappedBytes / 1024), (unsigned)(stats.usedBytes / 1024),
+        (unsigned)stats.numFallbacks);
+
+    // Restore the original mode for the scene that continues running
+    SetLargePageMode(originalMode);
+    CreateScene(scene, camera, preset);
+    renderer->ReleaseInstanceData();
+}
+
+void BenchmarkResourceLoading(Scene* scene, Camera* camera, int preset)
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    // Load the scene preset with its resources loaded on demand while recording them, then again with the recorded resources prefetched
+    scene->Clear();
+    cache->UnloadAllResources();
+    cache->BeginManifestRecording();
+    HiresTimer timer;
+    CreateScene(scene, camera, preset);
+    long long onDemandTime = timer.ElapsedUSec();
+
+    if (!cache->SaveManifest(ExecutableDir() + "Data/ResourceManifest.json"))
+        return;
+
+    scene->Clear();
+    cache->UnloadAllResources();
+    timer.Reset();
+    size_t numPrefetched = cache->PrefetchManifest("ResourceManifest.json");
+    CreateScene(scene, camera, preset);
+    long long prefetchTime = timer.ElapsedUSec();
+
+    LOGINFOF("Scene load: %.3f ms on demand, %.3f ms with %u resources prefetched", onDemandTime / 1000.0, prefetchTime / 1000.0, (unsigned)numPrefetched);
+}
+
+void BenchmarkBatchedQueries(Scene* scene, Camera* camera)
+{
+    ZoneScoped;
+
+    Octree* octree = scene->FindChild<Octree>();
+    if (!octree)
+        return;
+
+    // Simulate server-side interest management: observers scattered around the camera, each with a view frustum and an interest sphere
+    const size_t numObservers = 256;
+    std::vector<Frustum> frustums;
+    std::vector<Sphere> spheres;
+    Vector3 cameraPosition = camera->WorldPosition();
+
+    for (size_t i = 0; i < numObservers; ++i)
+    {
+        Vector3 position = cameraPosition + Vector3(Random() * 100.0f - 50.0f, 0.0f, Random() * 100.0f - 50.0f);
+        Frustum frustum;
+        frustum.Define(camera->Fov(), camera->AspectRatio(), 1.0f, camera->NearClip(), 50.0f, Matrix3x4(position, Quaternion(0.0f, Random() * 360.0f, 0.0f), 1.0f));
+        frustums.push_back(frustum);
+        spheres.push_back(Sphere(position, 25.0f));
+    }
+
+    std::vector<std::vector<Drawable*> > results;
+    std::vector<Drawable*> result;
+    HiresTimer timer;
+
+    for (size_t i = 0; i < numObservers; ++i)
+    {
+        result.clear();
+        octree->FindDrawables(result, frustums[i], DF_GEOMETRY);
+    }
+    for (size_t i = 0; i < numObservers; ++i)
+    {
+        result.clear();
+        octree->FindDrawables(result, spheres[i], DF_GEOMETRY);
+    }
+    long long singleTime = timer.ElapsedUSec();
+
+    timer.Reset();
+    octree->FindDrawablesBatched(results, frustums, DF_GEOMETRY);
+    octree->FindDrawablesBatched(results, spheres, DF_GEOMETRY);
+    long long batchedTime = timer.ElapsedUSec();
+
+    LOGINFOF("Observer queries (%u frustums + %u spheres): %.3f ms separate, %.3f ms batched", (unsigned)numObservers, (unsigned)numObservers,
+        singleTime / 1000.0, batchedTime / 1000.0);
+}
+
+static unsigned long long RandomBits()
+{
+    unsigned long long bits = 0;
+    for (int i = 0; i < 5; ++i)
+        bits = (bits << 15) ^ (unsigned long long)Rand();
+    return bits;
+}
+
+static bool IsNormal(double value)
+{
+    // Test the bits, as the floating point classification functions are not reliable with fast math
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof bits);
+    unsigned long long exponentBits = bits & 0x7ff0000000000000ULL;
+    return exponentBits && exponentBits != 0x7ff0000000000000ULL;
+}
+
+bool CheckNumberParsing()
+{
+    ZoneScoped;
+
+    // Halfway and near-halfway cases of more than 19 significant digits, and the extremes of the normal double range. Subnormal and underflowing results are not checked, as the fast math build flushes subnormals to zero
+    static const char* hardCases[] =
+    {
+        "1.9209717315955925298e31",
+        "9007199254740993",
+        "9007199254740993.0000000000000000000001",
+        "9007199254740992.9999999999999999999999",
+        "2.2250738585072013830902327173324040642192159804623318306e-308",
+        "2.2250738585072014e-308",
+        "1.7976931348623157e308",
+        "1.7976931348623158e308",
+        "123456789012345678901234567890",
+        "0.000000000000000000000000000000000000001e30"
+    };
+
+    const int numHardCases = sizeof hardCases / sizeof hardCases[0];
+    const int numRandomValues = 100000;
+    int numChecked = 0;
+    int numFailures = 0;
+    char buffer[64];
+
+    for (int i = 0; i < numHardCases + numRandomValues; ++i)
+    {
+        const char* string = i < numHardCases ? hardCases[i] : buffer;
+        if (i >= numHardCases)
+        {
+            // Random decimal of 1-30 significant digits across the whole exponent range
+            int numDigits = 1 + Random(30);
+            size_t length = 0;
+            buffer[length++] = (char)('1' + Random(9));
+            if (numDigits > 1)
+                buffer[length++] = '.';
+            for (int j = 1; j < numDigits; ++j)
+                buffer[length++] = (char)('0' + Random(10));
+            snprintf(buffer + length, sizeof buffer - length, "e%d", Random(-330, 330));
+        }
+
+        double expected = strtod(string, nullptr);
+        double parsed;
+        ParseNumber(string, parsed);
+        if (IsNormal(expected))
+        {
+            ++numChecked;
+            if (memcmp(&parsed, &expected, sizeof parsed))
+            {
+                LOGERROR(FormatString("ParseNumber(\"%s\") gave %.17g, strtod %.17g", string, parsed, expected));
+                ++numFailures;
+            }
+        }
+
+        // Round trip of a random normal double through the shortest formatting
+        unsigned long long bits = RandomBits();
+        double value;
+        memcpy(&value, &bits, sizeof value);
+        if (!IsNormal(value))
+            continue;
+
+        char formatted[NUMBER_BUFFER_SIZE];
+        FormatNumber(formatted, value);
+        ParseNumber(formatted, parsed);
+        ++numChecked;
+        if (memcmp(&parsed, &value, sizeof parsed))
+        {
+            LOGERROR(FormatString("Formatted %.17g as \"%s\", which parsed back as %.17g", value, formatted, parsed));
+            ++numFailures;
+        }
+    }
+
+    // Floats must be rounded directly from the decimal, not through a double. These are just above, exactly at and just below the halfway point between 1 and the next float, and around the halfway point above the largest float
+    static const char* floatHardCases[] =
+    {
+        "1.000000059604644775390625000001",
+        "1.000000059604644775390625",
+        "1.0000000596046447753906249999",
+        "3.4028235677973366e38",
+        "3.40282356779733661637539395458142568448e38",
+        "3.4028235677973367e38",
+        "7.038531e-26",
+        "1.17549435e-38"
+    };
+
+    const int numFloatHardCases = sizeof floatHardCases / sizeof floatHardCases[0];
+
+    for (int i = 0; i < numFloatHardCases + numRandomValues; ++i)
+    {
+        const char* string = i < numFloatHardCases ? floatHardCases[i] : buffer;
+        if (i >= numFloatHardCases)
+        {
+            int numDigits = 1 + Random(30);
+            size_t length = 0;
+            buffer[length++] = (char)('1' + Random(9));
+            if (numDigits > 1)
+                buffer[length++] = '.';
+            for (int j = 1; j < numDigits; ++j)
+                buffer[length++] = (char)('0' + Random(10));
+            snprintf(buffer + length, sizeof buffer - length, "e%d", Random(-37, 39));
+        }
+
+        float expected = strtof(string, nullptr);
+        float parsed;
+        ParseNumber(string, parsed);
+        unsigned expectedBits;
+        memcpy(&expectedBits, &expected, sizeof expectedBits);
+        if ((expectedBits & 0x7f800000) != 0)
+        {
+            ++numChecked;
+            if (memcmp(&parsed, &expected, sizeof parsed))
+            {
+                LOGERROR(FormatString("ParseNumber(\"%s\") gave float %.9g, strtof %.9g", string, parsed, expected));
+                ++numFailures;
+            }
+        }
+
+        // Round trip of a random normal float through the shortest formatting
+        unsigned bits = (unsigned)RandomBits();
+        float value;
+        memcpy(&value, &bits, sizeof value);
+        if (!(bits & 0x7f800000) || (bits & 0x7f800000) == 0x7f800000)
+            continue;
+
+        char formatted[NUMBER_BUFFER_SIZE];
+        FormatNumber(formatted, value);
+        ParseNumber(formatted, parsed);
+        ++numChecked;
+        if (memcmp(&parsed, &value, sizeof parsed))
+        {
+            LOGERROR(FormatString("Formatted float %.9g as \"%s\", which parsed back as %.9g", value, formatted, parsed));
+            ++numFailures;
+        }
+    }
+
+    // Doubles should be formatted with the fewest significant digits that parse back to the same value, also when 16 or 17 digits are needed
+    for (int i = 0; i < numRandomValues; ++i)
+    {
+        unsigned long long bits = RandomBits();
+        double value;
+        memcpy(&value, &bits, sizeof value);
+        if (!IsNormal(value))
+            continue;
+
+        int shortestDigits = 17;
+        for (int numDigits = 1; numDigits < 17; ++numDigits)
+        {
+            snprintf(buffer, sizeof buffer, "%.*e", numDigits - 1, value);
+            if (strtod(buffer, nullptr) == value)
+            {
+                shortestDigits = numDigits;
+                break;
+            }
+        }
+
+        char formatted[NUMBER_BUFFER_SIZE];
+        FormatNumber(formatted, value);
+
+        // Count the significant digits of the output, without leading and trailing zeros
+        std::string digits;
+        for (const char* ptr = formatted; *ptr && *ptr != 'e'; ++ptr)
+        {
+            if (isdigit((unsigned char)*ptr) && (digits.length() || *ptr != '0'))
+                digits += *ptr;
+        }
+        while (digits.length() && digits.back() == '0')
+            digits.pop_back();
+
+        ++numChecked;
+        if ((int)digits.length() != shortestDigits)
+        {
+            LOGERROR(FormatString("Formatted %.17g as \"%s\", shortest has %d digits", value, formatted, shortestDigits));
+            ++numFailures;
+        }
+    }
+
+    LOGINFOF("Number parsing: %d values checked, %d failures", numChecked, numFailures);
+    return numFailures == 0;
+}
+
+static void CollectNodes(Node* node, std::vector<Node*>& dest)
+{
+    for (size_t i = 0; i < node->NumChildren(); ++i)
+    {
+        Node* child = node->Child(i);
+        dest.push_back(child);
+        CollectNodes(child, dest);
+    }
+}
+
+static bool IsSameSave(Scene* lhs, Scene* rhs)
+{
+    VectorBuffer lhsData;
+    VectorBuffer rhsData;
+    lhs->Save(lhsData);
+    rhs->Save(rhsData);
+    return lhsData.Size() == rhsData.Size() && !memcmp(lhsData.Data(), rhsData.Data(), lhsData.Size());
+}
+
+bool CheckSceneDelta()
+{
+    ZoneScoped;
+
+    RegisterSceneLibrary();
+
+    // Scene saves and loads log each time, so show only errors during the check
+    Log* log = Object::Subsystem<Log>();
+    int oldLogLevel = log->Level();
+    log->SetLevel(LOG_ERROR);
+
+    SharedPtr<Scene> sender = Object::Create<Scene>();
+    SharedPtr<Scene> receiver = Object::Create<Scene>();
+    for (int i = 0; i < 20; ++i)
+        sender->CreateChild<SpatialNode>(FormatString("Node%d", i));
+
+    // The receiver starts from a full save of the sender's baseline
+    VectorBuffer data;
+    sender->SetDeltaBaseline();
+    sender->Save(data);
+    data.Seek(0);
+    receiver->Load(data);
+
+    const int numRounds = 50;
+    const int numOperations = 20;
+    int numFailures = 0;
+    std::vector<Node*> nodes;
+
+    for (int round = 0; round < numRounds; ++round)
+    {
+        for (int i = 0; i < numOperations; ++i)
+        {
+            nodes.clear();
+            CollectNodes(sender, nodes);
+            if (nodes.empty())
+            {
+                sender->CreateChild<SpatialNode>();
+                continue;
+            }
+
+            Node* node = nodes[Random((int)nodes.size())];
+            Node* target = Random(4) ? nodes[Random((int)nodes.size())] : sender.Get();
+
+            switch (Random(8))
+            {
+            case 0:
+                target->CreateChild(Random(2) ? SpatialNode::TypeStatic() : Node::TypeStatic(), FormatString("Added%d", Rand()));
+                break;
+
+            case 1:
+                node->RemoveSelf();
+                break;
+
+            case 2:
+                {
+                    // Reparent unless the target is within the node's own subtree
+                    Node* ancestor = target;
+                    while (ancestor && ancestor != node)
+                        ancestor = ancestor->Parent();
+                    if (!ancestor)
+                        target->AddChild(node);
+                }
+                break;
+
+            case 3:
+                node->SetName(FormatString("Renamed%d", Rand()));
+                break;
+
+            case 4:
+                if (node->TestFlag(NF_SPATIAL))
+                    static_cast<SpatialNode*>(node)->SetPosition(Vector3(Random(-100.0f, 100.0f), Random(-100.0f, 100.0f), Random(-100.0f, 100.0f)));
+                break;
+
+            case 5:
+                node->SetTemporary(!node->IsTemporary());
+                break;
+
+            case 6:
+                node->SetEnabled(!node->IsEnabled());
+                break;
+
+            case 7:
+                // Node that is added and removed between deltas
+                target->CreateChild<SpatialNode>()->RemoveSelf();
+                break;
+            }
+        }
+
+        data.Clear();
+        sender->SaveDelta(data);
+        data.Seek(0);
+        if (!receiver->Load(data) || !IsSameSave(sender, receiver))
+        {
+            LOGERRORF("Scene delta round %d did not reproduce the sender", round);
+            ++numFailures;
+        }
+    }
+
+    // A truncated delta must fail to load. Restore the receiver before each attempt, as the delta may be partially applied
+    for (int i = 0; i < numOperations; ++i)
+        sender->CreateChild<SpatialNode>()->SetPosition(Vector3(Random(100.0f), 0.0f, 0.0f));
+
+    VectorBuffer delta;
+    VectorBuffer receiverData;
+    sender->SaveDelta(delta);
+    receiver->Save(receiverData);
+
+    size_t truncatedSizes[] = { delta.Size() / 2, delta.Size() - 1 };
+    for (size_t i = 0; i < sizeof truncatedSizes / sizeof truncatedSizes[0]; ++i)
+    {
+        receiverData.Seek(0);
+        receiver->Load(receiverData);
+
+        // The truncation error is expected, so do not log it
+        VectorBuffer truncated(delta.Data(), truncatedSizes[i]);
+        log->SetLevel(LOG_NONE);
+        bool loaded = receiver->Load(truncated);
+        log->SetLevel(LOG_ERROR);
+        if (loaded)
+        {
+            LOGERRORF("Scene delta truncated to %u of %u bytes was loaded", (unsigned)truncatedSizes[i], (unsigned)delta.Size());
+            ++numFailures;
+        }
+    }
+
+    log->SetLevel(oldLogLevel);
+    LOGINFOF("Scene delta: %d rounds checked, %d failures", numRounds, numFailures);
+    return numFailures == 0;
+}
+
+bool CheckMultiDraw()
+{
+    ZoneScoped;
+
+    // The buffers are only compared by the command generation, so they need no OpenGL objects
+    SharedPtr<VertexBuffer> vertexBuffers[] = { new VertexBuffer(), new VertexBuffer(), new VertexBuffer() };
+    SharedPtr<IndexBuffer> indexBuffers[] = { new IndexBuffer(), new IndexBuffer(), new IndexBuffer() };
+
+    // Geometries 0 and 1 share all buffers. Geometry 2 has another vertex buffer, 3 another index buffer and 4 no position-only version
+    static const size_t geomVertexBuffers[] = { 0, 0, 1, 0, 0 };
+    static const size_t geomIndexBuffers[] = { 0, 0, 0, 1, 0 };
+    const size_t numGeometries = sizeof geomVertexBuffers / sizeof geomVertexBuffers[0];
+    SharedPtr<Geometry> geometries[numGeometries];
+
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        Geometry* geometry = new Geometry();
+        geometry->vertexBuffer = vertexBuffers[geomVertexBuffers[i]];
+        geometry->indexBuffer = indexBuffers[geomIndexBuffers[i]];
+        geometry->drawStart = i * 100;
+        geometry->drawCount = 30 + i * 3;
+
+        if (i < numGeometries - 1)
+        {
+            Geometry* positionGeometry = new Geometry();
+            positionGeometry->vertexBuffer = vertexBuffers[2];
+            positionGeometry->indexBuffer = indexBuffers[2];
+            positionGeometry->drawStart = i * 50;
+            positionGeometry->drawCount = 10 + i;
+            geometry->positionGeometry = positionGeometry;
+        }
+
+        geometries[i] = geometry;
+    }
+
+    SharedPtr<Material> material(new Material());
+    Pass* passes[] = { material->CreatePass(PASS_OPAQUE), material->CreatePass(PASS_ALPHA) };
+
+    // Batches in sorted order, with the number of entries each run starting from them should cover
+    struct TestBatch
+    {
+        size_t pass;
+        size_t geometry;
+        unsigned instanceCount;
+        size_t runLength;
+    };
+
+    static const TestBatch testBatches[] =
+    {
+        { 0, 0, 3, 3 },
+        { 0, 1, 2, 2 },
+        { 0, 0, 1, 1 },
+        { 0, 2, 4, 1 }, // Vertex buffer differs
+        { 0, 1, 2, 2 },
+        { 0, 0, 1, 1 },
+        { 0, 3, 1, 1 }, // Index buffer differs
+        { 0, 1, 1, 2 },
+        { 0, 0, 2, 1 },
+        { 0, 4, 2, 1 }, // Position-only geometry differs
+        { 1, 0, 1, 2 }, // Pass differs
+        { 1, 1, 3, 1 },
+        { 0, 1, 1, 1 }, // Pass differs
+        { 0, 0, 0, 0 }  // Not instanced
+    };
+
+    const size_t numTestBatches = sizeof testBatches / sizeof testBatches[0];
+    BatchQueue queue;
+    unsigned instanceStart = 0;
+
+    for (size_t i = 0; i < numTestBatches; ++i)
+    {
+        Batch batch;
+        batch.pass = passes[testBatches[i].pass];
+        batch.geometry = geometries[testBatches[i].geometry];
+        batch.geomIndex = 0;
+        batch.textureLayer = 0;
+        batch.userData = &Vector4::ZERO;
+
+        if (testBatches[i].instanceCount)
+        {
+            batch.programBits = SP_INSTANCED;
+            batch.instanceStart = instanceStart;
+            batch.instanceCount = testBatches[i].instanceCount;
+            instanceStart += batch.instanceCount;
+        }
+        else
+        {
+            batch.programBits = SP_STATIC;
+            batch.worldTransform = &Matrix3x4::IDENTITY;
+        }
+
+        queue.batches.push_back(batch);
+    }
+
+    int numChecked = 0;
+    int numFailures = 0;
+    std::vector<DrawIndirectCommand> commands;
+
+    for (int positionPass = 0; positionPass < 2; ++positionPass)
+    {
+        bool usePositionGeometry = positionPass != 0;
+
+        for (size_t i = 0; i < numTestBatches; ++i)
+        {
+            // The renderer uses the position-only geometries only if the first batch of the run has one
+            if (usePositionGeometry && !queue.batches[i].geometry->positionGeometry)
+                continue;
+
+            commands.clear();
+            size_t numEntries = queue.BuildMultiDraw(i, usePositionGeometry, commands);
+            ++numChecked;
+
+            if (numEntries != testBatches[i].runLength || commands.size() != numEntries)
+            {
+                LOGERRORF("Multi-draw run from batch %u covered %u entries with %u commands, expected %u", (unsigned)i, (unsigned)numEntries,
+                    (unsigned)commands.size(), (unsigned)testBatches[i].runLength);
+                ++numFailures;
+                continue;
+            }
+
+            for (size_t j = 0; j < commands.size(); ++j)
+            {
+                const Batch& batch = queue.batches[i + j];
+                const DrawIndirectCommand& command = commands[j];
+                Geometry* geometry = usePositionGeometry ? batch.geometry->positionGeometry.Get() : batch.geometry;
+
+                if (command.count != geometry->drawCount || command.firstIndex != geometry->drawStart || command.baseVertex != 0 ||
+                    command.instanceCount != batch.instanceCount || command.baseInstance != batch.instanceStart)
+                {
+                    LOGERRORF("Multi-draw command %u of run from batch %u does not match its batch", (unsigned)j, (unsigned)i);
+                    ++numFailures;
+                }
+            }
+        }
+    }
+
+    LOGINFOF("Multi-draw: %d runs checked, %d failures", numChecked, numFailures);
+    return numFailures == 0;
+}
+
+static size_t SortLayerBatches(const std::vector<Material*>& objectMaterials, Geometry** objectGeometries, const std::vector<Matrix3x4>& transforms,
+    const std::vector<Vector4>& userData, BatchQueue& queue, InstanceDataVector& instanceData, UserInstanceDataVector& userInstanceData)
+{
+    queue.Clear();
+    instanceData.clear();
+    userInstanceData.clear();
+
+    for (size_t i = 0; i < objectMaterials.size(); ++i)
+    {
+        Batch batch;
+        batch.pass = objectMaterials[i]->GetPass(PASS_OPAQUE);
+        batch.geometry = objectGeometries[i];
+        batch.programBits = SP_STATIC;
+        batch.geomIndex = 0;
+        batch.textureLayer = (unsigned short)objectMaterials[i]->TextureLayer();
+        batch.worldTransform = &transforms[i];
+        batch.userData = &userData[i];
+        queue.batches.push_back(batch);
+    }
+
+    queue.Sort(instanceData, userInstanceData, SORT_STATE, true);
+    return queue.batches.size();
+}
+
+bool CheckLayerVariants()
+{
+    ZoneScoped;
+
+    RegisterRendererLibrary();
+
+    const size_t numLayers = 8;
+    const size_t numObjects = 256;
+    const size_t numGeometries = 2;
+
+    SharedPtr<Material> baseMaterial = Object::Create<Material>();
+    baseMaterial->CreatePass(PASS_OPAQUE);
+
+    // Layer variants of one material, versus a separate material per layer as without array textures
+    std::vector<SharedPtr<Material> > variants;
+    std::vector<SharedPtr<Material> > separateMaterials;
+    for (size_t i = 0; i < numLayers; ++i)
+    {
+        variants.push_back(baseMaterial->CreateLayerVariant((unsigned)i));
+        separateMaterials.push_back(Object::Create<Material>());
+        separateMaterials.back()->CreatePass(PASS_OPAQUE);
+    }
+
+    SharedPtr<Geometry> geometries[numGeometries];
+    for (size_t i = 0; i < numGeometries; ++i)
+        geometries[i] = new Geometry();
+
+    // Encode the object index in the transform, to identify the instances after sorting
+    std::vector<Material*> variantMaterials(numObjects);
+    std::vector<Material*> objectMaterials(numObjects);
+    std::vector<Matrix3x4> transforms(numObjects);
+    std::vector<Vector4> userData(numObjects);
+    Geometry* objectGeometries[numObjects];
+    for (size_t i = 0; i < numObjects; ++i)
+    {
+        size_t layer = Random((int)numLayers);
+        variantMaterials[i] = variants[layer];
+        objectMaterials[i] = separateMaterials[layer];
+        objectGeometries[i] = geometries[Random((int)numGeometries)];
+        transforms[i] = Matrix3x4::IDENTITY;
+        transforms[i].m03 = (float)i;
+        userData[i] = Vector4((float)i, 0.0f, 0.0f, 1.0f);
+    }
+
+    BatchQueue queue;
+    InstanceDataVector instanceData;
+    UserInstanceDataVector userInstanceData;
+    int numFailures = 0;
+
+    size_t numSeparateDraws = SortLayerBatches(objectMaterials, objectGeometries, transforms, userData, queue, instanceData, userInstanceData);
+    size_t numVariantDraws = SortLayerBatches(variantMaterials, objectGeometries, transforms, userData, queue, instanceData, userInstanceData);
+
+    // The variants should be drawn as one instanced draw per geometry, with each instance carrying the layer of its object
+    if (numVariantDraws != numGeometries)
+    {
+        LOGERRORF("Layer variants were drawn in %u draws, expected %u", (unsigned)numVariantDraws, (unsigned)numGeometries);
+        ++numFailures;
+    }
+
+    size_t numInstances = 0;
+    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
+    {
+        if (it->programBits != SP_INSTANCED)
+            continue;
+
+        for (size_t i = it->instanceStart; i < it->instanceStart + it->instanceCount; ++i)
+        {
+            size_t object = (size_t)instanceData[i].worldTransform.m03;
+            if (objectGeometries[object] != it->geometry || instanceData[i].textureLayer != (float)variantMaterials[object]->TextureLayer())
+            {
+                LOGERRORF("Instance of object %u has the wrong geometry or texture layer", (unsigned)object);
+                ++numFailures;
+            }
+            ++numInstances;
+        }
+    }
+
+    if (numInstances != numObjects || userInstanceData.size())
+    {
+        LOGERRORF("Layer variants produced %u instances and %u user data instances, expected %u and none", (unsigned)numInstances,
+            (unsigned)userInstanceData.size(), (unsigned)numObjects);
+        ++numFailures;
+    }
+
+    // When the pass reads user data, the instances should move to the user data stream and carry the user data of their object
+    baseMaterial->GetPass(PASS_OPAQUE)->SetUserData(true);
+    SortLayerBatches(variantMaterials, objectGeometries, transforms, userData, queue, instanceData, userInstanceData);
+
+    if (instanceData.size() || userInstanceData.size() != numObjects)
+    {
+        LOGERRORF("User data pass produced %u instances and %u user data instances, expected none and %u", (unsigned)instanceData.size(),
+            (unsigned)userInstanceData.size(), (unsigned)numObjects);
+        ++numFailures;
+    }
+
+    for (auto it = userInstanceData.begin(); it != userInstanceData.end(); ++it)
+    {
+        if (it->userData.x != it->worldTransform.m03)
+        {
+            LOGERRORF("User data instance of object %u has the wrong user data", (unsigned)it->worldTransform.m03);
+            ++numFailures;
+        }
+    }
+
+    // Textures and cull mode set on the base material after creating the variants, or through a variant, should be seen by all variants
+    SharedPtr<Texture> texture(new Texture());
+    baseMaterial->SetTexture(0, texture);
+    variants[1]->SetCullMode(CULL_FRONT);
+
+    for (size_t i = 0; i < numLayers; ++i)
+    {
+        if (variants[i]->GetTexture(0) != texture || variants[i]->GetCullMode() != CULL_FRONT)
+        {
+            LOGERRORF("Layer variant %u does not forward its texture or cull mode to the base material", (unsigned)i);
+            ++numFailures;
+        }
+    }
+
+    if (baseMaterial->GetCullMode() != CULL_FRONT)
+    {
+        LOGERROR("Cull mode set through a layer variant did not reach the base material");
+        ++numFailures;
+    }
+
+    // Variants alias the base material's uniform block, so uniform values and the bound range come from the base material
+    static const char* uniformNames[] = { "matDiffColor", "matSpecColor" };
+    baseMaterial->DefineUniforms(2, uniformNames);
+    variants[2]->SetUniform("matSpecColor", Vector4(0.5f, 0.5f, 0.5f, 16.0f));
+
+    for (size_t i = 0; i < numLayers; ++i)
+    {
+        if (variants[i]->Uniform("matSpecColor") != baseMaterial->Uniform("matSpecColor") || baseMaterial->Uniform("matSpecColor").w != 16.0f ||
+            variants[i]->UniformDataSize() != baseMaterial->UniformDataSize() || variants[i]->UniformOffset() != baseMaterial->UniformOffset())
+        {
+            LOGERRORF("Layer variant %u does not alias the uniforms of the base material", (unsigned)i);
+            ++numFailures;
+        }
+    }
+
+    LOGINFOF("Layer variants: %u objects in %u draws, %u draws with separate materials, %d failures", (unsigned)numObjects, (unsigned)numVariantDraws,
+        (unsigned)numSeparateDraws, numFailures);
+    return numFailures == 0;
+}
+
+bool CheckResourcePrefetch()
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    static const char* names[] = { "Mushroom.json", "Stone.json", "Terrain.json" };
+    const size_t numNames = sizeof names / sizeof names[0];
+    int numFailures = 0;
+
+    // Record the resources as JSON files, so that loading them does not need the Graphics subsystem
+    for (size_t i = 0; i < numNames; ++i)
+        cache->UnloadResource(JSONFile::TypeStatic(), names[i]);
+
+    cache->BeginManifestRecording();
+    for (size_t i = 0; i < numNames; ++i)
+        cache->LoadResource<JSONFile>(names[i]);
+    if (!cache->SaveManifest(ExecutableDir() + "Data/ResourceManifest.json"))
+        return false;
+
+    for (size_t i = 0; i < numNames; ++i)
+        cache->UnloadResource(JSONFile::TypeStatic(), names[i]);
+
+    size_t numPrefetched = cache->PrefetchManifest("ResourceManifest.json");
+    if (numPrefetched != numNames)
+    {
+        LOGERRORF("Prefetched %u resources, expected %u", (unsigned)numPrefetched, (unsigned)numNames);
+        ++numFailures;
+    }
+
+    std::vector<JSONFile*> loaded;
+    cache->ResourcesByType(loaded);
+    for (size_t i = 0; i < numNames; ++i)
+    {
+        bool found = false;
+        for (auto it = loaded.begin(); it != loaded.end(); ++it)
+            found |= (*it)->Name() == names[i] && !(*it)->Root().IsNull();
+        if (!found)
+        {
+            LOGERRORF("Prefetched resource %s was not loaded", names[i]);
+            ++numFailures;
+        }
+    }
+
+    // An entry whose file has changed since recording should be discarded
+    cache->UnloadResource(JSONFile::TypeStatic(), names[0]);
+    std::vector<ResourceManifestEntry> entries(1);
+    entries[0].type = JSONFile::TypeStatic();
+    entries[0].name = names[0];
+    entries[0].modifiedTime = cache->LastModifiedTime(names[0]) + 1;
+    Log* log = Object::Subsystem<Log>();
+    int oldLogLevel = log->Level();
+    log->SetLevel(LOG_ERROR);
+    size_t numStaleLoaded = cache->PrefetchResources(entries);
+    log->SetLevel(oldLogLevel);
+    if (numStaleLoaded)
+    {
+        LOGERROR("Prefetched a resource whose file was modified after recording");
+        ++numFailures;
+    }
+
+    LOGINFOF("Resource prefetch: %u resources prefetched, %d failures", (unsigned)numPrefetched, numFailures);
+    return numFailures == 0;
+}
 
-    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+bool CheckNodePool()
+{
+    ZoneScoped;
 
-    scene->Clear();
-    scene->CreateChild<Octree>();
-    LightEnvironment* lightEnvironment = scene->CreateChild<LightEnvironment>();
+    RegisterRendererLibrary();
 
-    SetRandomSeed(1);
+    // A prefab of a spatial root with a drawable child and a plain child, with non-default transforms
+    SharedPtr<SpatialNode> original = Object::Create<SpatialNode>();
+    original->SetPosition(Vector3(1.0f, 2.0f, 3.0f));
+    StaticModel* originalChild = original->CreateChild<StaticModel>();
+    originalChild->SetPosition(Vector3(0.0f, 1.0f, 0.0f));
+    original->CreateChild<SpatialNode>("Marker");
+    SharedPtr<JSONFile> prefab = Object::Create<JSONFile>();
+    prefab->SetName("PoolCheck");
+    original->SaveJSON(prefab->Root());
 
-    // Preset 0: occluders, static meshes and many local shadowcasting lights in addition to ambient light
-    if (preset == 0)
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    Octree* octree = scene->CreateChild<Octree>();
+    NodePool* pool = scene->CreateChild<NodePool>();
+
+    const size_t numObjects = 8;
+    int numFailures = 0;
+    std::vector<SpatialNode*> objects;
+    std::vector<unsigned> nodeIds;
+    std::vector<unsigned> drawableIds;
+
+    for (size_t i = 0; i < numObjects; ++i)
+        objects.push_back(static_cast<SpatialNode*>(pool->Spawn(prefab)));
+    octree->Update(1);
+    octree->FinishUpdate();
+
+    // Change the spawned state, then despawn. The drawables should stay in the octree as dormant
+    for (size_t i = 0; i < numObjects; ++i)
     {
-        lightEnvironment->SetAmbientColor(Color(0.3f, 0.3f, 0.3f));
-        camera->SetFarClip(1000.0f);
+        StaticModel* child = objects[i]->FindChild<StaticModel>();
+        nodeIds.push_back(objects[i]->Id());
+        drawableIds.push_back(child->GetDrawable()->Id());
+        objects[i]->SetPosition(Vector3(Random() * 100.0f, 0.0f, Random() * 100.0f));
+        child->SetRotation(Quaternion(Random() * 360.0f, Vector3::UP));
+        // Disabling would take a drawable out of the octree, so disable the plain child
+        objects[i]->FindChild<SpatialNode>("Marker")->SetEnabled(false);
+        pool->Despawn(objects[i]);
+    }
+    octree->Update(2);
+    octree->FinishUpdate();
 
-        for (int y = -55; y <= 55; ++y)
+    if (pool->NumPooled(prefab) != numObjects || pool->NumSpawned())
+    {
+        LOGERRORF("Node pool has %u pooled and %u spawned, expected %u pooled", (unsigned)pool->NumPooled(prefab), (unsigned)pool->NumSpawned(), (unsigned)numObjects);
+        ++numFailures;
+    }
+    for (size_t i = 0; i < numObjects; ++i)
+    {
+        StaticModel* child = objects[i]->FindChild<StaticModel>();
+        if (!child->IsDormant() || !child->GetDrawable()->GetOctant())
         {
-            for (int x = -55; x <= 55; ++x)
-            {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                object->SetStatic(true);
-                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
-                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            }
+            LOGERROR("Despawned drawable is not dormant in the octree");
+            ++numFailures;
         }
+    }
 
-        for (unsigned i = 0; i < 10000; ++i)
+    // Respawn: the same subtrees come back with their ids, and the changed state reset to the prefab's
+    for (size_t i = 0; i < numObjects; ++i)
+    {
+        SpatialNode* object = static_cast<SpatialNode*>(pool->Spawn(prefab));
+        auto it = std::find(objects.begin(), objects.end(), object);
+        if (it == objects.end())
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
-            object->SetScale(1.5f);
-            object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
-            object->SetCastShadows(true);
-            object->SetLodBias(2.0f);
-            object->SetMaxDistance(600.0f);
+            LOGERROR("Spawn did not reuse a despawned subtree");
+            ++numFailures;
+            continue;
         }
 
-        Vector3 quadrantCenters[] = 
+        size_t index = it - objects.begin();
+        StaticModel* child = object->FindChild<StaticModel>();
+        if (object->Id() != nodeIds[index] || child->GetDrawable()->Id() != drawableIds[index])
         {
-            Vector3(-290.0f, 0.0f, -290.0f),
-            Vector3(290.0f, 0.0f, -290.0f),
-            Vector3(-290.0f, 0.0f, 290.0f),
-            Vector3(290.0f, 0.0f, 290.0f),
-        };
+            LOGERROR("Respawned subtree changed its node or drawable id");
+            ++numFailures;
+        }
+        if (object->Position() != Vector3(1.0f, 2.0f, 3.0f) || child->Position() != Vector3(0.0f, 1.0f, 0.0f) ||
+            child->Rotation() != Quaternion::IDENTITY || !object->FindChild<SpatialNode>("Marker")->IsEnabled() || child->IsDormant())
+        {
+            LOGERROR("Respawned subtree state was not reset to the prefab");
+            ++numFailures;
+        }
+    }
+    octree->Update(3);
+    octree->FinishUpdate();
 
-        std::vector<Light*> lights;
+    LOGINFOF("Node pool: %u subtrees recycled, %d failures", (unsigned)numObjects, numFailures);
+    return numFailures == 0;
+}
 
-        for (unsigned i = 0; i < 100; ++i)
+bool CheckVisibilityIdReuse()
+{
+    ZoneScoped;
+
+    RegisterRendererLibrary();
+
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    Octree* octree = scene->CreateChild<Octree>();
+    VisibilitySet visibility;
+    octree->AddVisibilitySet(&visibility);
+
+    const size_t numDrawables = 16;
+    std::vector<StaticModel*> objects;
+    for (size_t i = 0; i < numDrawables; ++i)
+        objects.push_back(scene->CreateChild<StaticModel>());
+    octree->Update(1);
+    octree->FinishUpdate();
+
+    // Mark every drawable as seen by the view, then replace half of them. The replacements reuse the freed ids but were never seen
+    visibility.Reset(octree->NumDrawableIds());
+    for (size_t i = 0; i < numDrawables; ++i)
+        visibility.Set(objects[i]->GetDrawable()->Id());
+
+    for (size_t i = 0; i < numDrawables; i += 2)
+    {
+        objects[i]->RemoveSelf();
+        objects[i] = scene->CreateChild<StaticModel>();
+    }
+    octree->Update(2);
+    octree->FinishUpdate();
+
+    int numFailures = 0;
+    for (size_t i = 0; i < numDrawables; ++i)
+    {
+        unsigned id = objects[i]->GetDrawable()->Id();
+        bool expected = (i & 1) != 0;
+        if (id >= numDrawables)
         {
-            Light* light = scene->CreateChild<Light>();
-            light->SetStatic(true);
-            light->SetLightType(LIGHT_POINT);
-            light->SetCastShadows(true);
-            Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
-            light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z, 0.5f));
-            light->SetRange(40.0f);
-            light->SetShadowMapSize(256);
-            light->SetShadowMaxDistance(200.0f);
-            light->SetMaxDistance(900.0f);
+            LOGERRORF("Drawable was given id %u instead of reusing a freed id", id);
+            ++numFailures;
+        }
+        else if (visibility.Test(id) != expected)
+        {
+            LOGERRORF("Drawable id %u reports %s after id reuse", id, expected ? "not visible" : "visible");
+            ++numFailures;
+        }
+    }
 
-            for (;;)
-            {
-                Vector3 newPos = quadrantCenters[i % 4] + Vector3(Random() * 500.0f - 250.0f, 10.0f, Random() * 500.0f - 250.0f);
-                bool posOk = true;
+    octree->RemoveVisibilitySet(&visibility);
 
-                for (unsigned j = 0; j < lights.size(); ++j)
-                {
-                    if ((newPos - lights[j]->Position()).Length() < 80.0f)
-                    {
-                        posOk = false;
-                        break;
-                    }
-                }
+    LOGINFOF("Visibility id reuse: %u drawables checked, %d failures", (unsigned)numDrawables, numFailures);
+    return numFailures == 0;
+}
 
-                if (posOk)
-                {
-                    light->SetPosition(newPos);
-                    break;
-                }
-            }
+void MoveCheckNodes(Node** nodes, size_t count, float timeStep, void*)
+{
+    // Depends only on each node's own state, so the parallel and serial results must match exactly
+    for (size_t i = 0; i < count; ++i)
+    {
+        SpatialNode* node = static_cast<SpatialNode*>(nodes[i]);
+        node->Translate(Vector3(timeStep, 0.0f, 0.5f * timeStep));
+        node->Rotate(Quaternion(10.0f * timeStep, Vector3::UP));
+    }
+}
 
-            lights.push_back(light);
-        }
+void ReplaceCheckNodes(Node** nodes, size_t count, float, void* userData)
+{
+    // Remove nodes still to be updated and create new ones during the update. Removed nodes leave null entries
+    Scene* scene = static_cast<Scene*>(userData);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!nodes[i])
+            continue;
+        if (!(i & 3) && nodes[count - 1 - i])
+            nodes[count - 1 - i]->RemoveSelf();
+        if (!(i & 7))
+            scene->CreateChild<SpatialNode>();
+    }
+}
+
+bool CheckNodeUpdates()
+{
+    ZoneScoped;
+
+    RegisterSceneLibrary();
 
+    const size_t numParents = 250;
+    const size_t numChildren = 4;
+    const int numFrames = 10;
+    int numFailures = 0;
+
+    // Update identical hierarchies in parallel and serially. Children follow their parents, so the deferred transform notifications must leave the same world transforms
+    SharedPtr<Scene> scenes[2];
+    std::vector<SpatialNode*> nodes[2];
+    for (size_t i = 0; i < 2; ++i)
+    {
+        scenes[i] = Object::Create<Scene>();
+        for (size_t j = 0; j < numParents; ++j)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
-            object->SetScale(Vector3(1165.0f, 50.0f, 1.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            object->SetCastShadows(true);
+            SpatialNode* parent = scenes[i]->CreateChild<SpatialNode>();
+            parent->SetPosition(Vector3((float)j, 0.0f, 0.0f));
+            nodes[i].push_back(parent);
+            for (size_t k = 0; k < numChildren; ++k)
+            {
+                SpatialNode* child = parent->CreateChild<SpatialNode>();
+                child->SetPosition(Vector3(0.0f, (float)k, 1.0f));
+                nodes[i].push_back(child);
+            }
         }
 
+        scenes[i]->GetUpdateScheduler()->RegisterUpdate<SpatialNode>(MoveCheckNodes, i ? UPDATE_SERIAL : UPDATE_PARALLEL);
+        for (int frame = 0; frame < numFrames; ++frame)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0.0f, 25.0f, 0.0f));
-            object->SetScale(Vector3(1.0f, 50.0f, 1165.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
-            object->SetCastShadows(true);
+            scenes[i]->GetUpdateScheduler()->Update(0.1f);
+            // Read the world transforms between frames, so that stale cached transforms would carry over
+            for (auto it = nodes[i].begin(); it != nodes[i].end(); ++it)
+                (*it)->WorldTransform();
         }
     }
-    // Preset 1: high number of animating cubes
-    else if (preset == 1)
+
+    for (size_t i = 0; i < nodes[0].size(); ++i)
     {
-        lightEnvironment->SetFogColor(Color(0.3f, 0.3f, 0.3f));
-        lightEnvironment->SetFogStart(300.0f);
-        lightEnvironment->SetFogEnd(500.0f);
-        camera->SetFarClip(500.0f);
+        if (!(nodes[0][i]->WorldTransform() == nodes[1][i]->WorldTransform()))
+        {
+            LOGERRORF("Node %u world transform differs between parallel and serial update", (unsigned)i);
+            ++numFailures;
+        }
+    }
 
-        SharedPtr<Material> customMat = Material::DefaultMaterial()->Clone();
-        customMat->SetUniform("matDiffColor", Vector4(0.75f, 0.35f, 0.0f, 1.0f));
-        customMat->SetUniform("matSpecColor", Vector4(0.75f / 3.0f, 0.35f / 3.0f, 0.0f, 1.0f));
+    // Nodes removed and created during a serial update must leave the node list matching the scene
+    SharedPtr<Scene> scene = Object::Create<Scene>();
+    for (size_t i = 0; i < numParents; ++i)
+        scene->CreateChild<SpatialNode>();
 
-        for (int y = -125; y <= 125; ++y)
+    UpdateScheduler* scheduler = scene->GetUpdateScheduler();
+    scheduler->RegisterUpdate<SpatialNode>(ReplaceCheckNodes, UPDATE_SERIAL, 0, scene.Get());
+    for (int frame = 0; frame < numFrames; ++frame)
+    {
+        scheduler->Update(0.1f);
+
+        std::vector<SpatialNode*> sceneNodes;
+        scene->FindChildren(sceneNodes);
+        if (scheduler->NumNodes(SpatialNode::TypeStatic()) != sceneNodes.size())
         {
-            for (int x = -125; x <= 125; ++x)
+            LOGERRORF("Update list has %u nodes, scene has %u", (unsigned)scheduler->NumNodes(SpatialNode::TypeStatic()), (unsigned)sceneNodes.size());
+            ++numFailures;
+        }
+        for (auto it = sceneNodes.begin(); it != sceneNodes.end(); ++it)
+        {
+            if ((*it)->UpdateIndex() >= sceneNodes.size())
             {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                //object->SetStatic(true);
-                object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
-                object->SetScale(0.25f);
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(customMat);
-                rotatingObjects.push_back(object);
+                LOGERRORF("Node has update index %u outside the update list", (*it)->UpdateIndex());
+                ++numFailures;
             }
         }
+    }
 
-        Light* light = scene->CreateChild<Light>();
-        light->SetLightType(LIGHT_DIRECTIONAL);
-        light->SetColor(Color(1.0f, 1.0f, 1.0f, 0.5f));
-        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+    LOGINFOF("Node updates: %u nodes compared, %d failures", (unsigned)nodes[0].size(), numFailures);
+    return numFailures == 0;
+}
+
+/// %Task for the counter wait check. Outer tasks queue their inner tasks and wait on them in the worker thread.
+struct CounterCheckTask : public FunctionTask
+{
+    /// Construct.
+    CounterCheckTask(WorkFunctionPtr function_) :
+        FunctionTask(function_),
+        workQueue(nullptr),
+        index(0),
+        sum(nullptr)
+    {
     }
-    // Preset 2: skinned characters with directional light shadows
-    else if (preset == 2)
+
+    /// Work queue to queue the inner tasks to.
+    WorkQueue* workQueue;
+    /// Task index.
+    unsigned index;
+    /// Sum to add the index to.
+    std::atomic<unsigned>* sum;
+    /// Inner tasks, used by the outer tasks.
+    std::vector<AutoPtr<CounterCheckTask> > innerTasks;
+};
+
+void CounterCheckInnerWork(Task* task_, unsigned)
+{
+    CounterCheckTask* task = static_cast<CounterCheckTask*>(task_);
+    // Some slow tasks leave the queue empty while their counters are still nonzero, so that the waiters must block
+    if (!(task->index & 7))
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    task->sum->fetch_add(task->index);
+}
+
+void CounterCheckOuterWork(Task* task_, unsigned threadIndex)
+{
+    CounterCheckTask* task = static_cast<CounterCheckTask*>(task_);
+    WorkQueue* workQueue = task->workQueue;
+
+    std::atomic<int> counter(0);
+    for (auto it = task->innerTasks.begin(); it != task->innerTasks.end(); ++it)
+        workQueue->AddCounter(*it, counter);
+    workQueue->QueueTasks(task->innerTasks.size(), reinterpret_cast<Task**>(&task->innerTasks[0]));
+    workQueue->Wait(counter, threadIndex);
+
+    task->sum->fetch_add(task->index);
+}
+
+bool CheckCounterWait()
+{
+    ZoneScoped;
+
+    // Blocking and nested waits need worker threads, so use a separate queue when running single-threaded
+    WorkQueue* originalQueue = Object::Subsystem<WorkQueue>();
+    AutoPtr<WorkQueue> threadedQueue;
+    WorkQueue* workQueue = originalQueue;
+    if (workQueue->NumThreads() < 4)
     {
-        lightEnvironment->SetFogColor(Color(0.5f, 0.5f, 0.75f));
-        lightEnvironment->SetFogStart(300.0f);
-        lightEnvironment->SetFogEnd(500.0f);
-        camera->SetFarClip(500.0f);
+        threadedQueue = new WorkQueue(4);
+        workQueue = threadedQueue.Get();
+        Object::RegisterSubsystem(originalQueue);
+    }
+
+    const unsigned numOuterTasks = 32;
+    const unsigned numInnerTasks = 16;
+    const int numRounds = 20;
+    int numFailures = 0;
 
+    std::atomic<unsigned> sum(0);
+    std::vector<AutoPtr<CounterCheckTask> > outerTasks;
+    unsigned expectedSum = 0;
+    for (unsigned i = 0; i < numOuterTasks; ++i)
+    {
+        CounterCheckTask* outerTask = new CounterCheckTask(CounterCheckOuterWork);
+        outerTask->workQueue = workQueue;
+        outerTask->index = i;
+        outerTask->sum = &sum;
+        expectedSum += i;
+        for (unsigned j = 0; j < numInnerTasks; ++j)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(0, -0.05f, 0));
-            object->SetScale(Vector3(100.0f, 0.1f, 100.0f));
-            object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+            CounterCheckTask* innerTask = new CounterCheckTask(CounterCheckInnerWork);
+            innerTask->index = j;
+            innerTask->sum = &sum;
+            outerTask->innerTasks.push_back(innerTask);
+            expectedSum += j;
         }
+        outerTasks.push_back(outerTask);
+    }
 
-        for (int i = 0; i < 500; ++i)
+    // Nested waits in worker threads, while the main thread waits on the outer tasks
+    for (int round = 0; round < numRounds; ++round)
+    {
+        sum.store(0);
+        std::atomic<int> counter(0);
+        for (auto it = outerTasks.begin(); it != outerTasks.end(); ++it)
+            workQueue->AddCounter(*it, counter);
+        workQueue->QueueTasks(outerTasks.size(), reinterpret_cast<Task**>(&outerTasks[0]));
+        workQueue->Wait(counter, WorkQueue::ThreadIndex());
+
+        if (sum.load() != expectedSum || counter.load() != 0)
         {
-            AnimatedModel* object = scene->CreateChild<AnimatedModel>();
-            object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 90.0f - 45.0f, 0.0f, Random() * 90.0f - 45.0f));
-            object->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
-            object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
-            object->SetCastShadows(true);
-            object->SetMaxDistance(600.0f);
-            AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
-            state->SetWeight(1.0f);
-            state->SetLooped(true);
-            animatingObjects.push_back(object);
+            LOGERRORF("Counter wait round %d finished with sum %u, expected %u", round, sum.load(), expectedSum);
+            ++numFailures;
         }
+    }
 
-        Light* light = scene->CreateChild<Light>();
-        light->SetLightType(LIGHT_DIRECTIONAL);
-        light->SetCastShadows(true);
-        light->SetColor(Color(1.0f, 1.0f, 1.0f, 1.0f));
-        light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
-        light->SetShadowMapSize(2048);
-        light->SetShadowMaxDistance(100.0f);
+    LOGINFOF("Counter wait: %d rounds on %u threads checked, %d failures", numRounds, workQueue->NumThreads(), numFailures);
+    return numFailures == 0;
+}
+
+bool CheckLargePages()
+{
+    ZoneScoped;
+
+    // Allocate with large pages off and on, and free each allocation after switching the mode, so that heap and mapped memory must be told apart by address
+    static const size_t sizes[] = { 16, 1000, 100000, 3 * LARGE_PAGE_CHUNK_SIZE };
+    const size_t numSizes = sizeof sizes / sizeof sizes[0];
+    LargePageMode originalMode = GetLargePageMode();
+    LargePageStats initialStats = GetLargePageStats();
+    std::vector<void*> allocations;
+    int numFailures = 0;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        SetLargePageMode(pass ? LARGE_PAGES_OFF : LARGE_PAGES_TRANSPARENT);
+        for (size_t i = 0; i < numSizes; ++i)
+        {
+            unsigned char* ptr = static_cast<unsigned char*>(LargePageAllocate(sizes[i]));
+            if (!ptr || ((size_t)ptr & 15))
+            {
+                LOGERRORF("Large page allocation of %u bytes failed or is misaligned", (unsigned)sizes[i]);
+                ++numFailures;
+                continue;
+            }
+            memset(ptr, pass + 1, sizes[i]);
+            allocations.push_back(ptr);
+        }
+    }
+
+    LargePageStats stats = GetLargePageStats();
+    if (stats.usedBytes <= initialStats.usedBytes)
+    {
+        LOGERROR("Large page allocations did not use mapped memory");
+        ++numFailures;
+    }
+
+    SetLargePageMode(LARGE_PAGES_TRANSPARENT);
+    for (size_t i = 0; i < allocations.size(); ++i)
+        LargePageFree(allocations[i]);
+    SetLargePageMode(originalMode);
+
+    stats = GetLargePageStats();
+    if (stats.usedBytes != initialStats.usedBytes)
+    {
+        LOGERRORF("Large page memory in use changed from %u to %u bytes after freeing", (unsigned)initialStats.usedBytes, (unsigned)stats.usedBytes);
+        ++numFailures;
     }
+
+    LOGINFOF("Large pages: %u allocations checked, %d failures", (unsigned)allocations.size(), numFailures);
+    return numFailures == 0;
+}
+
+bool RunChecks()
+{
+    ZoneScoped;
+
+    bool success = true;
+    success &= CheckNumberParsing();
+    success &= CheckSceneDelta();
+    success &= CheckMultiDraw();
+    success &= CheckResourcePrefetch();
+    success &= CheckLayerVariants();
+    success &= CheckNodePool();
+    success &= CheckVisibilityIdReuse();
+    success &= CheckNodeUpdates();
+    success &= CheckCounterWait();
+    success &= CheckLargePages();
+
+    LOGINFO(success ? "Checks passed" : "Checks failed");
+    return success;
 }
 
 int ApplicationMain(const std::vector<std::string>& arguments)
 {
     bool useThreads = true;
+    bool runChecks = false;
 
-    if (arguments.size() > 1 && arguments[1].find("nothreads") != std::string::npos)
-        useThreads = false;
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i].find("nothreads") != std::string::npos)
+            useThreads = false;
+        else if (arguments[i].find("check") != std::string::npos)
+            runChecks = true;
+        // Select large page backing for engine pools before any are allocated
+        else if (arguments[i].find("largepages") != std::string::npos)
+            SetLargePageMode(LARGE_PAGES_TRANSPARENT);
+        else if (arguments[i].find("hugepages") != std::string::npos)
+            SetLargePageMode(LARGE_PAGES_EXPLICIT);
+    }
 
     // Create subsystems that don't depend on the application window / OpenGL context
     AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
@@ -231,6 +1755,10 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     AutoPtr<ResourceCache> cache = new ResourceCache();
     cache->AddResourceDir(ExecutableDir() + "Data");
 
+    // The checks do not render, so run them without opening the application window
+    if (runChecks)
+        return RunChecks() ? 0 : 1;
+
     // Create the Graphics subsystem to open the application window and initialize OpenGL
     AutoPtr<Graphics> graphics = new Graphics("Turso3D renderer test", IntVector2(1920, 1080), WINDOWED);
     if (!graphics->IsInitialized())
@@ -242,6 +1770,10 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     AutoPtr<DebugRenderer> debugRenderer = new DebugRenderer();
 
     renderer->SetupShadowMaps(1024, 2048, FMT_D16);
+
+    // Compile the shader variations used on previous runs up front
+    if (cache->Exists("ShaderManifest.json"))
+        graphics->WarmShaderManifest("ShaderManifest.json");
     
     // Rendertarget textures
     AutoPtr<FrameBuffer> viewFbo = new FrameBuffer();
@@ -283,6 +1815,9 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     Timer profilerTimer;
     float dt = 0.0f;
     float angle = 0.0f;
+    Quaternion rotation;
+    UpdateMode updateMode = UPDATE_PARALLEL;
+    int scenePreset = 0;
     int shadowMode = 1;
     bool drawSSAO = false;
     bool useOcclusion = true;
@@ -291,7 +1826,11 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     bool drawShadowDebug = false;
     bool drawOcclusionDebug = false;
 
+    // Scene animation runs as node update functions, which survive scene switches
+    RegisterSceneUpdates(scene, updateMode, &rotation);
+
     std::string profilerOutput;
+    std::vector<Terrain*> terrains;
 
     // Main loop
     while (!input->ShouldExit() && !input->KeyPressed(27))
@@ -311,12 +1850,45 @@ int ApplicationMain(const std::vector<std::string>& arguments)
         // Check for input and scene switch / debug render options
         input->Update();
 
+        int preset = -1;
         if (input->KeyPressed(SDLK_F1))
-            CreateScene(scene, camera, 0);
+            preset = 0;
         if (input->KeyPressed(SDLK_F2))
-            CreateScene(scene, camera, 1);
+            preset = 1;
         if (input->KeyPressed(SDLK_F3))
-            CreateScene(scene, camera, 2);
+            preset = 2;
+        if (input->KeyPressed(SDLK_F4))
+            BenchmarkNodePool(scene);
+        if (input->KeyPressed(SDLK_F5))
+        {
+            BenchmarkPrepareView(renderer, scene, camera, scenePreset);
+            terrains.clear();
+            scene->FindChildren(terrains);
+        }
+        if (input->KeyPressed(SDLK_F6))
+            BenchmarkBatchedQueries(scene, camera);
+        if (input->KeyPressed(SDLK_F7))
+            preset = 3;
+        if (input->KeyPressed(SDLK_F8))
+            preset = 4;
+        if (input->KeyPressed(SDLK_F9))
+            RunChecks();
+        if (input->KeyPressed(SDLK_F10))
+            graphics->SaveShaderManifest(ExecutableDir() + "Data/ShaderManifest.json");
+        if (input->KeyPressed(SDLK_F11))
+        {
+            BenchmarkResourceLoading(scene, camera, scenePreset);
+            terrains.clear();
+            scene->FindChildren(terrains);
+        }
+        if (preset >= 0)
+        {
+            scenePreset = preset;
+            CreateScene(scene, camera, preset);
+            // Look up the terrains once per scene, as they are updated every frame
+            terrains.clear();
+            scene->FindChildren(terrains);
+        }
 
         if (input->KeyPressed(SDLK_1))
         {
@@ -339,6 +1911,28 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             drawShadowDebug = !drawShadowDebug;
         if (input->KeyPressed(SDLK_6))
             drawOcclusionDebug = !drawOcclusionDebug;
+        if (input->KeyPressed(SDLK_7))
+        {
+            if (renderer->MaxLights())
+                renderer->SetLightBudget(0, 0);
+            else
+                renderer->SetLightBudget(32, 8);
+
+            const LightBudgetStats& stats = renderer->GetLightBudgetStats();
+            LOGINFOF("Light budget %s, last view visible %d selected %d shadowed %d culled %d", renderer->MaxLights() ? "on" : "off",
+                (int)stats.numVisible, (int)stats.numSelected, (int)stats.numShadowed, (int)stats.numCulled);
+        }
+        if (input->KeyPressed(SDLK_8))
+        {
+            renderer->SetUseMultiDraw(!renderer->UseMultiDraw());
+            LOGINFOF("Multi-draw %s", renderer->UseMultiDraw() ? "on" : "off");
+        }
+        if (input->KeyPressed(SDLK_9))
+        {
+            updateMode = updateMode == UPDATE_PARALLEL ? UPDATE_SERIAL : UPDATE_PARALLEL;
+            RegisterSceneUpdates(scene, updateMode, &rotation);
+            LOGINFOF("Node updates %s", updateMode == UPDATE_PARALLEL ? "parallel" : "serial");
+        }
         if (input->KeyPressed(SDLK_SPACE))
             animate = !animate;
 
@@ -372,29 +1966,10 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             ZoneScopedN("MoveObjects");
 
             PROFILE(MoveObjects);
-        
-            if (rotatingObjects.size())
-            {
-                angle += 100.0f * dt;
-                Quaternion rotQuat(angle, Vector3::ONE);
-                for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
-                    (*it)->SetRotation(rotQuat);
-            }
-            else if (animatingObjects.size())
-            {
-                for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
-                {
-                    AnimatedModel* object = *it;
-                    AnimationState* state = object->AnimationStates()[0];
-                    state->AddTime(dt);
-                    object->Translate(Vector3::FORWARD * 2.0f * dt);
-
-                    // Rotate to avoid going outside the plane
-                    Vector3 pos = object->Position();
-                    if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
-                        object->Yaw(45.0f * dt);
-                }
-            }
+
+            angle += 100.0f * dt;
+            rotation = Quaternion(angle, Vector3::ONE);
+            scene->GetUpdateScheduler()->Update(dt);
         }
 
         // Recreate rendertarget textures if window resolution changed
@@ -427,9 +2002,17 @@ int ApplicationMain(const std::vector<std::string>& arguments)
 
         camera->SetAspectRatio((float)width / (float)height);
 
+        // Terrain patch selection follows the camera, so it runs every frame even when scene animation is paused
+        {
+            PROFILE(UpdateTerrain);
+            for (auto it = terrains.begin(); it != terrains.end(); ++it)
+                (*it)->Update(camera);
+        }
+
         // Collect geometries and lights in frustum. Also set debug renderer to use the correct camera view
         {
             PROFILE(PrepareView);
+            renderer->SetDrawDebug(drawDebug);
             renderer->PrepareView(scene, camera, shadowMode > 0, useOcclusion);
             debugRenderer->SetView(camera);
         }
@@ -499,10 +2082,7 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             graphics->SetViewport(IntRect(0, 0, width, height));
             renderer->RenderAlpha();
         
-            // Optional render of debug geometry
-            if (drawDebug)
-                renderer->RenderDebug();
-
+            // Render debug geometry, including any recorded by the renderer's worker tasks
             debugRenderer->Render();
             
             // Optional debug render of shadowmap. Draw both dir light cascades and the shadow atlas